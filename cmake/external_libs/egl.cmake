@@ -0,0 +1,10 @@
+# EGL is optional: without it, AntWorld can only render into a window
+find_package(OpenGL QUIET COMPONENTS EGL)
+
+if(OpenGL_EGL_FOUND)
+    BoB_add_include_directories(${OPENGL_EGL_INCLUDE_DIRS})
+    BoB_add_link_libraries(OpenGL::EGL)
+    add_definitions(-DBOB_HAVE_EGL)
+else()
+    message(STATUS "EGL not found; building without support for headless AntWorld rendering")
+endif()
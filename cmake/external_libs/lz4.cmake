@@ -0,0 +1,15 @@
+# LZ4 is optional: if it isn't installed, code which uses it falls back to
+# storing data uncompressed
+find_package(PkgConfig QUIET)
+if(PKG_CONFIG_FOUND)
+    pkg_check_modules(lz4 QUIET liblz4)
+endif()
+
+if(lz4_FOUND)
+    BoB_add_include_directories(${lz4_INCLUDE_DIRS})
+    BoB_add_link_directories(${lz4_LIBRARY_DIRS})
+    BoB_add_link_libraries(${lz4_LIBRARIES})
+    add_definitions(-DBOB_HAVE_LZ4)
+else()
+    message(STATUS "LZ4 not found; building without support for compressed packed image files")
+endif()
@@ -4,6 +4,7 @@
 #include "camera.h"
 #include "common/pose.h"
 #include "hid/joystick.h"
+#include "ray_caster.h"
 #include "renderer.h"
 #include "robots/robot.h"
 
@@ -35,6 +36,18 @@ public:
              meters_per_second_t velocity = DefaultVelocity,
              radians_per_second_t turnSpeed = DefaultTurnSpeed);
 
+    //! Create an agent which renders offscreen (see HeadlessContext)
+    AntAgent(HeadlessContext &context, Renderer &renderer,
+             const cv::Size &renderSize,
+             meters_per_second_t velocity = DefaultVelocity,
+             radians_per_second_t turnSpeed = DefaultTurnSpeed);
+
+    //! Create an agent which renders on the CPU (see RayCaster)
+    AntAgent(const RayCaster &rayCaster,
+             const cv::Size &renderSize,
+             meters_per_second_t velocity = DefaultVelocity,
+             radians_per_second_t turnSpeed = DefaultTurnSpeed);
+
     //----------------------------------------------------------------------------
     // Robot virtuals
     //----------------------------------------------------------------------------
@@ -3,6 +3,8 @@
 // BoB robotics includes
 #include "common/pose.h"
 #include "video/opengl/opengl.h"
+#include "antworld/headless_context.h"
+#include "antworld/ray_caster.h"
 #include "antworld/renderer.h"
 
 // SFML
@@ -25,9 +27,19 @@ public:
            Renderer &renderer,
            const cv::Size &renderSize);
 
+    //! Render offscreen, without a window (see HeadlessContext)
+    Camera(HeadlessContext &context,
+           Renderer &renderer,
+           const cv::Size &renderSize);
+
+    //! Render on the CPU with a RayCaster, so no OpenGL context is needed at all
+    Camera(const RayCaster &rayCaster,
+           const cv::Size &renderSize);
+
     void display();
     Pose3<meter_t, degree_t> getPose() const;
     sf::Window &getWindow() const;
+    bool isHeadless() const;
     bool isOpen() const;
     void setPose(const Pose3<meter_t, degree_t> &pose);
     void setPosition(meter_t x, meter_t y, meter_t z);
@@ -38,12 +50,23 @@ public:
 
     static std::unique_ptr<sf::Window> initialiseWindow(const cv::Size &size);
 
+    /*!
+     * \brief Create an offscreen OpenGL context, set up as initialiseWindow() does
+     *
+     * The context is left current on the calling thread.
+     */
+    static std::unique_ptr<HeadlessContext> initialiseHeadlessContext(const cv::Size &size,
+                                                                      int deviceIndex = -1);
+
 private:
     Pose3<meter_t, degree_t> m_Pose;
-    sf::Window &m_Window;
-    Renderer &m_Renderer;
+    sf::Window *const m_Window;
+    HeadlessContext *const m_Context;
+    Renderer *const m_Renderer;
+    const RayCaster *const m_RayCaster;
 
     void update();
+    static void initialiseGL();
 }; // Camera
 } // AntWorld
 } // BoBRobotics
@@ -0,0 +1,63 @@
+#pragma once
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+namespace BoBRobotics {
+namespace AntWorld {
+//----------------------------------------------------------------------------
+// BoBRobotics::AntWorld::HeadlessContext
+//----------------------------------------------------------------------------
+/*!
+ * \brief An offscreen OpenGL context, for rendering without a display
+ *
+ * The context is backed by an EGL pbuffer, so this is only available if BoB
+ * robotics was built with EGL. Frames are rendered into the pbuffer's default
+ * framebuffer, so Video::OpenGL can read them just as it would from a window.
+ *
+ * Contexts are independent of one another, so to render in parallel, give
+ * each thread its own HeadlessContext and Renderer (a context can only be
+ * current on one thread at a time). On machines with several GPUs, contexts
+ * can be spread across them by device index; if no index is given, the
+ * BOB_ANTWORLD_EGL_DEVICE environment variable is used, if set, which makes it
+ * easy to do the same with separate processes.
+ */
+class HeadlessContext
+{
+public:
+    /*!
+     * \brief Create a context and make it current on this thread
+     *
+     * @param size Size of the offscreen framebuffer
+     * @param deviceIndex EGL device to render with (-1 for the default)
+     */
+    explicit HeadlessContext(const cv::Size &size, int deviceIndex = -1);
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+    //! Make this context current on the calling thread
+    void makeCurrent();
+
+    //! Detach this context from the calling thread, so another can use it
+    void releaseCurrent();
+
+    const cv::Size &getSize() const { return m_Size; }
+
+    //! Whether BoB robotics was built with support for headless contexts
+    static bool isSupported();
+
+    //! Number of EGL devices (i.e. GPUs and software renderers) available
+    static int getNumDevices();
+
+private:
+    const cv::Size m_Size;
+
+    // **NOTE** these are EGL handles, kept opaque so EGL's headers aren't needed here
+    void *m_Display = nullptr;
+    void *m_Surface = nullptr;
+    void *m_Context = nullptr;
+}; // HeadlessContext
+} // AntWorld
+} // BoBRobotics
@@ -0,0 +1,135 @@
+#pragma once
+
+// Standard C includes
+#include <cstddef>
+#include <cstdint>
+
+// Standard C++ includes
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Forward declarations
+namespace filesystem
+{
+    class path;
+}
+
+namespace BoBRobotics
+{
+class MemoryMappedFile;
+
+namespace AntWorld
+{
+//----------------------------------------------------------------------------
+// BoBRobotics::AntWorld::ObjMesh
+//----------------------------------------------------------------------------
+/*!
+ * \brief A Wavefront OBJ mesh, in the form it gets uploaded to OpenGL
+ *
+ * Each material's faces are gathered into one surface, with vertices
+ * deduplicated and interleaved into a single buffer and drawn by index.
+ *
+ * As parsing big OBJ files is slow, the result is cached in a .bobmesh file
+ * next to the OBJ. The cache is used as long as the OBJ and its MTL files are
+ * unchanged (the same size and modification time or, failing that, contents)
+ * and it is mapped into memory, so vertices can be uploaded straight from it.
+ */
+class ObjMesh
+{
+public:
+    //! A material from an MTL file
+    struct Material
+    {
+        std::string name;
+        std::array<float, 3> colour{ { 1.0f, 1.0f, 1.0f } };
+
+        //! Diffuse texture, relative to the OBJ file (empty if there isn't one)
+        std::string textureFilename;
+    };
+
+    /*!
+     * \brief Faces drawn with a single material
+     *
+     * Vertices consist of an XYZ position, followed by UV texture coordinates
+     * and then RGBA colour bytes, if the surface has them.
+     */
+    struct SurfaceGeometry
+    {
+        std::string materialName;
+        bool hasTexCoords = false;
+        bool hasColours = false;
+        const uint8_t *vertices = nullptr;
+        size_t numVertices = 0;
+        const uint32_t *indices = nullptr;
+        size_t numIndices = 0;
+
+        size_t getStride() const;
+        size_t getTexCoordOffset() const { return 3 * sizeof(float); }
+        size_t getColourOffset() const { return hasTexCoords ? (5 * sizeof(float)) : (3 * sizeof(float)); }
+    };
+
+    ObjMesh(ObjMesh &&);
+    ~ObjMesh();
+
+    const std::vector<Material> &getMaterials() const{ return m_Materials; }
+    const std::vector<SurfaceGeometry> &getSurfaces() const{ return m_Surfaces; }
+    const std::array<float, 3> &getMinBound() const{ return m_MinBound; }
+    const std::array<float, 3> &getMaxBound() const{ return m_MaxBound; }
+
+    //! Whether this mesh was read from a .bobmesh cache
+    bool isCached() const{ return static_cast<bool>(m_Cache); }
+
+    /*!
+     * \brief Load an OBJ file, using or creating a cache if requested
+     *
+     * @param objPath OBJ file to load
+     * @param scale Factor to scale positions by
+     * @param useCache Whether to read from and write to a .bobmesh cache
+     */
+    static ObjMesh load(const filesystem::path &objPath, float scale = 1.0f, bool useCache = true);
+
+    //! Parse an OBJ file (and its MTL files), ignoring any cache
+    static ObjMesh parse(const filesystem::path &objPath, float scale = 1.0f);
+
+    //! Write mesh to a cache (atomically, so other processes never see a partial file)
+    void writeCache(const filesystem::path &objPath) const;
+
+    //! Where an OBJ file's cache lives
+    static filesystem::path getCachePath(const filesystem::path &objPath);
+
+private:
+    //! A file the mesh was loaded from, so we can check if the cache is stale
+    struct Dependency
+    {
+        std::string filename;
+        uint64_t size;
+        int64_t modifiedTime;
+        uint64_t hash;
+    };
+
+    ObjMesh();
+
+    void parseMaterials(const filesystem::path &basePath, const std::string &filename);
+    void addDependency(const filesystem::path &basePath, const std::string &filename,
+                       const MemoryMappedFile &file);
+
+    // Returns false if the cache is missing, out of date or for a different scale
+    bool readCache(const filesystem::path &objPath, float scale);
+
+    static bool isUpToDate(const filesystem::path &basePath, const Dependency &dependency);
+
+    float m_Scale;
+    std::vector<Material> m_Materials;
+    std::vector<SurfaceGeometry> m_Surfaces;
+    std::vector<Dependency> m_Dependencies;
+    std::array<float, 3> m_MinBound, m_MaxBound;
+
+    // Storage for surfaces, either parsed or mapped from cache
+    std::vector<std::vector<uint8_t>> m_VertexStorage;
+    std::vector<std::vector<uint32_t>> m_IndexStorage;
+    std::unique_ptr<MemoryMappedFile> m_Cache;
+};
+}   // namespace AntWorld
+}   // namespace BoBRobotics
@@ -0,0 +1,151 @@
+#pragma once
+
+// BoB robotics includes
+#include "common/pose.h"
+
+// Third-party includes
+#include "third_party/units.h"
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Standard C++ includes
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Forward declarations
+namespace filesystem
+{
+    class path;
+}
+
+namespace BoBRobotics
+{
+namespace AntWorld
+{
+using namespace units::literals;
+
+//----------------------------------------------------------------------------
+// BoBRobotics::AntWorld::RayCaster
+//----------------------------------------------------------------------------
+/*!
+ * \brief Renders panoramic views of a world on the CPU, without OpenGL
+ *
+ * Worlds are loaded from the same files, in the same way, as World::load()
+ * and World::loadObj() do, and views are laid out as with
+ * Renderer::renderPanoramicView(), so the two can be used interchangeably
+ * (e.g. with SnapshotProcessorArdin). As with the OpenGL renderer, back faces
+ * are culled and colours are interpolated across triangles.
+ *
+ * Rays are traced through a bounding volume hierarchy in packets of four (from
+ * 2x2 blocks of pixels) using SSE or NEON where available. Rows of each view
+ * and, with renderPanoramicViews(), different views are spread over threads
+ * with TBB. Rendering is const, so one RayCaster can be shared between threads.
+ */
+class RayCaster
+{
+    using degree_t = units::angle::degree_t;
+    using meter_t = units::length::meter_t;
+
+public:
+    RayCaster(degree_t horizontalFOV = 360_deg, degree_t verticalFOV = 75_deg,
+              double nearClip = 0.001, double farClip = 1000.0);
+    ~RayCaster();
+
+    //------------------------------------------------------------------------
+    // Public API
+    //------------------------------------------------------------------------
+    //! Load a world from a .bin file, as World::load() does
+    void load(const filesystem::path &filename, const float (&worldColour)[3], const float (&groundColour)[3]);
+
+    //! Load a world from an OBJ file (using the same .bobmesh cache as World::loadObj())
+    void loadObj(const filesystem::path &objFilename, float scale = 1.0f, bool useCache = true);
+
+    //! Render a panoramic view into a CV_8UC3 (BGR) image of the given size
+    void renderPanoramicView(meter_t x, meter_t y, meter_t z,
+                             degree_t yaw, degree_t pitch, degree_t roll,
+                             const cv::Size &size, cv::Mat &outFrame) const;
+
+    /*!
+     * \brief Render panoramic views from many poses, several at once
+     *
+     * @param poses Poses to render views from
+     * @param size Size of each view
+     * @param callback Called in order, on the calling thread, with the index of
+     *        each pose and its (CV_8UC3) view; the cv::Mat is only valid until
+     *        the callback returns
+     */
+    void renderPanoramicViews(const std::vector<Pose3<meter_t, degree_t>> &poses,
+                              const cv::Size &size,
+                              const std::function<void(size_t, const cv::Mat &)> &callback) const;
+
+    //! Set colour of rays which don't hit anything (defaults to the OpenGL renderer's clear colour)
+    void setSkyColour(const std::array<float, 3> &colour){ m_SkyColour = colour; }
+
+    const Vector3<meter_t> &getMinBound() const{ return m_MinBound; }
+    const Vector3<meter_t> &getMaxBound() const{ return m_MaxBound; }
+
+    size_t getNumTriangles() const{ return m_Triangles.size(); }
+
+private:
+    //------------------------------------------------------------------------
+    // Private types
+    //------------------------------------------------------------------------
+    //! Triangle, as used for intersection tests
+    struct Triangle
+    {
+        float vertex0[3];
+        float edge1[3];
+        float edge2[3];
+    };
+
+    //! What's needed to colour a triangle once it has been hit
+    struct TriangleShading
+    {
+        float colours[3][3];
+        float texCoords[3][2];
+        int texture;
+    };
+
+    //! BVH node: interior nodes have two consecutive children and leaves have a range of triangles
+    struct Node
+    {
+        float min[3];
+        uint32_t leftOrFirst;
+        float max[3];
+        uint16_t count;
+        uint16_t axis;
+    };
+
+    //------------------------------------------------------------------------
+    // Private methods
+    //------------------------------------------------------------------------
+    void addTriangle(const float *position0, const float *position1, const float *position2,
+                     const TriangleShading &shading);
+    void buildBVH();
+    std::vector<float> getRayDirections(const cv::Size &size) const;
+    void renderView(const Pose3<meter_t, degree_t> &pose, const cv::Size &size,
+                    const std::vector<float> &directions, cv::Mat &outFrame) const;
+
+    //------------------------------------------------------------------------
+    // Members
+    //------------------------------------------------------------------------
+    std::vector<Triangle> m_Triangles;
+    std::vector<TriangleShading> m_Shading;
+    std::vector<Node> m_Nodes;
+    std::vector<cv::Mat> m_Textures;
+
+    Vector3<meter_t> m_MinBound;
+    Vector3<meter_t> m_MaxBound;
+    std::array<float, 3> m_SkyColour;
+
+    const degree_t m_HorizontalFOV;
+    const degree_t m_VerticalFOV;
+    const float m_NearClip;
+    const float m_FarClip;
+};
+}   // namespace AntWorld
+}   // namespace BoBRobotics
@@ -24,6 +24,10 @@ class RenderTargetInput : public Video::Input
 public:
     /*!
      * \brief Create a Video::Input for reading from a LibAntWorld RenderTarget
+     *
+     * The render target's context (which may be a HeadlessContext) must be
+     * current when frames are read. To render without OpenGL, use a Camera
+     * or AntAgent constructed with a RayCaster instead.
      */
     RenderTargetInput(RenderTarget &renderTarget, bool needsUnwrapping = false)
         : m_RenderTarget(renderTarget), m_NeedsUnwrapping(needsUnwrapping)
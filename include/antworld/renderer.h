@@ -2,6 +2,7 @@
 
 // Standard C++ includes
 #include <algorithm>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -12,9 +13,15 @@
 #include "render_mesh.h"
 #include "world.h"
 
+// BoB robotics includes
+#include "common/pose.h"
+
 // Third-party includes
 #include "third_party/units.h"
 
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
 namespace BoBRobotics
 {
 namespace AntWorld
@@ -25,7 +32,15 @@ using namespace units::literals;
 //----------------------------------------------------------------------------
 // Renderer
 //----------------------------------------------------------------------------
-//! Helper class which combines a world with a rendermesh to allow ant views of world to be rendered to screen
+/*!
+ * \brief Helper class which combines a world with a rendermesh to allow ant views of world to be rendered to screen
+ *
+ * Panoramic views are rendered by first rendering the world into a cubemap.
+ * Where OpenGL 3.2 is available, all six faces are rendered in a single pass,
+ * with a geometry shader sending each triangle to the faces it appears on.
+ * Otherwise (or if the BOB_ANTWORLD_LEGACY_RENDERER environment variable is
+ * set) the world is rendered once per face with the fixed-function pipeline.
+ */
 class Renderer
 {
     using degree_t = units::angle::degree_t;
@@ -47,6 +62,25 @@ public:
     void renderPanoramicView(meter_t x, meter_t y, meter_t z,
                              degree_t yaw, degree_t pitch, degree_t roll,
                              RenderTarget &renderTarget, bool bind = true, bool clear = true);
+
+    /*!
+     * \brief Render panoramic views from many poses and read them back
+     *
+     * Views are rendered into a ring of render targets and copied back through
+     * pixel buffer objects, so later views are rendered while earlier ones are
+     * still being copied. They are flipped as they are rendered, so they come
+     * back the right way up without any work on the CPU.
+     *
+     * @param poses Poses to render views from
+     * @param size Size of each view
+     * @param callback Called in order with the index of each pose and its
+     *        (CV_8UC3) view; the cv::Mat is only valid until the callback returns
+     * @param ringSize Number of views which can be in flight at once
+     */
+    void renderPanoramicViews(const std::vector<Pose3<meter_t, degree_t>> &poses,
+                              const cv::Size &size,
+                              const std::function<void(size_t, const cv::Mat &)> &callback,
+                              size_t ringSize = 3);
     void renderFirstPersonView(meter_t x, meter_t y, meter_t z,
                                degree_t yaw, degree_t pitch, degree_t roll,
                                GLint viewportX, GLint viewportY, GLsizei viewportWidth, GLsizei viewportHeight);
@@ -56,6 +90,12 @@ public:
     void renderTopDownView(GLint viewportX, GLint viewportY, GLsizei viewportWidth, GLsizei viewportHeight);
     void renderTopDownView(RenderTarget &renderTarget, bool bind = true, bool clear = true);
 
+    //! Whether cubemap faces are rendered in a single pass
+    bool isLayeredRenderingEnabled() const{ return m_LayeredRendering; }
+
+    //! Switch between single-pass and per-face cubemap rendering
+    void setLayeredRenderingEnabled(bool enabled);
+
     World &getWorld(){ return m_World; }
     const World &getWorld() const{ return m_World; }
 
@@ -63,14 +103,32 @@ protected:
     //------------------------------------------------------------------------
     // Declared virtuals
     //------------------------------------------------------------------------
+    // **NOTE** if you override renderPanoramicGeometry(), either also override
+    // renderPanoramicGeometryLayered() or disable layered rendering
     virtual void renderPanoramicGeometry();
+    virtual void renderPanoramicGeometryLayered(GLint texturedUniform);
     virtual void renderFirstPersonGeometry();
     virtual void renderTopDownGeometry();
+
+    //------------------------------------------------------------------------
+    // Static API
+    //------------------------------------------------------------------------
+    //! Whether this OpenGL context supports rendering all cubemap faces in one pass
+    static bool isLayeredRenderingSupported();
+
 private:
     //------------------------------------------------------------------------
     // Private methods
     //------------------------------------------------------------------------
-    void generateCubeFaceLookAtMatrices();
+    void generateCubeFaceMatrices();
+    void createLayeredRenderingResources();
+    void deleteLayeredRenderingResources();
+    void renderCubemap(const GLfloat (&antMatrix)[16]);
+    void renderCubemapLayered(const GLfloat (&antMatrix)[16]);
+    void renderPanoramicViewInternal(meter_t x, meter_t y, meter_t z,
+                                     degree_t yaw, degree_t pitch, degree_t roll,
+                                     GLint viewportX, GLint viewportY, GLsizei viewportWidth, GLsizei viewportHeight,
+                                     GLuint drawFBO, bool flipVertically);
     void applyFrame(meter_t x, meter_t y, meter_t z,
                     degree_t yaw, degree_t pitch, degree_t roll);
 
@@ -83,7 +141,18 @@ private:
     GLuint m_CubemapTexture;
     GLuint m_FBO;
     GLuint m_DepthBuffer;
-    GLfloat m_CubeFaceLookAtMatrices[6][16];
+
+    // Projection and look at matrices for each cubemap face, combined
+    GLfloat m_CubeFaceViewProjectionMatrices[6][16];
+
+    // Resources for rendering cubemap in one pass
+    GLuint m_LayeredFBO;
+    GLuint m_LayeredDepthTexture;
+    GLuint m_LayeredProgram;
+    GLint m_AntMatrixUniform;
+    GLint m_CubeFaceMatricesUniform;
+    GLint m_TexturedUniform;
+    bool m_LayeredRendering;
 
     const GLsizei m_CubemapSize;
     const double m_NearClip;
@@ -61,6 +61,10 @@ public:
         glVertexPointer(size, OpenGLTypeTraits<T>::type, 0, BUFFER_OFFSET(0));
         glEnableClientState(GL_VERTEX_ARRAY);
 
+        // Also set generic attribute for rendering with shaders
+        glVertexAttribPointer(PositionAttribute, size, OpenGLTypeTraits<T>::type, GL_FALSE, 0, BUFFER_OFFSET(0));
+        glEnableVertexAttribArray(PositionAttribute);
+
         // Calculate number of vertices from positions
         m_NumVertices = static_cast<GLsizei>(positions.size() / size);
 
@@ -78,6 +82,10 @@ public:
         glColorPointer(size, OpenGLTypeTraits<T>::type, 0, BUFFER_OFFSET(0));
         glEnableClientState(GL_COLOR_ARRAY);
 
+        // Also set generic attribute for rendering with shaders
+        glVertexAttribPointer(ColourAttribute, size, OpenGLTypeTraits<T>::type, GL_TRUE, 0, BUFFER_OFFSET(0));
+        glEnableVertexAttribArray(ColourAttribute);
+
         // Unbind buffer
         glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
@@ -92,6 +100,10 @@ public:
         glTexCoordPointer(size, OpenGLTypeTraits<T>::type, 0, BUFFER_OFFSET(0));
         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
+        // Also set generic attribute for rendering with shaders
+        glVertexAttribPointer(TexCoordAttribute, size, OpenGLTypeTraits<T>::type, GL_FALSE, 0, BUFFER_OFFSET(0));
+        glEnableVertexAttribArray(TexCoordAttribute);
+
         // Unbind buffer
         glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
@@ -110,33 +122,43 @@ public:
         // leave it bound until after we unbind the VAO - makes sense but ugly
     }
 
+    //! Upload indices from memory which isn't in a vector, e.g. a memory-mapped file
+    void uploadIndices(const GLuint *indices, GLsizei numIndices);
+
+    //! Upload interleaved vertices: XYZ float positions, followed by UV float texture coordinates
+    //! and RGBA byte colours at the given offsets (-1 if the vertices don't have them)
+    void uploadVertices(const void *vertices, GLsizei numVertices, GLsizei stride,
+                        GLint texCoordOffset = -1, GLint colourOffset = -1);
+
     void setTexture(const Texture *texture){ m_Texture = texture; }
 
     void setColour(const Colour &colour) { m_Colour = colour; }
 
+    bool hasTexture() const{ return m_Texture != nullptr; }
+
     //------------------------------------------------------------------------
     // Constants
     //------------------------------------------------------------------------
     static const Colour DefaultColour;
 
+    // Generic vertex attribute locations for rendering with shaders
+    // **NOTE** these match the locations some drivers alias fixed-function attributes to
+    static constexpr GLuint PositionAttribute = 0;
+    static constexpr GLuint ColourAttribute = 3;
+    static constexpr GLuint TexCoordAttribute = 8;
+
 private:
     //------------------------------------------------------------------------
     // Private methods
     //------------------------------------------------------------------------
+    void uploadBuffer(const void *data, size_t size, GLuint &bufferObject,
+                      GLenum target, GLenum usage);
+
     template<typename T>
     void uploadBuffer(const std::vector<T> &data, GLuint &bufferObject,
                       GLenum target, GLenum usage)
     {
-        // Generate buffer if required
-        if(bufferObject == 0) {
-            glGenBuffers(1, &bufferObject);
-        }
-
-        // Bind buffer
-        glBindBuffer(target, bufferObject);
-
-        // Upload data
-        glBufferData(target, data.size() * sizeof(T), data.data(), usage);
+        uploadBuffer(data.data(), data.size() * sizeof(T), bufferObject, target, usage);
     }
 
     //------------------------------------------------------------------------
@@ -1,7 +1,6 @@
 #pragma once
 
 // Standard C++ includes
-#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -50,8 +49,20 @@ public:
     // Public API
     //------------------------------------------------------------------------
     void render() const;
+
+    //! Render with a shader program which uses Surface's generic attributes,
+    //! setting the bool uniform at texturedUniform for each surface
+    void renderWithShader(GLint texturedUniform) const;
     void load(const filesystem::path &filename, const GLfloat (&worldColour)[3], const GLfloat (&groundColour)[3]);
-    void loadObj(const filesystem::path &objFilename, float scale = 1.0f, int maxTextureSize = -1, GLint textureFormat = GL_RGB);
+
+    /*!
+     * \brief Load a world from a Wavefront OBJ file
+     *
+     * Unless useCache is false, the parsed mesh is cached in a .bobmesh file
+     * next to the OBJ file, which makes loading it again much quicker.
+     */
+    void loadObj(const filesystem::path &objFilename, float scale = 1.0f, int maxTextureSize = -1, GLint textureFormat = GL_RGB,
+                 bool useCache = true);
 
     const Vector3<meter_t> &getMinBound()
     {
@@ -70,9 +81,7 @@ private:
     //------------------------------------------------------------------------
     // Private methods
     //------------------------------------------------------------------------
-    void loadMaterials(const filesystem::path &basePath, const std::string &filename,
-                       GLint textureFormat, int maxTextureSize,
-                       std::map<std::string, std::tuple<Texture*, Surface::Colour>> &materialNames);
+    Texture *loadTexture(const filesystem::path &path, GLint textureFormat, int maxTextureSize);
 
     //------------------------------------------------------------------------
     // Members
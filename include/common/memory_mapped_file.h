@@ -0,0 +1,46 @@
+#pragma once
+
+// Third-party includes
+#include "third_party/path.h"
+
+// Standard C includes
+#include <cstddef>
+#include <cstdint>
+
+// Standard C++ includes
+#include <vector>
+
+namespace BoBRobotics {
+//----------------------------------------------------------------------------
+// BoBRobotics::MemoryMappedFile
+//----------------------------------------------------------------------------
+/*!
+ * \brief A read-only view of a whole file's contents
+ *
+ * On POSIX systems the file is mapped into memory, so pages are only read from
+ * disk as they are touched; elsewhere, the file is just read into a buffer.
+ */
+class MemoryMappedFile
+{
+public:
+    explicit MemoryMappedFile(const filesystem::path &path);
+    ~MemoryMappedFile();
+
+    MemoryMappedFile(const MemoryMappedFile &) = delete;
+    MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+    //! Pointer to the start of the file (nullptr if it is empty)
+    const uint8_t *data() const { return m_Data; }
+
+    //! Size of the file in bytes
+    size_t size() const { return m_Size; }
+
+private:
+    const uint8_t *m_Data = nullptr;
+    size_t m_Size = 0;
+
+#ifdef _WIN32
+    std::vector<uint8_t> m_Contents;
+#endif
+}; // MemoryMappedFile
+} // BoBRobotics
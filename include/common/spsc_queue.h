@@ -0,0 +1,87 @@
+#pragma once
+
+// Standard C includes
+#include <cstddef>
+
+// Standard C++ includes
+#include <atomic>
+#include <vector>
+
+namespace BoBRobotics {
+//----------------------------------------------------------------------------
+// BoBRobotics::SPSCQueue
+//----------------------------------------------------------------------------
+/*!
+ * \brief A bounded, lock-free queue for one producer and one consumer thread
+ *
+ * Slots are allocated up front and reused, so items (e.g. cv::Mats) can be
+ * filled in place without allocating: the producer calls beginPush() to get a
+ * free slot, fills it in and then calls endPush(); the consumer calls front()
+ * to get the oldest item and pop() once it is finished with it.
+ */
+template<class T>
+class SPSCQueue
+{
+public:
+    explicit SPSCQueue(size_t capacity)
+      : m_Slots(capacity + 1)
+    {}
+
+    //! Get a free slot to fill in, or nullptr if the queue is full (producer only)
+    T *beginPush()
+    {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (increment(tail) == m_Head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &m_Slots[tail];
+    }
+
+    //! Make the slot returned by beginPush() available to the consumer
+    void endPush()
+    {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        m_Tail.store(increment(tail), std::memory_order_release);
+    }
+
+    //! Get the oldest item, or nullptr if the queue is empty (consumer only)
+    T *front()
+    {
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        if (head == m_Tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &m_Slots[head];
+    }
+
+    //! Release the item returned by front() (consumer only)
+    void pop()
+    {
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        m_Head.store(increment(head), std::memory_order_release);
+    }
+
+    //! Approximate number of items in the queue (may be called from any thread)
+    size_t size() const
+    {
+        const size_t head = m_Head.load(std::memory_order_acquire);
+        const size_t tail = m_Tail.load(std::memory_order_acquire);
+        return (tail >= head) ? (tail - head) : (tail + m_Slots.size() - head);
+    }
+
+    size_t capacity() const { return m_Slots.size() - 1; }
+
+private:
+    std::vector<T> m_Slots;
+
+    // Keep producer and consumer indices on separate cache lines
+    std::atomic<size_t> m_Head{ 0 };
+    char m_Padding[64];
+    std::atomic<size_t> m_Tail{ 0 };
+
+    size_t increment(size_t index) const
+    {
+        return (index + 1 == m_Slots.size()) ? 0 : index + 1;
+    }
+}; // SPSCQueue
+} // BoBRobotics
@@ -43,6 +43,13 @@ public:
     //! Clone mask
     Mask clone() const;
 
+    /*!
+     * \brief Get a mask which refers to a region of this one
+     *
+     * No data is copied; this is just a view onto the original mask.
+     */
+    Mask getROI(const cv::Rect &roi) const;
+
     /*!
      * \brief Roll the mask the specified number of pixels to the left
      *
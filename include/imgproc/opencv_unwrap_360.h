@@ -7,6 +7,7 @@
 #include <opencv2/core.hpp>
 
 // Third-party includes
+#include "third_party/path.h"
 #include "third_party/units.h"
 
 //----------------------------------------------------------------------------
@@ -48,10 +49,44 @@ public:
                 degree_t offsetAngle = 0_deg,
                 bool flip = false);
 
+    //! Rebuild the unwrap maps, e.g. after changing the public members
     void updateMaps();
 
     void unwrap(const cv::Mat &input, cv::Mat &output) const;
 
+    /**!
+     * \brief Unwrap a colour image to a greyscale one of a different (usually
+     *        smaller) size in one go
+     *
+     * This samples the camera image directly at outputSize, with bilinear
+     * interpolation, which is quicker than unwrapping at full resolution then
+     * converting to greyscale and resizing. Maps for outputSize are built the
+     * first time it is used.
+     */
+    void unwrapGreyscale(const cv::Mat &input, cv::Mat &output, const cv::Size &outputSize);
+
+    //! Get the bounding box of the part of the camera image which is unwrapped
+    cv::Rect getAnnulusBounds() const;
+
+    /**!
+     * \brief Unwrap images which have already been cropped to roi, rather
+     *        than whole camera frames
+     *
+     * roi must contain getAnnulusBounds(). Results are identical to cropping
+     * afterwards, but cameras which support it can skip reading (and
+     * converting) the rest of the frame.
+     */
+    void setInputROI(const cv::Rect &roi);
+
+    /**!
+     * \brief Set the folder used to cache unwrap maps between runs
+     *
+     * Defaults to $BOB_UNWRAP_CACHE_PATH if set. If neither that nor this is
+     * set (or the path is empty) then maps aren't cached.
+     */
+    static void setMapCachePath(filesystem::path path);
+    static const filesystem::path &getMapCachePath();
+
     //! Serialise this object.
     void write(cv::FileStorage &fs) const;
 
@@ -74,10 +109,22 @@ private:
     //------------------------------------------------------------------------
     cv::Size m_CameraResolution;
     cv::Size m_UnwrappedResolution;
-    cv::Mat m_UnwrapMapX;
-    cv::Mat m_UnwrapMapY;
+    cv::Point m_InputOffset;
+
+    // Fixed-point (CV_16SC2) map for nearest-neighbour unwrapping
+    cv::Mat m_UnwrapMap;
+
+    // Fixed-point maps (CV_16SC2 + CV_16UC1) for unwrapGreyscale()
+    cv::Size m_GreyscaleResolution;
+    cv::Mat m_GreyscaleMap, m_GreyscaleInterpolation;
+    cv::Mat m_GreyscaleBuffer;
 
     void createMaps();
+    void computeMaps(const cv::Size &resolution, cv::Mat &mapX, cv::Mat &mapY) const;
+    void applyInputOffset(cv::Mat &map) const;
+    std::string getMapCacheFilename() const;
+    bool loadCachedMap(const filesystem::path &path);
+    void saveCachedMap(const filesystem::path &path) const;
 }; // OpenCVUnwrap360
 
 void
@@ -24,6 +24,15 @@
 // Standard C includes
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// SIMD intrinsics
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 namespace BoBRobotics {
 namespace Navigation {
@@ -137,6 +146,446 @@ public:
     };
 };
 
+namespace Detail {
+//! Running totals for a masked image difference
+struct DifferenceSums
+{
+    uint64_t sum = 0;   //!< Sum of absolute or squared differences
+    uint64_t count = 0; //!< Number of unmasked pixels
+};
+
+/*
+ * Vector kernels: these process as many whole vectors as they can and return
+ * the number of pixels processed, leaving the tail for the scalar code.
+ *
+ * Masks are assumed to be 0x00 or 0xff per pixel (ImgProc::Mask guarantees
+ * this), so ANDing a mask with the differences zeroes out masked pixels and
+ * summing a mask's bytes gives 255 * the number of unmasked pixels.
+ *
+ * The squared differences are accumulated in 32-bit lanes, so we widen them to
+ * 64 bits every MaxBlockVectors vectors to avoid overflow.
+ */
+constexpr size_t MaxBlockVectors = 4096;
+
+#if defined(__AVX2__)
+template<bool Masked, bool Squared>
+inline size_t accumulateDifferencesVector(const uint8_t *src1, const uint8_t *src2,
+                                          const uint8_t *mask1, const uint8_t *mask2,
+                                          size_t n, DifferenceSums &sums)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum64 = zero, count64 = zero;
+
+    size_t i = 0;
+    while (i + 32 <= n) {
+        const size_t blockEnd = std::min(n, i + 32 * MaxBlockVectors);
+        __m256i sum32 = zero;
+        for (; i + 32 <= blockEnd; i += 32) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src1 + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src2 + i));
+
+            // |a - b| for unsigned bytes
+            __m256i diff = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+            if (Masked) {
+                const __m256i mask = _mm256_and_si256(
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask1 + i)),
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask2 + i)));
+                diff = _mm256_and_si256(diff, mask);
+                count64 = _mm256_add_epi64(count64, _mm256_sad_epu8(mask, zero));
+            }
+
+            if (Squared) {
+                const __m256i lo = _mm256_unpacklo_epi8(diff, zero);
+                const __m256i hi = _mm256_unpackhi_epi8(diff, zero);
+                sum32 = _mm256_add_epi32(sum32, _mm256_madd_epi16(lo, lo));
+                sum32 = _mm256_add_epi32(sum32, _mm256_madd_epi16(hi, hi));
+            } else {
+                sum64 = _mm256_add_epi64(sum64, _mm256_sad_epu8(diff, zero));
+            }
+        }
+
+        if (Squared) {
+            sum64 = _mm256_add_epi64(sum64, _mm256_unpacklo_epi32(sum32, zero));
+            sum64 = _mm256_add_epi64(sum64, _mm256_unpackhi_epi32(sum32, zero));
+        }
+    }
+
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), sum64);
+    sums.sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    if (Masked) {
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), count64);
+        sums.count += (lanes[0] + lanes[1] + lanes[2] + lanes[3]) / 255;
+    }
+    return i;
+}
+#elif defined(__SSE2__)
+template<bool Masked, bool Squared>
+inline size_t accumulateDifferencesVector(const uint8_t *src1, const uint8_t *src2,
+                                          const uint8_t *mask1, const uint8_t *mask2,
+                                          size_t n, DifferenceSums &sums)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum64 = zero, count64 = zero;
+
+    size_t i = 0;
+    while (i + 16 <= n) {
+        const size_t blockEnd = std::min(n, i + 16 * MaxBlockVectors);
+        __m128i sum32 = zero;
+        for (; i + 16 <= blockEnd; i += 16) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src1 + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src2 + i));
+
+            // |a - b| for unsigned bytes
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+            if (Masked) {
+                const __m128i mask = _mm_and_si128(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask1 + i)),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask2 + i)));
+                diff = _mm_and_si128(diff, mask);
+                count64 = _mm_add_epi64(count64, _mm_sad_epu8(mask, zero));
+            }
+
+            if (Squared) {
+                const __m128i lo = _mm_unpacklo_epi8(diff, zero);
+                const __m128i hi = _mm_unpackhi_epi8(diff, zero);
+                sum32 = _mm_add_epi32(sum32, _mm_madd_epi16(lo, lo));
+                sum32 = _mm_add_epi32(sum32, _mm_madd_epi16(hi, hi));
+            } else {
+                sum64 = _mm_add_epi64(sum64, _mm_sad_epu8(diff, zero));
+            }
+        }
+
+        if (Squared) {
+            sum64 = _mm_add_epi64(sum64, _mm_unpacklo_epi32(sum32, zero));
+            sum64 = _mm_add_epi64(sum64, _mm_unpackhi_epi32(sum32, zero));
+        }
+    }
+
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum64);
+    sums.sum += lanes[0] + lanes[1];
+    if (Masked) {
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), count64);
+        sums.count += (lanes[0] + lanes[1]) / 255;
+    }
+    return i;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+template<bool Masked, bool Squared>
+inline size_t accumulateDifferencesVector(const uint8_t *src1, const uint8_t *src2,
+                                          const uint8_t *mask1, const uint8_t *mask2,
+                                          size_t n, DifferenceSums &sums)
+{
+    uint64x2_t sum64 = vdupq_n_u64(0), count64 = vdupq_n_u64(0);
+
+    size_t i = 0;
+    while (i + 16 <= n) {
+        const size_t blockEnd = std::min(n, i + 16 * MaxBlockVectors);
+        uint32x4_t sum32 = vdupq_n_u32(0), count32 = vdupq_n_u32(0);
+        for (; i + 16 <= blockEnd; i += 16) {
+            uint8x16_t diff = vabdq_u8(vld1q_u8(src1 + i), vld1q_u8(src2 + i));
+            if (Masked) {
+                const uint8x16_t mask = vandq_u8(vld1q_u8(mask1 + i), vld1q_u8(mask2 + i));
+                diff = vandq_u8(diff, mask);
+                count32 = vpadalq_u16(count32, vpaddlq_u8(vshrq_n_u8(mask, 7)));
+            }
+
+            if (Squared) {
+                sum32 = vpadalq_u16(sum32, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+                sum32 = vpadalq_u16(sum32, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+            } else {
+                sum32 = vpadalq_u16(sum32, vpaddlq_u8(diff));
+            }
+        }
+
+        sum64 = vpadalq_u32(sum64, sum32);
+        count64 = vpadalq_u32(count64, count32);
+    }
+
+    sums.sum += vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1);
+    if (Masked) {
+        sums.count += vgetq_lane_u64(count64, 0) + vgetq_lane_u64(count64, 1);
+    }
+    return i;
+}
+#else
+template<bool, bool>
+inline size_t accumulateDifferencesVector(const uint8_t *, const uint8_t *,
+                                          const uint8_t *, const uint8_t *,
+                                          size_t, DifferenceSums &)
+{
+    return 0;
+}
+#endif
+
+/*!
+ * \brief Accumulate the sum of absolute or squared differences between n
+ *        pixels of src1 and src2, ignoring pixels which are zero in either mask
+ *
+ * If Masked is false, mask1 and mask2 are ignored and can be nullptr.
+ */
+template<bool Masked, bool Squared>
+inline void accumulateDifferences(const uint8_t *src1, const uint8_t *src2,
+                                  const uint8_t *mask1, const uint8_t *mask2,
+                                  size_t n, DifferenceSums &sums)
+{
+    size_t i = accumulateDifferencesVector<Masked, Squared>(src1, src2, mask1, mask2, n, sums);
+
+    // Scalar code for the remainder (or everything, if we have no SIMD)
+    for (; i < n; i++) {
+        if (Masked && !(mask1[i] & mask2[i])) {
+            continue;
+        }
+        const uint32_t diff = (src1[i] > src2[i]) ? (src1[i] - src2[i]) : (src2[i] - src1[i]);
+        sums.sum += Squared ? diff * diff : diff;
+        if (Masked) {
+            sums.count++;
+        }
+    }
+    if (!Masked) {
+        sums.count += n;
+    }
+}
+
+//! Calculate masked sum of absolute or squared differences in a single pass over the images
+template<bool Squared>
+inline DifferenceSums sumDifferences(const cv::Mat &src1, const cv::Mat &src2,
+                                     const ImgProc::Mask &mask1, const ImgProc::Mask &mask2)
+{
+    BOB_ASSERT(src1.type() == CV_8UC1);
+    BOB_ASSERT(src2.type() == CV_8UC1);
+    BOB_ASSERT(src1.size() == src2.size());
+    BOB_ASSERT(mask1.isValid(src1.size()));
+    BOB_ASSERT(mask2.isValid(src1.size()));
+
+    // If we only have one mask, then just AND it with itself
+    const cv::Mat &maskMat1 = mask1.empty() ? mask2.get() : mask1.get();
+    const cv::Mat &maskMat2 = mask2.empty() ? mask1.get() : mask2.get();
+    const bool masked = !maskMat1.empty();
+
+    // If nothing is padded, we can treat the images as one long row
+    int rows = src1.rows;
+    size_t cols = static_cast<size_t>(src1.cols);
+    if (src1.isContinuous() && src2.isContinuous()
+            && (!masked || (maskMat1.isContinuous() && maskMat2.isContinuous()))) {
+        cols *= rows;
+        rows = 1;
+    }
+
+    DifferenceSums sums;
+    for (int y = 0; y < rows; y++) {
+        if (masked) {
+            accumulateDifferences<true, Squared>(src1.ptr(y), src2.ptr(y),
+                                                 maskMat1.ptr(y), maskMat2.ptr(y),
+                                                 cols, sums);
+        } else {
+            accumulateDifferences<false, Squared>(src1.ptr(y), src2.ptr(y),
+                                                  nullptr, nullptr, cols, sums);
+        }
+    }
+    return sums;
+}
+
+/*!
+ * \brief As sumDifferences(), but give up as soon as the sum exceeds a bound
+ *
+ * The images are processed in blocks of rowsPerBlock rows and after each block
+ * the running sum is compared with getMaxSum(), which is called each time so
+ * that the bound can be tightened by other threads as we go.
+ *
+ * \return false if we gave up, in which case sums is incomplete
+ */
+template<bool Squared, class MaxSumFunc>
+inline bool sumDifferencesBounded(const cv::Mat &src1, const cv::Mat &src2,
+                                  const ImgProc::Mask &mask1, const ImgProc::Mask &mask2,
+                                  int rowsPerBlock, const MaxSumFunc &getMaxSum,
+                                  DifferenceSums &sums)
+{
+    BOB_ASSERT(src1.type() == CV_8UC1);
+    BOB_ASSERT(src2.type() == CV_8UC1);
+    BOB_ASSERT(src1.size() == src2.size());
+    BOB_ASSERT(mask1.isValid(src1.size()));
+    BOB_ASSERT(mask2.isValid(src1.size()));
+    BOB_ASSERT(rowsPerBlock > 0);
+
+    const cv::Mat &maskMat1 = mask1.empty() ? mask2.get() : mask1.get();
+    const cv::Mat &maskMat2 = mask2.empty() ? mask1.get() : mask2.get();
+    const bool masked = !maskMat1.empty();
+    const size_t cols = static_cast<size_t>(src1.cols);
+
+    sums = {};
+    for (int firstRow = 0; firstRow < src1.rows; firstRow += rowsPerBlock) {
+        const int lastRow = std::min(src1.rows, firstRow + rowsPerBlock);
+        for (int y = firstRow; y < lastRow; y++) {
+            if (masked) {
+                accumulateDifferences<true, Squared>(src1.ptr(y), src2.ptr(y),
+                                                     maskMat1.ptr(y), maskMat2.ptr(y),
+                                                     cols, sums);
+            } else {
+                accumulateDifferences<false, Squared>(src1.ptr(y), src2.ptr(y),
+                                                      nullptr, nullptr, cols, sums);
+            }
+        }
+
+        if (lastRow < src1.rows && static_cast<double>(sums.sum) > getMaxSum()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Expand n bits of a packed mask (LSB first) into n bytes of 0x00 or 0xff
+inline void unpackMaskBits(const uint8_t *bits, size_t n, uint8_t *out)
+{
+    // Each possible byte of bits expands to eight bytes of mask
+    static const auto table = []() {
+        std::array<std::array<uint8_t, 8>, 256> t;
+        for (size_t byte = 0; byte < t.size(); byte++) {
+            for (size_t bit = 0; bit < 8; bit++) {
+                t[byte][bit] = ((byte >> bit) & 1) ? 0xff : 0;
+            }
+        }
+        return t;
+    }();
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        std::memcpy(&out[i], table[bits[i / 8]].data(), 8);
+    }
+    for (; i < n; i++) {
+        out[i] = table[bits[i / 8]][i % 8];
+    }
+}
+
+/*!
+ * \brief As sumDifferences(), but with src2's mask packed as one bit per pixel
+ *
+ * Each row of maskBits2 (maskRowStride bytes apart) is expanded into rowMask
+ * just before it's used, so the full 8-bit mask never exists in memory. If
+ * maskBits2 is nullptr then src2 is treated as unmasked.
+ */
+template<bool Squared>
+inline DifferenceSums sumDifferencesPacked(const cv::Mat &src1, const cv::Mat &src2,
+                                           const ImgProc::Mask &mask1, const uint8_t *maskBits2,
+                                           size_t maskRowStride, std::vector<uint8_t> &rowMask)
+{
+    if (!maskBits2) {
+        return sumDifferences<Squared>(src1, src2, mask1, {});
+    }
+
+    BOB_ASSERT(src1.type() == CV_8UC1);
+    BOB_ASSERT(src2.type() == CV_8UC1);
+    BOB_ASSERT(src1.size() == src2.size());
+    BOB_ASSERT(mask1.isValid(src1.size()));
+
+    const size_t cols = static_cast<size_t>(src1.cols);
+    rowMask.resize(cols);
+
+    DifferenceSums sums;
+    for (int y = 0; y < src1.rows; y++) {
+        unpackMaskBits(&maskBits2[y * maskRowStride], cols, rowMask.data());
+
+        // If we only have one mask, then just AND it with itself
+        const uint8_t *rowMask1 = mask1.empty() ? rowMask.data() : mask1.get().ptr(y);
+        accumulateDifferences<true, Squared>(src1.ptr(y), src2.ptr(y), rowMask1,
+                                             rowMask.data(), cols, sums);
+    }
+    return sums;
+}
+} // Detail
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::FusedAbsDiff
+//------------------------------------------------------------------------
+/*!
+ * \brief A faster version of AbsDiff for 8-bit greyscale images
+ *
+ * The difference, masking and reduction are done in a single pass with SIMD
+ * (AVX2, SSE2 or NEON, depending on the target), without any scratch images.
+ * The results are identical to AbsDiff's.
+ *
+ * Can be passed to PerfectMemoryStore::RawImage as a template parameter.
+ */
+class FusedAbsDiff
+{
+public:
+    template<class VecType = std::tuple<>>
+    class Internal
+    {
+    public:
+        float operator()(const cv::Mat &src1, const cv::Mat &src2,
+                         const ImgProc::Mask &mask1 = {},
+                         const ImgProc::Mask &mask2 = {})
+        {
+            return getMean(Detail::sumDifferences<false>(src1, src2, mask1, mask2));
+        }
+
+        //! As above, but with src2's mask packed as one bit per pixel (see PerfectMemoryStore::RawImageArena)
+        float operator()(const cv::Mat &src1, const cv::Mat &src2,
+                         const ImgProc::Mask &mask1, const uint8_t *maskBits2,
+                         size_t maskRowStride)
+        {
+            return getMean(Detail::sumDifferencesPacked<false>(src1, src2, mask1, maskBits2,
+                                                               maskRowStride, m_RowMask));
+        }
+
+    private:
+        std::vector<uint8_t> m_RowMask;
+
+        static float getMean(const Detail::DifferenceSums &sums)
+        {
+            // NB: This is how cv::mean() calculates the mean
+            return static_cast<float>(static_cast<double>(sums.sum) *
+                                      (sums.count ? 1.0 / static_cast<double>(sums.count) : 0.0));
+        }
+    };
+};
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::FusedRMSDiff
+//------------------------------------------------------------------------
+/*!
+ * \brief A faster version of RMSDiff for 8-bit greyscale images
+ *
+ * Squared differences are accumulated with integer arithmetic in a single SIMD
+ * pass, without any scratch images. The results are identical to RMSDiff's.
+ *
+ * Can be passed to PerfectMemoryStore::RawImage as a template parameter.
+ */
+class FusedRMSDiff
+{
+public:
+    template<class VecType = std::tuple<>>
+    class Internal
+    {
+    public:
+        float operator()(const cv::Mat &src1, const cv::Mat &src2,
+                         const ImgProc::Mask &mask1 = {},
+                         const ImgProc::Mask &mask2 = {})
+        {
+            return getRMS(Detail::sumDifferences<true>(src1, src2, mask1, mask2));
+        }
+
+        //! As above, but with src2's mask packed as one bit per pixel (see PerfectMemoryStore::RawImageArena)
+        float operator()(const cv::Mat &src1, const cv::Mat &src2,
+                         const ImgProc::Mask &mask1, const uint8_t *maskBits2,
+                         size_t maskRowStride)
+        {
+            return getRMS(Detail::sumDifferencesPacked<true>(src1, src2, mask1, maskBits2,
+                                                             maskRowStride, m_RowMask));
+        }
+
+    private:
+        std::vector<uint8_t> m_RowMask;
+
+        static float getRMS(const Detail::DifferenceSums &sums)
+        {
+            return sqrtf(static_cast<double>(sums.sum) / (float) sums.count);
+        }
+    };
+};
+
 template<class T>
 bool allSame(cv::InputArray &arr)
 {
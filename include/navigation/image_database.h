@@ -4,7 +4,9 @@
 #include "common/macros.h"
 #include "common/path.h"
 #include "common/pose.h"
+#include "common/spsc_queue.h"
 #include "common/string.h"
+#include "navigation/packed_image_file.h"
 
 // Third-party includes
 #include "plog/Log.h"
@@ -15,18 +17,30 @@
 #include <opencv2/opencv.hpp>
 
 // TBB
+#include <tbb/concurrent_queue.h>
 #include <tbb/parallel_for.h>
+#if TBB_INTERFACE_VERSION >= 12000
+#include <tbb/parallel_pipeline.h>
+#else
+#include <tbb/pipeline.h>
+#endif
 
 // Standard C includes
 #include <ctime>
 
 // Standard C++ includes
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <fstream>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -35,6 +49,15 @@ namespace BoBRobotics {
 namespace Navigation {
 using namespace units::literals;
 
+namespace Detail {
+// oneTBB moved the filter modes out of tbb::filter
+#if TBB_INTERFACE_VERSION >= 12000
+using PipelineFilterMode = tbb::filter_mode;
+#else
+using PipelineFilterMode = tbb::filter::mode;
+#endif
+} // Detail
+
 //------------------------------------------------------------------------
 // BoBRobotics::Navigation::Range
 //------------------------------------------------------------------------
@@ -82,6 +105,13 @@ class ImageDatabase
     using hertz_t = units::frequency::hertz_t;
 
 public:
+    //! Values of user-defined fields loaded from a CSV file, stored column-wise
+    struct ExtraFieldTable
+    {
+        std::vector<std::string> names;
+        std::vector<std::vector<std::string>> columns;
+    };
+
     //! The metadata for an entry in an ImageDatabase
     struct Entry
     {
@@ -91,22 +121,49 @@ public:
         std::array<size_t, 3> gridPosition; //! For grid-type databases, indicates the x,y,z grid position
         std::unordered_map<std::string, std::string> extraFields;
 
+        //! For entries loaded from disk, extra fields are looked up in this table instead
+        std::shared_ptr<const ExtraFieldTable> extraFieldTable;
+        size_t extraFieldRow = 0;
+
         cv::Mat load(bool greyscale = true) const;
         bool hasExtraField(const std::string &name) const;
         const std::string &getExtraField(const std::string &name) const;
+
+        //! Get a pointer to the value of an extra field, or nullptr if not present
+        const std::string *findExtraField(const std::string &name) const;
     };
 
     class FrameWriter {
     public:
         virtual std::string getCurrentFilenameRoot() const = 0;
-        virtual void writeFrame(const cv::Mat &frame, Entry &entry) = 0;
+
+        //! Fill in the entry's metadata, then encode and save the frame
+        void writeFrame(const cv::Mat &frame, Entry &entry)
+        {
+            prepareFrame(entry);
+            encodeFrame(frame, entry);
+        }
+
+        //! Fill in metadata for a new entry (always called on the recording thread)
+        virtual void prepareFrame(Entry &) {}
+
+        //! Encode and save a frame (may be called on a background thread)
+        virtual void encodeFrame(const cv::Mat &frame, const Entry &entry) = 0;
+
+        //! Whether encodeFrame() may be called for several frames at once
+        virtual bool canEncodeInParallel() const { return false; }
+
+        //! Called when recording is complete, before entries are saved
+        virtual void finish() {}
     };
 
     class ImageFileWriter
       : public FrameWriter {
     public:
         ImageFileWriter(const ImageDatabase &, std::string imageFormat);
-        void writeFrame(const cv::Mat &frame, Entry &entry) override;
+        void prepareFrame(Entry &entry) override;
+        void encodeFrame(const cv::Mat &frame, const Entry &entry) override;
+        bool canEncodeInParallel() const override { return true; }
 
     private:
         const std::string m_ImageFormat;
@@ -117,7 +174,7 @@ public:
     public:
         VideoFileWriter(const ImageDatabase &,
                         const std::pair<const std::string &, const std::string &> &format);
-        void writeFrame(const cv::Mat &frame, Entry &entry) override;
+        void encodeFrame(const cv::Mat &frame, const Entry &entry) override;
         const std::string &getVideoFileName() const;
 
     private:
@@ -125,6 +182,109 @@ public:
         const std::string m_FileName;
     };
 
+    //! Writes frames into a single memory-mappable PackedImageFile
+    class PackedFileWriter
+      : public FrameWriter {
+    public:
+        struct Format
+        {
+            cv::Size resolution;
+            int channels;
+            bool compress;
+        };
+
+        PackedFileWriter(const ImageDatabase &, const Format &format);
+        void encodeFrame(const cv::Mat &frame, const Entry &entry) override;
+        void finish() override;
+        const std::string &getPackedFileName() const;
+
+    private:
+        const std::string m_FileName;
+        std::shared_ptr<PackedImageFile::Writer> m_Writer;
+    };
+
+    //! What a Recorder in asynchronous mode does when its queue is full
+    enum class QueueFullPolicy
+    {
+        Block, //!< Wait for an encoder thread to free up space
+        Drop   //!< Discard the new frame (and don't add an entry for it)
+    };
+
+    //! Options for Recorder::setAsync()
+    struct AsyncOptions
+    {
+        //! Maximum number of frames waiting to be encoded
+        size_t queueSize = 32;
+
+        //! Number of encoder threads (zero to choose automatically)
+        size_t numEncoders = 0;
+
+        QueueFullPolicy policy = QueueFullPolicy::Block;
+    };
+
+    //! Statistics for a Recorder in asynchronous mode
+    struct AsyncStats
+    {
+        size_t queueDepth = 0;
+        size_t framesWritten = 0;
+        size_t framesDropped = 0;
+
+        //! Time between a frame being recorded and it being saved
+        std::chrono::microseconds meanLatency{ 0 }, maxLatency{ 0 };
+    };
+
+    /*!
+     * \brief Encodes frames for a Recorder on background threads
+     *
+     * Each encoder thread has its own single-producer, single-consumer queue,
+     * which frames are dealt out to in turn. Writers which have to receive
+     * frames in order (i.e. video and packed files) only get one thread.
+     */
+    class AsyncEncoder
+    {
+    public:
+        AsyncEncoder(FrameWriter &writer, const AsyncOptions &options);
+        ~AsyncEncoder();
+
+        AsyncEncoder(const AsyncEncoder &) = delete;
+        AsyncEncoder &operator=(const AsyncEncoder &) = delete;
+
+        //! Copy frame into the queue; returns false if it was dropped
+        bool push(const cv::Mat &frame, const Entry &entry);
+
+        //! Wait until all queued frames are saved, then stop encoder threads
+        void finish();
+
+        AsyncStats getStats() const;
+
+    private:
+        struct Slot
+        {
+            cv::Mat image;
+            Entry entry;
+            std::chrono::steady_clock::time_point queueTime;
+        };
+
+        FrameWriter &m_Writer;
+        const QueueFullPolicy m_Policy;
+        std::vector<std::unique_ptr<SPSCQueue<Slot>>> m_Queues;
+        std::vector<std::thread> m_Threads;
+
+        // Encoder threads sleep on these (one per queue) while their queues are empty
+        std::mutex m_WakeMutex;
+        std::vector<std::condition_variable> m_QueueNotEmpty;
+        size_t m_NextQueue = 0;
+        std::atomic<bool> m_Stopping{ false }, m_Failed{ false };
+        std::atomic<size_t> m_FramesWritten{ 0 }, m_FramesDropped{ 0 };
+        std::atomic<int64_t> m_TotalLatency{ 0 }, m_MaxLatency{ 0 };
+        std::mutex m_ErrorMutex;
+        std::exception_ptr m_Error;
+
+        void run(size_t index);
+        void stop();
+        void rethrowError();
+    };
+
     //! Base class for GridRecorder and RouteRecorder
     template<class FrameWriterType>
     class Recorder
@@ -133,8 +293,13 @@ public:
     public:
         ~Recorder()
         {
+            // Don't let errors from encoder threads escape the destructor
             if (m_Recording) {
-                save();
+                try {
+                    save();
+                } catch (std::exception &e) {
+                    LOGE << "Error saving image database: " << e.what();
+                }
             }
         }
 
@@ -144,9 +309,42 @@ public:
         //! Don't save new metadata when this class is destroyed
         void abortSave() { m_Recording = false; }
 
+        /*!
+         * \brief Encode and save frames on background threads, so that record()
+         *        doesn't have to wait for them
+         *
+         * Must be called before any frames are recorded. Entries are kept in
+         * the order they were recorded in, whatever order frames are saved in.
+         * The recorder shouldn't be copied after calling this.
+         */
+        void setAsync(const AsyncOptions &options)
+        {
+            BOB_ASSERT(m_NewEntries.empty());
+            m_AsyncEncoder = std::make_shared<AsyncEncoder>(*this, options);
+        }
+
+        void setAsync()
+        {
+            setAsync(AsyncOptions{});
+        }
+
+        bool isAsync() const { return static_cast<bool>(m_AsyncEncoder); }
+
+        AsyncStats getAsyncStats() const
+        {
+            BOB_ASSERT(isAsync());
+            return m_AsyncEncoder->getStats();
+        }
+
         //! Save new metadata
         void save()
         {
+            // Make sure all the frames are on disk
+            if (m_AsyncEncoder) {
+                m_AsyncEncoder->finish();
+            }
+            this->finish();
+
             // Write metadata to file
             {
                 m_YAML << "}";
@@ -170,6 +368,7 @@ public:
         ImageDatabase &m_ImageDatabase;
         bool m_Recording;
         std::vector<Entry> m_NewEntries;
+        std::shared_ptr<AsyncEncoder> m_AsyncEncoder;
 
     protected:
         cv::FileStorage m_YAML;
@@ -213,8 +412,9 @@ public:
                    << "type" << (isRoute ? "route" : "grid");
         }
 
+        //! Returns false if the frame was dropped because the queue was full
         template<class... Ts>
-        void addEntry(const cv::Mat &image,
+        bool addEntry(const cv::Mat &image,
                       const Vector3<millimeter_t> &position,
                       const degree_t heading,
                       const std::array<size_t, 3> &gridPosition,
@@ -233,10 +433,18 @@ public:
                 gridPosition,
                 {}
             };
-            this->writeFrame(image, newEntry);
+            if (m_AsyncEncoder) {
+                this->prepareFrame(newEntry);
+                if (!m_AsyncEncoder->push(image, newEntry)) {
+                    return false;
+                }
+            } else {
+                this->writeFrame(image, newEntry);
+            }
             m_NewEntries.emplace_back(std::move(newEntry));
 
             setExtraFields(std::forward<Ts>(extraFieldValues)...);
+            return true;
         }
 
         const ImageDatabase &getImageDatabase() const
@@ -290,12 +498,14 @@ public:
         /**!
          * \brief Save a new image into the database with values for extra
          *        fields, if used
+         *
+         * Returns false if the image was dropped (see setAsync()).
          */
         template<class... Ts>
-        void record(const cv::Mat &image, Ts &&... extraFieldValues)
+        bool record(const cv::Mat &image, Ts &&... extraFieldValues)
         {
             BOB_ASSERT(m_Current[2] < sizeZ());
-            record(m_Current, image, std::forward<Ts>(extraFieldValues)...);
+            const bool recorded = record(m_Current, image, std::forward<Ts>(extraFieldValues)...);
 
             if (++m_Current[0] == sizeX()) {
                 m_Current[0] = 0;
@@ -304,6 +514,7 @@ public:
                     m_Current[2]++;
                 }
             }
+            return recorded;
         }
 
         /**!
@@ -311,11 +522,11 @@ public:
          *        coordinates with values for extra fields, if used
          */
         template<class... Ts>
-        void record(const std::array<size_t, 3> &gridPosition,
+        bool record(const std::array<size_t, 3> &gridPosition,
                     const cv::Mat &image, Ts&&... extraFieldValues)
         {
             const auto position = getPosition(gridPosition);
-            this->addEntry(image, position, m_Heading,
+            return this->addEntry(image, position, m_Heading,
                      { gridPosition[0], gridPosition[1], gridPosition[2] },
                      std::forward<Ts>(extraFieldValues)...);
         }
@@ -350,12 +561,14 @@ public:
         /**!
          * \brief Save a new image taken at the specified pose with values for
          *        extra fields, if used
+         *
+         * Returns false if the image was dropped (see setAsync()).
          */
         template<class... Ts>
-        void record(const Vector3<millimeter_t> &position, degree_t heading,
+        bool record(const Vector3<millimeter_t> &position, degree_t heading,
                     const cv::Mat &image, Ts &&... extraFieldValues)
         {
-            this->addEntry(image, position, heading, { 0, 0, 0 },
+            return this->addEntry(image, position, heading, { 0, 0, 0 },
                            std::forward<Ts>(extraFieldValues)...);
         }
 
@@ -440,6 +653,15 @@ public:
                                                          const std::string &codec,
                                                          std::vector<std::string> extraFieldNames = {});
 
+    /**!
+     * \brief Start recording a route, saving images into a PackedImageFile,
+     *        optionally compressed with LZ4
+     */
+    RouteRecorder<PackedFileWriter> getRoutePackedRecorder(const cv::Size &resolution,
+                                                           int channels = 1,
+                                                           bool compress = false,
+                                                           std::vector<std::string> extraFieldNames = {});
+
     hertz_t getFrameRate() const;
 
     //! Get the resolution of saved images
@@ -448,6 +670,13 @@ public:
     //! Check if this database has any saved metadata (yet)
     bool hasMetadata() const;
 
+    /**!
+     * \brief Call func(index, image) for every frameSkip-th image in the database
+     *
+     * Images are loaded in parallel, so func may be called concurrently from
+     * different threads. Indices always match the images, but they are not
+     * visited in order, except within each segment of a video file.
+     */
     template<class Func>
     void forEachImage(const Func &func, size_t frameSkip = 1,
                       bool greyscale = true) const
@@ -458,6 +687,24 @@ public:
             return;
         }
 
+        /*
+         * If images are stored in a PackedImageFile, then they can be read in
+         * parallel. Note that uncompressed images are passed to func as views
+         * onto read-only memory, so they mustn't be written to.
+         */
+        if (m_PackedFile) {
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, m_Entries.size() / frameSkip),
+                              [&](const auto &r) {
+                                  cv::Mat img;
+                                  for (size_t i = r.begin(); i != r.end(); ++i) {
+                                      loadPackedImage(i * frameSkip, img, greyscale);
+                                      func(i, img);
+                                  }
+                              });
+
+            return;
+        }
+
         // If database consists of individual image files...
         if (m_VideoFilePath.empty()) {
             tbb::parallel_for(tbb::blocked_range<size_t>(0, m_Entries.size() / frameSkip),
@@ -470,37 +717,123 @@ public:
             return;
         }
 
-        // ...otherwise we have a video file
-        cv::VideoCapture cap{ m_VideoFilePath.str() };
-        BOB_ASSERT(cap.isOpened());
+        /*
+         * ...otherwise we have a video file, which we split into segments,
+         * each decoded by its own task with its own VideoCapture
+         */
+        const size_t numImages = m_Entries.size() / frameSkip;
+        const auto plan = planVideoDecode(frameSkip);
+        tbb::parallel_for(size_t{ 0 }, plan.numSegments, [&](size_t segment) {
+            forEachVideoFrame(func, frameSkip, greyscale, plan.seekToSkip,
+                              segment * numImages / plan.numSegments,
+                              (segment + 1) * numImages / plan.numSegments);
+        });
+    }
 
-        cv::Mat img;
-        for (size_t i = 0; i < m_Entries.size() / frameSkip; i++) {
-            BOB_ASSERT(cap.read(img));
+    /**!
+     * \brief Stream every frameSkip-th image through a bounded-memory pipeline
+     *
+     * Images are decoded, then passed to process(index, image, output) in
+     * parallel, then passed to consume(index, output) one at a time, in order.
+     * At most maxTokens images are in flight at once (by default, two per
+     * hardware thread) and their buffers are reused, so memory use doesn't
+     * grow with the size of the database.
+     */
+    template<class ProcessFunc, class ConsumeFunc>
+    void streamImages(const ProcessFunc &process, const ConsumeFunc &consume,
+                      size_t frameSkip = 1, bool greyscale = true,
+                      size_t maxTokens = 0) const
+    {
+        using Detail::PipelineFilterMode;
 
-            if (greyscale) {
-                cv::cvtColor(img, img, cv::COLOR_BGR2GRAY);
-            }
+        BOB_ASSERT(frameSkip > 0);
+        const size_t numImages = m_Entries.size() / frameSkip;
+        if (numImages == 0) {
+            return;
+        }
+        if (maxTokens == 0) {
+            maxTokens = getDefaultMaxTokens();
+        }
 
-            func(i, img);
+        // Each token in flight owns one of these
+        std::vector<StreamFrame> frames(maxTokens);
+        tbb::concurrent_queue<StreamFrame *> freeFrames;
+        for (auto &frame : frames) {
+            freeFrames.push(&frame);
+        }
 
-            /*
-             * It is possible to explicitly jump to a given frame with OpenCV,
-             * but that turns out to be reeeeeeeaaaally slow.
-             */
-            for (size_t j = 1; j < frameSkip && cap.grab(); j++)
-                ;
+        // Video frames have to be decoded in order, in the first stage
+        std::unique_ptr<cv::VideoCapture> cap;
+        bool seekToSkip = false;
+        if (!m_VideoFilePath.empty()) {
+            seekToSkip = planVideoDecode(frameSkip).seekToSkip;
+            cap = std::make_unique<cv::VideoCapture>(m_VideoFilePath.str());
+            BOB_ASSERT(cap->isOpened());
         }
+
+        size_t next = 0;
+        const auto readStage = [&](tbb::flow_control &fc) -> StreamFrame * {
+            if (next == numImages) {
+                fc.stop();
+                return nullptr;
+            }
+
+            // The pipeline's token limit means there's always a free frame
+            StreamFrame *frame = nullptr;
+            BOB_ASSERT(freeFrames.try_pop(frame));
+            frame->index = next++;
+            if (cap) {
+                if (frame->index > 0) {
+                    skipVideoFrames(*cap, frame->index, frameSkip, seekToSkip);
+                }
+                BOB_ASSERT(cap->read(frame->decoded));
+            }
+            return frame;
+        };
+        const auto processStage = [&](StreamFrame *frame) {
+            if (!cap) {
+                loadImage(frame->index * frameSkip, frame->image, greyscale);
+            } else if (greyscale) {
+                cv::cvtColor(frame->decoded, frame->image, cv::COLOR_BGR2GRAY);
+            } else {
+                frame->image = frame->decoded;
+            }
+
+            process(frame->index, static_cast<const cv::Mat &>(frame->image), frame->output);
+            return frame;
+        };
+        const auto consumeStage = [&](StreamFrame *frame) {
+            consume(frame->index, static_cast<const cv::Mat &>(frame->output));
+            freeFrames.push(frame);
+        };
+
+        tbb::parallel_pipeline(maxTokens,
+                               tbb::make_filter<void, StreamFrame *>(PipelineFilterMode::serial_in_order, readStage) &
+                               tbb::make_filter<StreamFrame *, StreamFrame *>(PipelineFilterMode::parallel, processStage) &
+                               tbb::make_filter<StreamFrame *, void>(PipelineFilterMode::serial_in_order, consumeStage));
     }
 
     /**!
      *  \brief Unwrap all the panoramic images in this database into a new
      *         folder, creating a new database.
+     *
+     * Images are streamed through streamImages(), so at most maxTokens are in
+     * memory at any one time.
      */
     void unwrap(const filesystem::path &destination,
                 const cv::Size &unwrapRes,
                 size_t frameSkip = 1,
-                bool greyscale = false) const;
+                bool greyscale = false,
+                size_t maxTokens = 0) const;
+
+    /**!
+     *  \brief Copy all the images in this database into a single
+     *         PackedImageFile in a new folder, creating a new database.
+     */
+    void pack(const filesystem::path &destination,
+              size_t frameSkip = 1,
+              bool greyscale = true,
+              bool compress = false) const;
 
     //! Return true if fn1 should be sorted before fn2
     static bool fileNameCompare(const std::string &fn1, const std::string &fn2);
@@ -509,6 +842,7 @@ private:
     filesystem::path m_Path, m_VideoFilePath;
     std::vector<Entry> m_Entries;
     std::unique_ptr<cv::FileStorage> m_MetadataYAML;
+    std::unique_ptr<PackedImageFile> m_PackedFile;
     cv::Size m_Resolution;
     std::tm m_CreationTime;
     hertz_t m_FrameRate{ 0 };
@@ -517,10 +851,71 @@ private:
     static constexpr const char *MetadataFilename = "database_metadata.yaml";
     static constexpr const char *EntriesFilename = "database_entries.csv";
 
+    //! Don't split videos into segments shorter than this many frames
+    static constexpr size_t MinVideoSegmentFrames = 250;
+
+    //! Seek rather than grab through more than this many skipped frames
+    static constexpr size_t MaxVideoGrabFrames = 125;
+
+    //! How forEachImage should divide up decoding a video file
+    struct VideoDecodePlan
+    {
+        size_t numSegments;
+        bool seekToSkip;
+    };
+
+    //! Buffers for one image passing through streamImages
+    struct StreamFrame
+    {
+        size_t index;
+        cv::Mat decoded, image, output;
+    };
+
     ImageDatabase(const std::tm *creationTime, filesystem::path databasePath,
                   bool overwrite);
 
     void generateUnwrapCSV(const filesystem::path &destination, size_t frameSkip) const;
+    void generatePackedCSV(const filesystem::path &destination, size_t frameSkip) const;
+    bool hasImageFiles() const;
+    VideoDecodePlan planVideoDecode(size_t frameSkip) const;
+    void loadImage(size_t index, cv::Mat &image, bool greyscale) const;
+    static void seekVideo(cv::VideoCapture &cap, size_t frame);
+    static void skipVideoFrames(cv::VideoCapture &cap, size_t nextImage,
+                                size_t frameSkip, bool seekToSkip);
+    static size_t getDefaultMaxTokens();
+
+    //! Decode images [begin, end) from a video file, in order
+    template<class Func>
+    void forEachVideoFrame(const Func &func, size_t frameSkip, bool greyscale,
+                           bool seekToSkip, size_t begin, size_t end) const
+    {
+        if (begin == end) {
+            return;
+        }
+
+        cv::VideoCapture cap{ m_VideoFilePath.str() };
+        BOB_ASSERT(cap.isOpened());
+        if (begin > 0) {
+            seekVideo(cap, begin * frameSkip);
+        }
+
+        cv::Mat img, grey;
+        for (size_t i = begin; i < end; i++) {
+            BOB_ASSERT(cap.read(img));
+
+            if (greyscale) {
+                cv::cvtColor(img, grey, cv::COLOR_BGR2GRAY);
+                func(i, grey);
+            } else {
+                func(i, img);
+            }
+
+            if (i + 1 < end) {
+                skipVideoFrames(cap, i + 1, frameSkip, seekToSkip);
+            }
+        }
+    }
+    void loadPackedImage(size_t index, cv::Mat &image, bool greyscale) const;
     void loadMetadata();
     bool loadCSV();
     bool readDirectoryEntries();
@@ -15,6 +15,9 @@
 // OpenCV
 #include <opencv2/opencv.hpp>
 
+// TBB
+#include <tbb/parallel_for.h>
+
 // Standard C includes
 #include <cmath>
 
@@ -68,9 +71,50 @@ public:
         trainUY();
     }
 
+    /*!
+     * \brief Train the network on images in mini-batches of batchSize
+     *
+     * The weight updates for every image in a batch are calculated with the
+     * weights as they were at the start of the batch and summed, so this is
+     * equivalent to train() for a batchSize of 1. Larger batches let the update
+     * be done with a couple of matrix-matrix products, which are much faster
+     * than training image by image and which Eigen will run across multiple
+     * threads if OpenMP is available (see Eigen::setNbThreads()).
+     *
+     * Note that, as the updates are summed, larger batches will need smaller
+     * learning rates.
+     */
+    void trainBatch(const std::vector<cv::Mat> &images, size_t batchSize)
+    {
+        BOB_ASSERT(batchSize > 0);
+
+        m_BatchInputs.resize(m_Weights.cols(), std::min(batchSize, images.size()));
+        for (size_t first = 0; first < images.size(); first += batchSize) {
+            const size_t count = std::min(batchSize, images.size() - first);
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
+                [&](const auto &r) {
+                    for (size_t i = r.begin(); i != r.end(); ++i) {
+                        setBatchInput(i, images[first + i]);
+                    }
+                });
+            trainBatchInputs(count);
+        }
+    }
+
     float test(const cv::Mat &image, const ImgProc::Mask& = ImgProc::Mask{}) const
     {
-        const auto decs = m_Weights * getFloatVector(image);
+        if (image.isContinuous()) {
+            const auto decs = m_Weights * getFloatVector(image);
+            return decs.array().abs().sum();
+        }
+
+        // Images which are views onto a larger image (e.g. from RollFreeRotater) need copying row by row
+        static thread_local VectorType floatVector;
+        floatVector.resize(image.cols * image.rows);
+        for (int y = 0; y < image.rows; y++) {
+            floatVector.segment(y * image.cols, image.cols) = getFloatVector(image.row(y));
+        }
+        const auto decs = m_Weights * floatVector;
         return decs.array().abs().sum();
     }
 
@@ -151,24 +195,63 @@ public:
         m_Y = tanh(m_U.array());
     }
 
+    void setBatchInput(size_t column, const cv::Mat &image)
+    {
+        BOB_ASSERT(image.type() == CV_8UC1);
+        BOB_ASSERT(image.size() == getUnwrapResolution());
+
+        if (image.isContinuous()) {
+            m_BatchInputs.col(column) = getFloatVector(image);
+        } else {
+            m_BatchInputs.col(column) = getFloatVector(image.clone());
+        }
+    }
+
+    //! Train on the first count columns of m_BatchInputs
+    void trainBatchInputs(size_t count)
+    {
+        const auto inputs = m_BatchInputs.leftCols(count);
+
+        /*
+         * Summing weights += lrate/N * (eye(H)-(y+u)*u') * weights over the
+         * batch gives:
+         *      weights = (1 + lrate/N * B) * weights - lrate/N * (Y+U) * (U' * weights)
+         * so we never need the identity matrix or an H x H intermediate.
+         */
+        m_BatchU.noalias() = m_Weights * inputs;
+        m_BatchYU = m_BatchU.array().tanh() + m_BatchU.array();
+        m_BatchUW.noalias() = m_BatchU.transpose() * m_Weights;
+
+        const FloatType learnRate = m_LearningRate / (FloatType) m_Weights.rows();
+        m_Weights *= 1 + learnRate * (FloatType) count;
+        m_Weights.noalias() -= learnRate * m_BatchYU * m_BatchUW;
+
+        // As in trainUY(), bail out if there are NaNs
+        if (!(m_Weights.array() == m_Weights.array()).all()) {
+            throw WeightsBlewUpError{};
+        }
+    }
+
     std::pair<VectorType, VectorType> getUY() const
     {
         // Copy the vectors
         return std::make_pair<>(m_U, m_Y);
     }
 
+protected:
+    static auto getFloatVector(const cv::Mat &image)
+    {
+        Eigen::Map<Eigen::Matrix<uint8_t, Eigen::Dynamic, 1>> map(image.data, image.cols * image.rows);
+        return map.cast<FloatType>() / 255.0;
+    }
+
 private:
     const cv::Size m_UnwrapRes;
     size_t m_SnapshotCount = 0;
     FloatType m_LearningRate;
     MatrixType m_Weights;
     VectorType m_U, m_Y;
-
-    static auto getFloatVector(const cv::Mat &image)
-    {
-        Eigen::Map<Eigen::Matrix<uint8_t, Eigen::Dynamic, 1>> map(image.data, image.cols * image.rows);
-        return map.cast<FloatType>() / 255.0;
-    }
+    MatrixType m_BatchInputs, m_BatchU, m_BatchYU, m_BatchUW;
 
     template<class T>
     static auto matrixSD(const T &mat)
@@ -180,7 +263,13 @@ private:
 //------------------------------------------------------------------------
 // BoBRobotics::Navigation::InfoMaxRotater
 //------------------------------------------------------------------------
-template<typename FloatType = float>
+/*!
+ * \brief InfoMax which also tests rotated versions of the current view
+ *
+ * \tparam Rotater InSilicoRotater or RollFreeRotater (which avoids copying the
+ *                 image for every rotation)
+ */
+template<typename FloatType = float, typename Rotater = InSilicoRotater>
 class InfoMaxRotater : public InfoMax<FloatType>
 {
     using MatrixType = Eigen::Matrix<FloatType, Eigen::Dynamic, Eigen::Dynamic>;
@@ -196,14 +285,35 @@ public:
     :   InfoMax<FloatType>(unwrapRes, learningRate)
     {}
 
+    //! How the differences for all the rotations of a view are calculated
+    enum class RIDFMethod
+    {
+        //! Rotate the view and do a matrix-vector product for each rotation
+        PerRotation,
+
+        //! Stack all rotations of the view into a matrix and do one matrix-matrix product
+        StackedGEMM,
+
+        /*!
+         * As StackedGEMM, but without ever storing the rotated views: each row
+         * of the view is copied into a buffer twice its width, so the rotated
+         * rows are overlapping columns of this buffer. This only works if the
+         * rotations are evenly spaced; otherwise StackedGEMM is used.
+         */
+        CirculantGEMM
+    };
+
     //------------------------------------------------------------------------
     // Public API
     //------------------------------------------------------------------------
+    void setRIDFMethod(RIDFMethod method) { m_RIDFMethod = method; }
+    RIDFMethod getRIDFMethod() const { return m_RIDFMethod; }
+
     template<class... Ts>
     const std::vector<FloatType> &getImageDifferences(const cv::Mat &image, ImgProc::Mask mask, Ts &&... args) const
     {
-        auto rotater = InSilicoRotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
-        calcImageDifferences(rotater);
+        auto rotater = Rotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
+        calcImageDifferences(image, rotater);
         return m_RotatedDifferences;
     }
 
@@ -219,21 +329,15 @@ public:
         using radian_t = units::angle::radian_t;
 
         const cv::Size unwrapRes = this->getUnwrapResolution();
-        auto rotater = InSilicoRotater::create(unwrapRes, mask, image, std::forward<Ts>(args)...);
-        calcImageDifferences(rotater);
+        auto rotater = Rotater::create(unwrapRes, mask, image, std::forward<Ts>(args)...);
+        calcImageDifferences(image, rotater);
 
         // Find index of lowest difference
         const auto el = std::min_element(m_RotatedDifferences.cbegin(), m_RotatedDifferences.cend());
         const size_t bestIndex = std::distance(m_RotatedDifferences.cbegin(), el);
 
         // Convert this to an angle
-        radian_t heading = rotater.columnToHeading(bestIndex);
-        while (heading <= -180_deg) {
-            heading += 360_deg;
-        }
-        while (heading > 180_deg) {
-            heading -= 360_deg;
-        }
+        const radian_t heading = toHeading(rotater, bestIndex);
 
         return std::make_tuple(heading, *el, std::cref(m_RotatedDifferences));
     }
@@ -244,26 +348,252 @@ public:
         return getHeading(image, ImgProc::Mask{}, std::forward<Ts>(args)...);
     }
 
+    //------------------------------------------------------------------------
+    // Batch API
+    //------------------------------------------------------------------------
+    //! Differences between a batch of views and the network, indexed by (view, rotation)
+    using BatchDifferences = Eigen::Matrix<FloatType, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+    /*!
+     * \brief Get differences for every rotation of a batch of views
+     *
+     * Rather than doing a matrix-vector product per rotation per view, the
+     * rotated views are stacked into the columns of a matrix and multiplied by
+     * the weights in one go, so the weights only need to be streamed through
+     * the cache once per chunk of views. Any additional parameters specifying
+     * rotation constraints are perfect-forwarded to RollFreeRotater::create.
+     */
+    template<class... Ts>
+    const BatchDifferences &getImageDifferences(const std::vector<cv::Mat> &images, ImgProc::Mask mask, Ts &&... args) const
+    {
+        calcBatchDifferences(images, mask, std::forward<Ts>(args)...);
+        return m_BatchDifferences;
+    }
+
+    template<class... Ts>
+    const BatchDifferences &getImageDifferences(const std::vector<cv::Mat> &images, Ts &&... args) const
+    {
+        return getImageDifferences(images, ImgProc::Mask{}, std::forward<Ts>(args)...);
+    }
+
+    /*!
+     * \brief Get estimates of heading for a batch of views
+     *
+     * Returns a vector of (heading, lowest difference) pairs along with a
+     * reference to all the differences.
+     */
+    template<class... Ts>
+    auto getHeadings(const std::vector<cv::Mat> &images, ImgProc::Mask mask, Ts &&... args) const
+    {
+        using radian_t = units::angle::radian_t;
+
+        const auto rotaters = calcBatchDifferences(images, mask, std::forward<Ts>(args)...);
+
+        std::vector<std::pair<radian_t, FloatType>> headings;
+        headings.reserve(images.size());
+        for (size_t q = 0; q < images.size(); q++) {
+            Eigen::Index bestIndex;
+            const FloatType lowest = m_BatchDifferences.row(q).minCoeff(&bestIndex);
+            headings.emplace_back(toHeading(rotaters[q], static_cast<size_t>(bestIndex)), lowest);
+        }
+
+        return std::make_tuple(std::move(headings), std::cref(m_BatchDifferences));
+    }
+
+    template<class... Ts>
+    auto getHeadings(const std::vector<cv::Mat> &images, Ts &&... args) const
+    {
+        return getHeadings(images, ImgProc::Mask{}, std::forward<Ts>(args)...);
+    }
+
 private:
+    //! Maximum number of rotated views to multiply by the weights at once
+    static constexpr size_t MaxBatchColumns = 1024;
+
     //------------------------------------------------------------------------
     // Private API
     //------------------------------------------------------------------------
     template<typename R>
-    void calcImageDifferences(R &rotater) const
+    static units::angle::radian_t toHeading(const R &rotater, size_t index)
+    {
+        units::angle::radian_t heading = rotater.columnToHeading(index);
+        while (heading <= -180_deg) {
+            heading += 360_deg;
+        }
+        while (heading > 180_deg) {
+            heading -= 360_deg;
+        }
+        return heading;
+    }
+
+    template<class... Ts>
+    auto calcBatchDifferences(const std::vector<cv::Mat> &images, const ImgProc::Mask &mask,
+                              const Ts &... args) const
+    {
+        BOB_ASSERT(!images.empty());
+
+        // We use RollFreeRotaters so we can get at views of every rotation without copying
+        const cv::Size &unwrapRes = this->getUnwrapResolution();
+        using BatchRotater = decltype(RollFreeRotater::create(unwrapRes, mask, images[0], args...));
+        std::vector<BatchRotater> rotaters;
+        rotaters.reserve(images.size());
+        for (const auto &image : images) {
+            rotaters.emplace_back(RollFreeRotater::create(unwrapRes, mask, image, args...));
+        }
+
+        const size_t numRotations = rotaters[0].numRotations();
+        const size_t viewsPerChunk = std::max<size_t>(1, MaxBatchColumns / numRotations);
+        const auto &weights = this->getWeights();
+        m_BatchDifferences.resize(images.size(), numRotations);
+        for (size_t first = 0; first < images.size(); first += viewsPerChunk) {
+            const size_t last = std::min(images.size(), first + viewsPerChunk);
+            const size_t numColumns = (last - first) * numRotations;
+
+            // Unpack every rotation of every view into a column of floats
+            m_BatchInputs.resize(weights.cols(), numColumns);
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, numColumns),
+                [&](const auto &r) {
+                    for (size_t c = r.begin(); c != r.end(); ++c) {
+                        const cv::Mat view = rotaters[first + c / numRotations].getRotation(c % numRotations).first;
+                        for (int y = 0; y < view.rows; y++) {
+                            m_BatchInputs.col(c).segment(y * view.cols, view.cols) = this->getFloatVector(view.row(y));
+                        }
+                    }
+                });
+
+            // One matrix-matrix product for all of these rotations
+            m_BatchOutputs.noalias() = weights * m_BatchInputs;
+
+            // As the differences are row-major, columns are in the same order as (view, rotation)
+            Eigen::Map<Eigen::Matrix<FloatType, 1, Eigen::Dynamic>>(m_BatchDifferences.row(first).data(), numColumns) =
+                    m_BatchOutputs.cwiseAbs().colwise().sum();
+        }
+
+        return rotaters;
+    }
+
+    template<typename R>
+    void calcImageDifferences(const cv::Mat &image, R &rotater) const
     {
         // Ensure there's enough space in m_RotatedDifferences
         m_RotatedDifferences.resize(rotater.numRotations());
 
-        // Populate rotated differences with results
-        rotater.rotate([this] (const cv::Mat &image, const ImgProc::Mask &, size_t i) {
-            m_RotatedDifferences[i] = this->test(image);
-        });
+        switch (m_RIDFMethod) {
+        case RIDFMethod::PerRotation:
+            // Populate rotated differences with results
+            rotater.rotate([this] (const cv::Mat &rotatedImage, const ImgProc::Mask &, size_t i) {
+                m_RotatedDifferences[i] = this->test(rotatedImage);
+            });
+            break;
+        case RIDFMethod::StackedGEMM:
+            calcImageDifferencesStacked(image, rotater);
+            break;
+        case RIDFMethod::CirculantGEMM:
+            calcImageDifferencesCirculant(image, rotater);
+            break;
+        }
+    }
+
+    template<typename R>
+    void calcImageDifferencesStacked(const cv::Mat &image, R &rotater) const
+    {
+        // Copy each rotation of the image into a column of floats
+        const auto &weights = this->getWeights();
+        const size_t numRotations = rotater.numRotations();
+        const size_t width = image.cols;
+        m_Inputs.resize(weights.cols(), numRotations);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, numRotations),
+            [&](const auto &r) {
+                for (size_t i = r.begin(); i != r.end(); ++i) {
+                    const size_t index = rotater.rotationToIndex(i);
+                    for (int y = 0; y < image.rows; y++) {
+                        // Rolling a row left is just two copies
+                        auto column = m_Inputs.col(i).segment(y * width, width);
+                        const cv::Mat row = image.row(y);
+                        column.head(width - index) = this->getFloatVector(row.colRange(index, width));
+                        if (index > 0) {
+                            column.tail(index) = this->getFloatVector(row.colRange(0, index));
+                        }
+                    }
+                }
+            });
+
+        // One matrix-matrix product for all rotations
+        m_Outputs.noalias() = weights * m_Inputs;
+        copyDifferences();
+    }
+
+    template<typename R>
+    void calcImageDifferencesCirculant(const cv::Mat &image, R &rotater) const
+    {
+        /*
+         * We can only do this if rotations are evenly spaced in increasing
+         * order. (Eigen treats an outer stride of zero as "use the default"
+         * and a negative stride would mean reading the doubled rows backwards,
+         * so we leave those cases to StackedGEMM too.)
+         */
+        const size_t numRotations = rotater.numRotations();
+        const auto firstIndex = static_cast<Eigen::Index>(rotater.rotationToIndex(0));
+        const Eigen::Index step = (numRotations > 1) ? static_cast<Eigen::Index>(rotater.rotationToIndex(1)) - firstIndex : 1;
+        if (step <= 0) {
+            calcImageDifferencesStacked(image, rotater);
+            return;
+        }
+        for (size_t i = 0; i < numRotations; i++) {
+            if (static_cast<Eigen::Index>(rotater.rotationToIndex(i)) != firstIndex + static_cast<Eigen::Index>(i) * step) {
+                calcImageDifferencesStacked(image, rotater);
+                return;
+            }
+        }
+
+        // Make a copy of the image, as floats, where every row is repeated twice
+        const int width = image.cols;
+        m_DoubledImage.resize(image.rows, 2 * width);
+        for (int y = 0; y < image.rows; y++) {
+            const auto row = this->getFloatVector(image.row(y));
+            m_DoubledImage.row(y).head(width) = row.transpose();
+            m_DoubledImage.row(y).tail(width) = row.transpose();
+        }
+
+        /*
+         * Column i of rolledRow starts i * step elements into the doubled row,
+         * i.e. it's the row of the image rolled left by firstIndex + i * step.
+         * Eigen copies the columns into blocks as it goes, so the full matrix
+         * of rotated images never exists in memory.
+         */
+        using StridedMap = Eigen::Map<const MatrixType, 0, Eigen::OuterStride<>>;
+        const auto &weights = this->getWeights();
+        m_Outputs.setZero(weights.rows(), numRotations);
+        for (int y = 0; y < image.rows; y++) {
+            const StridedMap rolledRow{ m_DoubledImage.row(y).data() + firstIndex, width,
+                                        static_cast<Eigen::Index>(numRotations),
+                                        Eigen::OuterStride<>(step) };
+            m_Outputs.noalias() += weights.middleCols(y * width, width) * rolledRow;
+        }
+        copyDifferences();
+    }
+
+    void copyDifferences() const
+    {
+        Eigen::Map<Eigen::Matrix<FloatType, 1, Eigen::Dynamic>>(m_RotatedDifferences.data(), m_RotatedDifferences.size()) =
+                m_Outputs.cwiseAbs().colwise().sum();
     }
 
     //------------------------------------------------------------------------
     // Members
     //------------------------------------------------------------------------
+    RIDFMethod m_RIDFMethod = RIDFMethod::PerRotation;
     mutable std::vector<FloatType> m_RotatedDifferences;
+
+    // Preallocated buffers for the GEMM-based RIDF methods
+    mutable MatrixType m_Inputs, m_Outputs;
+    mutable Eigen::Matrix<FloatType, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> m_DoubledImage;
+
+    mutable BatchDifferences m_BatchDifferences;
+    mutable MatrixType m_BatchInputs, m_BatchOutputs;
 };
+
+template<typename FloatType, typename Rotater>
+constexpr size_t InfoMaxRotater<FloatType, Rotater>::MaxBatchColumns;
 } // Navigation
 } // BoBRobotics
@@ -0,0 +1,417 @@
+#pragma once
+
+// BoB robotics includes
+#include "common/circstat.h"
+#include "common/macros.h"
+#include "imgproc/mask.h"
+#include "navigation/infomax.h"
+#include "navigation/insilico_rotater.h"
+
+// Third-party includes
+#include "third_party/units.h"
+
+// Eigen
+#include <Eigen/Core>
+
+// OpenCV
+#include <opencv2/opencv.hpp>
+
+// Standard C includes
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Standard C++ includes
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// SIMD intrinsics
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace BoBRobotics {
+namespace Navigation {
+namespace Detail {
+//! Convert a float to an IEEE half-precision float, rounding to nearest even
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // Infinity, NaN or too big to represent
+    if (exponent >= 31) {
+        const bool isNaN = ((bits >> 23) & 0xff) == 0xff && mantissa != 0;
+        return static_cast<uint16_t>(sign | 0x7c00 | (isNaN ? 0x200 : 0));
+    }
+
+    // Too small to represent, even as a subnormal
+    if (exponent < -10) {
+        return static_cast<uint16_t>(sign);
+    }
+
+    // Work out how many bits of mantissa we're throwing away
+    uint32_t shift = 13;
+    uint32_t half;
+    if (exponent <= 0) {
+        mantissa |= 0x800000;
+        shift = static_cast<uint32_t>(14 - exponent);
+        half = mantissa >> shift;
+    } else {
+        half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> shift);
+    }
+
+    // NB: Rounding up may carry into the exponent, which is what we want
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1))) {
+        half++;
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+//! Convert an IEEE half-precision float to a float
+inline float halfToFloat(uint16_t half)
+{
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // Subnormal, so normalise it
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//! Dot product of n int8 weights with n pixels
+inline int32_t dotInt8(const int8_t *weights, const uint8_t *pixels, size_t n)
+{
+    int32_t sum = 0;
+    size_t i = 0;
+
+    /*
+     * We widen both operands to 16 bits and use multiply-add instructions to
+     * sum adjacent pairs of products into 32 bits. (The instructions which
+     * multiply 8-bit values directly saturate at 16 bits, which uint8 x int8
+     * products can overflow.)
+     */
+#if defined(__AVX2__)
+    __m256i accumulator = _mm256_setzero_si256();
+    for (; (i + 16) <= n; i += 16) {
+        const __m256i p = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i)));
+        const __m256i w = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(weights + i)));
+        accumulator = _mm256_add_epi32(accumulator, _mm256_madd_epi16(p, w));
+    }
+
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(accumulator),
+                                   _mm256_extracti128_si256(accumulator, 1));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtsi128_si32(sum128);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i accumulator = _mm_setzero_si128();
+    for (; (i + 16) <= n; i += 16) {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i));
+        const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(weights + i));
+
+        // Zero-extend pixels; sign-extend weights by unpacking into the high byte and shifting down
+        const __m128i pLow = _mm_unpacklo_epi8(p, zero);
+        const __m128i pHigh = _mm_unpackhi_epi8(p, zero);
+        const __m128i wLow = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+        const __m128i wHigh = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+        accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(pLow, wLow));
+        accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(pHigh, wHigh));
+    }
+
+    accumulator = _mm_add_epi32(accumulator, _mm_shuffle_epi32(accumulator, _MM_SHUFFLE(1, 0, 3, 2)));
+    accumulator = _mm_add_epi32(accumulator, _mm_shuffle_epi32(accumulator, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtsi128_si32(accumulator);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    int32x4_t accumulator = vdupq_n_s32(0);
+    for (; (i + 16) <= n; i += 16) {
+        const uint8x16_t p = vld1q_u8(pixels + i);
+        const int8x16_t w = vld1q_s8(weights + i);
+
+        const int16x8_t pLow = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(p)));
+        const int16x8_t pHigh = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(p)));
+        const int16x8_t wLow = vmovl_s8(vget_low_s8(w));
+        const int16x8_t wHigh = vmovl_s8(vget_high_s8(w));
+        accumulator = vmlal_s16(accumulator, vget_low_s16(pLow), vget_low_s16(wLow));
+        accumulator = vmlal_s16(accumulator, vget_high_s16(pLow), vget_high_s16(wLow));
+        accumulator = vmlal_s16(accumulator, vget_low_s16(pHigh), vget_low_s16(wHigh));
+        accumulator = vmlal_s16(accumulator, vget_high_s16(pHigh), vget_high_s16(wHigh));
+    }
+
+    sum = vgetq_lane_s32(accumulator, 0) + vgetq_lane_s32(accumulator, 1)
+            + vgetq_lane_s32(accumulator, 2) + vgetq_lane_s32(accumulator, 3);
+#endif
+
+    // Scalar tail (or everything, if we have no SIMD)
+    for (; i < n; i++) {
+        sum += static_cast<int32_t>(weights[i]) * static_cast<int32_t>(pixels[i]);
+    }
+    return sum;
+}
+
+//! Dot product of n half-precision weights with n pixels
+inline float dotFloat16(const uint16_t *weights, const uint8_t *pixels, size_t n)
+{
+    float sum = 0.0f;
+    size_t i = 0;
+
+#if defined(__AVX2__) && defined(__F16C__)
+    __m256 accumulator = _mm256_setzero_ps();
+    for (; (i + 8) <= n; i += 8) {
+        const __m256 w = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(weights + i)));
+        const __m256 p = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(pixels + i))));
+        accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(w, p));
+    }
+
+    __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(accumulator), _mm256_extractf128_ps(accumulator, 1));
+    sum128 = _mm_add_ps(sum128, _mm_movehl_ps(sum128, sum128));
+    sum128 = _mm_add_ss(sum128, _mm_shuffle_ps(sum128, sum128, 1));
+    sum = _mm_cvtss_f32(sum128);
+#elif defined(__aarch64__)
+    float32x4_t accumulator = vdupq_n_f32(0.0f);
+    for (; (i + 8) <= n; i += 8) {
+        const uint16x8_t p = vmovl_u8(vld1_u8(pixels + i));
+        const float32x4_t pLow = vcvtq_f32_u32(vmovl_u16(vget_low_u16(p)));
+        const float32x4_t pHigh = vcvtq_f32_u32(vmovl_u16(vget_high_u16(p)));
+        const float32x4_t wLow = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(weights + i)));
+        const float32x4_t wHigh = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(weights + i + 4)));
+        accumulator = vmlaq_f32(accumulator, wLow, pLow);
+        accumulator = vmlaq_f32(accumulator, wHigh, pHigh);
+    }
+    sum = vaddvq_f32(accumulator);
+#endif
+
+    // Scalar tail (or everything, if we have no hardware half-precision conversion)
+    for (; i < n; i++) {
+        sum += halfToFloat(weights[i]) * static_cast<float>(pixels[i]);
+    }
+    return sum;
+}
+} // Detail
+
+//! How the weights of QuantisedInfoMaxRotater are stored
+enum class WeightPrecision
+{
+    //! 8-bit integers with one (float) scale factor per hidden unit
+    Int8,
+
+    //! IEEE half-precision floats
+    Float16
+};
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::QuantisedInfoMaxRotater
+//------------------------------------------------------------------------
+/*!
+ * \brief Inference-only InfoMax whose weights are stored at reduced precision
+ *
+ * The weights of a trained InfoMax network are converted either to int8 with
+ * one scale factor per row (a quarter of the size of float weights) or to
+ * IEEE half-precision floats (half the size), so that more of the weight
+ * matrix fits into the cache on embedded boards. Dot products are calculated
+ * directly between the 8-bit image and the reduced-precision weights with
+ * SIMD instructions where available (AVX2, SSE2 or NEON for int8; AVX2+F16C or
+ * AArch64 NEON for fp16).
+ *
+ * The results are approximations of those given by InfoMaxRotater, with int8
+ * being less accurate than fp16.
+ *
+ * \tparam Rotater InSilicoRotater or RollFreeRotater
+ */
+template<typename Rotater = InSilicoRotater>
+class QuantisedInfoMaxRotater
+{
+public:
+    using Precision = WeightPrecision;
+
+    template<typename FloatType>
+    QuantisedInfoMaxRotater(const InfoMax<FloatType> &infomax,
+                            Precision precision = Precision::Int8)
+      : QuantisedInfoMaxRotater(infomax.getUnwrapResolution(), infomax.getWeights(), precision)
+    {}
+
+    template<typename Derived>
+    QuantisedInfoMaxRotater(const cv::Size &unwrapRes,
+                            const Eigen::MatrixBase<Derived> &weights,
+                            Precision precision = Precision::Int8)
+      : m_UnwrapRes(unwrapRes)
+      , m_Precision(precision)
+      , m_NumHidden(static_cast<size_t>(weights.rows()))
+      , m_NumInputs(static_cast<size_t>(weights.cols()))
+    {
+        BOB_ASSERT(weights.cols() == unwrapRes.width * unwrapRes.height);
+
+        // Weights are stored row-major, so each hidden unit's weights are contiguous
+        if (precision == Precision::Int8) {
+            m_Int8Weights.resize(m_NumHidden * m_NumInputs);
+            m_RowScales.resize(m_NumHidden);
+            for (size_t r = 0; r < m_NumHidden; r++) {
+                const float maxWeight = static_cast<float>(weights.row(r).cwiseAbs().maxCoeff());
+                const float scale = (maxWeight > 0.0f) ? (maxWeight / 127.0f) : 1.0f;
+                for (size_t c = 0; c < m_NumInputs; c++) {
+                    const float quantised = std::round(static_cast<float>(weights(r, c)) / scale);
+                    m_Int8Weights[r * m_NumInputs + c] = static_cast<int8_t>(std::max(-127.0f, std::min(127.0f, quantised)));
+                }
+
+                // Fold the conversion of pixels to [0, 1] into the scale
+                m_RowScales[r] = scale / 255.0f;
+            }
+        } else {
+            m_Float16Weights.resize(m_NumHidden * m_NumInputs);
+            for (size_t r = 0; r < m_NumHidden; r++) {
+                for (size_t c = 0; c < m_NumInputs; c++) {
+                    m_Float16Weights[r * m_NumInputs + c] = Detail::floatToHalf(static_cast<float>(weights(r, c)));
+                }
+            }
+        }
+    }
+
+    //------------------------------------------------------------------------
+    // Public API
+    //------------------------------------------------------------------------
+    float test(const cv::Mat &image, const ImgProc::Mask& = ImgProc::Mask{}) const
+    {
+        BOB_ASSERT(image.type() == CV_8UC1);
+        BOB_ASSERT(image.size() == m_UnwrapRes);
+
+        // Images which are views onto a larger image (e.g. from RollFreeRotater) are processed row by row
+        const size_t rowLength = image.isContinuous() ? m_NumInputs : static_cast<size_t>(image.cols);
+        const int numRows = image.isContinuous() ? 1 : image.rows;
+
+        float sum = 0.0f;
+        for (size_t r = 0; r < m_NumHidden; r++) {
+            sum += std::fabs(calcHiddenInput(r, image, rowLength, numRows));
+        }
+        return sum;
+    }
+
+    template<class... Ts>
+    const std::vector<float> &getImageDifferences(const cv::Mat &image, ImgProc::Mask mask, Ts &&... args) const
+    {
+        auto rotater = Rotater::create(m_UnwrapRes, mask, image, std::forward<Ts>(args)...);
+        calcImageDifferences(rotater);
+        return m_RotatedDifferences;
+    }
+
+    template<class... Ts>
+    const std::vector<float> &getImageDifferences(const cv::Mat &image, Ts &&... args) const
+    {
+        return getImageDifferences(image, ImgProc::Mask{}, std::forward<Ts>(args)...);
+    }
+
+    template<class... Ts>
+    auto getHeading(const cv::Mat &image, ImgProc::Mask mask, Ts &&... args) const
+    {
+        using radian_t = units::angle::radian_t;
+
+        auto rotater = Rotater::create(m_UnwrapRes, mask, image, std::forward<Ts>(args)...);
+        calcImageDifferences(rotater);
+
+        // Find index of lowest difference
+        const auto el = std::min_element(m_RotatedDifferences.cbegin(), m_RotatedDifferences.cend());
+        const size_t bestIndex = std::distance(m_RotatedDifferences.cbegin(), el);
+
+        // Convert this to an angle
+        const radian_t heading = normaliseAngle180(rotater.columnToHeading(bestIndex));
+
+        return std::make_tuple(heading, *el, std::cref(m_RotatedDifferences));
+    }
+
+    template<class... Ts>
+    auto getHeading(const cv::Mat &image, Ts &&... args) const
+    {
+        return getHeading(image, ImgProc::Mask{}, std::forward<Ts>(args)...);
+    }
+
+    //! Get the resolution of images
+    const cv::Size &getUnwrapResolution() const { return m_UnwrapRes; }
+
+    Precision getPrecision() const { return m_Precision; }
+
+    //! Size of the quantised weights (and scales) in bytes
+    size_t getWeightsSizeBytes() const
+    {
+        return m_Int8Weights.size() * sizeof(int8_t) + m_RowScales.size() * sizeof(float)
+                + m_Float16Weights.size() * sizeof(uint16_t);
+    }
+
+private:
+    //------------------------------------------------------------------------
+    // Private API
+    //------------------------------------------------------------------------
+    //! Calculate the input to hidden unit r, i.e. row r of weights * image
+    float calcHiddenInput(size_t r, const cv::Mat &image, size_t rowLength, int numRows) const
+    {
+        if (m_Precision == Precision::Int8) {
+            const int8_t *weights = &m_Int8Weights[r * m_NumInputs];
+            int32_t sum = 0;
+            for (int y = 0; y < numRows; y++) {
+                sum += Detail::dotInt8(weights + y * rowLength, image.ptr(y), rowLength);
+            }
+            return m_RowScales[r] * static_cast<float>(sum);
+        } else {
+            const uint16_t *weights = &m_Float16Weights[r * m_NumInputs];
+            float sum = 0.0f;
+            for (int y = 0; y < numRows; y++) {
+                sum += Detail::dotFloat16(weights + y * rowLength, image.ptr(y), rowLength);
+            }
+            return sum / 255.0f;
+        }
+    }
+
+    template<typename R>
+    void calcImageDifferences(R &rotater) const
+    {
+        // Ensure there's enough space in m_RotatedDifferences
+        m_RotatedDifferences.resize(rotater.numRotations());
+
+        // Populate rotated differences with results
+        rotater.rotate([this] (const cv::Mat &rotatedImage, const ImgProc::Mask &, size_t i) {
+            m_RotatedDifferences[i] = test(rotatedImage);
+        });
+    }
+
+    //------------------------------------------------------------------------
+    // Members
+    //------------------------------------------------------------------------
+    const cv::Size m_UnwrapRes;
+    const Precision m_Precision;
+    const size_t m_NumHidden, m_NumInputs;
+    std::vector<int8_t> m_Int8Weights;
+    std::vector<float> m_RowScales;
+    std::vector<uint16_t> m_Float16Weights;
+    mutable std::vector<float> m_RotatedDifferences;
+}; // QuantisedInfoMaxRotater
+} // Navigation
+} // BoBRobotics
@@ -0,0 +1,62 @@
+#pragma once
+
+// BoB robotics includes
+#include "common/macros.h"
+#include "navigation/image_database.h"
+#include "navigation/infomax.h"
+
+// OpenCV
+#include <opencv2/opencv.hpp>
+
+// Standard C includes
+#include <cstddef>
+
+// Standard C++ includes
+#include <vector>
+
+namespace BoBRobotics {
+namespace Navigation {
+/*!
+ * \brief Train an InfoMax network in mini-batches on images streamed from an
+ *        ImageDatabase
+ *
+ * Images are streamed through ImageDatabase::streamImages(), so they are
+ * decoded and resized to the unwrap resolution in parallel, while only a
+ * few (plus one batch) are held in memory at a time. Batches are made up
+ * of consecutive images in database order; see InfoMax::trainBatch().
+ */
+template<class FloatType>
+void trainBatch(InfoMax<FloatType> &infomax, const ImageDatabase &database,
+                size_t batchSize, size_t frameSkip = 1)
+{
+    BOB_ASSERT(batchSize > 0);
+
+    const cv::Size unwrapRes = infomax.getUnwrapResolution();
+    std::vector<cv::Mat> batch(batchSize);
+    size_t count = 0;
+    database.streamImages(
+        [&unwrapRes](size_t, const cv::Mat &image, cv::Mat &output) {
+            if (image.size() == unwrapRes) {
+                output = image;
+            } else {
+                cv::resize(image, output, unwrapRes);
+            }
+        },
+        [&](size_t, const cv::Mat &image) {
+            // NB: The pipeline reuses its buffers, so we need our own copy
+            image.copyTo(batch[count]);
+            if (++count == batchSize) {
+                infomax.trainBatch(batch, batchSize);
+                count = 0;
+            }
+        },
+        frameSkip);
+
+    // Train on any leftover images
+    if (count > 0) {
+        batch.resize(count);
+        infomax.trainBatch(batch, batchSize);
+    }
+}
+} // Navigation
+} // BoBRobotics
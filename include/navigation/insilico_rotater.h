@@ -14,6 +14,9 @@
 // TBB
 #include <tbb/parallel_for.h>
 
+// Standard C++ includes
+#include <utility>
+
 namespace BoBRobotics {
 namespace Navigation {
 using namespace units::literals;
@@ -80,7 +83,13 @@ struct InSilicoRotater
             return (m_EndRoll - m_BeginRoll) / m_ScanStep;
         }
 
-    private:
+        //! Get the number of pixels the image is rolled left by for the given rotation
+        size_t rotationToIndex(size_t rotation) const
+        {
+            return toIndex(m_BeginRoll + rotation * m_ScanStep) % m_Image.cols;
+        }
+
+    protected:
         const size_t m_ScanStep;
         const IterType m_BeginRoll, m_EndRoll;
         const cv::Mat &m_Image;
@@ -141,5 +150,100 @@ struct InSilicoRotater
         return RotaterInternal<size_t>(unwrapRes, mask, image, scanStep, beginRoll, image.cols);
     }
 };
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::RollFreeRotater
+//------------------------------------------------------------------------
+/*!
+ * \brief A drop-in replacement for InSilicoRotater which doesn't copy the image
+ *        for every rotation
+ *
+ * The image (and mask) is copied once into an image twice the width, so that
+ * each rotation is just a view onto this doubled image, i.e. a cv::Mat whose
+ * rows aren't contiguous.
+ */
+struct RollFreeRotater
+{
+    template<typename IterType>
+    class RotaterInternal
+      : public InSilicoRotater::RotaterInternal<IterType>
+    {
+        using Base = InSilicoRotater::RotaterInternal<IterType>;
+
+    public:
+        RotaterInternal(const cv::Size &unwrapRes,
+                        const ImgProc::Mask &mask,
+                        const cv::Mat &image,
+                        size_t scanStep,
+                        IterType beginRoll,
+                        IterType endRoll)
+          : Base(unwrapRes, mask, image, scanStep, beginRoll, endRoll)
+        {
+            cv::hconcat(image, image, m_DoubledImage);
+            if (!mask.empty()) {
+                cv::Mat doubledMask;
+                cv::hconcat(mask.get(), mask.get(), doubledMask);
+                m_DoubledMask.set(std::move(doubledMask));
+            }
+        }
+
+        template<class Func>
+        void rotate(Func func) const
+        {
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, this->numRotations()),
+                [&](const auto &r) {
+                    for (size_t i = r.begin(); i != r.end(); ++i) {
+                        const auto rotated = getRotation(i);
+                        func(rotated.first, rotated.second, i);
+                    }
+                });
+        }
+
+        //! Get views onto the rotated image and mask (no data is copied)
+        std::pair<cv::Mat, ImgProc::Mask> getRotation(size_t rotation) const
+        {
+            // Rolling left by index pixels == starting our view index pixels in
+            const cv::Rect roi{ static_cast<int>(this->rotationToIndex(rotation)), 0,
+                                this->m_Image.cols, this->m_Image.rows };
+            return { m_DoubledImage(roi), m_DoubledMask.getROI(roi) };
+        }
+
+    private:
+        cv::Mat m_DoubledImage;
+        ImgProc::Mask m_DoubledMask;
+    };
+
+    template<typename IterType>
+    static auto
+    create(const cv::Size &unwrapRes,
+           const ImgProc::Mask &mask,
+           const cv::Mat &image,
+           IterType beginRoll,
+           IterType endRoll)
+    {
+        return RotaterInternal<IterType>(unwrapRes, mask, image, 1, beginRoll, endRoll);
+    }
+
+    static auto
+    create(const cv::Size &unwrapRes,
+           const ImgProc::Mask &mask,
+           const cv::Mat &image,
+           size_t scanStep,
+           size_t beginRoll,
+           size_t endRoll)
+    {
+        return RotaterInternal<size_t>(unwrapRes, mask, image, scanStep, beginRoll, endRoll);
+    }
+
+    static auto
+    create(const cv::Size &unwrapRes,
+           const ImgProc::Mask &mask,
+           const cv::Mat &image,
+           size_t scanStep = 1,
+           size_t beginRoll = 0)
+    {
+        return RotaterInternal<size_t>(unwrapRes, mask, image, scanStep, beginRoll, image.cols);
+    }
+};
 } // Navigation
 } // BoBRobotics
@@ -0,0 +1,128 @@
+#pragma once
+
+// BoB robotics includes
+#include "common/memory_mapped_file.h"
+
+// Third-party includes
+#include "third_party/path.h"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+// Standard C includes
+#include <cstdint>
+
+// Standard C++ includes
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace BoBRobotics {
+namespace Navigation {
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::PackedImageFile
+//------------------------------------------------------------------------
+/*!
+ * \brief A read-only, memory-mapped file of images which all have the same
+ *        resolution and number of channels
+ *
+ * This is a storage backend for ImageDatabase, for when images don't need to
+ * be decoded from PNG/JPEG files or a video every time they are loaded. The
+ * file starts with a Header and is followed by the images, either raw (with
+ * each image starting on a 64-byte boundary, so they can be accessed without
+ * copying) or each compressed with LZ4, in which case the header points to a
+ * table of their offsets at the end of the file.
+ *
+ * If recording was interrupted before the header and offset table could be
+ * written, the images are still found by scanning the file. Values are stored
+ * in the host's byte order (i.e. little endian, on anything we run on).
+ */
+class PackedImageFile
+{
+public:
+    //! Type of compression used for individual images
+    enum class Compression : uint32_t
+    {
+        None = 0,
+        LZ4 = 1
+    };
+
+    //! The header at the start of every packed image file
+    struct Header
+    {
+        char magic[8];              //!< Always "BoBPACK"
+        uint32_t version;
+        uint32_t width, height, channels;
+        Compression compression;
+        uint64_t numEntries;        //!< Zero if the file wasn't finished properly
+        uint64_t frameStride;       //!< Bytes between raw images
+        uint64_t offsetTable;       //!< File offset of table of image offsets (LZ4 only)
+        uint64_t reserved;
+    };
+
+    //! Writes images to a new packed file
+    class Writer
+    {
+    public:
+        Writer(const filesystem::path &path, const cv::Size &resolution,
+               int channels = 1, Compression compression = Compression::None);
+        ~Writer();
+
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        //! Append an image, which must match the resolution and number of channels
+        void write(const cv::Mat &image);
+
+        //! Write the header and offset table; no more images can be written after this
+        void finish();
+
+        //! Number of images written so far
+        size_t size() const { return m_Offsets.size(); }
+
+    private:
+        std::ofstream m_Stream;
+        Header m_Header;
+        std::vector<uint64_t> m_Offsets;
+        std::vector<char> m_Scratch;
+        bool m_Finished = false;
+    };
+
+    explicit PackedImageFile(const filesystem::path &path);
+
+    //! Number of images in the file
+    size_t size() const { return m_Offsets.size(); }
+
+    cv::Size getResolution() const;
+    int getChannels() const;
+    Compression getCompression() const;
+
+    /*!
+     * \brief Get a view onto an uncompressed image, without copying
+     *
+     * The image is read-only and remains valid for as long as this object.
+     */
+    cv::Mat getImage(size_t index) const;
+
+    /*!
+     * \brief Get an image, either as a view onto the file (for uncompressed
+     *        files) or by decompressing it into image
+     */
+    void getImage(size_t index, cv::Mat &image) const;
+
+    //! Whether this build can read and write LZ4-compressed images
+    static bool supportsCompression();
+
+private:
+    const MemoryMappedFile m_File;
+    const uint8_t *const m_Data;
+    const size_t m_FileSize;
+    Header m_Header;
+    std::vector<uint64_t> m_Offsets;
+
+    int getMatType() const;
+    size_t getImageBytes() const;
+}; // PackedImageFile
+} // Navigation
+} // BoBRobotics
@@ -3,6 +3,7 @@
 // BoB robotics includes
 #include "common/macros.h"
 #include "differencers.h"
+#include "imgproc/roll.h"
 #include "insilico_rotater.h"
 #include "perfect_memory_store_raw.h"
 
@@ -11,6 +12,7 @@
 
 // Eigen
 #include <Eigen/Core>
+#include <unsupported/Eigen/CXX11/Tensor>
 
 // OpenCV
 #include <opencv2/opencv.hpp>
@@ -19,15 +21,19 @@
 #include <tbb/parallel_for.h>
 
 // Standard C includes
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 
 // Standard C++ includes
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <functional>
 #include <limits>
 #include <numeric>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -35,6 +41,46 @@ namespace BoBRobotics {
 namespace Navigation {
 using namespace units::literals;
 
+namespace Detail {
+template<class...>
+struct MakeVoid
+{
+    using type = void;
+};
+
+//! Whether a store can calculate whole RIDFs itself (e.g. PerfectMemoryStore::SpectralRaw)
+template<class Store, class = void>
+struct CalculatesRIDFs
+  : std::false_type
+{};
+
+template<class Store>
+struct CalculatesRIDFs<Store, typename MakeVoid<decltype(&Store::calcRIDFs)>::type>
+  : std::true_type
+{};
+
+//! The differencer a store (e.g. PerfectMemoryStore::RawImage<AbsDiff>) compares images with
+template<class Store>
+struct StoreDifferencer
+{
+    using type = void;
+};
+
+template<template<class> class StoreTemplate, class Differencer>
+struct StoreDifferencer<StoreTemplate<Differencer>>
+{
+    using type = Differencer;
+};
+
+//! Whether a store's differencer sums squared (rather than absolute) differences
+template<class Store>
+struct UsesSquaredDifferences
+  : std::integral_constant<bool,
+                           std::is_same<typename StoreDifferencer<Store>::type, RMSDiff>::value ||
+                           std::is_same<typename StoreDifferencer<Store>::type, FusedRMSDiff>::value>
+{};
+} // Detail
+
 //------------------------------------------------------------------------
 // BoBRobotics::Navigation::PerfectMemory
 //------------------------------------------------------------------------
@@ -48,6 +94,8 @@ public:
       , m_Store(unwrapRes, std::forward<Ts>(args)...)
     {}
 
+    virtual ~PerfectMemory() = default;
+
     //------------------------------------------------------------------------
     // Typedefines
     //------------------------------------------------------------------------
@@ -65,6 +113,7 @@ public:
 
         // Add snapshot
         m_Store.addSnapshot(image, mask);
+        onSnapshotAdded(image, mask);
     }
 
     float test(const cv::Mat &image, const ImgProc::Mask &mask, const Window &window) const
@@ -83,6 +132,7 @@ public:
     void clearMemory()
     {
         m_Store.clear();
+        onMemoryCleared();
     }
 
     //! Return the number of snapshots that have been read into memory
@@ -117,6 +167,15 @@ public:
     const cv::Size &getUnwrapResolution() const { return m_UnwrapRes; }
 
 protected:
+    //------------------------------------------------------------------------
+    // Declared virtuals
+    //------------------------------------------------------------------------
+    //! Called by train() after the snapshot has been added to the store
+    virtual void onSnapshotAdded(const cv::Mat &, const ImgProc::Mask &) {}
+
+    //! Called by clearMemory() after the store has been cleared
+    virtual void onMemoryCleared() {}
+
     //------------------------------------------------------------------------
     // Protected API
     //------------------------------------------------------------------------
@@ -126,6 +185,8 @@ protected:
         return m_Store.calcSnapshotDifference(image, mask, snapshot);
     }
 
+    const Store &getStore() const { return m_Store; }
+
 private:
     //------------------------------------------------------------------------
     // Private members
@@ -161,7 +222,15 @@ private:
 //------------------------------------------------------------------------
 // BoBRobotics::Navigation::PerfectMemoryRotater
 //------------------------------------------------------------------------
-template<typename Store = PerfectMemoryStore::RawImage<>, typename RIDFProcessor = BestMatchingSnapshot>
+/*!
+ * \brief Perfect memory which also compares rotated versions of the current view
+ *
+ * \tparam Rotater InSilicoRotater or RollFreeRotater (which avoids copying the
+ *                 image for every rotation)
+ */
+template<typename Store = PerfectMemoryStore::RawImage<>,
+         typename RIDFProcessor = BestMatchingSnapshot,
+         typename Rotater = InSilicoRotater>
 class PerfectMemoryRotater : public PerfectMemory<Store>
 {
 public:
@@ -175,14 +244,14 @@ public:
      * \brief Get differences between current view with mask and stored snapshots within a 'window'
      *
      * Any additional parameters specifying rotation constraints are perfect-forwarded to
-     * InSilicoRotater::create. **NOTE** I wanted mask and window to be const references but for
+     * Rotater::create. **NOTE** I wanted mask and window to be const references but for
      * reasons that are beyond me, if it is a reference the second overload always gets selected
      */
     template<class... Ts>
     const auto &getImageDifferences(const cv::Mat &image, ImgProc::Mask mask, typename PerfectMemory<Store>::Window window, Ts &&... args) const
     {
-        auto rotater = InSilicoRotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
-        calcImageDifferences(window, rotater);
+        auto rotater = Rotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
+        calcImageDifferences(image, mask, window, rotater);
         return m_RotatedDifferences;
     }
 
@@ -190,7 +259,7 @@ public:
      * \brief Get differences between current view with mask and stored snapshots
      *
      * Any additional parameters specifying rotation constraints are perfect-forwarded to
-     * InSilicoRotater::create. **NOTE** I wanted mask and window to be const references but for
+     * Rotater::create. **NOTE** I wanted mask and window to be const references but for
      * reasons that are beyond me, if it is a reference the second overload always gets selected
      */
     template<class... Ts>
@@ -203,7 +272,7 @@ public:
      * \brief Get differences between current view and stored snapshots
      *
      * Any additional parameters specifying rotation constraints are perfect-forwarded to
-     * InSilicoRotater::create. **NOTE** I wanted mask and window to be const references but for
+     * Rotater::create. **NOTE** I wanted mask and window to be const references but for
      * reasons that are beyond me, if it is a reference the second overload always gets selected
      */
     template<class... Ts>
@@ -217,37 +286,22 @@ public:
      *        and stored snapshots within a 'window'
      *
      * Any additional parameters specifying rotation constraints are perfect-forwarded to
-     * InSilicoRotater::create. **NOTE** I wanted mask and window to be const references but for
+     * Rotater::create. **NOTE** I wanted mask and window to be const references but for
      * reasons that are beyond me, if it is a reference the second overload always gets selected
      */
     template<class... Ts>
     auto getHeading(const cv::Mat &image, ImgProc::Mask mask, typename PerfectMemory<Store>::Window window, Ts &&... args) const
     {
-        auto rotater = InSilicoRotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
-        calcImageDifferences(window, rotater);
-
-        // Now get the minimum for each snapshot and the column this corresponds to
-        const size_t numSnapshots = window.second - window.first;
-        m_BestColumns.resize(numSnapshots);
-        m_MinimumDifferences.resize(numSnapshots);
-
-        tbb::parallel_for(tbb::blocked_range<size_t>(0, numSnapshots),
-                          [&](const auto &r) {
-                              for (size_t i = r.begin(); i != r.end(); ++i) {
-                                  m_MinimumDifferences[i] = m_RotatedDifferences.row(i).minCoeff(&m_BestColumns[i]);
-                              }
-                          });
-
-        // Return result
-        return std::tuple_cat(RIDFProcessor()(m_BestColumns, m_MinimumDifferences, rotater, window.first),
-                              std::make_tuple(&m_RotatedDifferences));
+        auto rotater = Rotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
+        calcImageDifferences(image, mask, window, rotater);
+        return processRotatedDifferences(window, rotater);
     }
 
     /*!
      * \brief Get an estimate for heading based on current view with mask and stored snapshots
      *
      * Any additional parameters specifying rotation constraints are perfect-forwarded to
-     * InSilicoRotater::create. **NOTE**I wanted mask and window to be const references but for
+     * Rotater::create. **NOTE**I wanted mask and window to be const references but for
      * reasons that are beyond me, if it is a reference the second overload always gets selected
      */
     template<class... Ts>
@@ -260,7 +314,7 @@ public:
      * \brief Get an estimate for heading based on current view  and stored snapshots
      *
      * Any additional parameters specifying rotation constraints are perfect-forwarded to
-     * InSilicoRotater::create. **NOTE**I wanted mask and window to be const references but for
+     * Rotater::create. **NOTE**I wanted mask and window to be const references but for
      * reasons that are beyond me, if it is a reference the second overload always gets selected
      */
     template<class... Ts>
@@ -269,16 +323,594 @@ public:
         return getHeading(image, ImgProc::Mask{}, this->getFullWindow(), std::forward<Ts>(args)...);
     }
 
+    //------------------------------------------------------------------------
+    // Coarse-to-fine API
+    //------------------------------------------------------------------------
+    /*!
+     * \brief Enable coarse-to-fine heading search with getHeadingCoarseToFine()
+     *
+     * When enabled, each snapshot is downsampled numLevels times (halving its
+     * size each time) as it is trained. This must be called before any
+     * snapshots are trained.
+     */
+    void setCoarseToFine(size_t numLevels, size_t numCandidates = 8)
+    {
+        BOB_ASSERT(this->getNumSnapshots() == 0);
+        BOB_ASSERT(numCandidates > 0);
+
+        m_PyramidSizes.assign(1, this->getUnwrapResolution());
+        for (size_t l = 0; l < numLevels; l++) {
+            const cv::Size &size = m_PyramidSizes.back();
+            m_PyramidSizes.emplace_back((size.width + 1) / 2, (size.height + 1) / 2);
+            BOB_ASSERT(m_PyramidSizes.back().width > 1);
+        }
+        m_Pyramid.assign(numLevels, {});
+        m_NumCandidates = numCandidates;
+    }
+
+    /*!
+     * \brief Get an estimate for heading based on current view with mask and
+     *        stored snapshots within a 'window', searching coarse-to-fine
+     *
+     * Rather than comparing every rotation of the view against every snapshot
+     * at full resolution, the view is first compared against the smallest
+     * snapshots in the pyramid at every rotation. The best numCandidates
+     * (snapshot, rotation) pairs are refined at each larger level of the
+     * pyramid in turn, comparing only nearby rotations, until the final
+     * candidates are compared with the store's differencer at full resolution.
+     * Coarse levels are compared with FusedAbsDiff.
+     *
+     * The result is the same tuple as getHeading() gives, but rotations which
+     * were never compared at full resolution have a difference of infinity.
+     * This means numCandidates must be at least the number of snapshots the
+     * RIDFProcessor uses. Any additional parameters specifying rotation
+     * constraints are perfect-forwarded to Rotater::create.
+     */
+    template<class... Ts>
+    auto getHeadingCoarseToFine(const cv::Mat &image, ImgProc::Mask mask, typename PerfectMemory<Store>::Window window, Ts &&... args) const
+    {
+        BOB_ASSERT(!m_Pyramid.empty());
+        for (const auto &level : m_Pyramid) {
+            BOB_ASSERT(level.size() == this->getNumSnapshots());
+        }
+
+        auto rotater = Rotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
+        calcCoarseToFineDifferences(image, mask, window, rotater);
+        return processRotatedDifferences(window, rotater);
+    }
+
+    //! Get an estimate for heading based on current view with mask and stored snapshots, searching coarse-to-fine
+    template<class... Ts>
+    auto getHeadingCoarseToFine(const cv::Mat &image, ImgProc::Mask mask, Ts &&... args) const
+    {
+        return getHeadingCoarseToFine(image, mask, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+    //! Get an estimate for heading based on current view and stored snapshots, searching coarse-to-fine
+    template<class... Ts>
+    auto getHeadingCoarseToFine(const cv::Mat &image, Ts &&... args) const
+    {
+        return getHeadingCoarseToFine(image, ImgProc::Mask{}, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+    //------------------------------------------------------------------------
+    // Branch-and-bound API
+    //------------------------------------------------------------------------
+    /*!
+     * \brief Get the same heading as getHeading() with a BestMatchingSnapshot
+     *        RIDF processor, but without fully comparing every rotation with
+     *        every snapshot
+     *
+     * As we only need the overall minimum, each comparison is done in blocks
+     * of rows and abandoned once its partial sum shows it can't beat the best
+     * difference found so far (which is shared between TBB workers). Snapshots
+     * are compared in order of a cheap lower bound on their difference, the
+     * sum of absolute differences between the views' row sums, which doesn't
+     * depend on rotation. Without masks, this bound also lets us skip the
+     * remaining snapshots entirely once it exceeds the best difference.
+     *
+     * Differences are calculated from the raw snapshots as the store's
+     * differencer (which must be AbsDiff, FusedAbsDiff, RMSDiff or
+     * FusedRMSDiff) does, so the store must keep 8-bit snapshots at the unwrap
+     * resolution. The RMS difference is never less than the mean absolute
+     * difference, so the same lower bound works for both. The
+     * returned tuple is the same as getHeading()'s, but rotations which were
+     * abandoned have a difference of infinity. Any additional parameters
+     * specifying rotation constraints are perfect-forwarded to
+     * RollFreeRotater::create.
+     */
+    template<class... Ts>
+    auto getHeadingBounded(const cv::Mat &image, ImgProc::Mask mask, typename PerfectMemory<Store>::Window window, Ts &&... args) const
+    {
+        static_assert(std::is_same<RIDFProcessor, BestMatchingSnapshot>::value,
+                      "Bounded search only gives the best-matching snapshot");
+        using Differencer = typename Detail::StoreDifferencer<Store>::type;
+        static_assert(std::is_same<Differencer, AbsDiff>::value || std::is_same<Differencer, FusedAbsDiff>::value ||
+                      std::is_same<Differencer, RMSDiff>::value || std::is_same<Differencer, FusedRMSDiff>::value,
+                      "Bounded search only supports absolute and RMS differences");
+
+        auto rotater = RollFreeRotater::create(this->getUnwrapResolution(), mask, image, std::forward<Ts>(args)...);
+        calcBoundedDifferences(image, mask, window, rotater);
+        return processRotatedDifferences(window, rotater);
+    }
+
+    //! Get an estimate for heading based on current view with mask and stored snapshots, using branch-and-bound
+    template<class... Ts>
+    auto getHeadingBounded(const cv::Mat &image, ImgProc::Mask mask, Ts &&... args) const
+    {
+        return getHeadingBounded(image, mask, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+    //! Get an estimate for heading based on current view and stored snapshots, using branch-and-bound
+    template<class... Ts>
+    auto getHeadingBounded(const cv::Mat &image, Ts &&... args) const
+    {
+        return getHeadingBounded(image, ImgProc::Mask{}, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+    //------------------------------------------------------------------------
+    // Batch API
+    //------------------------------------------------------------------------
+    //! Differences between a batch of views and the snapshots, indexed by (view, snapshot, rotation)
+    using BatchDifferences = Eigen::Tensor<float, 3, Eigen::RowMajor>;
+
+    /*!
+     * \brief Get differences between a batch of views with mask and stored
+     *        snapshots within a 'window'
+     *
+     * This is equivalent to calling getImageDifferences() for each image, but
+     * views and snapshots are compared in cache-sized tiles and the images are
+     * not copied for each rotation. Any additional parameters
+     * specifying rotation constraints are perfect-forwarded to
+     * RollFreeRotater::create.
+     */
+    template<class... Ts>
+    const BatchDifferences &getImageDifferences(const std::vector<cv::Mat> &images, ImgProc::Mask mask,
+                                                typename PerfectMemory<Store>::Window window, Ts &&... args) const
+    {
+        calcBatchDifferences(images, mask, window, std::forward<Ts>(args)...);
+        return m_BatchDifferences;
+    }
+
+    //! Get differences between a batch of views with mask and stored snapshots
+    template<class... Ts>
+    const BatchDifferences &getImageDifferences(const std::vector<cv::Mat> &images, ImgProc::Mask mask, Ts &&... args) const
+    {
+        return getImageDifferences(images, mask, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+    //! Get differences between a batch of views and stored snapshots
+    template<class... Ts>
+    const BatchDifferences &getImageDifferences(const std::vector<cv::Mat> &images, Ts &&... args) const
+    {
+        return getImageDifferences(images, ImgProc::Mask{}, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+    /*!
+     * \brief Get estimates for heading for a batch of views with mask and stored
+     *        snapshots within a 'window'
+     *
+     * Returns a vector containing what getHeading() would have returned for
+     * each view (without the differences) along with a pointer to all the
+     * differences.
+     */
+    template<class... Ts>
+    auto getHeadings(const std::vector<cv::Mat> &images, ImgProc::Mask mask,
+                     typename PerfectMemory<Store>::Window window, Ts &&... args) const
+    {
+        const auto rotaters = calcBatchDifferences(images, mask, window, std::forward<Ts>(args)...);
+
+        // Get the minimum for each snapshot and the column this corresponds to
+        const size_t numSnapshots = window.second - window.first;
+        const size_t numRotations = static_cast<size_t>(m_BatchDifferences.dimension(2));
+        m_BestColumns.resize(numSnapshots);
+        m_MinimumDifferences.resize(numSnapshots);
+
+        using Result = decltype(RIDFProcessor()(m_BestColumns, m_MinimumDifferences, rotaters[0], window.first));
+        std::vector<Result> headings;
+        headings.reserve(images.size());
+        for (size_t q = 0; q < images.size(); q++) {
+            for (size_t s = 0; s < numSnapshots; s++) {
+                const float *ridf = &m_BatchDifferences(q, s, 0);
+                const float *best = std::min_element(ridf, ridf + numRotations);
+                m_BestColumns[s] = static_cast<size_t>(best - ridf);
+                m_MinimumDifferences[s] = *best;
+            }
+            headings.emplace_back(RIDFProcessor()(m_BestColumns, m_MinimumDifferences, rotaters[q], window.first));
+        }
+
+        return std::make_tuple(std::move(headings), &m_BatchDifferences);
+    }
+
+    //! Get estimates for heading for a batch of views with mask and stored snapshots
+    template<class... Ts>
+    auto getHeadings(const std::vector<cv::Mat> &images, ImgProc::Mask mask, Ts &&... args) const
+    {
+        return getHeadings(images, mask, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+    //! Get estimates for heading for a batch of views and stored snapshots
+    template<class... Ts>
+    auto getHeadings(const std::vector<cv::Mat> &images, Ts &&... args) const
+    {
+        return getHeadings(images, ImgProc::Mask{}, this->getFullWindow(), std::forward<Ts>(args)...);
+    }
+
+protected:
+    //------------------------------------------------------------------------
+    // PerfectMemory virtuals
+    //------------------------------------------------------------------------
+    //! Add downsampled copies of each new snapshot to the coarse-to-fine pyramid
+    virtual void onSnapshotAdded(const cv::Mat &image, const ImgProc::Mask &mask) override
+    {
+        for (size_t l = 0; l < m_Pyramid.size(); l++) {
+            m_Pyramid[l].emplace_back();
+            downsample(l == 0 ? std::make_pair(image, mask) : m_Pyramid[l - 1].back(),
+                       m_PyramidSizes[l + 1], m_Pyramid[l].back());
+        }
+    }
+
+    virtual void onMemoryCleared() override
+    {
+        for (auto &level : m_Pyramid) {
+            level.clear();
+        }
+    }
+
 private:
     mutable Eigen::MatrixXf m_RotatedDifferences;
+    mutable BatchDifferences m_BatchDifferences;
+    mutable std::vector<std::pair<cv::Mat, ImgProc::Mask>> m_BatchViews;
     mutable std::vector<size_t> m_BestColumns;
     mutable std::vector<float> m_MinimumDifferences;
+    mutable Eigen::MatrixXf m_WholeRIDFs;
+    mutable std::vector<Eigen::MatrixXf> m_BatchRIDFs;
+
+    //! Numbers of views and snapshots compared together by the batch API (see calcBatchDifferences())
+    static constexpr size_t BatchQueryBlockSize = 4;
+    static constexpr size_t BatchSnapshotBlockSize = 16;
+
+    // Downsampled snapshots for coarse-to-fine search, indexed by level - 1 then snapshot
+    std::vector<std::vector<std::pair<cv::Mat, ImgProc::Mask>>> m_Pyramid;
+    std::vector<cv::Size> m_PyramidSizes;
+    size_t m_NumCandidates = 0;
+
+    //! A snapshot and rotation (or column, for coarse levels) to refine
+    struct Candidate
+    {
+        size_t snapshot, column;
+        float difference;
+    };
+    mutable std::vector<std::pair<cv::Mat, ImgProc::Mask>> m_ViewPyramid;
+    mutable std::vector<Candidate> m_Candidates, m_NextCandidates;
+    mutable std::vector<uint8_t> m_Visited;
+
+    //! Number of rows to compare between checks against the best difference
+    static constexpr int BoundedBlockRows = 4;
+    static constexpr double BoundedSlack = 1.0 + 1e-6;
+    mutable std::vector<std::pair<double, size_t>> m_SnapshotBounds;
 
     //------------------------------------------------------------------------
     // Private API
     //------------------------------------------------------------------------
     template<class RotaterType>
-    void calcImageDifferences(typename PerfectMemory<Store>::Window window, RotaterType &rotater) const
+    auto processRotatedDifferences(typename PerfectMemory<Store>::Window window,
+                                   const RotaterType &rotater) const
+    {
+        // Now get the minimum for each snapshot and the column this corresponds to
+        const size_t numSnapshots = window.second - window.first;
+        m_BestColumns.resize(numSnapshots);
+        m_MinimumDifferences.resize(numSnapshots);
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, numSnapshots),
+                          [&](const auto &r) {
+                              for (size_t i = r.begin(); i != r.end(); ++i) {
+                                  m_MinimumDifferences[i] = m_RotatedDifferences.row(i).minCoeff(&m_BestColumns[i]);
+                              }
+                          });
+
+        // Return result
+        return std::tuple_cat(RIDFProcessor()(m_BestColumns, m_MinimumDifferences, rotater, window.first),
+                              std::make_tuple(&m_RotatedDifferences));
+    }
+
+    template<class RotaterType>
+    void calcBoundedDifferences(const cv::Mat &image, const ImgProc::Mask &mask,
+                                typename PerfectMemory<Store>::Window window,
+                                RotaterType &rotater) const
+    {
+        const auto &unwrapRes = this->getUnwrapResolution();
+        BOB_ASSERT(window.first < this->getNumSnapshots());
+        BOB_ASSERT(window.second <= this->getNumSnapshots());
+        BOB_ASSERT(window.first < window.second);
+
+        // Sum each row of an image (rolling the image doesn't change these)
+        const auto sumRows = [](const cv::Mat &in, std::vector<int32_t> &sums) {
+            sums.assign(in.rows, 0);
+            for (int y = 0; y < in.rows; y++) {
+                const uint8_t *row = in.ptr(y);
+                sums[y] = std::accumulate(row, row + in.cols, int32_t{ 0 });
+            }
+        };
+
+        /*
+         * By the triangle inequality, the sum of absolute differences between
+         * two images is at least the sum of absolute differences between their
+         * row sums. This doesn't hold with masks, but it's still a reasonable
+         * order in which to try the snapshots.
+         */
+        std::vector<int32_t> viewRowSums;
+        sumRows(image, viewRowSums);
+        const size_t numSnapshots = window.second - window.first;
+        m_SnapshotBounds.resize(numSnapshots);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, numSnapshots),
+            [&](const auto &r) {
+                std::vector<int32_t> snapshotRowSums;
+                for (size_t i = r.begin(); i != r.end(); ++i) {
+                    const cv::Mat &snapshot = this->getSnapshot(window.first + i);
+                    BOB_ASSERT(snapshot.type() == CV_8UC1);
+                    BOB_ASSERT(snapshot.size() == unwrapRes);
+                    sumRows(snapshot, snapshotRowSums);
+
+                    double bound = 0.0;
+                    for (size_t y = 0; y < viewRowSums.size(); y++) {
+                        bound += std::abs(viewRowSums[y] - snapshotRowSums[y]);
+                    }
+                    m_SnapshotBounds[i] = { bound / unwrapRes.area(), window.first + i };
+                }
+            });
+        std::sort(m_SnapshotBounds.begin(), m_SnapshotBounds.end());
+
+        // RMS differences are compared via their squares, so the bound needs squaring too
+        constexpr bool Squared = Detail::UsesSquaredDifferences<Store>::value;
+
+        const size_t numRotations = rotater.numRotations();
+        const size_t viewCount = mask.countUnmaskedPixels(unwrapRes);
+        m_RotatedDifferences.setConstant(numSnapshots, numRotations, std::numeric_limits<float>::infinity());
+        std::atomic<float> bestDifference{ std::numeric_limits<float>::infinity() };
+        for (const auto &snapshotBound : m_SnapshotBounds) {
+            const size_t s = snapshotBound.second;
+
+            // NB: Copy, as some stores (e.g. RawImageArena) return a reference to scratch storage
+            const auto snapshot = this->getMaskedSnapshot(s);
+
+            /*
+             * Snapshots are sorted by bound, so if this one can't win, none of
+             * the rest can either. NB: We allow a little slack as the best
+             * difference has been rounded to a float and we want to be sure
+             * we find ties in the same way as getHeading().
+             */
+            const bool anyMasks = !mask.empty() || !snapshot.second.empty();
+            if (!anyMasks && snapshotBound.first > BoundedSlack * bestDifference.load()) {
+                break;
+            }
+
+            // There can't be more unmasked pixels than in either image alone
+            const double maxCount = static_cast<double>(std::min(viewCount, snapshot.second.countUnmaskedPixels(unwrapRes)));
+            const auto getMaxSum = [&bestDifference, maxCount]() {
+                const double best = static_cast<double>(bestDifference.load());
+                return BoundedSlack * (Squared ? best * best : best) * maxCount;
+            };
+
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, numRotations),
+                [&](const auto &r) {
+                    Detail::DifferenceSums sums;
+                    for (size_t i = r.begin(); i != r.end(); ++i) {
+                        const auto rotated = rotater.getRotation(i);
+                        if (!Detail::sumDifferencesBounded<Squared>(rotated.first, snapshot.first, rotated.second,
+                                                                    snapshot.second, BoundedBlockRows, getMaxSum, sums)) {
+                            continue;
+                        }
+
+                        const float difference = getBoundedDifference(sums);
+                        m_RotatedDifferences(s - window.first, i) = difference;
+
+                        // Update the shared best difference
+                        float best = bestDifference.load();
+                        while (difference < best && !bestDifference.compare_exchange_weak(best, difference)) {
+                        }
+                    }
+                });
+        }
+    }
+
+    //! Turn sums from Detail::sumDifferencesBounded() into a difference, exactly as the store's differencer would
+    static float getBoundedDifference(const Detail::DifferenceSums &sums)
+    {
+        if (Detail::UsesSquaredDifferences<Store>::value) {
+            // NB: This is how RMSDiff and FusedRMSDiff calculate the RMS
+            return sqrtf(static_cast<double>(sums.sum) / (float) sums.count);
+        } else {
+            // NB: This is how AbsDiff (i.e. cv::mean()) calculates the mean
+            return static_cast<float>(static_cast<double>(sums.sum) *
+                                      (sums.count ? 1.0 / static_cast<double>(sums.count) : 0.0));
+        }
+    }
+
+    static void downsample(const std::pair<cv::Mat, ImgProc::Mask> &in, const cv::Size &size,
+                           std::pair<cv::Mat, ImgProc::Mask> &out)
+    {
+        cv::resize(in.first, out.first, size, 0.0, 0.0, cv::INTER_AREA);
+        if (!in.second.empty()) {
+            out.second = ImgProc::Mask{ in.second.get(), size };
+        }
+    }
+
+    //! Convert a number of pixels rolled at one level of the pyramid to another
+    size_t toLevelColumn(size_t column, size_t fromLevel, size_t toLevel) const
+    {
+        const int fromWidth = m_PyramidSizes[fromLevel].width;
+        const int toWidth = m_PyramidSizes[toLevel].width;
+        return static_cast<size_t>(std::lround((double) column * toWidth / fromWidth)) % toWidth;
+    }
+
+    //! Calculate the difference between a view at a level of the pyramid rolled left by column and a snapshot
+    float calcLevelDifference(size_t level, size_t column, size_t snapshot) const
+    {
+        static thread_local FusedAbsDiff::Internal<> differencer;
+        static thread_local cv::Mat rolledImage;
+        static thread_local ImgProc::Mask rolledMask;
+
+        const auto &view = m_ViewPyramid[level - 1];
+        ImgProc::roll(view.first, rolledImage, column);
+        view.second.roll(rolledMask, column);
+
+        const auto &snapshotImage = m_Pyramid[level - 1][snapshot];
+        return differencer(rolledImage, snapshotImage.first, rolledMask, snapshotImage.second);
+    }
+
+    //! Evaluate candidates in parallel and keep the best m_NumCandidates
+    template<class Func>
+    void selectCandidates(std::vector<Candidate> &candidates, Func calcDifference) const
+    {
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, candidates.size()),
+            [&](const auto &r) {
+                for (size_t i = r.begin(); i != r.end(); ++i) {
+                    candidates[i].difference = calcDifference(candidates[i]);
+                }
+            });
+
+        const auto compare = [](const Candidate &a, const Candidate &b) {
+            return a.difference < b.difference;
+        };
+        if (candidates.size() > m_NumCandidates) {
+            std::nth_element(candidates.begin(), candidates.begin() + m_NumCandidates, candidates.end(), compare);
+            candidates.resize(m_NumCandidates);
+        }
+    }
+
+    template<class RotaterType>
+    void calcCoarseToFineDifferences(const cv::Mat &image, const ImgProc::Mask &mask,
+                                     typename PerfectMemory<Store>::Window window,
+                                     RotaterType &rotater) const
+    {
+        const auto &unwrapRes = this->getUnwrapResolution();
+        BOB_ASSERT(image.size() == unwrapRes);
+        BOB_ASSERT(image.type() == CV_8UC1);
+        BOB_ASSERT(mask.isValid(unwrapRes));
+        BOB_ASSERT(window.first < this->getNumSnapshots());
+        BOB_ASSERT(window.second <= this->getNumSnapshots());
+        BOB_ASSERT(window.first < window.second);
+
+        // Build pyramid for current view
+        const size_t numLevels = m_Pyramid.size();
+        m_ViewPyramid.resize(numLevels);
+        for (size_t l = 0; l < numLevels; l++) {
+            downsample(l == 0 ? std::make_pair(image, mask) : m_ViewPyramid[l - 1],
+                       m_PyramidSizes[l + 1], m_ViewPyramid[l]);
+        }
+
+        // At the coarsest level, try every snapshot at every column corresponding to a rotation we're allowed
+        const size_t numRotations = rotater.numRotations();
+        std::vector<size_t> columns(numRotations);
+        for (size_t i = 0; i < numRotations; i++) {
+            columns[i] = toLevelColumn(rotater.rotationToIndex(i), 0, numLevels);
+        }
+        std::sort(columns.begin(), columns.end());
+        columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+
+        m_Candidates.clear();
+        for (size_t s = window.first; s < window.second; s++) {
+            for (size_t column : columns) {
+                m_Candidates.push_back({ s, column, 0.0f });
+            }
+        }
+        selectCandidates(m_Candidates, [this, numLevels](const Candidate &c) {
+            return calcLevelDifference(numLevels, c.column, c.snapshot);
+        });
+
+        // Refine candidates at each level, trying neighbouring columns
+        for (size_t l = numLevels - 1; l > 0; l--) {
+            const size_t width = static_cast<size_t>(m_PyramidSizes[l].width);
+            m_NextCandidates.clear();
+            for (const auto &c : m_Candidates) {
+                const size_t centre = toLevelColumn(c.column, l + 1, l);
+                for (size_t column : { centre + width - 1, centre, centre + 1 }) {
+                    m_NextCandidates.push_back({ c.snapshot, column % width, 0.0f });
+                }
+            }
+
+            // Remove duplicates
+            std::sort(m_NextCandidates.begin(), m_NextCandidates.end(),
+                      [](const Candidate &a, const Candidate &b) {
+                          return std::tie(a.snapshot, a.column) < std::tie(b.snapshot, b.column);
+                      });
+            m_NextCandidates.erase(std::unique(m_NextCandidates.begin(), m_NextCandidates.end(),
+                                               [](const Candidate &a, const Candidate &b) {
+                                                   return a.snapshot == b.snapshot && a.column == b.column;
+                                               }),
+                                   m_NextCandidates.end());
+
+            selectCandidates(m_NextCandidates, [this, l](const Candidate &c) {
+                return calcLevelDifference(l, c.column, c.snapshot);
+            });
+            std::swap(m_Candidates, m_NextCandidates);
+        }
+
+        /*
+         * At full resolution, compare all the allowed rotations within one
+         * coarse pixel of each candidate (or the nearest allowed rotation, if
+         * there aren't any), skipping ones we've already done.
+         */
+        const size_t numSnapshots = window.second - window.first;
+        const size_t width = static_cast<size_t>(unwrapRes.width);
+        const size_t levelWidth = static_cast<size_t>(m_PyramidSizes[1].width);
+        const size_t radius = (width + levelWidth - 1) / levelWidth;
+        m_Visited.assign(numSnapshots * numRotations, 0);
+        m_NextCandidates.clear();
+        const auto addRotation = [&](size_t snapshot, size_t rotation) {
+            uint8_t &visited = m_Visited[(snapshot - window.first) * numRotations + rotation];
+            if (!visited) {
+                visited = 1;
+                m_NextCandidates.push_back({ snapshot, rotation, 0.0f });
+            }
+        };
+        for (const auto &c : m_Candidates) {
+            const size_t centre = toLevelColumn(c.column, 1, 0);
+            size_t nearest = 0, nearestDistance = width;
+            bool anyAdded = false;
+            for (size_t i = 0; i < numRotations; i++) {
+                const size_t offset = (rotater.rotationToIndex(i) + width - centre) % width;
+                const size_t distance = std::min(offset, width - offset);
+                if (distance <= radius) {
+                    addRotation(c.snapshot, i);
+                    anyAdded = true;
+                }
+                if (distance < nearestDistance) {
+                    nearest = i;
+                    nearestDistance = distance;
+                }
+            }
+            if (!anyAdded) {
+                addRotation(c.snapshot, nearest);
+            }
+        }
+
+        // Compare these rotations with the store's differencer
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, m_NextCandidates.size()),
+            [&](const auto &r) {
+                static thread_local cv::Mat rolledImage;
+                static thread_local ImgProc::Mask rolledMask;
+                for (size_t i = r.begin(); i != r.end(); ++i) {
+                    auto &c = m_NextCandidates[i];
+                    const size_t index = rotater.rotationToIndex(c.column);
+                    ImgProc::roll(image, rolledImage, index);
+                    mask.roll(rolledMask, index);
+                    c.difference = this->calcSnapshotDifference(rolledImage, rolledMask, c.snapshot);
+                }
+            });
+
+        // Rotations we haven't compared are left as infinity
+        m_RotatedDifferences.setConstant(numSnapshots, numRotations, std::numeric_limits<float>::infinity());
+        for (const auto &c : m_NextCandidates) {
+            m_RotatedDifferences(c.snapshot - window.first, c.column) = c.difference;
+        }
+    }
+
+    template<class RotaterType>
+    void calcImageDifferences(const cv::Mat &image, const ImgProc::Mask &mask,
+                              typename PerfectMemory<Store>::Window window,
+                              RotaterType &rotater) const
     {
         BOB_ASSERT(window.first < this->getNumSnapshots());
         BOB_ASSERT(window.second <= this->getNumSnapshots());
@@ -287,6 +919,114 @@ private:
         // Preallocate snapshot difference vectors
         m_RotatedDifferences.resize(window.second - window.first, rotater.numRotations());
 
+        calcImageDifferences(image, mask, window, rotater, Detail::CalculatesRIDFs<Store>{});
+    }
+
+    template<class... Ts>
+    auto calcBatchDifferences(const std::vector<cv::Mat> &images, const ImgProc::Mask &mask,
+                              typename PerfectMemory<Store>::Window window, const Ts &... args) const
+    {
+        BOB_ASSERT(!images.empty());
+        BOB_ASSERT(window.first < this->getNumSnapshots());
+        BOB_ASSERT(window.second <= this->getNumSnapshots());
+        BOB_ASSERT(window.first < window.second);
+
+        // We use RollFreeRotaters so we can get at views of every rotation at once
+        using BatchRotater = decltype(RollFreeRotater::create(this->getUnwrapResolution(), mask, images[0], args...));
+        std::vector<BatchRotater> rotaters;
+        rotaters.reserve(images.size());
+        for (const auto &image : images) {
+            rotaters.emplace_back(RollFreeRotater::create(this->getUnwrapResolution(), mask, image, args...));
+        }
+
+        m_BatchDifferences.resize(static_cast<Eigen::Index>(images.size()),
+                                  static_cast<Eigen::Index>(window.second - window.first),
+                                  static_cast<Eigen::Index>(rotaters[0].numRotations()));
+        calcBatchDifferences(images, mask, window, rotaters, typename Detail::CalculatesRIDFs<Store>::type{});
+        return rotaters;
+    }
+
+    template<class RotaterType>
+    void calcBatchDifferences(const std::vector<cv::Mat> &images, const ImgProc::Mask &mask,
+                              typename PerfectMemory<Store>::Window window,
+                              const std::vector<RotaterType> &rotaters, std::true_type) const
+    {
+        // Transforms are expensive, so do each view in parallel (each one gets its own RIDFs)
+        m_BatchRIDFs.resize(images.size());
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, images.size()),
+            [&](const auto &r) {
+                for (size_t q = r.begin(); q != r.end(); ++q) {
+                    auto &ridfs = m_BatchRIDFs[q];
+                    this->getStore().calcRIDFs(images[q], mask, window.first, window.second, ridfs);
+                    for (size_t s = 0; s < window.second - window.first; s++) {
+                        for (size_t i = 0; i < rotaters[q].numRotations(); i++) {
+                            m_BatchDifferences(q, s, i) = ridfs(s, rotaters[q].rotationToIndex(i));
+                        }
+                    }
+                }
+            });
+    }
+
+    template<class RotaterType>
+    void calcBatchDifferences(const std::vector<cv::Mat> &images, const ImgProc::Mask &,
+                              typename PerfectMemory<Store>::Window window,
+                              const std::vector<RotaterType> &rotaters, std::false_type) const
+    {
+        // Get views onto every rotation of every image
+        const size_t numRotations = rotaters[0].numRotations();
+        m_BatchViews.resize(images.size() * numRotations);
+        for (size_t q = 0; q < images.size(); q++) {
+            for (size_t i = 0; i < numRotations; i++) {
+                m_BatchViews[q * numRotations + i] = rotaters[q].getRotation(i);
+            }
+        }
+
+        /*
+         * Split the work into tiles of BatchQueryBlockSize views by
+         * BatchSnapshotBlockSize snapshots, small enough for both to stay in
+         * the cache while we compare every rotation of each view in the tile
+         * with each snapshot in the tile.
+         */
+        const size_t numSnapshots = window.second - window.first;
+        const size_t numQueryBlocks = (images.size() + BatchQueryBlockSize - 1) / BatchQueryBlockSize;
+        const size_t numSnapshotBlocks = (numSnapshots + BatchSnapshotBlockSize - 1) / BatchSnapshotBlockSize;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, numQueryBlocks * numSnapshotBlocks),
+            [&](const auto &r) {
+                for (size_t tile = r.begin(); tile != r.end(); ++tile) {
+                    const size_t firstQuery = (tile / numSnapshotBlocks) * BatchQueryBlockSize;
+                    const size_t lastQuery = std::min(images.size(), firstQuery + BatchQueryBlockSize);
+                    const size_t firstSnapshot = window.first + (tile % numSnapshotBlocks) * BatchSnapshotBlockSize;
+                    const size_t lastSnapshot = std::min(window.second, firstSnapshot + BatchSnapshotBlockSize);
+
+                    for (size_t s = firstSnapshot; s < lastSnapshot; s++) {
+                        for (size_t q = firstQuery; q < lastQuery; q++) {
+                            for (size_t i = 0; i < numRotations; i++) {
+                                const auto &view = m_BatchViews[q * numRotations + i];
+                                m_BatchDifferences(q, s - window.first, i) = this->calcSnapshotDifference(view.first, view.second, s);
+                            }
+                        }
+                    }
+                }
+            });
+    }
+
+    //! Get the store to calculate the whole RIDFs and pick out the rotations we want
+    template<class RotaterType>
+    void calcImageDifferences(const cv::Mat &image, const ImgProc::Mask &mask,
+                              typename PerfectMemory<Store>::Window window,
+                              RotaterType &rotater, std::true_type) const
+    {
+        this->getStore().calcRIDFs(image, mask, window.first, window.second, m_WholeRIDFs);
+        for (size_t i = 0; i < rotater.numRotations(); i++) {
+            m_RotatedDifferences.col(i) = m_WholeRIDFs.col(rotater.rotationToIndex(i));
+        }
+    }
+
+    template<class RotaterType>
+    void calcImageDifferences(const cv::Mat &, const ImgProc::Mask &,
+                              typename PerfectMemory<Store>::Window window,
+                              RotaterType &rotater, std::false_type) const
+    {
         // Scan across image columns
         rotater.rotate(
                 [this, &window](const cv::Mat &fr, const ImgProc::Mask &mask, size_t i) {
@@ -298,5 +1038,17 @@ private:
                 });
     }
 };
+
+template<typename Store, typename RIDFProcessor, typename Rotater>
+constexpr size_t PerfectMemoryRotater<Store, RIDFProcessor, Rotater>::BatchQueryBlockSize;
+
+template<typename Store, typename RIDFProcessor, typename Rotater>
+constexpr size_t PerfectMemoryRotater<Store, RIDFProcessor, Rotater>::BatchSnapshotBlockSize;
+
+template<typename Store, typename RIDFProcessor, typename Rotater>
+constexpr int PerfectMemoryRotater<Store, RIDFProcessor, Rotater>::BoundedBlockRows;
+
+template<typename Store, typename RIDFProcessor, typename Rotater>
+constexpr double PerfectMemoryRotater<Store, RIDFProcessor, Rotater>::BoundedSlack;
 } // Navigation
 } // BoBRobotics
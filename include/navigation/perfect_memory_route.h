@@ -0,0 +1,42 @@
+#pragma once
+
+// BoB robotics includes
+#include "imgproc/mask.h"
+#include "navigation/image_database.h"
+
+// OpenCV
+#include <opencv2/opencv.hpp>
+
+// Standard C includes
+#include <cstddef>
+
+namespace BoBRobotics {
+namespace Navigation {
+/*!
+ * \brief Train a PerfectMemory (or PerfectMemoryRotater) on every frameSkip-th
+ *        image in an ImageDatabase
+ *
+ * Images are streamed through ImageDatabase::streamImages(), so they are
+ * decoded and resized in parallel, but only a few are held in memory at a
+ * time. Snapshots are added in database order.
+ */
+template<class PerfectMemoryType>
+void trainRoute(PerfectMemoryType &pm, const ImageDatabase &database,
+                size_t frameSkip = 1, const ImgProc::Mask &mask = ImgProc::Mask{})
+{
+    const cv::Size unwrapRes = pm.getUnwrapResolution();
+    database.streamImages(
+        [&unwrapRes](size_t, const cv::Mat &image, cv::Mat &output) {
+            if (image.size() == unwrapRes) {
+                output = image;
+            } else {
+                cv::resize(image, output, unwrapRes);
+            }
+        },
+        [&](size_t, const cv::Mat &image) {
+            pm.train(image, mask);
+        },
+        frameSkip);
+}
+} // Navigation
+} // BoBRobotics
@@ -0,0 +1,367 @@
+#pragma once
+
+// BoB robotics includes
+#include "common/macros.h"
+#include "imgproc/mask.h"
+#include "navigation/differencers.h"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+// Standard C includes
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Standard C++ includes
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace BoBRobotics {
+namespace Navigation {
+namespace PerfectMemoryStore {
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::PerfectMemoryStore::AlignedArena
+//------------------------------------------------------------------------
+//! A growable, contiguous block of memory whose start is aligned to Alignment bytes
+template<size_t Alignment>
+class AlignedArena
+{
+public:
+    uint8_t *data() { return m_Aligned; }
+    const uint8_t *data() const { return m_Aligned; }
+    size_t capacity() const { return m_Capacity; }
+
+    //! Grow to at least newCapacity bytes, preserving the first usedBytes bytes
+    void grow(size_t newCapacity, size_t usedBytes)
+    {
+        if (newCapacity <= m_Capacity) {
+            return;
+        }
+
+        // Over-allocate so that we can align the start of the block ourselves
+        std::unique_ptr<uint8_t[]> storage{ new uint8_t[newCapacity + Alignment - 1] };
+        const auto address = reinterpret_cast<uintptr_t>(storage.get());
+        uint8_t *aligned = storage.get() + ((Alignment - (address % Alignment)) % Alignment);
+
+        if (usedBytes > 0) {
+            std::memcpy(aligned, m_Aligned, usedBytes);
+        }
+
+        m_Storage = std::move(storage);
+        m_Aligned = aligned;
+        m_Capacity = newCapacity;
+    }
+
+    void clear()
+    {
+        m_Storage.reset();
+        m_Aligned = nullptr;
+        m_Capacity = 0;
+    }
+
+private:
+    std::unique_ptr<uint8_t[]> m_Storage;
+    uint8_t *m_Aligned = nullptr;
+    size_t m_Capacity = 0;
+};
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::PerfectMemoryStore::RawImageArena
+//------------------------------------------------------------------------
+/*!
+ * \brief A drop-in replacement for RawImage which packs all snapshots into one
+ *        contiguous, 64-byte-aligned block of memory
+ *
+ * Every row of every snapshot starts on a 64-byte boundary (i.e. rows are
+ * stored with a fixed stride) so that snapshots can be streamed through the
+ * cache without chasing a separate heap allocation per snapshot. Masks are
+ * stored in a separate plane with one bit per pixel; consecutive snapshots
+ * with identical masks share the same entry in this plane. FusedAbsDiff and
+ * FusedRMSDiff read the packed masks directly; other differencers are given
+ * a temporary 8-bit copy.
+ *
+ * \tparam Differencer This can be AbsDiff, RMSDiff or CorrCoefficient
+ */
+template<typename Differencer = AbsDiff>
+class RawImageArena
+{
+public:
+    //! All rows (and hence all snapshots) start on a boundary of this many bytes
+    static constexpr size_t Alignment = 64;
+
+    RawImageArena(const cv::Size &unwrapRes, size_t initialCapacity = 0)
+      : m_UnwrapRes(unwrapRes)
+      , m_RowStride(alignUp(unwrapRes.width))
+      , m_MaskRowStride(alignUp((unwrapRes.width + 7) / 8))
+    {
+        if (initialCapacity > 0) {
+            reserve(initialCapacity);
+        }
+    }
+
+    //------------------------------------------------------------------------
+    // Public API
+    //------------------------------------------------------------------------
+    size_t getNumSnapshots() const
+    {
+        return m_Images.size();
+    }
+
+    /*!
+     * \brief Get a snapshot and its mask
+     *
+     * The image is a view onto the arena, so it is invalidated by subsequent
+     * calls to addSnapshot(), as with std::vector. The mask is unpacked into a
+     * new 8-bit ImgProc::Mask on every call and the returned reference is only
+     * valid until this thread next calls getSnapshot(), so copy the pair if you
+     * need to keep it.
+     */
+    const std::pair<cv::Mat, ImgProc::Mask> &getSnapshot(size_t index) const
+    {
+        BOB_ASSERT(index < m_Images.size());
+
+        static thread_local std::pair<cv::Mat, ImgProc::Mask> snapshot;
+        snapshot.first = m_Images[index];
+
+        const size_t maskIndex = m_MaskIndices[index];
+        if (maskIndex == NoMask) {
+            snapshot.second = ImgProc::Mask{};
+        } else {
+            unpackMask(maskIndex, snapshot.second);
+        }
+        return snapshot;
+    }
+
+    size_t addSnapshot(const cv::Mat &image, const ImgProc::Mask &mask)
+    {
+        BOB_ASSERT(image.size() == m_UnwrapRes);
+        BOB_ASSERT(image.type() == CV_8UC1);
+        BOB_ASSERT(mask.isValid(m_UnwrapRes));
+
+        // Grow geometrically, like std::vector
+        const size_t index = m_Images.size();
+        if (index == m_ImageCapacity) {
+            reserve(std::max<size_t>(16, 2 * m_ImageCapacity));
+        }
+
+        // Copy image into arena (OpenCV won't reallocate as size and type match)
+        m_Images.push_back(getImageView(index));
+        image.copyTo(m_Images.back());
+
+        m_MaskIndices.push_back(mask.empty() ? NoMask : addMask(mask));
+
+        // Return index of new snapshot
+        return index;
+    }
+
+    void clear()
+    {
+        m_Images.clear();
+        m_MaskIndices.clear();
+        m_ImageArena.clear();
+        m_MaskArena.clear();
+        m_ImageCapacity = 0;
+        m_NumMasks = 0;
+
+        // Invalidate any thread-local unpacked masks
+        m_Generation = nextGeneration();
+    }
+
+    //! Preallocate space for numSnapshots snapshots
+    void reserve(size_t numSnapshots)
+    {
+        if (numSnapshots <= m_ImageCapacity) {
+            return;
+        }
+
+        m_ImageArena.grow(numSnapshots * getSnapshotBytes(),
+                          m_Images.size() * getSnapshotBytes());
+        m_ImageCapacity = numSnapshots;
+
+        // Arena has moved, so update our views onto it
+        for (size_t i = 0; i < m_Images.size(); i++) {
+            m_Images[i] = getImageView(i);
+        }
+    }
+
+    float calcSnapshotDifference(const cv::Mat &image,
+                                 const ImgProc::Mask &imageMask,
+                                 size_t snapshot) const
+    {
+        return calcSnapshotDifference(image, imageMask, snapshot, ReadsPackedMasks{});
+    }
+
+    //------------------------------------------------------------------------
+    // Raw arena access
+    //------------------------------------------------------------------------
+    //! Number of bytes between the start of consecutive rows
+    size_t getRowStride() const { return m_RowStride; }
+
+    //! Number of bytes between the start of consecutive rows of packed masks
+    size_t getMaskRowStride() const { return m_MaskRowStride; }
+
+    //! Pointer to first pixel of snapshot (aligned to Alignment bytes)
+    const uint8_t *getImageData(size_t snapshot) const
+    {
+        return m_ImageArena.data() + snapshot * getSnapshotBytes();
+    }
+
+    //! Pointer to packed mask bits for snapshot (LSB first) or nullptr if unmasked
+    const uint8_t *getMaskBits(size_t snapshot) const
+    {
+        const size_t maskIndex = m_MaskIndices[snapshot];
+        return (maskIndex == NoMask) ? nullptr : getPackedMask(maskIndex);
+    }
+
+private:
+    static constexpr size_t NoMask = std::numeric_limits<size_t>::max();
+
+    //! Whether Differencer can use getMaskBits() directly
+    using ReadsPackedMasks = std::integral_constant<bool, std::is_same<Differencer, FusedAbsDiff>::value ||
+                                                          std::is_same<Differencer, FusedRMSDiff>::value>;
+
+    //------------------------------------------------------------------------
+    // Private API
+    //------------------------------------------------------------------------
+    size_t getSnapshotBytes() const { return m_RowStride * m_UnwrapRes.height; }
+    size_t getPackedMaskBytes() const { return m_MaskRowStride * m_UnwrapRes.height; }
+
+    cv::Mat getImageView(size_t snapshot)
+    {
+        return cv::Mat(m_UnwrapRes, CV_8UC1,
+                       m_ImageArena.data() + snapshot * getSnapshotBytes(),
+                       m_RowStride);
+    }
+
+    const uint8_t *getPackedMask(size_t maskIndex) const
+    {
+        return m_MaskArena.data() + maskIndex * getPackedMaskBytes();
+    }
+
+    float calcSnapshotDifference(const cv::Mat &image, const ImgProc::Mask &imageMask,
+                                 size_t snapshot, std::true_type) const
+    {
+        static thread_local typename Differencer::template Internal<> differencer;
+        return differencer(image, m_Images[snapshot], imageMask, getMaskBits(snapshot),
+                           m_MaskRowStride);
+    }
+
+    float calcSnapshotDifference(const cv::Mat &image, const ImgProc::Mask &imageMask,
+                                 size_t snapshot, std::false_type) const
+    {
+        static thread_local typename Differencer::template Internal<> differencer;
+        return differencer(image, m_Images[snapshot], imageMask,
+                           getSnapshotMask(snapshot));
+    }
+
+    size_t addMask(const ImgProc::Mask &mask)
+    {
+        // Pack mask into scratch buffer
+        const size_t maskBytes = getPackedMaskBytes();
+        m_PackScratch.assign(maskBytes, 0);
+        const cv::Mat &maskMat = mask.get();
+        for (int y = 0; y < maskMat.rows; y++) {
+            const uint8_t *rowIn = maskMat.ptr(y);
+            uint8_t *rowOut = &m_PackScratch[y * m_MaskRowStride];
+            for (int x = 0; x < maskMat.cols; x++) {
+                if (rowIn[x]) {
+                    rowOut[x / 8] |= static_cast<uint8_t>(1 << (x % 8));
+                }
+            }
+        }
+
+        // If it's the same as the last mask we added, then share it
+        if (m_NumMasks > 0
+                && std::memcmp(getPackedMask(m_NumMasks - 1), m_PackScratch.data(), maskBytes) == 0) {
+            return m_NumMasks - 1;
+        }
+
+        if (m_NumMasks * maskBytes == m_MaskArena.capacity()) {
+            m_MaskArena.grow(std::max<size_t>(4, 2 * m_NumMasks) * maskBytes,
+                             m_NumMasks * maskBytes);
+        }
+        std::memcpy(m_MaskArena.data() + m_NumMasks * maskBytes,
+                    m_PackScratch.data(), maskBytes);
+        return m_NumMasks++;
+    }
+
+    void unpackMask(size_t maskIndex, ImgProc::Mask &mask) const
+    {
+        cv::Mat maskMat{ m_UnwrapRes, CV_8UC1 };
+        const uint8_t *bits = getPackedMask(maskIndex);
+        for (int y = 0; y < maskMat.rows; y++) {
+            Detail::unpackMaskBits(&bits[y * m_MaskRowStride], maskMat.cols, maskMat.ptr(y));
+        }
+        mask.set(std::move(maskMat));
+    }
+
+    const ImgProc::Mask &getSnapshotMask(size_t snapshot) const
+    {
+        /*
+         * Differencers other than the fused ones want an 8-bit mask, so keep
+         * the most recently unpacked one for each thread. Routes are usually
+         * trained with one mask (or a run of identical masks), so this is
+         * rarely recomputed.
+         */
+        struct UnpackedMask
+        {
+            const RawImageArena *store = nullptr;
+            size_t generation = 0, maskIndex = NoMask;
+            ImgProc::Mask mask;
+        };
+        static thread_local UnpackedMask unpacked;
+        static const ImgProc::Mask EmptyMask;
+
+        const size_t maskIndex = m_MaskIndices[snapshot];
+        if (maskIndex == NoMask) {
+            return EmptyMask;
+        }
+        if (unpacked.store != this || unpacked.generation != m_Generation
+                || unpacked.maskIndex != maskIndex) {
+            unpackMask(maskIndex, unpacked.mask);
+            unpacked.store = this;
+            unpacked.generation = m_Generation;
+            unpacked.maskIndex = maskIndex;
+        }
+        return unpacked.mask;
+    }
+
+    static size_t alignUp(size_t bytes)
+    {
+        return ((bytes + Alignment - 1) / Alignment) * Alignment;
+    }
+
+    static size_t nextGeneration()
+    {
+        static std::atomic<size_t> generation{ 0 };
+        return ++generation;
+    }
+
+    //------------------------------------------------------------------------
+    // Members
+    //------------------------------------------------------------------------
+    const cv::Size m_UnwrapRes;
+    const size_t m_RowStride, m_MaskRowStride;
+    AlignedArena<Alignment> m_ImageArena, m_MaskArena;
+    size_t m_ImageCapacity = 0, m_NumMasks = 0;
+    size_t m_Generation = nextGeneration();
+    std::vector<cv::Mat> m_Images;
+    std::vector<size_t> m_MaskIndices;
+    std::vector<uint8_t> m_PackScratch;
+}; // RawImageArena
+
+template<typename Differencer>
+constexpr size_t RawImageArena<Differencer>::Alignment;
+
+template<typename Differencer>
+constexpr size_t RawImageArena<Differencer>::NoMask;
+} // PerfectMemoryStore
+} // Navigation
+} // BoBRobotics
@@ -90,9 +90,21 @@ public:
 
         static thread_local typename Differencer::template Internal<std::vector<float>> differencer;
 
+        /*
+         * OpenCV's HOG implementation will read pixels outside of the image
+         * if it is a view onto a bigger one (e.g. from RollFreeRotater), which
+         * changes the gradients at the edges, so copy it first.
+         */
+        static thread_local cv::Mat scratchImage;
+        const cv::Mat *imagePtr = &image;
+        if (image.isSubmatrix()) {
+            image.copyTo(scratchImage);
+            imagePtr = &scratchImage;
+        }
+
         // Calculate HOG descriptors of image
         auto &scratchDescriptors = differencer.getScratchVector();
-        m_HOG.compute(image, scratchDescriptors);
+        m_HOG.compute(*imagePtr, scratchDescriptors);
         BOB_ASSERT(scratchDescriptors.size() == m_HOGDescriptorSize);
 
         // Calculate differences between image HOG descriptors and snapshot
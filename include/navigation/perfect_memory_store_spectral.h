@@ -0,0 +1,257 @@
+#pragma once
+
+// BoB robotics includes
+#include "common/macros.h"
+#include "imgproc/mask.h"
+#include "navigation/differencers.h"
+#include "navigation/perfect_memory_store_raw.h"
+
+// Eigen
+#include <Eigen/Core>
+
+// OpenCV
+#include <opencv2/opencv.hpp>
+
+// TBB
+#include <tbb/parallel_for.h>
+
+// Standard C includes
+#include <cmath>
+
+// Standard C++ includes
+#include <utility>
+#include <vector>
+
+namespace BoBRobotics {
+namespace Navigation {
+namespace PerfectMemoryStore {
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::PerfectMemoryStore::SpectralRaw
+//------------------------------------------------------------------------
+/*!
+ * \brief Perfect memory with RMS differences, where whole RIDFs are calculated
+ *        with FFTs
+ *
+ * The sum of squared differences between a view rolled left by k pixels and a
+ * snapshot expands into sums of squares (which don't depend on k) minus twice
+ * the circular cross-correlation of the view and snapshot along the azimuth
+ * axis. We cache the row-wise DFT of every snapshot when training, so that at
+ * test time the entire RIDF for a snapshot is given by a single inverse DFT,
+ * i.e. O(W log W) rather than O(W^2) operations per row.
+ *
+ * Masks are handled by also correlating the masks and squared images, which
+ * needs a few more DFTs. All of the sums are integers, so we calculate them in
+ * double precision and round them, which means the results are identical to
+ * RawImage<RMSDiff>.
+ *
+ * Note that each snapshot's spectrum takes up 8 bytes per pixel (24 if it has
+ * a mask), in addition to the raw snapshot.
+ */
+class SpectralRaw
+{
+public:
+    SpectralRaw(const cv::Size &unwrapRes)
+      : m_UnwrapRes(unwrapRes)
+      , m_Raw(unwrapRes)
+    {
+        // The DFT of an image of ones, for when only one of the images is masked
+        const cv::Mat ones = cv::Mat::ones(unwrapRes, CV_64FC1);
+        cv::dft(ones, m_OnesSpectrum, cv::DFT_ROWS);
+    }
+
+    //------------------------------------------------------------------------
+    // Public API
+    //------------------------------------------------------------------------
+    size_t getNumSnapshots() const
+    {
+        return m_Raw.getNumSnapshots();
+    }
+
+    const std::pair<cv::Mat, ImgProc::Mask> &getSnapshot(size_t index) const
+    {
+        return m_Raw.getSnapshot(index);
+    }
+
+    size_t addSnapshot(const cv::Mat &image, const ImgProc::Mask &mask)
+    {
+        BOB_ASSERT(image.size() == m_UnwrapRes);
+        BOB_ASSERT(image.type() == CV_8UC1);
+        BOB_ASSERT(mask.isValid(m_UnwrapRes));
+
+        // We only need the squared image's spectrum for masked snapshots
+        m_Spectra.emplace_back();
+        calcSpectra(image, mask, !mask.empty(), m_Spectra.back());
+        if (!mask.empty()) {
+            m_NumMaskedSnapshots++;
+        }
+
+        return m_Raw.addSnapshot(image, mask);
+    }
+
+    void clear()
+    {
+        m_Raw.clear();
+        m_Spectra.clear();
+        m_NumMaskedSnapshots = 0;
+    }
+
+    float calcSnapshotDifference(const cv::Mat &image,
+                                 const ImgProc::Mask &imageMask,
+                                 size_t snapshot) const
+    {
+        return m_Raw.calcSnapshotDifference(image, imageMask, snapshot);
+    }
+
+    /*!
+     * \brief Calculate the RIDFs for a range of snapshots
+     *
+     * Column k of ridfs will contain the RMS differences between the snapshots
+     * and image, rolled left by k pixels.
+     */
+    void calcRIDFs(const cv::Mat &image, const ImgProc::Mask &mask,
+                   size_t firstSnapshot, size_t lastSnapshot,
+                   Eigen::MatrixXf &ridfs) const
+    {
+        BOB_ASSERT(image.size() == m_UnwrapRes);
+        BOB_ASSERT(image.type() == CV_8UC1);
+        BOB_ASSERT(mask.isValid(m_UnwrapRes));
+        BOB_ASSERT(lastSnapshot <= getNumSnapshots());
+
+        // Transform current view
+        const bool anyMasks = !mask.empty() || m_NumMaskedSnapshots > 0;
+        Spectra view;
+        calcSpectra(image, mask, anyMasks, view);
+
+        const size_t width = static_cast<size_t>(m_UnwrapRes.width);
+        ridfs.resize(lastSnapshot - firstSnapshot, width);
+        tbb::parallel_for(tbb::blocked_range<size_t>(firstSnapshot, lastSnapshot),
+            [&](const auto &r) {
+                static thread_local cv::Mat squaredDifferences, counts;
+                for (size_t s = r.begin(); s != r.end(); ++s) {
+                    const auto &snapshot = m_Spectra[s];
+                    if (view.mask.empty() && snapshot.mask.empty()) {
+                        calcUnmaskedSquaredDifferences(view, snapshot, squaredDifferences);
+                        for (size_t k = 0; k < width; k++) {
+                            ridfs(s - firstSnapshot, k) = rms(squaredDifferences.at<double>(k),
+                                                              m_UnwrapRes.area());
+                        }
+                    } else {
+                        calcMaskedSquaredDifferences(view, snapshot, s, squaredDifferences, counts);
+                        for (size_t k = 0; k < width; k++) {
+                            ridfs(s - firstSnapshot, k) = rms(squaredDifferences.at<double>(k),
+                                                              std::round(counts.at<double>(k)));
+                        }
+                    }
+                }
+            });
+    }
+
+private:
+    //! DFTs of a (masked) image, computed row by row
+    struct Spectra
+    {
+        cv::Mat image;          //!< DFT of masked image
+        cv::Mat squared;        //!< DFT of masked image squared (may be empty)
+        cv::Mat mask;           //!< DFT of mask (empty if unmasked)
+        double sumSquared = 0;  //!< Sum of masked image squared
+    };
+
+    //------------------------------------------------------------------------
+    // Private API
+    //------------------------------------------------------------------------
+    static void calcSpectra(const cv::Mat &image, const ImgProc::Mask &mask,
+                            bool withSquared, Spectra &spectra)
+    {
+        // NB: We need double precision to be able to recover the integer sums exactly
+        cv::Mat masked;
+        image.convertTo(masked, CV_64FC1);
+        if (!mask.empty()) {
+            cv::Mat maskDouble;
+            mask.get().convertTo(maskDouble, CV_64FC1, 1.0 / 255.0);
+            masked = masked.mul(maskDouble);
+            cv::dft(maskDouble, spectra.mask, cv::DFT_ROWS);
+        }
+
+        const cv::Mat squared = masked.mul(masked);
+        spectra.sumSquared = cv::sum(squared)[0];
+        cv::dft(masked, spectra.image, cv::DFT_ROWS);
+        if (withSquared) {
+            cv::dft(squared, spectra.squared, cv::DFT_ROWS);
+        }
+    }
+
+    /*
+     * Calculate the circular cross-correlation of two sets of images from the
+     * products of their spectra, summed over rows.
+     *
+     * Because the DFT is linear, we can add the spectra up before doing the
+     * (single) inverse DFT.
+     */
+    static void inverseRowSum(const cv::Mat &spectrumProducts, cv::Mat &out)
+    {
+        static thread_local cv::Mat rowSum;
+        cv::reduce(spectrumProducts, rowSum, 0, cv::REDUCE_SUM, CV_64FC1);
+        cv::dft(rowSum, out, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+    }
+
+    static void calcUnmaskedSquaredDifferences(const Spectra &view, const Spectra &snapshot,
+                                               cv::Mat &squaredDifferences)
+    {
+        static thread_local cv::Mat product;
+        cv::mulSpectrums(view.image, snapshot.image, product, cv::DFT_ROWS, /*conjB=*/true);
+        inverseRowSum(product, squaredDifferences);
+
+        // sum((I - S)^2) = sum(I^2) + sum(S^2) - 2 * corr(I, S)
+        squaredDifferences = view.sumSquared + snapshot.sumSquared - 2.0 * squaredDifferences;
+    }
+
+    void calcMaskedSquaredDifferences(const Spectra &view, const Spectra &snapshot,
+                                      size_t snapshotIndex, cv::Mat &squaredDifferences,
+                                      cv::Mat &counts) const
+    {
+        static thread_local cv::Mat accumulator, product, raw, snapshotSquared;
+
+        const cv::Mat &viewMask = view.mask.empty() ? m_OnesSpectrum : view.mask;
+        const cv::Mat &snapshotMask = snapshot.mask.empty() ? m_OnesSpectrum : snapshot.mask;
+
+        // We don't store the squared spectrum for unmasked snapshots, so calculate it on the fly
+        const cv::Mat *snapshotSquaredPtr = &snapshot.squared;
+        if (snapshot.squared.empty()) {
+            m_Raw.getSnapshot(snapshotIndex).first.convertTo(raw, CV_64FC1);
+            cv::multiply(raw, raw, raw);
+            cv::dft(raw, snapshotSquared, cv::DFT_ROWS);
+            snapshotSquaredPtr = &snapshotSquared;
+        }
+
+        // sum(m*M*(I - S)^2) = corr(m*I^2, M) + corr(m, M*S^2) - 2 * corr(m*I, M*S)
+        cv::mulSpectrums(view.squared, snapshotMask, accumulator, cv::DFT_ROWS, true);
+        cv::mulSpectrums(viewMask, *snapshotSquaredPtr, product, cv::DFT_ROWS, true);
+        accumulator += product;
+        cv::mulSpectrums(view.image, snapshot.image, product, cv::DFT_ROWS, true);
+        cv::scaleAdd(product, -2.0, accumulator, accumulator);
+        inverseRowSum(accumulator, squaredDifferences);
+
+        // Number of unmasked pixels = corr(m, M)
+        cv::mulSpectrums(viewMask, snapshotMask, product, cv::DFT_ROWS, true);
+        inverseRowSum(product, counts);
+    }
+
+    //! Calculate RMS difference in the same way as RMSDiff
+    static float rms(double squaredDifferences, double count)
+    {
+        return sqrtf(std::round(squaredDifferences) / (float) count);
+    }
+
+    //------------------------------------------------------------------------
+    // Members
+    //------------------------------------------------------------------------
+    const cv::Size m_UnwrapRes;
+    RawImage<RMSDiff> m_Raw;
+    std::vector<Spectra> m_Spectra;
+    size_t m_NumMaskedSnapshots = 0;
+    cv::Mat m_OnesSpectrum;
+}; // SpectralRaw
+} // PerfectMemoryStore
+} // Navigation
+} // BoBRobotics
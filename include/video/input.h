@@ -68,6 +68,40 @@ public:
      */
     virtual bool readGreyscaleFrame(cv::Mat &outFrame);
 
+    /*!
+     * \brief Try to read part of a frame in colour from this video source
+     *
+     * By default this reads a whole frame and outFrame is a view onto it, but
+     * cameras which can read only the region of interest override this.
+     *
+     * @return Whether a new frame was read
+     */
+    virtual bool readFrameROI(const cv::Rect &roi, cv::Mat &outFrame);
+
+    //! Try to read part of a frame in greyscale from this video source
+    virtual bool readGreyscaleFrameROI(const cv::Rect &roi, cv::Mat &outFrame);
+
+    /*!
+     * \brief Set the resolution of frames from readUnwrappedFrame()
+     *
+     * This creates an unwrapper (see createUnwrapper()) which reads only the
+     * part of each frame which is actually unwrapped.
+     */
+    void setUnwrapResolution(const cv::Size &unwrapRes);
+
+    /*!
+     * \brief Try to read an unwrapped frame in colour from this video source
+     *
+     * Only the bounding box of the unwrapped annulus is read from the camera
+     * (see readFrameROI()). setUnwrapResolution() must be called first.
+     *
+     * @return Whether a new frame was read
+     */
+    bool readUnwrappedFrame(cv::Mat &outFrame);
+
+    //! Try to read an unwrapped frame in greyscale from this video source
+    bool readUnwrappedGreyscaleFrame(cv::Mat &outFrame);
+
     //! Read a frame synchronously, blocking until a new frame is received
     void readFrameSync(cv::Mat &outFrame);
 
@@ -79,7 +113,9 @@ public:
     static constexpr const char *DefaultCameraName = "unknown_camera";
 
 private:
-    cv::Mat m_IntermediateFrame;
+    cv::Mat m_IntermediateFrame, m_FullFrame, m_ROIFrame;
+    ImgProc::OpenCVUnwrap360 m_Unwrapper;
+    cv::Rect m_UnwrapROI;
 }; // Input
 
 //! More OpenCV boilerplate
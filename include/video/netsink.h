@@ -4,9 +4,13 @@
 #include "common/semaphore.h"
 #include "net/connection.h"
 #include "input.h"
+#include "netstream.h"
 
 // Standard C++ includes
 #include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -16,10 +20,26 @@ namespace Video {
 //----------------------------------------------------------------------------
 // BoBRobotics::Video::NetSink
 //----------------------------------------------------------------------------
-//! Object for sending video frames synchronously or asynchronously over network
+/*!
+ * \brief Object for sending video frames synchronously or asynchronously over network
+ *
+ * By default, each frame is JPEG-encoded and sent before the next one is
+ * read. If NetSource requests streaming (see NetStreamOptions), frames are
+ * instead encoded and sent on a separate thread, with a binary header giving
+ * their sequence number and capture time. If the network can't keep up,
+ * frames which haven't been encoded yet are replaced by newer ones, so the
+ * receiver always gets the most recent frame available.
+ */
 class NetSink
 {
 public:
+    //! Statistics for streaming mode
+    struct StreamStats
+    {
+        size_t framesSent = 0;
+        size_t framesDropped = 0; //!< Frames replaced by newer ones before being sent
+    };
+
     /*!
      * \brief Create a NetSink for asynchronous operation
      *
@@ -47,6 +67,11 @@ public:
     //! Send a frame over the network (when operating in synchronous mode)
     void sendFrame(const cv::Mat &frame);
 
+    //! Whether the receiver has requested streaming mode
+    bool isStreaming() const { return m_Encoder != nullptr; }
+
+    StreamStats getStreamStats() const;
+
 private:
     //----------------------------------------------------------------------------
     // Private methods
@@ -61,6 +86,11 @@ private:
 
     void runAsync();
 
+    //! Hand a frame to the encoder thread, replacing any it hasn't got to yet
+    void postFrame(const cv::Mat &frame);
+
+    void runEncoder();
+
     //----------------------------------------------------------------------------
     // Members
     //----------------------------------------------------------------------------
@@ -72,6 +102,18 @@ private:
     const cv::Size m_FrameSize;
     Input *m_Input;
     std::atomic<bool> m_DoRun{ true };
+
+    // Streaming mode
+    std::unique_ptr<NetStreamEncoder> m_Encoder;
+    std::thread m_EncoderThread;
+    std::mutex m_PendingMutex;
+    std::condition_variable m_PendingCondition;
+    cv::Mat m_PendingFrame, m_EncodingFrame;
+    int64_t m_PendingTimestamp;
+    uint32_t m_PendingSequence, m_NextSequence = 0;
+    bool m_HasPendingFrame = false;
+    std::vector<uchar> m_StreamBuffer;
+    std::atomic<size_t> m_FramesSent{ 0 }, m_FramesDropped{ 0 };
 };
 } // Video
 } // BoBRobotics
@@ -4,9 +4,11 @@
 #include "common/semaphore.h"
 #include "net/connection.h"
 #include "input.h"
+#include "netstream.h"
 
 // Standard C++ includes
 #include <atomic>
+#include <chrono>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -20,6 +22,15 @@ namespace Video {
 class NetSource : public Input
 {
 public:
+    //! Statistics for streaming mode
+    struct StreamStats
+    {
+        size_t framesReceived = 0;
+        size_t framesDropped = 0;            //!< Inferred from gaps in sequence numbers
+        std::chrono::microseconds latency{}; //!< From capture to decoding, for the latest frame
+        std::chrono::microseconds meanLatency{};
+    };
+
     /*!
      * \brief Create an object to read video transmitted over the network
      *
@@ -27,6 +38,17 @@ public:
      */
     NetSource(Net::Connection &connection);
 
+    /*!
+     * \brief Create an object to read video streamed over the network
+     *
+     * Latencies are only meaningful if the sender's and receiver's clocks are
+     * synchronised (e.g. with NTP).
+     *
+     * @param node The network connection from which to read images
+     * @param options Codec etc. for NetSink to use
+     */
+    NetSource(Net::Connection &connection, const NetStreamOptions &options);
+
     virtual ~NetSource() override;
 
     virtual std::string getCameraName() const override;
@@ -37,6 +59,8 @@ public:
 
     virtual bool readFrame(cv::Mat &frame) override;
 
+    StreamStats getStreamStats() const;
+
 private:
     cv::Mat m_Frame;
     mutable Semaphore m_ParamsSemaphore;
@@ -44,9 +68,18 @@ private:
     std::string m_CameraName = DefaultCameraName;
     Net::Connection &m_Connection;
     cv::Size m_CameraResolution;
-    std::mutex m_FrameMutex;
+    mutable std::mutex m_FrameMutex;
     std::atomic<bool> m_NewFrame{ false };
 
+    // Streaming mode
+    NetStreamDecoder m_Decoder;
+    cv::Mat m_DecodedFrame;
+    StreamStats m_Stats;
+    std::chrono::microseconds m_TotalLatency{};
+    uint32_t m_LastSequence = 0;
+
+    void onStreamFrameReceived(Net::Connection &connection, size_t nbytes);
+
     void onCommandReceived(Net::Connection &connection,
                            const Net::Command &command);
 }; // NetSource
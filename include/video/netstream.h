@@ -0,0 +1,110 @@
+#pragma once
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+// Standard C includes
+#include <cstdint>
+
+// Standard C++ includes
+#include <string>
+#include <vector>
+
+namespace BoBRobotics {
+namespace Video {
+
+//! Codecs which NetSink can use for streaming video
+enum class NetStreamCodec : uint8_t
+{
+    RawGreyscale = 0, //!< Uncompressed greyscale
+    JPEG = 1,         //!< JPEG, with configurable quality
+    Delta = 2         //!< XOR against the previous frame, run-length encoded
+};
+
+//! Get the name of a codec, as used in the IMG START command
+std::string getNetStreamCodecName(NetStreamCodec codec);
+
+//! Get a codec from its name, throwing std::invalid_argument if there isn't one
+NetStreamCodec parseNetStreamCodec(const std::string &name);
+
+//! Microseconds since the epoch, for timestamping streamed frames
+int64_t getNetStreamTimestamp();
+
+//----------------------------------------------------------------------------
+// BoBRobotics::Video::NetStreamOptions
+//----------------------------------------------------------------------------
+//! Streaming options, which NetSource sends to NetSink when it connects
+struct NetStreamOptions
+{
+    NetStreamCodec codec = NetStreamCodec::JPEG;
+
+    //! JPEG quality (0-100)
+    int quality = 80;
+
+    //! For the delta codec, how often to send a full frame
+    unsigned int keyframeInterval = 30;
+};
+
+//----------------------------------------------------------------------------
+// BoBRobotics::Video::NetStreamFrameHeader
+//----------------------------------------------------------------------------
+//! Binary header preceding each streamed frame (in host byte order)
+struct NetStreamFrameHeader
+{
+    uint32_t sequence;     //!< Incremented for every frame captured, so gaps mean dropped frames
+    NetStreamCodec codec;
+    uint8_t channels;
+    uint8_t keyframe;      //!< Whether frame can be decoded without the previous one
+    uint8_t reserved;
+    uint16_t width, height;
+    uint32_t payloadSize;
+    int64_t timestamp;     //!< When the frame was captured (see getNetStreamTimestamp())
+};
+
+//----------------------------------------------------------------------------
+// BoBRobotics::Video::NetStreamEncoder
+//----------------------------------------------------------------------------
+//! Encodes frames for streaming by NetSink
+class NetStreamEncoder
+{
+public:
+    explicit NetStreamEncoder(const NetStreamOptions &options);
+
+    /*!
+     * \brief Encode a CV_8UC1 or CV_8UC3 frame
+     *
+     * A NetStreamFrameHeader followed by the encoded frame is appended to buffer.
+     */
+    void encode(const cv::Mat &frame, uint32_t sequence, int64_t timestamp,
+                std::vector<uchar> &buffer);
+
+    const NetStreamOptions &getOptions() const { return m_Options; }
+
+private:
+    const NetStreamOptions m_Options;
+    cv::Mat m_Frame, m_Previous;
+    std::vector<uchar> m_Scratch;
+    unsigned int m_FramesSinceKeyframe = 0;
+};
+
+//----------------------------------------------------------------------------
+// BoBRobotics::Video::NetStreamDecoder
+//----------------------------------------------------------------------------
+//! Decodes frames encoded with NetStreamEncoder
+class NetStreamDecoder
+{
+public:
+    /*!
+     * \brief Decode a header and frame
+     *
+     * Frames must be decoded in the order they were encoded. Returns false
+     * if this is a delta frame and the frame it is relative to is missing.
+     */
+    bool decode(const uchar *data, size_t size, NetStreamFrameHeader &header,
+                cv::Mat &frame);
+
+private:
+    cv::Mat m_Previous;
+};
+} // Video
+} // BoBRobotics
@@ -37,6 +37,15 @@ public:
         _2688x1520 = (2688ULL | (1520ULL << 32)),
     };
 
+    //! Ways of converting the sensor's 10-bit values to 8-bit colour
+    enum class SuperPixelMode
+    {
+        Scale,       //!< Divide by 4
+        Clamp,       //!< Clamp at 255 (as the qtcam example does)
+        WBCoolWhite, //!< White balance for cool white lighting
+        WBU30        //!< White balance for U30 lighting
+    };
+
     See3CAM_CU40();
     See3CAM_CU40(const std::string &device,
                  Resolution res,
@@ -48,6 +57,8 @@ public:
     virtual std::string getCameraName() const override;
     virtual bool readFrame(cv::Mat &outFrame) override;
     virtual bool readGreyscaleFrame(cv::Mat &outFrame) override;
+    virtual bool readFrameROI(const cv::Rect &roi, cv::Mat &outFrame) override;
+    virtual bool readGreyscaleFrameROI(const cv::Rect &roi, cv::Mat &outFrame) override;
     virtual cv::Size getOutputSize() const override;
 
     //------------------------------------------------------------------------
@@ -90,106 +101,32 @@ public:
     //------------------------------------------------------------------------
     static cv::Mat createBubblescopeMask(const cv::Size &camRes);
 
-private:
-    //------------------------------------------------------------------------
-    // PixelScale
-    //------------------------------------------------------------------------
-    // Converts 10-bit intensity values to 8-bit by dividing by 4
-    class PixelScale
-    {
-    public:
-        static uint8_t getR(uint16_t r, uint16_t, uint16_t);
-        static uint8_t getG(uint16_t, uint16_t g, uint16_t);
-        static uint8_t getB(uint16_t, uint16_t, uint16_t b);
-
-    private:
-        static uint8_t getScaled(uint16_t v);
-    };
-
-    //------------------------------------------------------------------------
-    // PixelClamp
-    //------------------------------------------------------------------------
-    // Converts 10-bit intensity values to 8-bit by clamping at 255
-    // **NOTE** this is dubious but a)Is what the qtcam example does and b)Can
-    // LOOK nicer than PixelScale
-    class PixelClamp
-    {
-    public:
-        static uint8_t getR(uint16_t r, uint16_t, uint16_t);
-        static uint8_t getG(uint16_t, uint16_t g, uint16_t);
-        static uint8_t getB(uint16_t, uint16_t, uint16_t b);
-
-    private:
-        static uint8_t getClamped(uint16_t v);
-    };
-
-    //------------------------------------------------------------------------
-    // WhiteBalanceCoolWhite
-    //------------------------------------------------------------------------
-    class WhiteBalanceCoolWhite
-    {
-    public:
-        static uint8_t getR(uint16_t r, uint16_t, uint16_t);
-        static uint8_t getG(uint16_t, uint16_t g, uint16_t);
-        static uint8_t getB(uint16_t, uint16_t, uint16_t b);
-    };
-
-    //------------------------------------------------------------------------
-    // WhiteBalanceU30
-    //------------------------------------------------------------------------
-    class WhiteBalanceU30
-    {
-    public:
-        static uint8_t getR(uint16_t r, uint16_t, uint16_t);
-        static uint8_t getG(uint16_t, uint16_t g, uint16_t);
-        static uint8_t getB(uint16_t, uint16_t, uint16_t b);
-    };
+    /*!
+     * \brief Convert raw Bayer data to BGR super-pixels
+     *
+     * Each 2x2 block of the sensor's BG/IR-R pattern becomes one pixel.
+     *
+     * @param bayer Raw frame (CV_16UC1) at full sensor resolution
+     * @param output Output image, which will be roi.size()
+     * @param mode How to convert 10-bit sensor values to 8-bit
+     * @param roi Region to convert, in super-pixels (empty for the whole frame)
+     * @param vectorise Whether to use SIMD instructions, if available (the
+     *        results are identical; this is for testing and benchmarking)
+     */
+    static void convertSuperPixel(const cv::Mat &bayer, cv::Mat &output,
+                                  SuperPixelMode mode, cv::Rect roi = {},
+                                  bool vectorise = true);
+
+    //! Convert raw Bayer data to greyscale super-pixels (see convertSuperPixel())
+    static void convertSuperPixelGreyscale(const cv::Mat &bayer, cv::Mat &output,
+                                           cv::Rect roi = {}, bool vectorise = true);
 
+private:
     //------------------------------------------------------------------------
     // Private API
     //------------------------------------------------------------------------
-    template<typename T>
-    void captureSuperPixel(cv::Mat &output)
-    {
-        // Check that output size is suitable for super-pixel output i.e. a
-        // quarter input size
-        const unsigned int inputWidth = getWidth();
-        const unsigned int inputHeight = getHeight();
-        BOB_ASSERT(output.cols == (int) inputWidth / 2);
-        BOB_ASSERT(output.rows == (int) inputHeight / 2);
-        BOB_ASSERT(output.type() == CV_8UC3);
-
-        // Read data and size (in bytes) from camera
-        // **NOTE** these pointers are only valid within one frame
-        void *data = nullptr;
-        uint32_t sizeBytes = Video4LinuxCamera::capture(data);
-
-        // Check frame size is correct
-        BOB_ASSERT(sizeBytes == (inputWidth * inputHeight * sizeof(uint16_t)));
-        const uint16_t *bayerData = reinterpret_cast<uint16_t *>(data);
-
-        // Loop through bayer pixels
-        for (unsigned int y = 0; y < inputHeight; y += 2) {
-            // Get pointers to start of both rows of Bayer data and output
-            // RGB data
-            const uint16_t *inBG16Start = &bayerData[y * inputWidth];
-            const uint16_t *inR16Start =
-                    &bayerData[((y + 1) * inputWidth) + 1];
-            uint8_t *outRGBStart = output.ptr(y / 2);
-            for (unsigned int x = 0; x < inputWidth; x += 2) {
-                // Read Bayer pixels
-                const uint16_t b = *(inBG16Start++);
-                const uint16_t g = *(inBG16Start++);
-                const uint16_t r = *inR16Start;
-                inR16Start += 2;
-
-                // Write back to BGR
-                *(outRGBStart++) = T::getB(r, g, b);
-                *(outRGBStart++) = T::getG(r, g, b);
-                *(outRGBStart++) = T::getR(r, g, b);
-            }
-        }
-    }
+    void captureSuperPixel(cv::Mat &output, SuperPixelMode mode, const cv::Rect &roi);
+    void captureSuperPixelGreyscale(cv::Mat &output, const cv::Rect &roi);
 
     //------------------------------------------------------------------------
     // Members
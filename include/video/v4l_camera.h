@@ -1,10 +1,14 @@
 #pragma once
 #ifdef __linux__
 
+// OpenCV includes
+#include <opencv2/core.hpp>
+
 // Standard C++ includes
 #include <functional>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 // Standard C includes
 #include <cstdint>
@@ -17,7 +21,12 @@ namespace Video {
 //------------------------------------------------------------------------
 // BoBRobotics::Video::Video4LinuxCamera
 //------------------------------------------------------------------------
-//! An interface for the low-level Video4Linux API
+/*!
+ * \brief An interface for the low-level Video4Linux API
+ *
+ * A ring of buffers is mmap'd and all of them are queued with the driver up
+ * front, so the camera can keep capturing while we process earlier frames.
+ */
 class Video4LinuxCamera
 {
 public:
@@ -28,11 +37,53 @@ public:
         Error(const std::string &msg);
     };
 
+    /*!
+     * \brief A frame lent out from the camera's buffers, without copying
+     *
+     * The buffer is given back to the driver when this object is destroyed or
+     * release() is called, so don't hang on to it for longer than needed (and
+     * never for longer than the camera object).
+     */
+    class Frame
+    {
+    public:
+        Frame() = default;
+        Frame(Frame &&other) noexcept;
+        Frame &operator=(Frame &&other) noexcept;
+        ~Frame();
+
+        Frame(const Frame &) = delete;
+        Frame &operator=(const Frame &) = delete;
+
+        //! A view onto the buffer (rows x columns for uncompressed formats)
+        const cv::Mat &getMat() const { return m_Mat; }
+
+        const void *data() const { return m_Mat.data; }
+
+        //! Number of bytes of image data
+        uint32_t size() const { return m_BytesUsed; }
+
+        bool empty() const { return m_Camera == nullptr; }
+
+        //! Give the buffer back to the driver now
+        void release();
+
+    private:
+        friend class Video4LinuxCamera;
+        Video4LinuxCamera *m_Camera = nullptr;
+        unsigned int m_Index = 0;
+        uint32_t m_BytesUsed = 0;
+        cv::Mat m_Mat;
+
+        Frame(Video4LinuxCamera &camera, unsigned int index, uint32_t bytesUsed, cv::Mat mat);
+    };
+
     Video4LinuxCamera();
     Video4LinuxCamera(const std::string &device,
                       unsigned int width,
                       unsigned int height,
-                      uint32_t pixelFormat);
+                      uint32_t pixelFormat,
+                      unsigned int numBuffers = DefaultNumBuffers);
     ~Video4LinuxCamera();
 
     //------------------------------------------------------------------------
@@ -41,26 +92,73 @@ public:
     void open(const std::string &device,
               unsigned int width,
               unsigned int height,
-              uint32_t pixelFormat);
+              uint32_t pixelFormat,
+              unsigned int numBuffers = DefaultNumBuffers);
     void enumerateControls(const std::function<void(const v4l2_queryctrl &)> &processControl);
     void queryControl(uint32_t id, v4l2_queryctrl &queryControl);
+
+    /*!
+     * \brief Wait for a frame and lend it out
+     *
+     * If several frames are waiting, the older ones are skipped, so this
+     * always gives the most recent frame.
+     */
+    Frame captureFrame();
+
+    //! As captureFrame(), but give up after timeoutMs milliseconds
+    bool tryCaptureFrame(Frame &frame, int timeoutMs = 0);
+
+    /*!
+     * \brief Capture a frame, returning a pointer to the raw data and its size
+     *
+     * **NOTE** the pointer is only valid until the next call to capture()
+     */
     uint32_t capture(void *&buffer);
+
     int32_t getControlValue(uint32_t id) const;
     void setControlValue(uint32_t id, int32_t value);
 
+    //! Number of buffers in the ring (may differ from the number requested)
+    size_t getNumBuffers() const { return m_Buffers.size(); }
+
+    static constexpr unsigned int DefaultNumBuffers = 4;
+
 private:
+    struct Buffer
+    {
+        void *data;
+        size_t length;
+    };
+
+    //------------------------------------------------------------------------
+    // Private API
+    //------------------------------------------------------------------------
+    void openDevice(const std::string &device,
+                    unsigned int width,
+                    unsigned int height,
+                    uint32_t pixelFormat,
+                    unsigned int numBuffers);
+    bool dequeueLatest(v4l2_buffer &bufferInfo);
+    void enqueue(unsigned int index);
+    void close();
+
     //------------------------------------------------------------------------
     // Members
     //------------------------------------------------------------------------
     // File handle to camera
     int m_Camera;
 
-    // Index of current frame - used to select correct buffer
-    unsigned int m_Frame;
+    // epoll instance used to wait for frames
+    int m_Epoll;
+
+    // Format the driver actually gave us
+    v4l2_pix_format m_Format;
+
+    // mmap'd buffers
+    std::vector<Buffer> m_Buffers;
 
-    // Two buffers and their corresponding information structures
-    void *m_Buffer[2];
-    v4l2_buffer m_BufferInfo[2];
+    // Frame returned by capture()
+    Frame m_CapturedFrame;
 }; // Video4LinuxCamera
 } // Video
 } // BoBRobotics
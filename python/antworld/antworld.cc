@@ -15,15 +15,39 @@ using namespace BoBRobotics;
 
 struct AgentObjectData
 {
-    AgentObjectData(const cv::Size &renderSize)
-      : window{ AntWorld::AntAgent::initialiseWindow(renderSize) }
-      , renderer(256, 0.001, 1000.0, 360_deg)
-      , agent(*window, renderer, renderSize)
-    {}
+    AgentObjectData(const cv::Size &renderSize, bool headless, int device, bool raycast)
+      : window{ (headless || raycast) ? nullptr : AntWorld::AntAgent::initialiseWindow(renderSize) }
+      , context{ (headless && !raycast) ? AntWorld::AntAgent::initialiseHeadlessContext(renderSize, device) : nullptr }
+    {
+        if (raycast) {
+            rayCaster = std::make_unique<AntWorld::RayCaster>(360_deg, 75_deg, 0.001, 1000.0);
+            agent = std::make_unique<AntWorld::AntAgent>(*rayCaster, renderSize);
+        } else {
+            // **NOTE** Renderer needs a current OpenGL context, so create it after window or context
+            renderer = std::make_unique<AntWorld::Renderer>(256, 0.001, 1000.0, 360_deg);
+            if (headless) {
+                agent = std::make_unique<AntWorld::AntAgent>(*context, *renderer, renderSize);
+            } else {
+                agent = std::make_unique<AntWorld::AntAgent>(*window, *renderer, renderSize);
+            }
+        }
+    }
+
+    // Several agents may exist at once, so make sure we upload data to the right context
+    void makeCurrent()
+    {
+        if (context) {
+            context->makeCurrent();
+        } else if (window) {
+            window->setActive(true);
+        }
+    }
 
     std::unique_ptr<sf::Window> window;
-    AntWorld::Renderer renderer;
-    AntWorld::AntAgent agent;
+    std::unique_ptr<AntWorld::HeadlessContext> context;
+    std::unique_ptr<AntWorld::Renderer> renderer;
+    std::unique_ptr<AntWorld::RayCaster> rayCaster;
+    std::unique_ptr<AntWorld::AntAgent> agent;
 };
 
 struct AgentObject
@@ -35,17 +59,20 @@ struct AgentObject
 };
 
 static PyObject *
-Agent_new(PyTypeObject *type, PyObject *args, PyObject * /*kwds*/)
+Agent_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
+    static const char *keywords[] = { "width", "height", "headless", "device", "raycast", nullptr };
     int width, height;
-    if (!PyArg_ParseTuple(args, "ii", &width, &height))
+    int headless = 0, device = -1, raycast = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ii|pip", const_cast<char **>(keywords),
+                                     &width, &height, &headless, &device, &raycast))
         return nullptr;
 
     PyObject *self = type->tp_alloc(type, 0);
     if (!self)
         return nullptr;
     try {
-        auto data = new AgentObjectData({ width, height });
+        auto data = new AgentObjectData({ width, height }, headless, device, raycast);
         reinterpret_cast<AgentObject *>(self)->members = data;
     } catch (std::exception &e) {
         Py_DECREF(self);
@@ -74,17 +101,30 @@ Agent_load_world(AgentObject *self, PyObject *args)
         return nullptr;
     }
 
-    auto &world = self->members->renderer.getWorld();
+    auto &members = *self->members;
     try {
         const filesystem::path filepath = filepath_c;
         const auto ext = filepath.extension();
-        if (ext == "bin") {
-            // Load with default world and ground colours
-            world.load(filepath, { 0.0f, 1.0f, 0.0f }, { 0.898f, 0.718f, 0.353f });
-        } else if (ext == "obj") {
-            world.loadObj(filepath);
-        } else {
+
+        // Load with default world and ground colours
+        const float worldColour[3] = { 0.0f, 1.0f, 0.0f };
+        const float groundColour[3] = { 0.898f, 0.718f, 0.353f };
+        if (ext != "bin" && ext != "obj") {
             throw std::runtime_error{ "Unknown file type" };
+        } else if (members.rayCaster) {
+            if (ext == "bin") {
+                members.rayCaster->load(filepath, worldColour, groundColour);
+            } else {
+                members.rayCaster->loadObj(filepath);
+            }
+        } else {
+            members.makeCurrent();
+            auto &world = members.renderer->getWorld();
+            if (ext == "bin") {
+                world.load(filepath, worldColour, groundColour);
+            } else {
+                world.loadObj(filepath);
+            }
         }
     } catch (std::exception &e) {
         PyErr_SetString(PyExc_RuntimeError, e.what());
@@ -92,8 +132,8 @@ Agent_load_world(AgentObject *self, PyObject *args)
     }
 
     // Return world limits as a tuple of tuples: (xlim, ylim, zlim) = ...
-    const auto &worldMin = world.getMaxBound();
-    const auto &worldMax = world.getMinBound();
+    const auto &worldMin = members.rayCaster ? members.rayCaster->getMaxBound() : members.renderer->getWorld().getMaxBound();
+    const auto &worldMax = members.rayCaster ? members.rayCaster->getMinBound() : members.renderer->getWorld().getMinBound();
     auto xlim = PyTuple_New(2);
     PyTuple_SET_ITEM(xlim, 1, PyFloat_FromDouble(worldMin.x().value()));
     PyTuple_SET_ITEM(xlim, 0, PyFloat_FromDouble(worldMax.x().value()));
@@ -114,7 +154,7 @@ Agent_load_world(AgentObject *self, PyObject *args)
 static PyObject *
 Agent_read_frame(AgentObject *self, PyObject *)
 {
-    const auto size = self->members->agent.getOutputSize();
+    const auto size = self->members->agent->getOutputSize();
 
     // Allocate new numpy array
     npy_intp dims[3] = { size.height, size.width, 3 };
@@ -126,7 +166,7 @@ Agent_read_frame(AgentObject *self, PyObject *)
         // A cv::Mat wrapper for the allocated data
         auto data = PyArray_DATA(reinterpret_cast<PyArrayObject *>(array));
         cv::Mat frame{ size.height, size.width, CV_8UC3, data };
-        self->members->agent.readFrameSync(frame);
+        self->members->agent->readFrameSync(frame);
         BOB_ASSERT(frame.type() == CV_8UC3);
     } catch (std::exception &e) {
         Py_DECREF(array);
@@ -141,7 +181,7 @@ Agent_read_frame(AgentObject *self, PyObject *)
 static PyObject *
 Agent_read_frame_greyscale(AgentObject *self, PyObject *)
 {
-    const auto size = self->members->agent.getOutputSize();
+    const auto size = self->members->agent->getOutputSize();
 
     // Allocate new numpy array
     npy_intp dims[2] = { size.height, size.width };
@@ -153,7 +193,7 @@ Agent_read_frame_greyscale(AgentObject *self, PyObject *)
         // A cv::Mat wrapper for the allocated data
         auto data = PyArray_DATA(reinterpret_cast<PyArrayObject *>(array));
         cv::Mat frame{ size.height, size.width, CV_8UC1, data };
-        self->members->agent.readGreyscaleFrameSync(frame);
+        self->members->agent->readGreyscaleFrameSync(frame);
         BOB_ASSERT(frame.type() == CV_8UC1);
     } catch (std::exception &e) {
         Py_DECREF(array);
@@ -176,7 +216,7 @@ Agent_set_position(AgentObject *self, PyObject *args)
     }
 
     // Assume no exceptions thrown
-    self->members->agent.setPosition(meter_t{ x }, meter_t{ y }, meter_t{ z });
+    self->members->agent->setPosition(meter_t{ x }, meter_t{ y }, meter_t{ z });
 
     Py_RETURN_NONE;
 }
@@ -192,7 +232,7 @@ Agent_set_attitude(AgentObject *self, PyObject *args)
     }
 
     // Assume no exceptions thrown
-    self->members->agent.setAttitude(degree_t{ yaw }, degree_t{ pitch }, degree_t{ roll });
+    self->members->agent->setAttitude(degree_t{ yaw }, degree_t{ pitch }, degree_t{ roll });
 
     Py_RETURN_NONE;
 }
@@ -200,7 +240,7 @@ Agent_set_attitude(AgentObject *self, PyObject *args)
 static PyObject *
 Agent_display(AgentObject *self, PyObject *)
 {
-    self->members->agent.display();
+    self->members->agent->display();
     Py_RETURN_NONE;
 }
 
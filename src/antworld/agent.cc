@@ -24,6 +24,25 @@ AntAgent::AntAgent(sf::Window &window,
   , m_TurnSpeed(turnSpeed)
 {}
 
+AntAgent::AntAgent(HeadlessContext &context,
+                   Renderer &renderer,
+                   const cv::Size &renderSize,
+                   meters_per_second_t velocity,
+                   radians_per_second_t turnSpeed)
+  : Camera(context, renderer, renderSize)
+  , m_Velocity(velocity)
+  , m_TurnSpeed(turnSpeed)
+{}
+
+AntAgent::AntAgent(const RayCaster &rayCaster,
+                   const cv::Size &renderSize,
+                   meters_per_second_t velocity,
+                   radians_per_second_t turnSpeed)
+  : Camera(rayCaster, renderSize)
+  , m_Velocity(velocity)
+  , m_TurnSpeed(turnSpeed)
+{}
+
 void
 AntAgent::moveForward(float speed)
 {
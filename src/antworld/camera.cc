@@ -1,9 +1,13 @@
 // BoB robotics includes
 #include "antworld/camera.h"
+#include "common/macros.h"
 
 // Third-party includes
 #include "plog/Log.h"
 
+// Standard C++ includes
+#include <mutex>
+
 void
 handleGLError(GLenum, GLenum, GLuint, GLenum severity, GLsizei, const GLchar *message, const void *)
 {
@@ -26,8 +30,30 @@ namespace AntWorld {
 
 Camera::Camera(sf::Window &window, Renderer &renderer, const cv::Size &renderSize)
   : Video::OpenGL(renderSize)
-  , m_Window(window)
-  , m_Renderer(renderer)
+  , m_Window(&window)
+  , m_Context(nullptr)
+  , m_Renderer(&renderer)
+  , m_RayCaster(nullptr)
+{}
+
+Camera::Camera(HeadlessContext &context, Renderer &renderer, const cv::Size &renderSize)
+  : Video::OpenGL(renderSize)
+  , m_Window(nullptr)
+  , m_Context(&context)
+  , m_Renderer(&renderer)
+  , m_RayCaster(nullptr)
+{
+    // We read frames from the context's default framebuffer
+    BOB_ASSERT(renderSize.width <= context.getSize().width);
+    BOB_ASSERT(renderSize.height <= context.getSize().height);
+}
+
+Camera::Camera(const RayCaster &rayCaster, const cv::Size &renderSize)
+  : Video::OpenGL(renderSize)
+  , m_Window(nullptr)
+  , m_Context(nullptr)
+  , m_Renderer(nullptr)
+  , m_RayCaster(&rayCaster)
 {}
 
 Pose3<units::length::meter_t, units::angle::degree_t>
@@ -39,7 +65,14 @@ Camera::getPose() const
 sf::Window &
 Camera::getWindow() const
 {
-    return m_Window;
+    BOB_ASSERT(m_Window);
+    return *m_Window;
+}
+
+bool
+Camera::isHeadless() const
+{
+    return m_Window == nullptr;
 }
 
 void
@@ -63,6 +96,14 @@ Camera::setAttitude(degree_t yaw, degree_t pitch, degree_t roll)
 bool
 Camera::readFrame(cv::Mat &frame)
 {
+    // Ray caster renders straight into frame
+    if (m_RayCaster) {
+        m_RayCaster->renderPanoramicView(m_Pose.x(), m_Pose.y(), m_Pose.z(),
+                                         m_Pose.yaw(), m_Pose.pitch(), m_Pose.roll(),
+                                         getOutputSize(), frame);
+        return true;
+    }
+
     // Render
     update();
 
@@ -70,7 +111,9 @@ Camera::readFrame(cv::Mat &frame)
     Video::OpenGL::readFrame(frame);
 
     // Swap buffers
-    m_Window.display();
+    if (m_Window) {
+        m_Window->display();
+    }
 
     return true;
 }
@@ -78,31 +121,44 @@ Camera::readFrame(cv::Mat &frame)
 void
 Camera::display()
 {
+    // There's nothing to display without OpenGL
+    if (m_RayCaster) {
+        return;
+    }
+
     // Render
     update();
 
-    // Swap buffers
-    m_Window.display();
+    // Swap buffers (headless contexts are single-buffered)
+    if (m_Window) {
+        m_Window->display();
+    } else {
+        glFlush();
+    }
 }
 
 void
 Camera::update()
 {
-    // Render to m_Window
-    m_Window.setActive(true);
+    // Render to m_Window or our offscreen context
+    if (m_Window) {
+        m_Window->setActive(true);
+    } else {
+        m_Context->makeCurrent();
+    }
 
     // Clear colour and depth buffer
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Render first person
     const auto size = getOutputSize();
-    m_Renderer.renderPanoramicView(m_Pose.x(), m_Pose.y(), m_Pose.z(), m_Pose.yaw(), m_Pose.pitch(), m_Pose.roll(), 0, 0, size.width, size.height);
+    m_Renderer->renderPanoramicView(m_Pose.x(), m_Pose.y(), m_Pose.z(), m_Pose.yaw(), m_Pose.pitch(), m_Pose.roll(), 0, 0, size.width, size.height);
 }
 
 bool
 Camera::isOpen() const
 {
-    return m_Window.isOpen();
+    return !m_Window || m_Window->isOpen();
 }
 
 std::unique_ptr<sf::Window>
@@ -117,9 +173,37 @@ Camera::initialiseWindow(const cv::Size &size)
     window->setVerticalSyncEnabled(true);
     window->setActive(true);
 
+    initialiseGL();
+    return window;
+}
+
+std::unique_ptr<HeadlessContext>
+Camera::initialiseHeadlessContext(const cv::Size &size, int deviceIndex)
+{
+    auto context = std::make_unique<HeadlessContext>(size, deviceIndex);
+    initialiseGL();
+    return context;
+}
+
+void
+Camera::initialiseGL()
+{
     // Initialize GLEW
-    if (glewInit() != GLEW_OK) {
-        throw std::runtime_error("Failed to initialize GLEW");
+    // **NOTE** GLEW's function pointers are global, so don't let several
+    // threads initialise their contexts at once
+    static std::mutex glewMutex;
+    {
+        std::lock_guard<std::mutex> lock(glewMutex);
+        GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+        // GLX builds of GLEW complain about EGL contexts, but will still have loaded GL itself
+        if (err == GLEW_ERROR_NO_GLX_DISPLAY && glGenFramebuffers) {
+            err = GLEW_OK;
+        }
+#endif
+        if (err != GLEW_OK) {
+            throw std::runtime_error("Failed to initialize GLEW");
+        }
     }
 
     glDebugMessageCallback(handleGLError, nullptr);
@@ -134,8 +218,6 @@ Camera::initialiseWindow(const cv::Size &size)
     glCullFace(GL_BACK);
 
     glEnable(GL_TEXTURE_2D);
-
-    return window;
 }
 
 } // AntWorld
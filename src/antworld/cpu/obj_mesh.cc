@@ -0,0 +1,939 @@
+// BoB robotics includes
+#include "antworld/obj_mesh.h"
+#include "common/macros.h"
+#include "common/memory_mapped_file.h"
+#include "plog/Log.h"
+
+// Third-party includes
+#include "third_party/path.h"
+
+// POSIX includes
+#include <sys/stat.h>
+
+// Standard C includes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Standard C++ includes
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+//----------------------------------------------------------------------------
+// Anonymous namespace
+//----------------------------------------------------------------------------
+namespace
+{
+constexpr char CacheMagic[8] = "BoBMESH";
+constexpr uint32_t CacheVersion = 1;
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    float scale;
+    uint32_t numDependencies;
+    uint32_t numMaterials;
+    uint32_t numSurfaces;
+    uint32_t reserved;
+    float minBound[3];
+    float maxBound[3];
+};
+
+// Powers of ten which can be represented exactly as doubles
+constexpr double ExactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//----------------------------------------------------------------------------
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+//----------------------------------------------------------------------------
+bool isWhitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+//----------------------------------------------------------------------------
+// Parses plain decimal numbers, as found in pretty much every OBJ file, without
+// any rounding error: if both the digits and the power of ten can be represented
+// exactly as doubles, a single multiplication or division is correctly rounded.
+// Returns false for anything else, which is left for strtod to deal with
+bool parseDoubleFast(const char *begin, const char *end, double &value)
+{
+    const char *p = begin;
+    const bool negative = (p != end && *p == '-');
+    if(p != end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+
+    // Read digits into mantissa, keeping track of the decimal point in exponent
+    // **NOTE** once there are too many digits to be exact, we bail out below anyway
+    uint64_t mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool anyDigits = false;
+    for(; p != end && isDigit(*p); p++) {
+        anyDigits = true;
+        if(numDigits < 19) {
+            mantissa = (mantissa * 10) + (*p - '0');
+            numDigits += (mantissa != 0);
+        }
+        else {
+            exponent++;
+        }
+    }
+    if(p != end && *p == '.') {
+        for(p++; p != end && isDigit(*p); p++) {
+            anyDigits = true;
+            if(numDigits < 19) {
+                mantissa = (mantissa * 10) + (*p - '0');
+                numDigits += (mantissa != 0);
+                exponent--;
+            }
+        }
+    }
+    if(!anyDigits) {
+        return false;
+    }
+
+    // Read exponent
+    if(p != end && (*p == 'e' || *p == 'E')) {
+        p++;
+        const bool negativeExponent = (p != end && *p == '-');
+        if(p != end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+
+        int explicitExponent = 0;
+        bool anyExponentDigits = false;
+        for(; p != end && isDigit(*p); p++) {
+            anyExponentDigits = true;
+            explicitExponent = std::min((explicitExponent * 10) + (*p - '0'), 10000);
+        }
+        if(!anyExponentDigits) {
+            return false;
+        }
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+
+    // If there are trailing characters or the result wouldn't be exact, give up
+    if(p != end || mantissa > (1ull << 53) || exponent < -22 || exponent > 22) {
+        return false;
+    }
+
+    value = static_cast<double>(mantissa);
+    if(exponent < 0) {
+        value /= ExactPowersOfTen[-exponent];
+    }
+    else {
+        value *= ExactPowersOfTen[exponent];
+    }
+    if(negative) {
+        value = -value;
+    }
+    return true;
+}
+//----------------------------------------------------------------------------
+// FNV-1a, but eight bytes at a time, as we only need to spot changed files
+uint64_t hashBytes(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for(; (i + sizeof(uint64_t)) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(uint64_t));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+//----------------------------------------------------------------------------
+bool getFileStatus(const filesystem::path &path, uint64_t &size, int64_t &modifiedTime)
+{
+    struct stat status;
+    if(stat(path.str().c_str(), &status) != 0) {
+        return false;
+    }
+
+    size = static_cast<uint64_t>(status.st_size);
+#ifdef __linux__
+    modifiedTime = (static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000) + status.st_mtim.tv_nsec;
+#else
+    modifiedTime = static_cast<int64_t>(status.st_mtime) * 1000000000;
+#endif
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// Token
+//----------------------------------------------------------------------------
+// A whitespace-delimited part of a line
+struct Token
+{
+    const char *begin;
+    const char *end;
+
+    bool empty() const{ return begin == end; }
+    size_t size() const{ return static_cast<size_t>(end - begin); }
+    std::string str() const{ return std::string(begin, end); }
+
+    bool operator==(const char *string) const
+    {
+        const size_t length = std::strlen(string);
+        return size() == length && std::memcmp(begin, string, length) == 0;
+    }
+};
+
+//----------------------------------------------------------------------------
+// LineParser
+//----------------------------------------------------------------------------
+// Splits a line of an OBJ or MTL file into tokens and numbers, without copying it
+class LineParser
+{
+public:
+    LineParser(const std::string &filename, size_t lineNumber, const char *begin, const char *end)
+    :   m_Filename(filename), m_LineNumber(lineNumber), m_Position(begin), m_End(end)
+    {
+        // Strip trailing whitespace (including Windows line endings)
+        while(m_End != m_Position && isWhitespace(m_End[-1])) {
+            m_End--;
+        }
+    }
+
+    bool atEnd()
+    {
+        skipWhitespace();
+        return m_Position == m_End;
+    }
+
+    Token readToken()
+    {
+        skipWhitespace();
+        const char *begin = m_Position;
+        while(m_Position != m_End && !isWhitespace(*m_Position)) {
+            m_Position++;
+        }
+        return Token{begin, m_Position};
+    }
+
+    //! Treat the rest of the line as a single string, e.g. a filename containing spaces
+    std::string readRest()
+    {
+        skipWhitespace();
+        const std::string rest(m_Position, m_End);
+        m_Position = m_End;
+        return rest;
+    }
+
+    float readFloat()
+    {
+        const Token token = readToken();
+        if(token.empty()) {
+            throwError("Expected a number");
+        }
+
+        double value;
+        if(!parseDoubleFast(token.begin, token.end, value)) {
+            // Fall back to strtod, which needs a null-terminated string
+            const std::string string = token.str();
+            char *end;
+            value = std::strtod(string.c_str(), &end);
+            if(end != (string.c_str() + string.size())) {
+                throwError("Could not parse '" + string + "' as a number");
+            }
+        }
+        return static_cast<float>(value);
+    }
+
+    //! Read an index as used in faces, converting it to zero-based and resolving negative (relative) indices
+    uint32_t readIndex(const char *begin, const char *end, size_t count)
+    {
+        const char *p = begin;
+        const bool negative = (p != end && *p == '-');
+        if(negative) {
+            p++;
+        }
+
+        uint64_t index = 0;
+        if(p == end) {
+            throwError("Expected an index");
+        }
+        for(; p != end; p++) {
+            if(!isDigit(*p) || index > count) {
+                throwError("Could not parse '" + std::string(begin, end) + "' as an index");
+            }
+            index = (index * 10) + (*p - '0');
+        }
+
+        if(index == 0 || index > count) {
+            throwError("Index '" + std::string(begin, end) + "' is out of range");
+        }
+        return static_cast<uint32_t>(negative ? (count - index) : (index - 1));
+    }
+
+    [[noreturn]] void throwError(const std::string &message) const
+    {
+        throw std::runtime_error(m_Filename + ":" + std::to_string(m_LineNumber) + ": " + message);
+    }
+
+private:
+    void skipWhitespace()
+    {
+        while(m_Position != m_End && isWhitespace(*m_Position)) {
+            m_Position++;
+        }
+    }
+
+    const std::string &m_Filename;
+    const size_t m_LineNumber;
+    const char *m_Position;
+    const char *m_End;
+};
+//----------------------------------------------------------------------------
+// Call function with a LineParser for each non-empty, non-comment line of file
+template<typename F>
+void forEachLine(const BoBRobotics::MemoryMappedFile &file, const std::string &filename, F function)
+{
+    const char *position = reinterpret_cast<const char *>(file.data());
+    const char *const end = position + file.size();
+    for(size_t lineNumber = 1; position < end; lineNumber++) {
+        const char *lineEnd = static_cast<const char *>(std::memchr(position, '\n', end - position));
+        if(lineEnd == nullptr) {
+            lineEnd = end;
+        }
+
+        LineParser line(filename, lineNumber, position, lineEnd);
+        position = lineEnd + 1;
+
+        // Entirely skip comment or empty lines
+        if(line.atEnd()) {
+            continue;
+        }
+        const Token command = line.readToken();
+        if(*command.begin != '#') {
+            function(command, line);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// SurfaceBuilder
+//----------------------------------------------------------------------------
+// Gathers the faces for one material, giving each distinct position and
+// texture coordinate pair a single index
+struct SurfaceBuilder
+{
+    std::string materialName;
+    std::unordered_map<uint64_t, uint32_t> vertexIndices;
+    std::vector<std::pair<uint32_t, int64_t>> vertices;
+    std::vector<uint32_t> indices;
+    bool hasTexCoords = false;
+
+    uint32_t getVertexIndex(uint32_t position, int64_t texCoord)
+    {
+        const uint64_t key = (static_cast<uint64_t>(position) << 32) | static_cast<uint32_t>(texCoord + 1);
+        const auto vertex = vertexIndices.emplace(key, static_cast<uint32_t>(vertices.size()));
+        if(vertex.second) {
+            vertices.emplace_back(position, texCoord);
+            hasTexCoords |= (texCoord >= 0);
+        }
+        return vertex.first->second;
+    }
+};
+
+//----------------------------------------------------------------------------
+// CacheWriter
+//----------------------------------------------------------------------------
+class CacheWriter
+{
+public:
+    explicit CacheWriter(const std::string &filename)
+    :   m_Stream(filename, std::ios::binary), m_Position(0)
+    {
+        m_Stream.exceptions(std::ios::badbit | std::ios::failbit);
+    }
+
+    void write(const void *data, size_t size)
+    {
+        m_Stream.write(reinterpret_cast<const char *>(data), size);
+        m_Position += size;
+    }
+
+    template<typename T>
+    void write(const T &value)
+    {
+        write(&value, sizeof(T));
+    }
+
+    void write(const std::string &string)
+    {
+        write(static_cast<uint32_t>(string.size()));
+        write(string.data(), string.size());
+    }
+
+    //! Pad so that arrays which follow can be used straight from the mapped file
+    void align()
+    {
+        const char zeros[8] = {};
+        write(zeros, (8 - (m_Position % 8)) % 8);
+    }
+
+    void close()
+    {
+        m_Stream.close();
+    }
+
+private:
+    std::ofstream m_Stream;
+    size_t m_Position;
+};
+
+//----------------------------------------------------------------------------
+// CacheReader
+//----------------------------------------------------------------------------
+// Reads from a mapped cache file, returning false if it is truncated
+class CacheReader
+{
+public:
+    CacheReader(const uint8_t *data, size_t size)
+    :   m_Begin(data), m_Position(data), m_End(data + size)
+    {}
+
+    const uint8_t *readBytes(size_t size)
+    {
+        if(size > static_cast<size_t>(m_End - m_Position)) {
+            return nullptr;
+        }
+        const uint8_t *data = m_Position;
+        m_Position += size;
+        return data;
+    }
+
+    template<typename T>
+    bool read(T &value)
+    {
+        const uint8_t *data = readBytes(sizeof(T));
+        if(data) {
+            std::memcpy(&value, data, sizeof(T));
+        }
+        return data != nullptr;
+    }
+
+    bool read(std::string &string)
+    {
+        uint32_t size;
+        const uint8_t *data;
+        if(!read(size) || !(data = readBytes(size))) {
+            return false;
+        }
+        string.assign(reinterpret_cast<const char *>(data), size);
+        return true;
+    }
+
+    bool align()
+    {
+        return readBytes((8 - ((m_Position - m_Begin) % 8)) % 8) != nullptr;
+    }
+
+private:
+    const uint8_t *const m_Begin;
+    const uint8_t *m_Position;
+    const uint8_t *const m_End;
+};
+}   // Anonymous namespace
+
+//----------------------------------------------------------------------------
+// BoBRobotics::AntWorld::ObjMesh
+//----------------------------------------------------------------------------
+namespace BoBRobotics
+{
+namespace AntWorld
+{
+size_t ObjMesh::SurfaceGeometry::getStride() const
+{
+    return (3 * sizeof(float)) + (hasTexCoords ? (2 * sizeof(float)) : 0) + (hasColours ? 4 : 0);
+}
+//----------------------------------------------------------------------------
+ObjMesh::ObjMesh()
+:   m_Scale(1.0f), m_MinBound{{0.0f, 0.0f, 0.0f}}, m_MaxBound{{0.0f, 0.0f, 0.0f}}
+{
+}
+//----------------------------------------------------------------------------
+ObjMesh::ObjMesh(ObjMesh &&) = default;
+//----------------------------------------------------------------------------
+ObjMesh::~ObjMesh() = default;
+//----------------------------------------------------------------------------
+ObjMesh ObjMesh::load(const filesystem::path &objPath, float scale, bool useCache)
+{
+    if(useCache) {
+        ObjMesh mesh;
+        try {
+            if(mesh.readCache(objPath, scale)) {
+                LOG_INFO << "Loaded mesh from cache " << getCachePath(objPath);
+                return mesh;
+            }
+        }
+        catch(std::exception &e) {
+            LOG_WARNING << "Could not read mesh cache for " << objPath << ": " << e.what();
+        }
+    }
+
+    auto mesh = parse(objPath, scale);
+    if(useCache) {
+        mesh.writeCache(objPath);
+    }
+    return mesh;
+}
+//----------------------------------------------------------------------------
+ObjMesh ObjMesh::parse(const filesystem::path &objPath, float scale)
+{
+    ObjMesh mesh;
+    mesh.m_Scale = scale;
+
+    // Get base path to load materials etc relative to
+    const auto basePath = objPath.make_absolute().parent_path();
+    const std::string objFilename = objPath.filename();
+
+    MemoryMappedFile objFile(objPath);
+    mesh.addDependency(basePath, objFilename, objFile);
+
+    // 'Raw' positions, colours and texture coordinates read from obj
+    std::vector<float> rawPositions;
+    std::vector<uint8_t> rawColours;
+    std::vector<float> rawTexCoords;
+
+    // Faces, grouped by material
+    std::vector<SurfaceBuilder> surfaces;
+    std::unordered_map<std::string, size_t> surfaceIndices;
+    SurfaceBuilder *currentSurface = nullptr;
+
+    std::vector<uint32_t> faceIndices;
+    std::set<std::string> unhandledTags;
+    forEachLine(objFile, objFilename,
+                [&](const Token &command, LineParser &line)
+                {
+                    if(command == "v") {
+                        for(unsigned int c = 0; c < 3; c++) {
+                            rawPositions.push_back(line.readFloat() * scale);
+                        }
+
+                        // If line has more data, read it into raw colours
+                        if(!line.atEnd()) {
+                            for(unsigned int c = 0; c < 3; c++) {
+                                const float colour = std::round(line.readFloat() * 255.0f);
+                                rawColours.push_back(static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, colour))));
+                            }
+                        }
+                    }
+                    else if(command == "vt") {
+                        rawTexCoords.push_back(line.readFloat());
+                        rawTexCoords.push_back(line.readFloat());
+
+                        // Some exporters add a (zero) W component
+                        if(!line.atEnd()) {
+                            line.readFloat();
+                        }
+                    }
+                    else if(command == "f") {
+                        // If there are no textures, surfaces aren't always created (at least by MeshLab), so create a default one
+                        if(!currentSurface) {
+                            LOG_WARNING << "Encountered faces before any surfaces are defined - adding default surface";
+                            surfaceIndices.emplace("default", surfaces.size());
+                            surfaces.emplace_back();
+                            surfaces.back().materialName = "default";
+                            currentSurface = &surfaces.back();
+                        }
+
+                        // Read each vertex's P, P/T, P/T/N or P//N indices
+                        faceIndices.clear();
+                        const size_t numPositions = rawPositions.size() / 3;
+                        const size_t numTexCoords = rawTexCoords.size() / 2;
+                        while(!line.atEnd()) {
+                            const Token vertex = line.readToken();
+                            const char *positionEnd = std::find(vertex.begin, vertex.end, '/');
+                            const uint32_t position = line.readIndex(vertex.begin, positionEnd, numPositions);
+
+                            int64_t texCoord = -1;
+                            if(positionEnd != vertex.end) {
+                                const char *texCoordEnd = std::find(positionEnd + 1, vertex.end, '/');
+                                if(texCoordEnd != (positionEnd + 1)) {
+                                    texCoord = line.readIndex(positionEnd + 1, texCoordEnd, numTexCoords);
+                                }
+                            }
+                            faceIndices.push_back(currentSurface->getVertexIndex(position, texCoord));
+                        }
+                        if(faceIndices.size() < 3) {
+                            line.throwError("Faces must have at least three vertices");
+                        }
+
+                        // Split polygons into a fan of triangles
+                        for(size_t i = 2; i < faceIndices.size(); i++) {
+                            currentSurface->indices.push_back(faceIndices[0]);
+                            currentSurface->indices.push_back(faceIndices[i - 1]);
+                            currentSurface->indices.push_back(faceIndices[i]);
+                        }
+                    }
+                    else if(command == "usemtl") {
+                        // Gather all faces with the same material into one surface
+                        const std::string materialName = line.readToken().str();
+                        const auto surface = surfaceIndices.emplace(materialName, surfaces.size());
+                        if(surface.second) {
+                            LOG_INFO << "\tReading surface: " << materialName;
+                            surfaces.emplace_back();
+                            surfaces.back().materialName = materialName;
+                        }
+                        currentSurface = &surfaces[surface.first->second];
+                    }
+                    else if(command == "mtllib") {
+                        while(!line.atEnd()) {
+                            mesh.parseMaterials(basePath, line.readToken().str());
+                        }
+                    }
+                    else if(command == "o") {
+                        LOG_DEBUG << "Reading object: " << line.readRest();
+                    }
+                    else if(command == "vn" || command == "s" || command == "g") {
+                        // ignore vertex normals, smoothing and groups
+                    }
+                    else if(unhandledTags.insert(command.str()).second) {
+                        LOG_WARNING << "Unhandled obj tag '" << command.str() << "'";
+                    }
+                });
+
+    LOG_INFO << "\t" << rawPositions.size() / 3 << " raw positions, " << rawTexCoords.size() / 2 << " raw texture coordinates, ";
+    LOG_INFO << rawColours.size() / 3 << " raw colours, " << surfaces.size() << " surfaces, " << mesh.m_Materials.size() << " materials";
+
+    // If there are ANY raw colours, assert that there are the same number as there are positions
+    const bool hasColours = !rawColours.empty();
+    if(hasColours) {
+        BOB_ASSERT(rawColours.size() == rawPositions.size());
+    }
+
+    // Calculate bounds
+    if(!rawPositions.empty()) {
+        std::copy_n(rawPositions.cbegin(), 3, mesh.m_MinBound.begin());
+        std::copy_n(rawPositions.cbegin(), 3, mesh.m_MaxBound.begin());
+        for(size_t i = 0; i < rawPositions.size(); i += 3) {
+            for(unsigned int c = 0; c < 3; c++) {
+                mesh.m_MinBound[c] = std::min(mesh.m_MinBound[c], rawPositions[i + c]);
+                mesh.m_MaxBound[c] = std::max(mesh.m_MaxBound[c], rawPositions[i + c]);
+            }
+        }
+    }
+
+    // Interleave vertices for each surface
+    for(const auto &builder : surfaces) {
+        if(builder.indices.empty()) {
+            continue;
+        }
+
+        SurfaceGeometry surface;
+        surface.materialName = builder.materialName;
+        surface.hasTexCoords = builder.hasTexCoords;
+        surface.hasColours = hasColours;
+        surface.numVertices = builder.vertices.size();
+        surface.numIndices = builder.indices.size();
+
+        const size_t stride = surface.getStride();
+        const size_t colourOffset = surface.getColourOffset();
+        std::vector<uint8_t> vertices(surface.numVertices * stride);
+        for(size_t v = 0; v < surface.numVertices; v++) {
+            uint8_t *vertex = &vertices[v * stride];
+            const uint32_t position = builder.vertices[v].first;
+            const int64_t texCoord = builder.vertices[v].second;
+
+            std::memcpy(vertex, &rawPositions[3 * position], 3 * sizeof(float));
+
+            // **NOTE** vertices without texture coordinates on textured surfaces get (0, 0)
+            if(surface.hasTexCoords && texCoord >= 0) {
+                std::memcpy(vertex + surface.getTexCoordOffset(), &rawTexCoords[2 * texCoord], 2 * sizeof(float));
+            }
+            if(hasColours) {
+                std::copy_n(&rawColours[3 * position], 3, vertex + colourOffset);
+                vertex[colourOffset + 3] = 255;
+            }
+        }
+
+        mesh.m_VertexStorage.emplace_back(std::move(vertices));
+        mesh.m_IndexStorage.emplace_back(builder.indices);
+        surface.vertices = mesh.m_VertexStorage.back().data();
+        surface.indices = mesh.m_IndexStorage.back().data();
+        mesh.m_Surfaces.emplace_back(std::move(surface));
+    }
+
+    return mesh;
+}
+//----------------------------------------------------------------------------
+void ObjMesh::writeCache(const filesystem::path &objPath) const
+{
+    const auto cachePath = getCachePath(objPath);
+
+    // Write to a temporary file and then move it over the top of any existing
+    // cache, so processes loading the same world at once never see a partial file
+    const std::string tempPath = cachePath.str() + ".tmp" + std::to_string(std::random_device{}());
+    try {
+        {
+            CacheWriter writer(tempPath);
+
+            CacheHeader header{};
+            std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+            header.version = CacheVersion;
+            header.scale = m_Scale;
+            header.numDependencies = static_cast<uint32_t>(m_Dependencies.size());
+            header.numMaterials = static_cast<uint32_t>(m_Materials.size());
+            header.numSurfaces = static_cast<uint32_t>(m_Surfaces.size());
+            std::copy(m_MinBound.cbegin(), m_MinBound.cend(), header.minBound);
+            std::copy(m_MaxBound.cbegin(), m_MaxBound.cend(), header.maxBound);
+            writer.write(header);
+
+            for(const auto &dependency : m_Dependencies) {
+                writer.write(dependency.filename);
+                writer.write(dependency.size);
+                writer.write(dependency.modifiedTime);
+                writer.write(dependency.hash);
+            }
+
+            for(const auto &material : m_Materials) {
+                writer.write(material.name);
+                writer.write(material.colour);
+                writer.write(material.textureFilename);
+            }
+
+            for(const auto &surface : m_Surfaces) {
+                writer.write(surface.materialName);
+                writer.write(static_cast<uint8_t>(surface.hasTexCoords));
+                writer.write(static_cast<uint8_t>(surface.hasColours));
+                writer.write(static_cast<uint64_t>(surface.numVertices));
+                writer.write(static_cast<uint64_t>(surface.numIndices));
+                writer.align();
+                writer.write(surface.vertices, surface.numVertices * surface.getStride());
+                writer.align();
+                writer.write(surface.indices, surface.numIndices * sizeof(uint32_t));
+                writer.align();
+            }
+            writer.close();
+        }
+
+        if(std::rename(tempPath.c_str(), cachePath.str().c_str()) != 0) {
+            std::remove(tempPath.c_str());
+            LOG_WARNING << "Could not write mesh cache " << cachePath;
+        }
+        else {
+            LOG_INFO << "Wrote mesh cache " << cachePath;
+        }
+    }
+    catch(std::exception &e) {
+        // Caching is just an optimisation, so carry on regardless
+        std::remove(tempPath.c_str());
+        LOG_WARNING << "Could not write mesh cache " << cachePath << ": " << e.what();
+    }
+}
+//----------------------------------------------------------------------------
+filesystem::path ObjMesh::getCachePath(const filesystem::path &objPath)
+{
+    std::string filename = objPath.filename();
+    const size_t extension = filename.find_last_of('.');
+    if(extension != std::string::npos) {
+        filename.erase(extension);
+    }
+    return objPath.make_absolute().parent_path() / (filename + ".bobmesh");
+}
+//----------------------------------------------------------------------------
+void ObjMesh::parseMaterials(const filesystem::path &basePath, const std::string &filename)
+{
+    LOG_DEBUG << "Reading material file: " << filename;
+
+    MemoryMappedFile mtlFile(basePath / filename);
+    addDependency(basePath, filename, mtlFile);
+
+    Material *currentMaterial = nullptr;
+    std::set<std::string> unhandledTags;
+    forEachLine(mtlFile, filename,
+                [&](const Token &command, LineParser &line)
+                {
+                    // If command is a material name, add a new material (or replace an existing one)
+                    if(command == "newmtl") {
+                        const std::string name = line.readToken().str();
+                        LOG_INFO << "\tReading material: " << name;
+
+                        auto material = std::find_if(m_Materials.begin(), m_Materials.end(),
+                                                     [&name](const Material &m){ return m.name == name; });
+                        if(material == m_Materials.end()) {
+                            m_Materials.emplace_back();
+                            currentMaterial = &m_Materials.back();
+                            currentMaterial->name = name;
+                        }
+                        else {
+                            currentMaterial = &*material;
+                            *currentMaterial = Material();
+                            currentMaterial->name = name;
+                        }
+                    }
+                    // Otherwise, if command specifies a diffuse colour
+                    else if(command == "Kd") {
+                        if(!currentMaterial) {
+                            line.throwError("Kd before newmtl");
+                        }
+                        for(unsigned int i = 0; i < 3; i++) {
+                            currentMaterial->colour[i] = line.readFloat();
+                        }
+                    }
+                    // Otherwise, if command specifies a diffuse map
+                    else if(command == "map_Kd") {
+                        if(!currentMaterial) {
+                            line.throwError("map_Kd before newmtl");
+                        }
+                        else if(!currentMaterial->textureFilename.empty()) {
+                            line.throwError("Material '" + currentMaterial->name + "' already has a texture");
+                        }
+
+                        // Treat remainder of line as texture filename
+                        std::string textureFilename = line.readRest();
+                        const size_t firstNonQuote = textureFilename.find_first_not_of('"');
+                        const size_t lastNonQuote = textureFilename.find_last_not_of('"');
+                        if(firstNonQuote == std::string::npos) {
+                            line.throwError("Expected a texture filename");
+                        }
+                        textureFilename = textureFilename.substr(firstNonQuote, lastNonQuote - firstNonQuote + 1);
+
+                        LOG_DEBUG << "\t\tTexture: '" << textureFilename << "'";
+                        currentMaterial->textureFilename = textureFilename;
+                    }
+                    // Otherwise, if it's another material property, ignore
+                    else if(command == "Ns" || command == "Ka" || command == "Ks" ||
+                            command == "Ke" || command == "Ni" || command == "d" ||
+                            command == "illum")
+                    {
+                    }
+                    // Otherwise, give warning
+                    else if(unhandledTags.insert(command.str()).second) {
+                        LOG_WARNING << "Unhandled mtl tag '" << command.str() << "'";
+                    }
+                });
+}
+//----------------------------------------------------------------------------
+void ObjMesh::addDependency(const filesystem::path &basePath, const std::string &filename,
+                            const MemoryMappedFile &file)
+{
+    Dependency dependency;
+    dependency.filename = filename;
+    if(!getFileStatus(basePath / filename, dependency.size, dependency.modifiedTime)) {
+        throw std::runtime_error("Could not stat " + (basePath / filename).str());
+    }
+    dependency.hash = hashBytes(file.data(), file.size());
+    m_Dependencies.emplace_back(std::move(dependency));
+}
+//----------------------------------------------------------------------------
+bool ObjMesh::readCache(const filesystem::path &objPath, float scale)
+{
+    const auto cachePath = getCachePath(objPath);
+    if(!cachePath.exists()) {
+        return false;
+    }
+
+    m_Cache.reset(new MemoryMappedFile(cachePath));
+    CacheReader reader(m_Cache->data(), m_Cache->size());
+
+    // Check cache is valid and was created with the same scale
+    CacheHeader header;
+    if(!reader.read(header) || std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0
+            || header.version != CacheVersion) {
+        LOG_WARNING << "Ignoring invalid mesh cache " << cachePath;
+        return false;
+    }
+    if(header.scale != scale) {
+        LOG_INFO << "Mesh cache " << cachePath << " has a different scale";
+        return false;
+    }
+    m_Scale = scale;
+    std::copy_n(header.minBound, 3, m_MinBound.begin());
+    std::copy_n(header.maxBound, 3, m_MaxBound.begin());
+
+    // Check none of the files the mesh was loaded from have changed
+    const auto basePath = objPath.make_absolute().parent_path();
+    m_Dependencies.resize(header.numDependencies);
+    for(auto &dependency : m_Dependencies) {
+        if(!reader.read(dependency.filename) || !reader.read(dependency.size)
+                || !reader.read(dependency.modifiedTime) || !reader.read(dependency.hash)) {
+            LOG_WARNING << "Ignoring truncated mesh cache " << cachePath;
+            return false;
+        }
+        if(!isUpToDate(basePath, dependency)) {
+            LOG_INFO << "Mesh cache " << cachePath << " is out of date";
+            return false;
+        }
+    }
+
+    m_Materials.resize(header.numMaterials);
+    for(auto &material : m_Materials) {
+        if(!reader.read(material.name) || !reader.read(material.colour) || !reader.read(material.textureFilename)) {
+            LOG_WARNING << "Ignoring truncated mesh cache " << cachePath;
+            return false;
+        }
+    }
+
+    // Point surfaces straight at the mapped vertices and indices
+    m_Surfaces.resize(header.numSurfaces);
+    for(auto &surface : m_Surfaces) {
+        uint8_t hasTexCoords, hasColours;
+        uint64_t numVertices, numIndices;
+        if(!reader.read(surface.materialName) || !reader.read(hasTexCoords) || !reader.read(hasColours)
+                || !reader.read(numVertices) || !reader.read(numIndices) || !reader.align()) {
+            LOG_WARNING << "Ignoring truncated mesh cache " << cachePath;
+            return false;
+        }
+        surface.hasTexCoords = (hasTexCoords != 0);
+        surface.hasColours = (hasColours != 0);
+        surface.numVertices = static_cast<size_t>(numVertices);
+        surface.numIndices = static_cast<size_t>(numIndices);
+
+        const size_t maxCount = m_Cache->size() / sizeof(uint32_t);
+        if(numVertices > maxCount || numIndices > maxCount
+                || !(surface.vertices = reader.readBytes(surface.numVertices * surface.getStride())) || !reader.align()
+                || !(surface.indices = reinterpret_cast<const uint32_t *>(reader.readBytes(surface.numIndices * sizeof(uint32_t))))
+                || !reader.align()) {
+            LOG_WARNING << "Ignoring truncated mesh cache " << cachePath;
+            return false;
+        }
+
+        // Don't trust indices from disk any more than we have to
+        if(std::any_of(surface.indices, surface.indices + surface.numIndices,
+                       [&surface](uint32_t i){ return i >= surface.numVertices; })) {
+            LOG_WARNING << "Ignoring corrupt mesh cache " << cachePath;
+            return false;
+        }
+    }
+
+    return true;
+}
+//----------------------------------------------------------------------------
+bool ObjMesh::isUpToDate(const filesystem::path &basePath, const Dependency &dependency)
+{
+    const auto path = basePath / dependency.filename;
+    uint64_t size;
+    int64_t modifiedTime;
+    if(!getFileStatus(path, size, modifiedTime) || size != dependency.size) {
+        return false;
+    }
+
+    // If file has been touched (e.g. by copying or checking out), compare contents
+    if(modifiedTime != dependency.modifiedTime) {
+        MemoryMappedFile file(path);
+        return hashBytes(file.data(), file.size()) == dependency.hash;
+    }
+    return true;
+}
+}   // namespace AntWorld
+}   // namespace BoBRobotics
@@ -0,0 +1,855 @@
+// BoB robotics includes
+#include "antworld/obj_mesh.h"
+#include "antworld/ray_caster.h"
+#include "common/macros.h"
+#include "plog/Log.h"
+
+// Third-party includes
+#include "third_party/path.h"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+// TBB includes
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+// Standard C includes
+#include <cmath>
+#include <cstring>
+
+// Standard C++ includes
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace units::literals;
+using namespace units::angle;
+using namespace units::length;
+
+//----------------------------------------------------------------------------
+// Anonymous namespace
+//----------------------------------------------------------------------------
+namespace
+{
+// Panoramic views start at this latitude, as in Renderer
+constexpr degree_t StartLongitude = 15_deg;
+
+// Maximum number of triangles in BVH leaves and number of bins used when choosing where to split nodes
+// **NOTE** nodes with more than MaxUnsplittableLeafSize triangles are always split, whatever the SAH says
+constexpr size_t MaxLeafSize = 4;
+constexpr size_t MaxUnsplittableLeafSize = 255;
+constexpr size_t NumBins = 16;
+
+// Size of the stack used to traverse the BVH, which limits its depth
+constexpr size_t TraversalStackSize = 128;
+
+//----------------------------------------------------------------------------
+// Float4
+//----------------------------------------------------------------------------
+// Four floats, i.e. one component of four rays. Comparisons return masks
+// with all bits of a lane set if true, which can be combined with & and |
+#if defined(__SSE2__)
+struct Float4
+{
+    __m128 v;
+
+    Float4() = default;
+    Float4(__m128 value) : v(value){}
+    explicit Float4(float value) : v(_mm_set1_ps(value)){}
+    explicit Float4(const float *values) : v(_mm_loadu_ps(values)){}
+
+    void store(float *values) const{ _mm_storeu_ps(values, v); }
+};
+
+inline Float4 operator+(Float4 a, Float4 b){ return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b){ return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b){ return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b){ return _mm_div_ps(a.v, b.v); }
+inline Float4 operator<(Float4 a, Float4 b){ return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator>(Float4 a, Float4 b){ return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 operator<=(Float4 a, Float4 b){ return _mm_cmple_ps(a.v, b.v); }
+inline Float4 operator>=(Float4 a, Float4 b){ return _mm_cmpge_ps(a.v, b.v); }
+inline Float4 operator&(Float4 a, Float4 b){ return _mm_and_ps(a.v, b.v); }
+inline Float4 min(Float4 a, Float4 b){ return _mm_min_ps(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b){ return _mm_max_ps(a.v, b.v); }
+inline Float4 select(Float4 mask, Float4 a, Float4 b){ return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+inline int getMask(Float4 mask){ return _mm_movemask_ps(mask.v); }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+// **NOTE** 32-bit ARM has no vector division, so only AArch64 gets NEON
+struct Float4
+{
+    float32x4_t v;
+
+    Float4() = default;
+    Float4(float32x4_t value) : v(value){}
+    Float4(uint32x4_t mask) : v(vreinterpretq_f32_u32(mask)){}
+    explicit Float4(float value) : v(vdupq_n_f32(value)){}
+    explicit Float4(const float *values) : v(vld1q_f32(values)){}
+
+    void store(float *values) const{ vst1q_f32(values, v); }
+    uint32x4_t mask() const{ return vreinterpretq_u32_f32(v); }
+};
+
+inline Float4 operator+(Float4 a, Float4 b){ return vaddq_f32(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b){ return vsubq_f32(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b){ return vmulq_f32(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b){ return vdivq_f32(a.v, b.v); }
+inline Float4 operator<(Float4 a, Float4 b){ return vcltq_f32(a.v, b.v); }
+inline Float4 operator>(Float4 a, Float4 b){ return vcgtq_f32(a.v, b.v); }
+inline Float4 operator<=(Float4 a, Float4 b){ return vcleq_f32(a.v, b.v); }
+inline Float4 operator>=(Float4 a, Float4 b){ return vcgeq_f32(a.v, b.v); }
+inline Float4 operator&(Float4 a, Float4 b){ return vandq_u32(a.mask(), b.mask()); }
+inline Float4 min(Float4 a, Float4 b){ return vminq_f32(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b){ return vmaxq_f32(a.v, b.v); }
+inline Float4 select(Float4 mask, Float4 a, Float4 b){ return vbslq_f32(mask.mask(), a.v, b.v); }
+inline int getMask(Float4 mask)
+{
+    const uint32x4_t bits = vshrq_n_u32(mask.mask(), 31);
+    return static_cast<int>(vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1)
+                            | (vgetq_lane_u32(bits, 2) << 2) | (vgetq_lane_u32(bits, 3) << 3));
+}
+#else
+struct Float4
+{
+    float v[4];
+
+    Float4() = default;
+    explicit Float4(float value){ std::fill_n(v, 4, value); }
+    explicit Float4(const float *values){ std::copy_n(values, 4, v); }
+
+    void store(float *values) const{ std::copy_n(v, 4, values); }
+};
+
+template<typename F>
+inline Float4 apply(Float4 a, Float4 b, F f)
+{
+    Float4 result;
+    for(int i = 0; i < 4; i++) {
+        result.v[i] = f(a.v[i], b.v[i]);
+    }
+    return result;
+}
+
+template<typename F>
+inline Float4 compare(Float4 a, Float4 b, F f)
+{
+    Float4 result;
+    for(int i = 0; i < 4; i++) {
+        const uint32_t bits = f(a.v[i], b.v[i]) ? 0xFFFFFFFFu : 0u;
+        std::memcpy(&result.v[i], &bits, sizeof(float));
+    }
+    return result;
+}
+
+inline bool isSet(float lane)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &lane, sizeof(float));
+    return bits != 0;
+}
+
+inline Float4 operator+(Float4 a, Float4 b){ return apply(a, b, [](float x, float y){ return x + y; }); }
+inline Float4 operator-(Float4 a, Float4 b){ return apply(a, b, [](float x, float y){ return x - y; }); }
+inline Float4 operator*(Float4 a, Float4 b){ return apply(a, b, [](float x, float y){ return x * y; }); }
+inline Float4 operator/(Float4 a, Float4 b){ return apply(a, b, [](float x, float y){ return x / y; }); }
+inline Float4 operator<(Float4 a, Float4 b){ return compare(a, b, [](float x, float y){ return x < y; }); }
+inline Float4 operator>(Float4 a, Float4 b){ return compare(a, b, [](float x, float y){ return x > y; }); }
+inline Float4 operator<=(Float4 a, Float4 b){ return compare(a, b, [](float x, float y){ return x <= y; }); }
+inline Float4 operator>=(Float4 a, Float4 b){ return compare(a, b, [](float x, float y){ return x >= y; }); }
+inline Float4 operator&(Float4 a, Float4 b){ return compare(a, b, [](float x, float y){ return isSet(x) && isSet(y); }); }
+inline Float4 min(Float4 a, Float4 b){ return apply(a, b, [](float x, float y){ return (x < y) ? x : y; }); }
+inline Float4 max(Float4 a, Float4 b){ return apply(a, b, [](float x, float y){ return (x > y) ? x : y; }); }
+inline Float4 select(Float4 mask, Float4 a, Float4 b)
+{
+    Float4 result;
+    for(int i = 0; i < 4; i++) {
+        result.v[i] = isSet(mask.v[i]) ? a.v[i] : b.v[i];
+    }
+    return result;
+}
+inline int getMask(Float4 mask)
+{
+    int result = 0;
+    for(int i = 0; i < 4; i++) {
+        result |= (isSet(mask.v[i]) ? 1 : 0) << i;
+    }
+    return result;
+}
+#endif
+
+//----------------------------------------------------------------------------
+// RayPacket
+//----------------------------------------------------------------------------
+// Four rays from the same origin, along with the closest hit found so far
+struct RayPacket
+{
+    float origin[3];
+    Float4 direction[3];
+    Float4 inverseDirection[3];
+    Float4 originTimesInverse[3];
+    bool negative[3];
+
+    Float4 t;
+    Float4 u;
+    Float4 v;
+    int triangle[4];
+};
+//----------------------------------------------------------------------------
+// Returns mask of rays in packet which pass through node's bounding box before their closest hit
+template<typename NodeType>
+inline Float4 intersectBox(const NodeType &node, const RayPacket &packet, Float4 tMin)
+{
+    Float4 tNear = tMin;
+    Float4 tFar = packet.t;
+    for(unsigned int a = 0; a < 3; a++) {
+        const Float4 t1 = (Float4(node.min[a]) * packet.inverseDirection[a]) - packet.originTimesInverse[a];
+        const Float4 t2 = (Float4(node.max[a]) * packet.inverseDirection[a]) - packet.originTimesInverse[a];
+        tNear = max(tNear, min(t1, t2));
+        tFar = min(tFar, max(t1, t2));
+    }
+    return tNear <= tFar;
+}
+//----------------------------------------------------------------------------
+// Moller-Trumbore intersection test, culling back faces as OpenGL does
+// **NOTE** as all rays share an origin, a lot of the work only needs doing once
+template<typename TriangleType>
+inline void intersectTriangle(const TriangleType &triangle, uint32_t index, RayPacket &packet, Float4 tMin)
+{
+    const float *e1 = triangle.edge1;
+    const float *e2 = triangle.edge2;
+    const float s[3] = { packet.origin[0] - triangle.vertex0[0],
+                         packet.origin[1] - triangle.vertex0[1],
+                         packet.origin[2] - triangle.vertex0[2] };
+    const float q[3] = { (s[1] * e1[2]) - (s[2] * e1[1]),
+                         (s[2] * e1[0]) - (s[0] * e1[2]),
+                         (s[0] * e1[1]) - (s[1] * e1[0]) };
+    const Float4 tNumerator((e2[0] * q[0]) + (e2[1] * q[1]) + (e2[2] * q[2]));
+
+    const Float4 *d = packet.direction;
+    const Float4 p0 = (d[1] * Float4(e2[2])) - (d[2] * Float4(e2[1]));
+    const Float4 p1 = (d[2] * Float4(e2[0])) - (d[0] * Float4(e2[2]));
+    const Float4 p2 = (d[0] * Float4(e2[1])) - (d[1] * Float4(e2[0]));
+    const Float4 determinant = (Float4(e1[0]) * p0) + (Float4(e1[1]) * p1) + (Float4(e1[2]) * p2);
+    const Float4 uNumerator = (Float4(s[0]) * p0) + (Float4(s[1]) * p1) + (Float4(s[2]) * p2);
+    const Float4 vNumerator = (d[0] * Float4(q[0])) + (d[1] * Float4(q[1])) + (d[2] * Float4(q[2]));
+
+    // Compare numerators against determinant to avoid dividing unless there's a hit
+    // **NOTE** a positive determinant means the triangle is front-facing
+    const Float4 zero(0.0f);
+    const Float4 hit = (determinant > zero) & (uNumerator >= zero) & (vNumerator >= zero)
+        & ((uNumerator + vNumerator) <= determinant)
+        & (tNumerator > (tMin * determinant)) & (tNumerator < (packet.t * determinant));
+
+    const int hitMask = getMask(hit);
+    if(hitMask) {
+        const Float4 inverseDeterminant = Float4(1.0f) / determinant;
+        packet.t = select(hit, tNumerator * inverseDeterminant, packet.t);
+        packet.u = select(hit, uNumerator * inverseDeterminant, packet.u);
+        packet.v = select(hit, vNumerator * inverseDeterminant, packet.v);
+        for(int i = 0; i < 4; i++) {
+            if(hitMask & (1 << i)) {
+                packet.triangle[i] = static_cast<int>(index);
+            }
+        }
+    }
+}
+//----------------------------------------------------------------------------
+float getSurfaceArea(const float (&min)[3], const float (&max)[3])
+{
+    const float x = max[0] - min[0];
+    const float y = max[1] - min[1];
+    const float z = max[2] - min[2];
+    return 2.0f * ((x * y) + (y * z) + (z * x));
+}
+//----------------------------------------------------------------------------
+// Bilinearly sample texture with clamp-to-edge, as OpenGL does
+// **NOTE** World flips textures for OpenGL, so t = 0 is the bottom row of the image
+void sampleTexture(const cv::Mat &texture, float s, float t, float (&colour)[3])
+{
+    const float x = std::min(std::max((s * texture.cols) - 0.5f, 0.0f), static_cast<float>(texture.cols - 1));
+    const float y = std::min(std::max(((1.0f - t) * texture.rows) - 0.5f, 0.0f), static_cast<float>(texture.rows - 1));
+    const int x0 = static_cast<int>(x);
+    const int y0 = static_cast<int>(y);
+    const int x1 = std::min(x0 + 1, texture.cols - 1);
+    const int y1 = std::min(y0 + 1, texture.rows - 1);
+    const float fx = x - x0;
+    const float fy = y - y0;
+
+    const auto &p00 = texture.at<cv::Vec3b>(y0, x0);
+    const auto &p01 = texture.at<cv::Vec3b>(y0, x1);
+    const auto &p10 = texture.at<cv::Vec3b>(y1, x0);
+    const auto &p11 = texture.at<cv::Vec3b>(y1, x1);
+    for(unsigned int c = 0; c < 3; c++) {
+        // Convert from BGR to RGB
+        const int i = 2 - c;
+        const float top = (p00[i] * (1.0f - fx)) + (p01[i] * fx);
+        const float bottom = (p10[i] * (1.0f - fx)) + (p11[i] * fx);
+        colour[c] = ((top * (1.0f - fy)) + (bottom * fy)) / 255.0f;
+    }
+}
+//----------------------------------------------------------------------------
+uint8_t toByte(float value)
+{
+    return static_cast<uint8_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+}
+}   // Anonymous namespace
+
+//----------------------------------------------------------------------------
+// BoBRobotics::AntWorld::RayCaster
+//----------------------------------------------------------------------------
+namespace BoBRobotics
+{
+namespace AntWorld
+{
+RayCaster::RayCaster(degree_t horizontalFOV, degree_t verticalFOV, double nearClip, double farClip)
+:   m_MinBound{0_m, 0_m, 0_m}, m_MaxBound{0_m, 0_m, 0_m}, m_SkyColour{{0.75f, 0.75f, 0.75f}},
+    m_HorizontalFOV(horizontalFOV), m_VerticalFOV(verticalFOV),
+    m_NearClip(static_cast<float>(nearClip)), m_FarClip(static_cast<float>(farClip))
+{
+}
+//----------------------------------------------------------------------------
+RayCaster::~RayCaster() = default;
+//----------------------------------------------------------------------------
+void RayCaster::load(const filesystem::path &filename, const float (&worldColour)[3], const float (&groundColour)[3])
+{
+    LOGI << "Loading " << filename << "...";
+
+    // Open file for binary IO
+    std::ifstream input(filename.str(), std::ios::binary);
+    input.exceptions(std::ios::badbit | std::ios::failbit);
+
+    // Seek to end of file, get size and rewind
+    input.seekg(0, std::ios_base::end);
+    const auto numTriangles = static_cast<size_t>(input.tellg()) / (sizeof(double) * 12);
+    input.seekg(0);
+    LOG_INFO << "World has " << numTriangles << " triangles";
+
+    // Read each component of each vertex of every triangle, followed by their (greyscale) colours
+    std::vector<double> data(numTriangles * 10);
+    input.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(double));
+    const auto getPosition = [&data, numTriangles](size_t t, size_t v, size_t c)
+    {
+        return static_cast<float>(data[(c * 3 * numTriangles) + (v * numTriangles) + t]);
+    };
+
+    // Calculate bounds
+    m_Triangles.clear();
+    m_Shading.clear();
+    m_Textures.clear();
+    std::fill_n(&m_MinBound[0], 3, std::numeric_limits<meter_t>::max());
+    std::fill_n(&m_MaxBound[0], 3, std::numeric_limits<meter_t>::lowest());
+    for(unsigned int c = 0; c < 3; c++) {
+        for(size_t i = c * 3 * numTriangles; i < (c + 1) * 3 * numTriangles; i++) {
+            m_MinBound[c] = units::math::min(m_MinBound[c], meter_t(data[i]));
+            m_MaxBound[c] = units::math::max(m_MaxBound[c], meter_t(data[i]));
+        }
+    }
+
+    // Add ground plane triangles, as World does
+    TriangleShading shading;
+    shading.texture = -1;
+    for(unsigned int v = 0; v < 3; v++) {
+        std::copy_n(groundColour, 3, shading.colours[v]);
+    }
+    const float minX = static_cast<float>(m_MinBound[0].value());
+    const float minY = static_cast<float>(m_MinBound[1].value());
+    const float maxX = static_cast<float>(m_MaxBound[0].value());
+    const float maxY = static_cast<float>(m_MaxBound[1].value());
+    const float ground[6][3] = { { minX, minY, 0.0f }, { maxX, maxY, 0.0f }, { minX, maxY, 0.0f },
+                                 { minX, minY, 0.0f }, { maxX, minY, 0.0f }, { maxX, maxY, 0.0f } };
+    addTriangle(ground[0], ground[1], ground[2], shading);
+    addTriangle(ground[3], ground[4], ground[5], shading);
+
+    // Add world triangles
+    const double *colours = &data[9 * numTriangles];
+    for(size_t t = 0; t < numTriangles; t++) {
+        float positions[3][3];
+        for(unsigned int v = 0; v < 3; v++) {
+            for(unsigned int c = 0; c < 3; c++) {
+                positions[v][c] = getPosition(t, v, c);
+                shading.colours[v][c] = worldColour[c] * static_cast<float>(colours[t]);
+            }
+        }
+        addTriangle(positions[0], positions[1], positions[2], shading);
+    }
+
+    buildBVH();
+}
+//----------------------------------------------------------------------------
+void RayCaster::loadObj(const filesystem::path &objFilename, float scale, bool useCache)
+{
+    LOGI << "Loading " << objFilename << "...";
+
+    const ObjMesh mesh = ObjMesh::load(objFilename, scale, useCache);
+    for(unsigned int c = 0; c < 3; c++) {
+        m_MinBound[c] = meter_t(mesh.getMinBound()[c]);
+        m_MaxBound[c] = meter_t(mesh.getMaxBound()[c]);
+    }
+
+    // Load textures and build map of material names to texture indices and colours
+    // **NOTE** textures are kept at their original size, rather than being resized for OpenGL
+    m_Triangles.clear();
+    m_Shading.clear();
+    m_Textures.clear();
+    const auto basePath = objFilename.make_absolute().parent_path();
+    std::map<std::string, std::tuple<int, std::array<float, 3>>> materialNames;
+    for(const auto &material : mesh.getMaterials()) {
+        int texture = -1;
+        if(!material.textureFilename.empty()) {
+            const std::string texturePath = (basePath / material.textureFilename).str();
+            cv::Mat image = cv::imread(texturePath);
+            if(image.empty()) {
+                LOG_WARNING << "Cannot load texture '" << texturePath << "'";
+            }
+            else {
+                texture = static_cast<int>(m_Textures.size());
+                m_Textures.emplace_back(std::move(image));
+            }
+        }
+        materialNames[material.name] = std::make_tuple(texture, material.colour);
+    }
+
+    // Add each surface's triangles
+    for(const auto &surface : mesh.getSurfaces()) {
+        // As with OpenGL, vertex colours take priority over the material's
+        // colour, which in turn takes priority over the default (white)
+        TriangleShading shading;
+        shading.texture = -1;
+        std::array<float, 3> colour{{1.0f, 1.0f, 1.0f}};
+        const auto mtl = materialNames.find(surface.materialName);
+        if(mtl != materialNames.end()) {
+            colour = std::get<1>(mtl->second);
+            if(surface.hasTexCoords) {
+                shading.texture = std::get<0>(mtl->second);
+            }
+        }
+
+        const size_t stride = surface.getStride();
+        for(size_t i = 0; i < surface.numIndices; i += 3) {
+            const float *positions[3];
+            for(unsigned int v = 0; v < 3; v++) {
+                const uint8_t *vertex = surface.vertices + (surface.indices[i + v] * stride);
+                positions[v] = reinterpret_cast<const float *>(vertex);
+
+                if(surface.hasColours) {
+                    for(unsigned int c = 0; c < 3; c++) {
+                        shading.colours[v][c] = vertex[surface.getColourOffset() + c] / 255.0f;
+                    }
+                }
+                else {
+                    std::copy(colour.cbegin(), colour.cend(), shading.colours[v]);
+                }
+
+                if(surface.hasTexCoords) {
+                    std::memcpy(shading.texCoords[v], vertex + surface.getTexCoordOffset(), 2 * sizeof(float));
+                }
+            }
+            addTriangle(positions[0], positions[1], positions[2], shading);
+        }
+    }
+
+    buildBVH();
+}
+//----------------------------------------------------------------------------
+void RayCaster::renderPanoramicView(meter_t x, meter_t y, meter_t z,
+                                    degree_t yaw, degree_t pitch, degree_t roll,
+                                    const cv::Size &size, cv::Mat &outFrame) const
+{
+    const Pose3<meter_t, degree_t> pose({ x, y, z }, { yaw, pitch, roll });
+    renderView(pose, size, getRayDirections(size), outFrame);
+}
+//----------------------------------------------------------------------------
+void RayCaster::renderPanoramicViews(const std::vector<Pose3<meter_t, degree_t>> &poses,
+                                     const cv::Size &size,
+                                     const std::function<void(size_t, const cv::Mat &)> &callback) const
+{
+    const auto directions = getRayDirections(size);
+
+    // Render a few views per thread at once, then hand them over in order
+    const size_t batchSize = 2 * std::max(1u, std::thread::hardware_concurrency());
+    std::vector<cv::Mat> frames(std::min(batchSize, poses.size()));
+    for(size_t first = 0; first < poses.size(); first += batchSize) {
+        const size_t count = std::min(batchSize, poses.size() - first);
+        tbb::parallel_for(size_t{ 0 }, count,
+                          [&](size_t i)
+                          {
+                              renderView(poses[first + i], size, directions, frames[i]);
+                          });
+
+        for(size_t i = 0; i < count; i++) {
+            callback(first + i, frames[i]);
+        }
+    }
+}
+//----------------------------------------------------------------------------
+void RayCaster::addTriangle(const float *position0, const float *position1, const float *position2,
+                            const TriangleShading &shading)
+{
+    Triangle triangle;
+    for(unsigned int c = 0; c < 3; c++) {
+        triangle.vertex0[c] = position0[c];
+        triangle.edge1[c] = position1[c] - position0[c];
+        triangle.edge2[c] = position2[c] - position0[c];
+    }
+    m_Triangles.push_back(triangle);
+    m_Shading.push_back(shading);
+}
+//----------------------------------------------------------------------------
+void RayCaster::buildBVH()
+{
+    m_Nodes.clear();
+    const size_t numTriangles = m_Triangles.size();
+    if(numTriangles == 0) {
+        return;
+    }
+    BOB_ASSERT(numTriangles < std::numeric_limits<uint32_t>::max());
+
+    // Calculate bounds and centroids of triangles
+    std::vector<std::array<float, 3>> triangleMin(numTriangles), triangleMax(numTriangles), centroids(numTriangles);
+    for(size_t t = 0; t < numTriangles; t++) {
+        const auto &triangle = m_Triangles[t];
+        for(unsigned int c = 0; c < 3; c++) {
+            const float v0 = triangle.vertex0[c];
+            const float v1 = v0 + triangle.edge1[c];
+            const float v2 = v0 + triangle.edge2[c];
+            triangleMin[t][c] = std::min({ v0, v1, v2 });
+            triangleMax[t][c] = std::max({ v0, v1, v2 });
+            centroids[t][c] = (triangleMin[t][c] + triangleMax[t][c]) * 0.5f;
+        }
+    }
+
+    // Build tree top-down, splitting nodes where the surface area heuristic says it's worth it
+    // **NOTE** a binary tree with single-triangle leaves has 2N - 1 nodes, so nodes won't be reallocated
+    std::vector<uint32_t> indices(numTriangles);
+    std::iota(indices.begin(), indices.end(), 0);
+    m_Nodes.reserve((2 * numTriangles) - 1);
+    m_Nodes.emplace_back();
+
+    struct BuildTask
+    {
+        size_t node;
+        size_t first;
+        size_t count;
+        size_t depth;
+    };
+    std::vector<BuildTask> tasks{ { 0, 0, numTriangles, 0 } };
+    size_t maxDepth = 0;
+    while(!tasks.empty()) {
+        const BuildTask task = tasks.back();
+        tasks.pop_back();
+        maxDepth = std::max(maxDepth, task.depth);
+        auto &node = m_Nodes[task.node];
+        const auto begin = indices.begin() + task.first;
+        const auto end = begin + task.count;
+
+        // Calculate bounds of node and of its triangles' centroids
+        float centroidMin[3], centroidMax[3];
+        std::fill_n(node.min, 3, std::numeric_limits<float>::max());
+        std::fill_n(node.max, 3, std::numeric_limits<float>::lowest());
+        std::fill_n(centroidMin, 3, std::numeric_limits<float>::max());
+        std::fill_n(centroidMax, 3, std::numeric_limits<float>::lowest());
+        for(auto t = begin; t != end; ++t) {
+            for(unsigned int c = 0; c < 3; c++) {
+                node.min[c] = std::min(node.min[c], triangleMin[*t][c]);
+                node.max[c] = std::max(node.max[c], triangleMax[*t][c]);
+                centroidMin[c] = std::min(centroidMin[c], centroids[*t][c]);
+                centroidMax[c] = std::max(centroidMax[c], centroids[*t][c]);
+            }
+        }
+
+        // Find cheapest split by binning centroids along each axis
+        float bestCost = std::numeric_limits<float>::max();
+        unsigned int bestAxis = 0;
+        size_t bestBin = 0;
+        if(task.count > MaxLeafSize) {
+            for(unsigned int a = 0; a < 3; a++) {
+                const float extent = centroidMax[a] - centroidMin[a];
+                if(extent <= 0.0f) {
+                    continue;
+                }
+
+                size_t binCounts[NumBins] = {};
+                float binMin[NumBins][3], binMax[NumBins][3];
+                for(size_t b = 0; b < NumBins; b++) {
+                    std::fill_n(binMin[b], 3, std::numeric_limits<float>::max());
+                    std::fill_n(binMax[b], 3, std::numeric_limits<float>::lowest());
+                }
+                const float binScale = NumBins / extent;
+                for(auto t = begin; t != end; ++t) {
+                    const size_t b = std::min(NumBins - 1, static_cast<size_t>((centroids[*t][a] - centroidMin[a]) * binScale));
+                    binCounts[b]++;
+                    for(unsigned int c = 0; c < 3; c++) {
+                        binMin[b][c] = std::min(binMin[b][c], triangleMin[*t][c]);
+                        binMax[b][c] = std::max(binMax[b][c], triangleMax[*t][c]);
+                    }
+                }
+
+                // Sweep from the right, recording the cost of everything right of each split
+                float rightCosts[NumBins];
+                float sweepMin[3], sweepMax[3];
+                std::fill_n(sweepMin, 3, std::numeric_limits<float>::max());
+                std::fill_n(sweepMax, 3, std::numeric_limits<float>::lowest());
+                size_t sweepCount = 0;
+                for(size_t b = NumBins - 1; b > 0; b--) {
+                    sweepCount += binCounts[b];
+                    for(unsigned int c = 0; c < 3; c++) {
+                        sweepMin[c] = std::min(sweepMin[c], binMin[b][c]);
+                        sweepMax[c] = std::max(sweepMax[c], binMax[b][c]);
+                    }
+                    rightCosts[b] = (sweepCount == 0) ? 0.0f : (sweepCount * getSurfaceArea(sweepMin, sweepMax));
+                }
+
+                // Then sweep from the left, adding the cost of everything left of each split
+                std::fill_n(sweepMin, 3, std::numeric_limits<float>::max());
+                std::fill_n(sweepMax, 3, std::numeric_limits<float>::lowest());
+                sweepCount = 0;
+                for(size_t b = 0; b < (NumBins - 1); b++) {
+                    sweepCount += binCounts[b];
+                    for(unsigned int c = 0; c < 3; c++) {
+                        sweepMin[c] = std::min(sweepMin[c], binMin[b][c]);
+                        sweepMax[c] = std::max(sweepMax[c], binMax[b][c]);
+                    }
+                    if(sweepCount == 0 || sweepCount == task.count) {
+                        continue;
+                    }
+
+                    const float cost = (sweepCount * getSurfaceArea(sweepMin, sweepMax)) + rightCosts[b + 1];
+                    if(cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = a;
+                        bestBin = b;
+                    }
+                }
+            }
+        }
+
+        // If splitting is no cheaper than testing all the triangles (or not possible) and they fit, make a leaf
+        // **NOTE** cost of traversing a node is taken to be the same as testing a triangle
+        const float leafCost = task.count * getSurfaceArea(node.min, node.max);
+        const bool canSplit = (bestCost < std::numeric_limits<float>::max());
+        if(task.count <= MaxLeafSize
+           || (task.count <= MaxUnsplittableLeafSize
+               && (!canSplit || (bestCost + getSurfaceArea(node.min, node.max)) >= leafCost)))
+        {
+            node.leftOrFirst = static_cast<uint32_t>(task.first);
+            node.count = static_cast<uint16_t>(task.count);
+            node.axis = 0;
+            continue;
+        }
+
+        // Partition triangles about split or, if they all have the same centroid, down the middle
+        auto middle = begin + (task.count / 2);
+        if(canSplit) {
+            const float binScale = NumBins / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+            middle = std::partition(begin, end,
+                                    [&](uint32_t t)
+                                    {
+                                        const size_t b = std::min(NumBins - 1, static_cast<size_t>((centroids[t][bestAxis] - centroidMin[bestAxis]) * binScale));
+                                        return b <= bestBin;
+                                    });
+        }
+
+        // Add children
+        const size_t leftCount = static_cast<size_t>(middle - begin);
+        node.leftOrFirst = static_cast<uint32_t>(m_Nodes.size());
+        node.count = 0;
+        node.axis = static_cast<uint16_t>(bestAxis);
+        tasks.push_back({ m_Nodes.size(), task.first, leftCount, task.depth + 1 });
+        tasks.push_back({ m_Nodes.size() + 1, task.first + leftCount, task.count - leftCount, task.depth + 1 });
+        m_Nodes.emplace_back();
+        m_Nodes.emplace_back();
+    }
+
+    // Reorder triangles so each leaf's are contiguous
+    std::vector<Triangle> triangles(numTriangles);
+    std::vector<TriangleShading> shading(numTriangles);
+    for(size_t i = 0; i < numTriangles; i++) {
+        triangles[i] = m_Triangles[indices[i]];
+        shading[i] = m_Shading[indices[i]];
+    }
+    m_Triangles.swap(triangles);
+    m_Shading.swap(shading);
+
+    // Traversal holds at most one sibling per level plus both children of the current node
+    BOB_ASSERT((maxDepth + 1) <= TraversalStackSize);
+
+    LOG_INFO << "Built BVH with " << m_Nodes.size() << " nodes over " << numTriangles << " triangles (depth " << maxDepth << ")";
+}
+//----------------------------------------------------------------------------
+std::vector<float> RayCaster::getRayDirections(const cv::Size &size) const
+{
+    // Calculate a direction for the centre of each pixel, in the ant's frame of
+    // reference, with the same mapping from latitude and longitude as RenderMeshSpherical
+    // **NOTE** directions are stored as separate X, Y and Z planes
+    const size_t numPixels = size.area();
+    std::vector<float> directions(3 * numPixels);
+    for(int row = 0; row < size.height; row++) {
+        const degree_t longitude = StartLongitude - (m_VerticalFOV * (1.0 - ((row + 0.5) / size.height)));
+        const double sinLongitude = units::math::sin(longitude);
+        const double cosLongitude = units::math::cos(longitude);
+        for(int col = 0; col < size.width; col++) {
+            const degree_t latitude = (-m_HorizontalFOV / 2.0) + (m_HorizontalFOV * ((col + 0.5) / size.width));
+            const double sinLatitude = units::math::sin(latitude);
+            const double cosLatitude = units::math::cos(latitude);
+
+            const size_t i = (row * size.width) + col;
+            directions[i] = static_cast<float>(sinLatitude * cosLongitude);
+            directions[numPixels + i] = static_cast<float>(cosLatitude * cosLongitude);
+            directions[(2 * numPixels) + i] = static_cast<float>(-sinLongitude);
+        }
+    }
+    return directions;
+}
+//----------------------------------------------------------------------------
+void RayCaster::renderView(const Pose3<meter_t, degree_t> &pose, const cv::Size &size,
+                           const std::vector<float> &directions, cv::Mat &outFrame) const
+{
+    outFrame.create(size, CV_8UC3);
+
+    // Calculate rotation from ant's frame to world, undoing what Renderer::applyFrame() does
+    const double cy = units::math::cos(pose.yaw()), sy = units::math::sin(pose.yaw());
+    const double cp = units::math::cos(pose.pitch()), sp = units::math::sin(pose.pitch());
+    const double cr = units::math::cos(pose.roll()), sr = units::math::sin(pose.roll());
+    const double yawPitch[3][3] = { { cy, sy * cp, sy * sp },
+                                    { -sy, cy * cp, cy * sp },
+                                    { 0.0, -sp, cp } };
+    const double roll[3][3] = { { cr, 0.0, -sr }, { 0.0, 1.0, 0.0 }, { sr, 0.0, cr } };
+    float rotation[3][3];
+    for(unsigned int i = 0; i < 3; i++) {
+        for(unsigned int j = 0; j < 3; j++) {
+            rotation[i][j] = static_cast<float>((yawPitch[i][0] * roll[0][j]) + (yawPitch[i][1] * roll[1][j])
+                                                + (yawPitch[i][2] * roll[2][j]));
+        }
+    }
+
+    const float origin[3] = { static_cast<float>(pose.x().value()),
+                              static_cast<float>(pose.y().value()),
+                              static_cast<float>(pose.z().value()) };
+    const size_t numPixels = size.area();
+    const Float4 tMin(m_NearClip);
+
+    // Trace 2x2 blocks of pixels as packets of rays, a couple of rows of blocks at a time
+    const int numBlockRows = (size.height + 1) / 2;
+    tbb::parallel_for(tbb::blocked_range<int>(0, numBlockRows),
+        [&](const tbb::blocked_range<int> &range)
+        {
+            RayPacket packet;
+            std::copy_n(origin, 3, packet.origin);
+            for(int blockRow = range.begin(); blockRow != range.end(); blockRow++) {
+                for(int blockCol = 0; blockCol < size.width; blockCol += 2) {
+                    // Get pixels in block, repeating the edge ones if the view has an odd size
+                    int pixelRows[4], pixelCols[4];
+                    for(int i = 0; i < 4; i++) {
+                        pixelRows[i] = std::min((2 * blockRow) + (i / 2), size.height - 1);
+                        pixelCols[i] = std::min(blockCol + (i % 2), size.width - 1);
+                    }
+
+                    // Rotate ray directions into world
+                    float direction[3][4], inverseDirection[3][4], originTimesInverse[3][4];
+                    for(int i = 0; i < 4; i++) {
+                        const size_t p = (pixelRows[i] * size.width) + pixelCols[i];
+                        const float antDirection[3] = { directions[p], directions[numPixels + p], directions[(2 * numPixels) + p] };
+                        for(unsigned int c = 0; c < 3; c++) {
+                            float d = (rotation[c][0] * antDirection[0]) + (rotation[c][1] * antDirection[1])
+                                + (rotation[c][2] * antDirection[2]);
+
+                            // Avoid infinities in slab tests for rays parallel to axes
+                            if(std::fabs(d) < 1e-20f) {
+                                d = 1e-20f;
+                            }
+                            direction[c][i] = d;
+                            inverseDirection[c][i] = 1.0f / d;
+                            originTimesInverse[c][i] = origin[c] * inverseDirection[c][i];
+                        }
+                    }
+                    for(unsigned int c = 0; c < 3; c++) {
+                        packet.direction[c] = Float4(direction[c]);
+                        packet.inverseDirection[c] = Float4(inverseDirection[c]);
+                        packet.originTimesInverse[c] = Float4(originTimesInverse[c]);
+                        packet.negative[c] = direction[c][0] < 0.0f;
+                    }
+                    packet.t = Float4(m_FarClip);
+                    packet.u = Float4(0.0f);
+                    packet.v = Float4(0.0f);
+                    std::fill_n(packet.triangle, 4, -1);
+
+                    // Traverse BVH, visiting nearest child first
+                    if(!m_Nodes.empty()) {
+                        uint32_t stack[TraversalStackSize];
+                        int stackSize = 0;
+                        stack[stackSize++] = 0;
+                        while(stackSize > 0) {
+                            const Node &node = m_Nodes[stack[--stackSize]];
+                            if(!getMask(intersectBox(node, packet, tMin))) {
+                                continue;
+                            }
+
+                            if(node.count > 0) {
+                                for(uint32_t t = node.leftOrFirst; t < (node.leftOrFirst + node.count); t++) {
+                                    intersectTriangle(m_Triangles[t], t, packet, tMin);
+                                }
+                            }
+                            else {
+                                const bool leftFirst = !packet.negative[node.axis];
+                                stack[stackSize++] = leftFirst ? (node.leftOrFirst + 1) : node.leftOrFirst;
+                                stack[stackSize++] = leftFirst ? node.leftOrFirst : (node.leftOrFirst + 1);
+                            }
+                        }
+                    }
+
+                    // Shade and write pixels
+                    float u[4], v[4];
+                    packet.u.store(u);
+                    packet.v.store(v);
+                    for(int i = 0; i < 4; i++) {
+                        // Skip repeated edge pixels
+                        if((i % 2 == 1 && (blockCol + 1) >= size.width) || (i >= 2 && ((2 * blockRow) + 1) >= size.height)) {
+                            continue;
+                        }
+
+                        float colour[3];
+                        if(packet.triangle[i] < 0) {
+                            std::copy(m_SkyColour.cbegin(), m_SkyColour.cend(), colour);
+                        }
+                        else {
+                            // Interpolate vertex colours and, if there's a texture, modulate them by it
+                            const auto &shading = m_Shading[packet.triangle[i]];
+                            const float w[3] = { 1.0f - u[i] - v[i], u[i], v[i] };
+                            for(unsigned int c = 0; c < 3; c++) {
+                                colour[c] = (w[0] * shading.colours[0][c]) + (w[1] * shading.colours[1][c]) + (w[2] * shading.colours[2][c]);
+                            }
+                            if(shading.texture >= 0) {
+                                const float s = (w[0] * shading.texCoords[0][0]) + (w[1] * shading.texCoords[1][0]) + (w[2] * shading.texCoords[2][0]);
+                                const float t = (w[0] * shading.texCoords[0][1]) + (w[1] * shading.texCoords[1][1]) + (w[2] * shading.texCoords[2][1]);
+                                float texel[3];
+                                sampleTexture(m_Textures[shading.texture], s, t, texel);
+                                for(unsigned int c = 0; c < 3; c++) {
+                                    colour[c] *= texel[c];
+                                }
+                            }
+                        }
+
+                        // Write BGR pixel
+                        auto &pixel = outFrame.at<cv::Vec3b>(pixelRows[i], pixelCols[i]);
+                        pixel[0] = toByte(colour[2]);
+                        pixel[1] = toByte(colour[1]);
+                        pixel[2] = toByte(colour[0]);
+                    }
+                }
+            }
+        });
+}
+}   // namespace AntWorld
+}   // namespace BoBRobotics
@@ -0,0 +1,231 @@
+// BoB robotics includes
+#include "common/macros.h"
+#include "antworld/headless_context.h"
+
+#ifdef BOB_HAVE_EGL
+// EGL includes
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Standard C includes
+#include <cstdlib>
+#include <cstring>
+
+// Standard C++ includes
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+#ifdef BOB_HAVE_EGL
+// Contexts on the same device share a display, which has to stay initialised
+// until the last of them is destroyed
+std::mutex DisplayMutex;
+std::map<EGLDisplay, int> DisplayRefCounts;
+
+void
+throwEGLError(const std::string &message)
+{
+    std::ostringstream ss;
+    ss << message << " (EGL error 0x" << std::hex << eglGetError() << ")";
+    throw std::runtime_error(ss.str());
+}
+
+bool
+hasClientExtension(const char *name)
+{
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    return extensions && std::strstr(extensions, name);
+}
+
+std::vector<EGLDeviceEXT>
+getDevices()
+{
+    if (!hasClientExtension("EGL_EXT_device_enumeration")) {
+        return {};
+    }
+    const auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(
+            eglGetProcAddress("eglQueryDevicesEXT"));
+
+    EGLint numDevices = 0;
+    if (!queryDevices || !queryDevices(0, nullptr, &numDevices)) {
+        return {};
+    }
+    std::vector<EGLDeviceEXT> devices(numDevices);
+    queryDevices(numDevices, devices.data(), &numDevices);
+    devices.resize(numDevices);
+    return devices;
+}
+
+EGLDisplay
+getDisplay(int deviceIndex)
+{
+    if (deviceIndex < 0) {
+        if (const char *device = std::getenv("BOB_ANTWORLD_EGL_DEVICE")) {
+            deviceIndex = std::stoi(device);
+        }
+    }
+
+    // Without EGL_EXT_platform_device, we can only use the default display,
+    // which may need an X server
+    const auto devices = getDevices();
+    if (devices.empty() || !hasClientExtension("EGL_EXT_platform_device")) {
+        if (deviceIndex > 0) {
+            throw std::runtime_error("This EGL implementation does not support selecting devices");
+        }
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    if (deviceIndex < 0) {
+        deviceIndex = 0;
+    } else if (deviceIndex >= static_cast<int>(devices.size())) {
+        throw std::runtime_error("EGL device " + std::to_string(deviceIndex) +
+                                 " requested, but only " + std::to_string(devices.size()) +
+                                 " available");
+    }
+    const auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    BOB_ASSERT(getPlatformDisplay);
+    return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[deviceIndex], nullptr);
+}
+
+void
+destroy(EGLDisplay display, EGLSurface surface, EGLContext context)
+{
+    if (context != EGL_NO_CONTEXT) {
+        if (eglGetCurrentContext() == context) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        }
+        eglDestroyContext(display, context);
+    }
+    if (surface != EGL_NO_SURFACE) {
+        eglDestroySurface(display, surface);
+    }
+
+    std::lock_guard<std::mutex> lock(DisplayMutex);
+    if (--DisplayRefCounts[display] == 0) {
+        DisplayRefCounts.erase(display);
+        eglTerminate(display);
+    }
+}
+#endif // BOB_HAVE_EGL
+} // anonymous namespace
+
+namespace BoBRobotics {
+namespace AntWorld {
+
+HeadlessContext::HeadlessContext(const cv::Size &size, int deviceIndex)
+  : m_Size(size)
+{
+#ifdef BOB_HAVE_EGL
+    BOB_ASSERT(size.width > 0 && size.height > 0);
+
+    EGLDisplay display = getDisplay(deviceIndex);
+    if (display == EGL_NO_DISPLAY) {
+        throwEGLError("Could not get EGL display");
+    }
+    {
+        std::lock_guard<std::mutex> lock(DisplayMutex);
+        if (!eglInitialize(display, nullptr, nullptr)) {
+            throwEGLError("Could not initialise EGL display");
+        }
+        DisplayRefCounts[display]++;
+    }
+    m_Display = display;
+
+    try {
+        // AntWorld uses the fixed-function pipeline, so we need desktop GL, not GLES
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_DEPTH_SIZE, 24,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint numConfigs;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+            throwEGLError("Could not find a suitable EGL config");
+        }
+
+        const EGLint surfaceAttribs[] = { EGL_WIDTH, size.width, EGL_HEIGHT, size.height, EGL_NONE };
+        m_Surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+        if (m_Surface == EGL_NO_SURFACE) {
+            throwEGLError("Could not create EGL pbuffer");
+        }
+
+        // As we don't ask for a particular version, this gives us a compatibility context
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            throwEGLError("EGL implementation does not support OpenGL");
+        }
+        m_Context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+        if (m_Context == EGL_NO_CONTEXT) {
+            throwEGLError("Could not create EGL context");
+        }
+
+        makeCurrent();
+    } catch (...) {
+        destroy(display, m_Surface, m_Context);
+        throw;
+    }
+#else
+    (void) deviceIndex;
+    throw std::runtime_error("BoB robotics was built without EGL, so headless rendering is not available");
+#endif
+}
+
+HeadlessContext::~HeadlessContext()
+{
+#ifdef BOB_HAVE_EGL
+    destroy(m_Display, m_Surface, m_Context);
+#endif
+}
+
+void
+HeadlessContext::makeCurrent()
+{
+#ifdef BOB_HAVE_EGL
+    // The current API is per-thread state
+    eglBindAPI(EGL_OPENGL_API);
+    if (!eglMakeCurrent(m_Display, m_Surface, m_Surface, m_Context)) {
+        throwEGLError("Could not make EGL context current");
+    }
+#endif
+}
+
+void
+HeadlessContext::releaseCurrent()
+{
+#ifdef BOB_HAVE_EGL
+    eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+#endif
+}
+
+bool
+HeadlessContext::isSupported()
+{
+#ifdef BOB_HAVE_EGL
+    return true;
+#else
+    return false;
+#endif
+}
+
+int
+HeadlessContext::getNumDevices()
+{
+#ifdef BOB_HAVE_EGL
+    return static_cast<int>(getDevices().size());
+#else
+    return 0;
+#endif
+}
+
+} // AntWorld
+} // BoBRobotics
@@ -1,9 +1,109 @@
 // BoB robotics includes
 #include "antworld/renderer.h"
 #include "antworld/render_target.h"
+#include "common/macros.h"
+#include "plog/Log.h"
+
+// Standard C includes
+#include <cstdlib>
 
 // Standard C++ includes
+#include <memory>
 #include <stdexcept>
+#include <utility>
+
+//----------------------------------------------------------------------------
+// Anonymous namespace
+//----------------------------------------------------------------------------
+namespace
+{
+// Transforms world into the ant's frame
+const char *const LayeredVertexShader = R"(
+#version 150
+uniform mat4 antMatrix;
+in vec4 position;
+in vec4 colour;
+in vec2 texCoord;
+out vec4 vertexColour;
+out vec2 vertexTexCoord;
+void main()
+{
+    gl_Position = antMatrix * position;
+    vertexColour = colour;
+    vertexTexCoord = texCoord;
+}
+)";
+
+// Sends each triangle to every cubemap face it might be visible on
+const char *const LayeredGeometryShader = R"(
+#version 150
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 18) out;
+uniform mat4 cubeFaceMatrices[6];
+in vec4 vertexColour[];
+in vec2 vertexTexCoord[];
+out vec4 fragmentColour;
+out vec2 fragmentTexCoord;
+void main()
+{
+    for(int f = 0; f < 6; f++) {
+        // Skip triangle if all its vertices are outside the same clip plane
+        vec4 clip[3];
+        vec3 below = vec3(0.0);
+        vec3 above = vec3(0.0);
+        for(int v = 0; v < 3; v++) {
+            clip[v] = cubeFaceMatrices[f] * gl_in[v].gl_Position;
+            below += step(clip[v].xyz, vec3(-clip[v].w));
+            above += step(vec3(clip[v].w), clip[v].xyz);
+        }
+        if(any(equal(below, vec3(3.0))) || any(equal(above, vec3(3.0)))) {
+            continue;
+        }
+
+        for(int v = 0; v < 3; v++) {
+            gl_Layer = f;
+            gl_Position = clip[v];
+            fragmentColour = vertexColour[v];
+            fragmentTexCoord = vertexTexCoord[v];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+)";
+
+// Equivalent to fixed-function GL_MODULATE texturing
+const char *const LayeredFragmentShader = R"(
+#version 150
+uniform sampler2D surfaceTexture;
+uniform bool textured;
+in vec4 fragmentColour;
+in vec2 fragmentTexCoord;
+out vec4 outputColour;
+void main()
+{
+    outputColour = textured ? (fragmentColour * texture(surfaceTexture, fragmentTexCoord)) : fragmentColour;
+}
+)";
+
+GLuint compileShader(GLenum type, const char *source)
+{
+    const GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if(status != GL_TRUE) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        glDeleteShader(shader);
+        throw std::runtime_error(std::string("Error compiling shader: ") + log);
+    }
+    return shader;
+}
+}
+
 
 //------------------------------------------------------------------------
 // BoBRobotics::AntWorld::Renderer
@@ -19,7 +119,9 @@ Renderer::Renderer(GLsizei cubemapSize, double nearClip, double farClip,
                    degree_t horizontalFOV, degree_t verticalFOV)
 :   m_RenderMesh(horizontalFOV, verticalFOV, 15_deg, 40, 10),
     m_CubemapTexture(0), m_FBO(0), m_DepthBuffer(0),
-    m_CubemapSize(cubemapSize), m_NearClip(nearClip), m_FarClip(farClip)
+    m_LayeredFBO(0), m_LayeredDepthTexture(0), m_LayeredProgram(0),
+    m_AntMatrixUniform(-1), m_CubeFaceMatricesUniform(-1), m_TexturedUniform(-1),
+    m_LayeredRendering(false), m_CubemapSize(cubemapSize), m_NearClip(nearClip), m_FarClip(farClip)
 {
     // Create FBO for rendering to cubemap and bind
     glGenFramebuffers(1, &m_FBO);
@@ -59,12 +161,23 @@ Renderer::Renderer(GLsizei cubemapSize, double nearClip, double farClip,
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // Pre-generate lookat matrices to point at cubemap faces
-    generateCubeFaceLookAtMatrices();
+    // Pre-generate matrices to point at cubemap faces
+    generateCubeFaceMatrices();
+
+    // If possible, render all cubemap faces in one pass
+    if(isLayeredRenderingSupported() && std::getenv("BOB_ANTWORLD_LEGACY_RENDERER") == nullptr) {
+        try {
+            createLayeredRenderingResources();
+        }
+        catch(std::runtime_error &ex) {
+            LOGW << "Rendering cubemap faces separately: " << ex.what();
+        }
+    }
 }
 //----------------------------------------------------------------------------
 Renderer::~Renderer()
 {
+    deleteLayeredRenderingResources();
     glDeleteRenderbuffers(1, &m_DepthBuffer);
     glDeleteTextures(1, &m_CubemapTexture);
     glDeleteFramebuffers(1, &m_FBO);
@@ -74,45 +187,33 @@ void Renderer::renderPanoramicView(meter_t x, meter_t y, meter_t z,
                                    degree_t yaw, degree_t pitch, degree_t roll,
                                    GLint viewportX, GLint viewportY, GLsizei viewportWidth, GLsizei viewportHeight,
                                    GLuint drawFBO)
+{
+    renderPanoramicViewInternal(x, y, z, yaw, pitch, roll,
+                                viewportX, viewportY, viewportWidth, viewportHeight,
+                                drawFBO, false);
+}
+//----------------------------------------------------------------------------
+void Renderer::renderPanoramicViewInternal(meter_t x, meter_t y, meter_t z,
+                                           degree_t yaw, degree_t pitch, degree_t roll,
+                                           GLint viewportX, GLint viewportY, GLsizei viewportWidth, GLsizei viewportHeight,
+                                           GLuint drawFBO, bool flipVertically)
 {
     // Configure viewport to cubemap-sized square
     glViewport(0, 0, m_CubemapSize, m_CubemapSize);
 
-    // Bind the cubemap FBO for offscreen rendering
-    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
-
-    // Configure perspective projection matrix
-    // **TODO** re-implement in Eigen
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(90.0,
-                   1.0,
-                   m_NearClip, m_FarClip);
-
-    glMatrixMode(GL_MODELVIEW);
-
     // Save ant transform to matrix
-    float antMatrix[16];
+    GLfloat antMatrix[16];
+    glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
     applyFrame(x, y, z, yaw, pitch, roll);
     glGetFloatv(GL_MODELVIEW_MATRIX, antMatrix);
 
-    // Loop through each heading we need to render
-    for(GLenum f = 0; f < 6; f++) {
-        // Attach correct frame buffer face to frame buffer
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, f + GL_TEXTURE_CUBE_MAP_POSITIVE_X, m_CubemapTexture, 0);
-
-        // Load look at matrix for this cube face
-        glLoadMatrixf(m_CubeFaceLookAtMatrices[f]);
-
-        // Multiply this by ant transform
-        glMultMatrixf(antMatrix);
-
-        // Clear colour and depth buffer
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // Render geometry
-        renderPanoramicGeometry();
+    // Render world into cubemap
+    if(m_LayeredRendering) {
+        renderCubemapLayered(antMatrix);
+    }
+    else {
+        renderCubemap(antMatrix);
     }
 
     // Rebind draw framebuffer
@@ -128,14 +229,23 @@ void Renderer::renderPanoramicView(meter_t x, meter_t y, meter_t z,
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluOrtho2D(0.0, 1.0,
-               0.0, 1.0);
+    if(flipVertically) {
+        // Flipping reverses the winding order, so front faces do too
+        gluOrtho2D(0.0, 1.0,
+                   1.0, 0.0);
+        glFrontFace(GL_CW);
+    }
+    else {
+        gluOrtho2D(0.0, 1.0,
+                   0.0, 1.0);
+    }
 
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
     // Render render mesh
     m_RenderMesh.render();
+    glFrontFace(GL_CCW);
 
     // Disable texture coordinate array, cube map texture and cube map texturing!
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
@@ -167,6 +277,116 @@ void Renderer::renderPanoramicView(meter_t x, meter_t y, meter_t z,
     }
 }
 //----------------------------------------------------------------------------
+void Renderer::renderPanoramicViews(const std::vector<Pose3<meter_t, degree_t>> &poses,
+                                    const cv::Size &size,
+                                    const std::function<void(size_t, const cv::Mat &)> &callback,
+                                    size_t ringSize)
+{
+    BOB_ASSERT(ringSize > 0);
+    if(poses.empty()) {
+        return;
+    }
+    ringSize = std::min(ringSize, poses.size());
+
+    // Create ring of render targets, each with a PBO to copy its view into
+    const size_t viewBytes = size.area() * 3;
+    std::vector<std::unique_ptr<RenderTarget>> renderTargets;
+    std::vector<GLuint> pbos(ringSize);
+    std::vector<GLsync> fences(ringSize, nullptr);
+    glGenBuffers(static_cast<GLsizei>(ringSize), pbos.data());
+    for(GLuint pbo : pbos) {
+        renderTargets.emplace_back(std::make_unique<RenderTarget>(size.width, size.height));
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, viewBytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // Rows of views needn't be 4-byte aligned
+    GLint packAlignment;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    // Without fences, mapping PBOs just waits for the copy to complete
+    const bool useFences = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+
+    auto cleanup = [&]() {
+        for(GLsync fence : fences) {
+            if(fence) {
+                glDeleteSync(fence);
+            }
+        }
+        glDeleteBuffers(static_cast<GLsizei>(ringSize), pbos.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    };
+
+    // Wait for view to be copied and pass it to callback
+    auto readView = [&](size_t index) {
+        const size_t slot = index % ringSize;
+        if(fences[slot]) {
+            GLenum result;
+            do {
+                result = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while(result == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fences[slot]);
+            fences[slot] = nullptr;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+        void *data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if(!data) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            throw std::runtime_error("Could not map pixel buffer");
+        }
+        try {
+            callback(index, cv::Mat(size, CV_8UC3, data));
+        }
+        catch(...) {
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            throw;
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    };
+
+    try {
+        for(size_t i = 0; i < poses.size(); i++) {
+            // Free up this slot by handing its previous view over
+            const size_t slot = i % ringSize;
+            if(i >= ringSize) {
+                readView(i - ringSize);
+            }
+
+            // Render view, upside down so rows come back in OpenCV's order
+            const auto &pose = poses[i];
+            auto &renderTarget = *renderTargets[slot];
+            renderTarget.bind();
+            renderTarget.clear();
+            renderPanoramicViewInternal(pose.x(), pose.y(), pose.z(), pose.yaw(), pose.pitch(), pose.roll(),
+                                        0, 0, size.width, size.height, renderTarget.getFBO(), true);
+
+            // Start copying it back asynchronously
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+            glReadPixels(0, 0, size.width, size.height, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            if(useFences) {
+                fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
+        }
+
+        // Hand over views still in flight
+        for(size_t i = poses.size() - ringSize; i < poses.size(); i++) {
+            readView(i);
+        }
+    }
+    catch(...) {
+        cleanup();
+        throw;
+    }
+    cleanup();
+}
+//----------------------------------------------------------------------------
 void Renderer::renderFirstPersonView(meter_t x, meter_t y, meter_t z,
                                      degree_t yaw, degree_t pitch, degree_t roll,
                                      GLint viewportX, GLint viewportY, GLsizei viewportWidth, GLsizei viewportHeight)
@@ -276,6 +496,11 @@ void Renderer::renderPanoramicGeometry()
     m_World.render();
 }
 //----------------------------------------------------------------------------
+void Renderer::renderPanoramicGeometryLayered(GLint texturedUniform)
+{
+    m_World.renderWithShader(texturedUniform);
+}
+//----------------------------------------------------------------------------
 void Renderer::renderFirstPersonGeometry()
 {
     m_World.render();
@@ -286,17 +511,37 @@ void Renderer::renderTopDownGeometry()
     m_World.render();
 }
 //----------------------------------------------------------------------------
-void Renderer::generateCubeFaceLookAtMatrices()
+void Renderer::setLayeredRenderingEnabled(bool enabled)
 {
-    // Set matrix model (which matrix stack you trash is somewhat arbitrary)
-    glMatrixMode(GL_MODELVIEW);
+    if(enabled && m_LayeredProgram == 0) {
+        if(!isLayeredRenderingSupported()) {
+            throw std::runtime_error("Rendering cubemap faces in one pass requires OpenGL 3.2");
+        }
+        createLayeredRenderingResources();
+    }
+    m_LayeredRendering = enabled;
+}
+//----------------------------------------------------------------------------
+bool Renderer::isLayeredRenderingSupported()
+{
+    return GLEW_VERSION_3_2;
+}
+//----------------------------------------------------------------------------
+void Renderer::generateCubeFaceMatrices()
+{
+    // Build matrices on the projection stack, as the GPU uses them
+    glMatrixMode(GL_PROJECTION);
 
     // Loop through cube faces
     for(unsigned int f = 0; f < 6; f++) {
-        // Load identity matrix
+        // Configure perspective projection matrix
+        // **TODO** re-implement in Eigen
         glLoadIdentity();
+        gluPerspective(90.0,
+                       1.0,
+                       m_NearClip, m_FarClip);
 
-        // Load lookup matrix
+        // Multiply by lookat matrix
         switch (f + GL_TEXTURE_CUBE_MAP_POSITIVE_X)
         {
             case GL_TEXTURE_CUBE_MAP_POSITIVE_X:
@@ -340,10 +585,133 @@ void Renderer::generateCubeFaceLookAtMatrices()
         };
 
         // Save matrix
-        glGetFloatv(GL_MODELVIEW_MATRIX, m_CubeFaceLookAtMatrices[f]);
+        glGetFloatv(GL_PROJECTION_MATRIX, m_CubeFaceViewProjectionMatrices[f]);
+    }
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+}
+//----------------------------------------------------------------------------
+void Renderer::createLayeredRenderingResources()
+{
+    try {
+        // Compile shaders and attach to program
+        // **NOTE** shaders are only actually deleted when program is
+        m_LayeredProgram = glCreateProgram();
+        const std::pair<GLenum, const char *> shaders[] = {{GL_VERTEX_SHADER, LayeredVertexShader},
+                                                          {GL_GEOMETRY_SHADER, LayeredGeometryShader},
+                                                          {GL_FRAGMENT_SHADER, LayeredFragmentShader}};
+        for(const auto &s : shaders) {
+            const GLuint shader = compileShader(s.first, s.second);
+            glAttachShader(m_LayeredProgram, shader);
+            glDeleteShader(shader);
+        }
+
+        // Match attributes to those surfaces use and link
+        glBindAttribLocation(m_LayeredProgram, Surface::PositionAttribute, "position");
+        glBindAttribLocation(m_LayeredProgram, Surface::ColourAttribute, "colour");
+        glBindAttribLocation(m_LayeredProgram, Surface::TexCoordAttribute, "texCoord");
+        glBindFragDataLocation(m_LayeredProgram, 0, "outputColour");
+        glLinkProgram(m_LayeredProgram);
+
+        GLint status;
+        glGetProgramiv(m_LayeredProgram, GL_LINK_STATUS, &status);
+        if(status != GL_TRUE) {
+            char log[1024];
+            glGetProgramInfoLog(m_LayeredProgram, sizeof(log), nullptr, log);
+            throw std::runtime_error(std::string("Error linking shader program: ") + log);
+        }
+
+        m_AntMatrixUniform = glGetUniformLocation(m_LayeredProgram, "antMatrix");
+        m_CubeFaceMatricesUniform = glGetUniformLocation(m_LayeredProgram, "cubeFaceMatrices");
+        m_TexturedUniform = glGetUniformLocation(m_LayeredProgram, "textured");
+
+        // Surface textures are bound to the first texture unit
+        glUseProgram(m_LayeredProgram);
+        glUniform1i(glGetUniformLocation(m_LayeredProgram, "surfaceTexture"), 0);
+        glUseProgram(0);
+
+        // Create depth cubemap, as renderbuffers can't be layered
+        glGenTextures(1, &m_LayeredDepthTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, m_LayeredDepthTexture);
+        for(unsigned int t = 0; t < 6; t++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + t, 0, GL_DEPTH_COMPONENT24,
+                         m_CubemapSize, m_CubemapSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        // Create FBO with whole cubemaps attached so geometry shader can select faces
+        glGenFramebuffers(1, &m_LayeredFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_LayeredFBO);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_CubemapTexture, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_LayeredDepthTexture, 0);
+        const GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if(fboStatus != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Layered frame buffer not complete");
+        }
+    }
+    catch(...) {
+        deleteLayeredRenderingResources();
+        throw;
+    }
+
+    m_LayeredRendering = true;
+}
+//----------------------------------------------------------------------------
+void Renderer::deleteLayeredRenderingResources()
+{
+    // **NOTE** OpenGL ignores zero names
+    glDeleteFramebuffers(1, &m_LayeredFBO);
+    glDeleteTextures(1, &m_LayeredDepthTexture);
+    glDeleteProgram(m_LayeredProgram);
+    m_LayeredFBO = 0;
+    m_LayeredDepthTexture = 0;
+    m_LayeredProgram = 0;
+    m_LayeredRendering = false;
+}
+//----------------------------------------------------------------------------
+void Renderer::renderCubemap(const GLfloat (&antMatrix)[16])
+{
+    // Bind the cubemap FBO for offscreen rendering
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+
+    // Loop through each heading we need to render
+    for(GLenum f = 0; f < 6; f++) {
+        // Attach correct frame buffer face to frame buffer
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, f + GL_TEXTURE_CUBE_MAP_POSITIVE_X, m_CubemapTexture, 0);
+
+        // Load projection and look at matrix for this cube face, as the layered path does
+        glMatrixMode(GL_PROJECTION);
+        glLoadMatrixf(m_CubeFaceViewProjectionMatrices[f]);
+
+        // Load ant transform
+        glMatrixMode(GL_MODELVIEW);
+        glLoadMatrixf(antMatrix);
+
+        // Clear colour and depth buffer
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Render geometry
+        renderPanoramicGeometry();
     }
 }
 //----------------------------------------------------------------------------
+void Renderer::renderCubemapLayered(const GLfloat (&antMatrix)[16])
+{
+    // Bind the layered FBO and clear all faces at once
+    glBindFramebuffer(GL_FRAMEBUFFER, m_LayeredFBO);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Render geometry once, letting geometry shader send it to each face
+    glUseProgram(m_LayeredProgram);
+    glUniformMatrix4fv(m_AntMatrixUniform, 1, GL_FALSE, antMatrix);
+    glUniformMatrix4fv(m_CubeFaceMatricesUniform, 6, GL_FALSE, &m_CubeFaceViewProjectionMatrices[0][0]);
+    renderPanoramicGeometryLayered(m_TexturedUniform);
+    glUseProgram(0);
+}
+//----------------------------------------------------------------------------
 void Renderer::applyFrame(meter_t x, meter_t y, meter_t z,
                           degree_t yaw, degree_t pitch, degree_t roll)
 {
@@ -10,6 +10,9 @@ namespace AntWorld
 {
 //----------------------------------------------------------------------------
 const Surface::Colour Surface::DefaultColour = {1.0f, 1.0f, 1.0f};
+constexpr GLuint Surface::PositionAttribute;
+constexpr GLuint Surface::ColourAttribute;
+constexpr GLuint Surface::TexCoordAttribute;
 //----------------------------------------------------------------------------
 Surface::Surface() 
 :   m_PositionVBO(0), m_ColourVBO(0), m_TexCoordVBO(0), m_IBO(0), 
@@ -46,7 +49,9 @@ void Surface::bind() const
     glBindVertexArray(m_VAO);
 
     // Set colour
+    // **NOTE** if there's a colour array, this is ignored
     glColor3fv(m_Colour.data());
+    glVertexAttrib4f(ColourAttribute, m_Colour[0], m_Colour[1], m_Colour[2], 1.0f);
 }
 //----------------------------------------------------------------------------
 void Surface::unbind() const
@@ -85,6 +90,48 @@ void Surface::unbindIndices() const
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 //----------------------------------------------------------------------------
+void Surface::uploadIndices(const GLuint *indices, GLsizei numIndices)
+{
+    // Upload indices and cache number
+    // **NOTE** as with the templated version, this leaves the IBO bound
+    uploadBuffer(indices, numIndices * sizeof(GLuint), m_IBO, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW);
+    m_NumIndices = numIndices;
+}
+//----------------------------------------------------------------------------
+void Surface::uploadVertices(const void *vertices, GLsizei numVertices, GLsizei stride,
+                             GLint texCoordOffset, GLint colourOffset)
+{
+    // Upload all vertex data to the one buffer
+    uploadBuffer(vertices, numVertices * stride, m_PositionVBO, GL_ARRAY_BUFFER, GL_STATIC_DRAW);
+
+    // Set vertex pointer and generic attribute
+    glVertexPointer(3, GL_FLOAT, stride, BUFFER_OFFSET(0));
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexAttribPointer(PositionAttribute, 3, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(0));
+    glEnableVertexAttribArray(PositionAttribute);
+
+    // If there are texture coordinates, set texture coordinate pointer and generic attribute
+    if(texCoordOffset >= 0) {
+        glTexCoordPointer(2, GL_FLOAT, stride, BUFFER_OFFSET(static_cast<size_t>(texCoordOffset)));
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexAttribPointer(TexCoordAttribute, 2, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(static_cast<size_t>(texCoordOffset)));
+        glEnableVertexAttribArray(TexCoordAttribute);
+    }
+
+    // If there are colours, set colour pointer and generic attribute
+    if(colourOffset >= 0) {
+        glColorPointer(4, GL_UNSIGNED_BYTE, stride, BUFFER_OFFSET(static_cast<size_t>(colourOffset)));
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexAttribPointer(ColourAttribute, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, BUFFER_OFFSET(static_cast<size_t>(colourOffset)));
+        glEnableVertexAttribArray(ColourAttribute);
+    }
+
+    m_NumVertices = numVertices;
+
+    // Unbind buffer
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+//----------------------------------------------------------------------------
 void Surface::render(GLenum primitive, GLenum indexType) const
 {
     glEnable(GL_CULL_FACE);
@@ -98,6 +145,20 @@ void Surface::render(GLenum primitive, GLenum indexType) const
         glDrawElements(primitive, m_NumIndices, indexType, BUFFER_OFFSET(0));
     }
 }
+//----------------------------------------------------------------------------
+void Surface::uploadBuffer(const void *data, size_t size, GLuint &bufferObject,
+                           GLenum target, GLenum usage)
+{
+    // Generate buffer if required
+    if(bufferObject == 0) {
+        glGenBuffers(1, &bufferObject);
+    }
 
+    // Bind buffer
+    glBindBuffer(target, bufferObject);
+
+    // Upload data
+    glBufferData(target, size, data, usage);
+}
 }   // namespace AntWorld
 }   // namespace BoBRobotics
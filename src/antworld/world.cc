@@ -1,5 +1,6 @@
 // BoB robotics includes
 #include "antworld/common.h"
+#include "antworld/obj_mesh.h"
 #include "antworld/world.h"
 #include "common/macros.h"
 #include "plog/Log.h"
@@ -13,94 +14,10 @@
 // Standard C++ includes
 #include <algorithm>
 #include <fstream>
-#include <sstream>
+#include <map>
 #include <stdexcept>
 #include <tuple>
 
-//----------------------------------------------------------------------------
-// Anonymous namespace
-//----------------------------------------------------------------------------
-namespace
-{
-template<unsigned int N, typename T, typename std::enable_if<std::is_floating_point<T>::value>::type* = nullptr>
-void readVector(std::istringstream &stream, std::vector<T> &vector, float scale)
-{
-    // Read components and push back
-    GLfloat x;
-    for(unsigned int i = 0; i < N; i++) {
-        stream >> x;
-        vector.push_back(x * scale);
-    }
-}
-//----------------------------------------------------------------------------
-template<unsigned int N, typename T, typename std::enable_if<std::is_integral<T>::value>::type* = nullptr>
-void readVector(std::istringstream &stream, std::vector<T> &vector, float scale)
-{
-    // Read components and push back
-    GLfloat x;
-    for(unsigned int i = 0; i < N; i++) {
-        stream >> x;
-        vector.push_back((T)std::round(x * scale));
-    }
-}
-//----------------------------------------------------------------------------
-void readFace(std::istringstream &lineStream,
-              const std::vector<GLfloat> &rawPositions,
-              const std::vector<GLbyte> &rawColours,
-              const std::vector<GLfloat> &rawTexCoords,
-              std::tuple<std::string, std::vector<GLfloat>, std::vector<GLbyte>, std::vector<GLfloat>> &currentObjSurface)
-{
-    // Get references to current material's positions and texture coordinates
-    auto &surfacePositions = std::get<1>(currentObjSurface);
-    auto &surfaceColours = std::get<2>(currentObjSurface);
-    auto &surfaceTexCoords = std::get<3>(currentObjSurface);
-
-    // Loop through face vertex
-    std::string faceIndexString;
-    std::string indexString;
-    for(unsigned int v = 0; v < 3; v++) {
-        // Read indices i.e. P/T/N into string
-        lineStream >> faceIndexString;
-
-        // Convert into stream for processing
-        std::istringstream faceIndexStream(faceIndexString);
-
-        // Extract index of raw position
-        std::getline(faceIndexStream, indexString, '/');
-        const int position = stoi(indexString) - 1;
-
-        // Copy raw position into material
-        std::copy_n(&rawPositions[3 * position], 3, std::back_inserter(surfacePositions));
-
-        // If there are any colours, copy them into material
-        if(!rawColours.empty()) {
-            std::copy_n(&rawColours[3 * position], 3, std::back_inserter(surfaceColours));
-        }
-
-        // If there is more data to read
-        if(!faceIndexStream.eof()) {
-            // Extract index of raw texture coordinate
-            std::getline(faceIndexStream, indexString, '/');
-            const int texCoord = stoi(indexString) - 1;
-
-            // Copy raw texture coordinates into material
-            std::copy_n(&rawTexCoords[2 * texCoord], 2, std::back_inserter(surfaceTexCoords));
-        }
-    }
-
-    // Check this is the end of the linestream i.e. there aren't extra components
-    BOB_ASSERT(lineStream.eof());
-}
-//----------------------------------------------------------------------------
-void stripWindowsLineEnding(std::string &lineString)
-{
-    // If line has a Windows line ending, remove it
-    if(!lineString.empty() && lineString.back() == '\r') {
-        lineString.pop_back();
-    }
-}
-}
-
 //----------------------------------------------------------------------------
 // BoBRobotics::AntWorld::World
 //----------------------------------------------------------------------------
@@ -224,7 +141,8 @@ void World::load(const filesystem::path &filename, const GLfloat (&worldColour)[
     surface.unbind();
 }
 //----------------------------------------------------------------------------
-void World::loadObj(const filesystem::path &filename, float scale, int maxTextureSize, GLint textureFormat)
+void World::loadObj(const filesystem::path &filename, float scale, int maxTextureSize, GLint textureFormat,
+                    bool useCache)
 {
     LOGI << "Loading " << filename << "...";
 
@@ -243,170 +161,68 @@ void World::loadObj(const filesystem::path &filename, float scale, int maxTextur
 
     LOG_DEBUG << "Max texture size: " << maxTextureSize;
 
-    // Vector of geometry associated with each named surface (in unindexed triangle format)
-    // Each surface consists of:
-    // 0 - a name
-    // 1 - a vector of floating point vertex positions (x, y, z)
-    // 2 - a vector of 8-bit colours (r, g, b)
-    // 3 - a vector of floating point texture coordinates (U, V)
-    std::vector<std::tuple<std::string, std::vector<GLfloat>, std::vector<GLbyte>, std::vector<GLfloat>>> objSurfaces;
-
-    // Map of material names to texture pointers and colour names
-    std::map<std::string, std::tuple<Texture*, Surface::Colour>> materialNames;
-
-    // Parser
-    {
-        // Vectors to hold 'raw' positions, colours and texture coordinates read from obj
-        std::vector<GLfloat> rawPositions;
-        std::vector<GLbyte> rawColours;
-        std::vector<GLfloat> rawTexCoords;
-
-        // Open obj file
-        std::ifstream objFile(filename.str());
-        BOB_ASSERT(!objFile.fail());
-        objFile.exceptions(std::ios::badbit);
-
-        // Get base path to load materials etc relative to
-        const auto basePath = filename.make_absolute().parent_path();
-
-        // Read lines into strings
-        std::string lineString;
-        std::string commandString;
-        std::string parameterString;
-        while(std::getline(objFile, lineString)) {
-            // Strip windows line endings
-            stripWindowsLineEnding(lineString);
-
-            // Entirely skip comment or empty lines
-            if(lineString.empty() || lineString[0] == '#') {
-                continue;
-            }
-
-            // Wrap line in stream for easier parsing
-            std::istringstream lineStream(lineString);
-
-            // Read command from first token
-            lineStream >> commandString;
-            if(commandString == "mtllib") {
-                lineStream >> parameterString;
-
-                // Parse materials
-                loadMaterials(basePath, parameterString,
-                              textureFormat, maxTextureSize,
-                              materialNames);
-            }
-            else if(commandString == "o") {
-                lineStream >> parameterString;
-                LOG_DEBUG << "Reading object: " << parameterString;
-            }
-            else if(commandString == "v") {
-                // Read vertex
-                readVector<3>(lineStream, rawPositions, scale);
-
-                // If line has more data, read it into raw colours
-                if(!lineStream.eof()) {
-                    readVector<3>(lineStream, rawColours, 255.0f);
-                }
-            }
-            else if(commandString == "vt") {
-                // Read texture coordinate and check there's no unhandled components following it
-                readVector<2>(lineStream, rawTexCoords, 1.0f);
-                BOB_ASSERT(lineStream.eof());
-            }
-            else if(commandString == "vn") {
-                // ignore vertex normals for now
-            }
-            else if(commandString == "usemtl") {
-                lineStream >> parameterString;
-                LOG_INFO << "\tReading surface: " << parameterString;
-                objSurfaces.emplace_back(parameterString, std::initializer_list<GLfloat>(),
-                                         std::initializer_list<GLbyte>(), std::initializer_list<GLfloat>());
-            }
-            else if(commandString == "s") {
-                // ignore smoothing
-            }
-            else if(commandString == "f") {
-                // If there are no textures, surfaces aren't always created (at least by MeshLab), so create a default one
-                if(objSurfaces.empty()) {
-                    LOG_WARNING << "Encountered faces before any surfaces are defined - adding default surface";
-                    objSurfaces.emplace_back("default", std::initializer_list<GLfloat>(),
-                                             std::initializer_list<GLbyte>(), std::initializer_list<GLfloat>());
-                }
-
-                // Read face
-                readFace(lineStream, rawPositions, rawColours, rawTexCoords, objSurfaces.back());
-            }
-            else {
-                LOG_WARNING << "Unhandled obj tag '" << commandString << "'";
-            }
+    // Parse obj file or read it from cache
+    const ObjMesh mesh = ObjMesh::load(filename, scale, useCache);
 
-        }
+    // Copy bounds
+    for(unsigned int c = 0; c < 3; c++) {
+        m_MinBound[c] = meter_t(mesh.getMinBound()[c]);
+        m_MaxBound[c] = meter_t(mesh.getMaxBound()[c]);
+    }
 
-        LOG_INFO << "\t" << rawPositions.size() / 3 << " raw positions, " << rawTexCoords.size() / 2 << " raw texture coordinates, ";
-        LOG_INFO << rawColours.size() / 3 << " raw colours, " << objSurfaces.size() << " surfaces, " << m_Textures.size() << " textures";
+    LOG_INFO << "Min: (" << m_MinBound[0] << ", " << m_MinBound[1] << ", " << m_MinBound[2] << ")";
+    LOG_INFO << "Max: (" << m_MaxBound[0] << ", " << m_MaxBound[1] << ", " << m_MaxBound[2] << ")";
 
-        // If there are ANY raw colours, assert that there are the same number as there are positions
-        if(!rawColours.empty()) {
-            BOB_ASSERT(rawColours.size() == rawPositions.size());
-        }
+    // Remove any existing surfaces and the textures they used
+    m_Surfaces.clear();
+    m_Textures.clear();
 
-        // Initialise bounds to limits of underlying data types
-        std::fill_n(&m_MinBound[0], 3, std::numeric_limits<meter_t>::max());
-        std::fill_n(&m_MaxBound[0], 3, std::numeric_limits<meter_t>::min());
-        for(unsigned int i = 0; i < rawPositions.size(); i += 3) {
-            for(unsigned int c = 0; c < 3; c++) {
-                m_MinBound[c] = units::math::min(m_MinBound[c], meter_t(rawPositions[i + c]));
-                m_MaxBound[c] = units::math::max(m_MaxBound[c], meter_t(rawPositions[i + c]));
-            }
+    // Load textures and build map of material names to texture pointers and colours
+    const auto basePath = filename.make_absolute().parent_path();
+    std::map<std::string, std::tuple<Texture*, Surface::Colour>> materialNames;
+    for(const auto &material : mesh.getMaterials()) {
+        Texture *texture = nullptr;
+        if(!material.textureFilename.empty()) {
+            texture = loadTexture(basePath / material.textureFilename, textureFormat, maxTextureSize);
         }
-
-        LOG_INFO << "Min: (" << m_MinBound[0] << ", " << m_MinBound[1] << ", " << m_MinBound[2] << ")";
-        LOG_INFO << "Max: (" << m_MaxBound[0] << ", " << m_MaxBound[1] << ", " << m_MaxBound[2] << ")";
+        materialNames[material.name] = std::make_tuple(texture, material.colour);
     }
 
-    // Remove any existing surfaces
-    m_Surfaces.clear();
-
     // Allocate new materials array to match those found in obj
-    m_Surfaces.resize(objSurfaces.size());
+    m_Surfaces.resize(mesh.getSurfaces().size());
 
     // Loop through surfaces
-    for(unsigned int s = 0; s < objSurfaces.size(); s++) {
-        const auto &objSurface = objSurfaces[s];
+    for(unsigned int s = 0; s < m_Surfaces.size(); s++) {
+        const auto &objSurface = mesh.getSurfaces()[s];
         auto &surface = m_Surfaces[s];
 
         // Find corresponding material
-        const auto mtl = materialNames.find(std::get<0>(objSurface));
+        const auto mtl = materialNames.find(objSurface.materialName);
 
         // Bind material
         surface.bind();
 
-        // Upload positions from obj file
-        surface.uploadPositions(std::get<1>(objSurface));
+        // Upload interleaved vertices and indices
+        surface.uploadVertices(objSurface.vertices, static_cast<GLsizei>(objSurface.numVertices),
+                               static_cast<GLsizei>(objSurface.getStride()),
+                               objSurface.hasTexCoords ? static_cast<GLint>(objSurface.getTexCoordOffset()) : -1,
+                               objSurface.hasColours ? static_cast<GLint>(objSurface.getColourOffset()) : -1);
+        surface.uploadIndices(objSurface.indices, static_cast<GLsizei>(objSurface.numIndices));
 
         // If material was found, set colour
         if(mtl != materialNames.end()) {
             surface.setColour(std::get<1>(mtl->second));
-        }
-
-        // If there are any vertex colours, upload them from obj file
-        if(!std::get<2>(objSurface).empty()) {
-            surface.uploadColours(std::get<2>(objSurface));
-        }
-
-        // If there are any texture coordinates
-        if(!std::get<3>(objSurface).empty()) {
-            // Upload texture coordinates from obj file
-            surface.uploadTexCoords(std::get<3>(objSurface));
 
-            // If material was found, set texture
-            if(mtl != materialNames.end()) {
+            // If there are any texture coordinates, set texture
+            if(objSurface.hasTexCoords) {
                 surface.setTexture(std::get<0>(mtl->second));
             }
         }
 
         // Unbind surface
+        // **NOTE** indices have to stay bound until VAO is unbound
         surface.unbind();
+        surface.unbindIndices();
     }
 }
 //----------------------------------------------------------------------------
@@ -420,147 +236,54 @@ void World::render() const
     }
 }
 //----------------------------------------------------------------------------
-void World::loadMaterials(const filesystem::path &basePath, const std::string &filename,
-                          GLint textureFormat, int maxTextureSize,
-                          std::map<std::string, std::tuple<Texture*, Surface::Colour>> &materialNames)
+void World::renderWithShader(GLint texturedUniform) const
 {
-    // Open obj file
-    std::ifstream mtlFile((basePath / filename).str());
-    BOB_ASSERT(!mtlFile.fail());
-    mtlFile.exceptions(std::ios::badbit);
-
-    LOG_DEBUG << "Reading material file: " << filename;
-
-    // Read lines into strings
-    std::string currentMaterialName;
-    std::string lineString;
-    std::string commandString;
-    std::string parameterString;
-    while(std::getline(mtlFile, lineString)) {
-        // Strip windows line endings
-        stripWindowsLineEnding(lineString);
-
-        // Entirely skip comment or empty lines
-        if(lineString[0] == '#' || lineString.empty()) {
-            continue;
-        }
-
-        // Wrap line in stream for easier parsing
-        std::istringstream lineStream(lineString);
-
-        // Read command from first token
-        lineStream >> commandString;
-
-        // If command is a material name
-        if(commandString == "newmtl") {
-            lineStream >> currentMaterialName;
-            LOG_INFO << "\tReading material: " << currentMaterialName;
-        }
-        // Otherwise, if command specifies a diffuse colour
-        else if(commandString == "Kd") {
-            // Read colour
-            Surface::Colour colour;
-            for(unsigned int i = 0; i < 3; i++) {
-                lineStream >> colour[i];
-            }
-
-            // If material doesn't yet exist, emplace new material with colour and no texture
-            auto mtl = materialNames.find(currentMaterialName);
-            if(mtl == materialNames.cend()) {
-                materialNames.emplace(std::piecewise_construct,
-                                      std::forward_as_tuple(currentMaterialName),
-                                      std::forward_as_tuple(nullptr, colour));
-            }
-            // Otherwise, set colour in existing material
-            else {
-                std::get<1>(mtl->second) = colour;
-            }
-        }
-        // Otherwise, if command specifies a diffuse map
-        else if(commandString == "map_Kd") {
-            BOB_ASSERT(!currentMaterialName.empty());
-
-            // Skip any whitespace preceeding texture filename
-            while(lineStream.peek() == ' ') {
-                lineStream.get();
-            }
-
-            // Treat remainder of line as texture filename
-            std::string textureFilename;
-            std::getline(lineStream, textureFilename);
-            const size_t firstNonQuote = textureFilename.find_first_not_of('"');
-            const size_t lastNonQuote = textureFilename.find_last_not_of('"');
-            textureFilename = textureFilename.substr(firstNonQuote, lastNonQuote - firstNonQuote + 1);
-
-            LOG_DEBUG << "\t\tTexture: '" << textureFilename << "'";
-
-            // Load texture and add to map
-            const std::string texturePath = (basePath / textureFilename).str();
-
-            // Load texture
-            // **NOTE** using OpenCV so as to reduce need for extra dependencies
-            cv::Mat texture = cv::imread(texturePath);
-
-            // If texture couldn't be loaded, give warning
-            if(texture.cols == 0 && texture.rows == 0) {
-                LOG_WARNING << "Cannot load texture '" << texturePath << "'";
-            }
-            // Otherwise
-            else {
-                LOG_DEBUG << "\t\t\tOriginal dimensions: " << texture.cols << "x" << texture.rows;
-
-                // If texture isn't square, use longest side as size
-                int size = texture.cols;
-                if(texture.cols != texture.rows) {
-                    size = std::max(texture.cols, texture.rows);
-                }
-
-                // Clamp size to maximum texture size
-                size = std::min(size, maxTextureSize);
+    // Bind and render each material
+    for(auto &surf : m_Surfaces) {
+        glUniform1i(texturedUniform, surf.hasTexture() ? GL_TRUE : GL_FALSE);
+        surf.bindTextured();
+        surf.render();
+        surf.unbindTextured();
+    }
+}
+//----------------------------------------------------------------------------
+Texture *World::loadTexture(const filesystem::path &path, GLint textureFormat, int maxTextureSize)
+{
+    // Load texture
+    // **NOTE** using OpenCV so as to reduce need for extra dependencies
+    cv::Mat texture = cv::imread(path.str());
+
+    // If texture couldn't be loaded, give warning
+    if(texture.cols == 0 && texture.rows == 0) {
+        LOG_WARNING << "Cannot load texture '" << path.str() << "'";
+        return nullptr;
+    }
 
-                // Perform resize if required
-                if(size != texture.cols || size != texture.rows) {
-                    LOG_DEBUG << "\t\t\tResizing to: " << size << "x" << size;
-                    cv::resize(texture, texture, cv::Size(size, size), 0, 0, cv::INTER_CUBIC);
-                }
+    LOG_DEBUG << "\t\t\tOriginal dimensions: " << texture.cols << "x" << texture.rows;
 
-                // Flip texture about y-axis as the origin of OpenGL texture coordinates
-                // is in the bottom-left and obj file's is in the top-left
-                cv::flip(texture, texture, 0);
+    // If texture isn't square, use longest side as size
+    int size = texture.cols;
+    if(texture.cols != texture.rows) {
+        size = std::max(texture.cols, texture.rows);
+    }
 
-                // Add a new texture to array and upload data to it in selected format
-                m_Textures.emplace_back(new Texture());
-                m_Textures.back()->upload(texture, textureFormat);
+    // Clamp size to maximum texture size
+    size = std::min(size, maxTextureSize);
 
-                // If material doesn't yet exist, emplace new material with texture and default colour
-                auto mtl = materialNames.find(currentMaterialName);
-                if(mtl == materialNames.cend()) {
-                    materialNames.emplace(std::piecewise_construct,
-                                          std::forward_as_tuple(currentMaterialName),
-                                          std::forward_as_tuple(m_Textures.back().get(), Surface::DefaultColour));
-                }
-                // Otherwise
-                else {
-                    // Ensure texture isn't already set for this material
-                    BOB_ASSERT(std::get<0>(mtl->second) == nullptr);
+    // Perform resize if required
+    if(size != texture.cols || size != texture.rows) {
+        LOG_DEBUG << "\t\t\tResizing to: " << size << "x" << size;
+        cv::resize(texture, texture, cv::Size(size, size), 0, 0, cv::INTER_CUBIC);
+    }
 
-                    // Set texture in material
-                    std::get<0>(mtl->second) = m_Textures.back().get();
-                }
-            }
-        }
-        // Otherwise, if it's another material property, ignore
-        else if(commandString == "Ns" || commandString == "Ka" || commandString == "Ks" ||
-                commandString == "Ke" || commandString == "Ni" || commandString == "d" ||
-                commandString == "illum")
-        {
-        }
-        // Otherwise, give warning
-        else {
-            LOG_WARNING << "Unhandled mtl tag '" << commandString << "'";
-        }
+    // Flip texture about y-axis as the origin of OpenGL texture coordinates
+    // is in the bottom-left and obj file's is in the top-left
+    cv::flip(texture, texture, 0);
 
-    }
+    // Add a new texture to array and upload data to it in selected format
+    m_Textures.emplace_back(new Texture());
+    m_Textures.back()->upload(texture, textureFormat);
+    return m_Textures.back().get();
 }
 }   // namespace AntWorld
 }   // namespace BoBRobotics
@@ -0,0 +1,71 @@
+// BoB robotics includes
+#include "common/memory_mapped_file.h"
+
+// Standard C includes
+#include <cerrno>
+#include <cstring>
+
+// Standard C++ includes
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+// POSIX includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace BoBRobotics {
+MemoryMappedFile::MemoryMappedFile(const filesystem::path &path)
+{
+#ifdef _WIN32
+    // No mmap on Windows, so just read the whole file in
+    std::ifstream ifs(path.str(), std::ios::binary | std::ios::ate);
+    if (!ifs.good()) {
+        throw std::runtime_error("Could not open " + path.str());
+    }
+    m_Contents.resize(static_cast<size_t>(ifs.tellg()));
+    ifs.seekg(0);
+    ifs.read(reinterpret_cast<char *>(m_Contents.data()), m_Contents.size());
+    m_Data = m_Contents.empty() ? nullptr : m_Contents.data();
+    m_Size = m_Contents.size();
+#else
+    const int fd = ::open(path.str().c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + path.str() + " (" + strerror(errno) + ")");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not stat " + path.str() + " (" + strerror(errno) + ")");
+    }
+
+    // Zero-length mappings aren't allowed
+    m_Size = static_cast<size_t>(st.st_size);
+    if (m_Size > 0) {
+        void *data = mmap(nullptr, m_Size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Could not map " + path.str() + " into memory (" + strerror(errno) + ")");
+        }
+        m_Data = static_cast<const uint8_t *>(data);
+    }
+
+    // The mapping stays valid after the file is closed
+    ::close(fd);
+#endif
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+#ifndef _WIN32
+    if (m_Data) {
+        munmap(const_cast<uint8_t *>(m_Data), m_Size);
+    }
+#endif
+}
+} // BoBRobotics
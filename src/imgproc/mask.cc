@@ -78,6 +78,16 @@ Mask::clone() const
     return newMask;
 }
 
+Mask
+Mask::getROI(const cv::Rect &roi) const
+{
+    Mask newMask;
+    if (!empty()) {
+        newMask.m_Mask = m_Mask(roi);
+    }
+    return newMask;
+}
+
 void
 Mask::roll(Mask &out, size_t pixelsLeft) const
 {
@@ -4,7 +4,17 @@
 #include "plog/Log.h"
 #include "imgproc/opencv_unwrap_360.h"
 
+// Standard C includes
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
 // Standard C++ includes
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
 #include <stdexcept>
 #include <vector>
 
@@ -15,6 +25,43 @@
 #include "third_party/path.h"
 #include "third_party/units.h"
 
+namespace {
+//! Header for files in the unwrap map cache
+struct MapCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t width, height;
+    uint32_t reserved;
+};
+
+constexpr char MapCacheMagic[8] = "BoBUNWR";
+constexpr uint32_t MapCacheVersion = 1;
+
+filesystem::path &
+mapCachePath()
+{
+    // The cache is opt-in, so we don't write to users' home folders behind their backs
+    static filesystem::path path = []() -> filesystem::path {
+        if (const char *cachePath = std::getenv("BOB_UNWRAP_CACHE_PATH")) {
+            return cachePath;
+        }
+        return {};
+    }();
+    return path;
+}
+
+void
+createDirectories(const filesystem::path &path)
+{
+    if (path.empty() || path.exists()) {
+        return;
+    }
+    createDirectories(path.parent_path());
+    filesystem::create_directory(path);
+}
+} // anonymous namespace
+
 //----------------------------------------------------------------------------
 // BoBRobotics::ImgProc::OpenCVUnwrap360
 //----------------------------------------------------------------------------
@@ -105,37 +152,88 @@ OpenCVUnwrap360::create(const cv::Size &cameraResolution,
 void
 OpenCVUnwrap360::updateMaps()
 {
-    // Build unwrap maps
-    for (int i = 0; i < m_UnwrappedResolution.height; i++) {
-        for (int j = 0; j < m_UnwrappedResolution.width; j++) {
-            // Get i as a fraction of unwrapped height, flipping if desired
-            const float iFrac =
-                    m_Flip ? 1.0f - ((float) i /
-                                     (float) m_UnwrappedResolution.height)
-                           : ((float) i /
-                              (float) m_UnwrappedResolution.height);
+    cv::Mat mapX, mapY, unused;
+    computeMaps(m_UnwrappedResolution, mapX, mapY);
 
-            // Convert i and j to polar
-            const float r =
-                    iFrac * (m_OuterPixel - m_InnerPixel) + m_InnerPixel;
-            const degree_t th =
-                    (((double) j / (double) m_UnwrappedResolution.width) *
-                     360.0_deg) +
-                    m_OffsetAngle;
+    /*
+     * Fixed-point maps are roughly twice as quick to remap with and, for
+     * nearest-neighbour lookups, give exactly the same results. Copies of this
+     * object may share the old map's memory, so don't overwrite it.
+     */
+    m_UnwrapMap.release();
+    cv::convertMaps(mapX, mapY, m_UnwrapMap, unused, CV_16SC2, /*nninterpolation=*/true);
+    applyInputOffset(m_UnwrapMap);
 
-            // Remap onto sphere
-            const float x = m_CentrePixel.x - r * units::math::sin(th);
-            const float y = m_CentrePixel.y + r * units::math::cos(th);
-            m_UnwrapMapX.at<float>(i, j) = x;
-            m_UnwrapMapY.at<float>(i, j) = y;
-        }
-    }
+    // Greyscale maps will need rebuilding too
+    m_GreyscaleResolution = {};
 }
 
 void
 OpenCVUnwrap360::unwrap(const cv::Mat &input, cv::Mat &output) const
 {
-    cv::remap(input, output, m_UnwrapMapX, m_UnwrapMapY, cv::INTER_NEAREST);
+    cv::remap(input, output, m_UnwrapMap, cv::noArray(), cv::INTER_NEAREST);
+}
+
+void
+OpenCVUnwrap360::unwrapGreyscale(const cv::Mat &input, cv::Mat &output,
+                                 const cv::Size &outputSize)
+{
+    if (outputSize != m_GreyscaleResolution) {
+        cv::Mat mapX, mapY;
+        computeMaps(outputSize, mapX, mapY);
+
+        m_GreyscaleMap.release();
+        m_GreyscaleInterpolation.release();
+        cv::convertMaps(mapX, mapY, m_GreyscaleMap, m_GreyscaleInterpolation, CV_16SC2);
+        applyInputOffset(m_GreyscaleMap);
+        m_GreyscaleResolution = outputSize;
+    }
+
+    // Convert after sampling, so we only convert the pixels we actually use
+    switch (input.channels()) {
+    case 1:
+        cv::remap(input, output, m_GreyscaleMap, m_GreyscaleInterpolation, cv::INTER_LINEAR);
+        break;
+    case 3:
+        cv::remap(input, m_GreyscaleBuffer, m_GreyscaleMap, m_GreyscaleInterpolation, cv::INTER_LINEAR);
+        cv::cvtColor(m_GreyscaleBuffer, output, cv::COLOR_BGR2GRAY);
+        break;
+    case 4:
+        cv::remap(input, m_GreyscaleBuffer, m_GreyscaleMap, m_GreyscaleInterpolation, cv::INTER_LINEAR);
+        cv::cvtColor(m_GreyscaleBuffer, output, cv::COLOR_BGRA2GRAY);
+        break;
+    default:
+        throw std::invalid_argument("Unsupported number of channels");
+    }
+}
+
+cv::Rect
+OpenCVUnwrap360::getAnnulusBounds() const
+{
+    // Leave an extra pixel for bilinear interpolation in unwrapGreyscale()
+    const cv::Rect bounds{ m_CentrePixel.x - m_OuterPixel, m_CentrePixel.y - m_OuterPixel,
+                           2 * m_OuterPixel + 2, 2 * m_OuterPixel + 2 };
+    return bounds & cv::Rect{ { 0, 0 }, m_CameraResolution };
+}
+
+void
+OpenCVUnwrap360::setInputROI(const cv::Rect &roi)
+{
+    BOB_ASSERT((roi & getAnnulusBounds()) == getAnnulusBounds());
+    m_InputOffset = roi.tl();
+    createMaps();
+}
+
+void
+OpenCVUnwrap360::setMapCachePath(filesystem::path path)
+{
+    mapCachePath() = std::move(path);
+}
+
+const filesystem::path &
+OpenCVUnwrap360::getMapCachePath()
+{
+    return mapCachePath();
 }
 
 void
@@ -198,9 +296,155 @@ OpenCVUnwrap360::read(const cv::FileNode &node)
 void
 OpenCVUnwrap360::createMaps()
 {
-    m_UnwrapMapX.create(m_UnwrappedResolution, CV_32FC1);
-    m_UnwrapMapY.create(m_UnwrappedResolution, CV_32FC1);
-    updateMaps();
+    const auto &cachePath = getMapCachePath();
+    if (cachePath.empty()) {
+        updateMaps();
+        return;
+    }
+
+    // Building maps involves a sin and cos for every pixel, so try the cache first
+    const auto path = cachePath / getMapCacheFilename();
+    if (loadCachedMap(path)) {
+        applyInputOffset(m_UnwrapMap);
+        m_GreyscaleResolution = {};
+    } else {
+        // Cached maps are always for the whole camera image
+        const auto offset = m_InputOffset;
+        m_InputOffset = {};
+        updateMaps();
+        saveCachedMap(path);
+
+        m_InputOffset = offset;
+        applyInputOffset(m_UnwrapMap);
+    }
+}
+
+void
+OpenCVUnwrap360::computeMaps(const cv::Size &resolution, cv::Mat &mapX, cv::Mat &mapY) const
+{
+    mapX.create(resolution, CV_32FC1);
+    mapY.create(resolution, CV_32FC1);
+
+    /*
+     * If resolution is lower than m_UnwrappedResolution, sample from the
+     * centre of each block of unwrapped pixels. (At full resolution, these
+     * are just i and j.)
+     */
+    const double scaleX = (double) m_UnwrappedResolution.width / (double) resolution.width;
+    const double scaleY = (double) m_UnwrappedResolution.height / (double) resolution.height;
+    for (int i = 0; i < resolution.height; i++) {
+        const auto iUnwrapped = (float) ((i + 0.5) * scaleY - 0.5);
+
+        // Get i as a fraction of unwrapped height, flipping if desired
+        const float iFrac =
+                m_Flip ? 1.0f - (iUnwrapped /
+                                 (float) m_UnwrappedResolution.height)
+                       : (iUnwrapped /
+                          (float) m_UnwrappedResolution.height);
+        const float r =
+                iFrac * (m_OuterPixel - m_InnerPixel) + m_InnerPixel;
+
+        for (int j = 0; j < resolution.width; j++) {
+            // Convert i and j to polar
+            const double jUnwrapped = (j + 0.5) * scaleX - 0.5;
+            const degree_t th =
+                    ((jUnwrapped / (double) m_UnwrappedResolution.width) *
+                     360.0_deg) +
+                    m_OffsetAngle;
+
+            // Remap onto sphere
+            const float x = m_CentrePixel.x - r * units::math::sin(th);
+            const float y = m_CentrePixel.y + r * units::math::cos(th);
+            mapX.at<float>(i, j) = x;
+            mapY.at<float>(i, j) = y;
+        }
+    }
+}
+
+void
+OpenCVUnwrap360::applyInputOffset(cv::Mat &map) const
+{
+    /*
+     * Shifting the integer part of a fixed-point map is exact, so this gives
+     * the same results as unwrapping the whole image. The map must not be
+     * shared with another object.
+     */
+    if (m_InputOffset != cv::Point{}) {
+        cv::subtract(map, cv::Scalar(m_InputOffset.x, m_InputOffset.y), map);
+    }
+}
+
+std::string
+OpenCVUnwrap360::getMapCacheFilename() const
+{
+    // The maps depend only on these values, so there's no need to hash them
+    std::ostringstream ss;
+    ss << "unwrap_" << m_CameraResolution.width << "x" << m_CameraResolution.height
+       << "_" << m_UnwrappedResolution.width << "x" << m_UnwrappedResolution.height
+       << "_c" << m_CentrePixel.x << "," << m_CentrePixel.y
+       << "_r" << m_InnerPixel << "-" << m_OuterPixel
+       << "_a" << std::setprecision(17) << m_OffsetAngle.value()
+       << (m_Flip ? "_flip" : "") << ".bin";
+    return ss.str();
+}
+
+bool
+OpenCVUnwrap360::loadCachedMap(const filesystem::path &path)
+{
+    std::ifstream ifs(path.str(), std::ios::binary);
+    if (!ifs.good()) {
+        return false;
+    }
+
+    MapCacheHeader header;
+    ifs.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!ifs.good() || std::memcmp(header.magic, MapCacheMagic, sizeof(MapCacheMagic)) != 0
+            || header.version != MapCacheVersion
+            || header.width != m_UnwrappedResolution.width
+            || header.height != m_UnwrappedResolution.height) {
+        LOGW << "Ignoring invalid unwrap map cache file " << path;
+        return false;
+    }
+
+    cv::Mat map(m_UnwrappedResolution, CV_16SC2);
+    ifs.read(reinterpret_cast<char *>(map.data), map.total() * map.elemSize());
+    if (!ifs.good()) {
+        LOGW << "Ignoring truncated unwrap map cache file " << path;
+        return false;
+    }
+
+    m_UnwrapMap = map;
+    return true;
+}
+
+void
+OpenCVUnwrap360::saveCachedMap(const filesystem::path &path) const
+{
+    // Not being able to write to the cache shouldn't stop anything working
+    try {
+        createDirectories(path.parent_path());
+
+        // Write to a temporary file first, so other processes never see a partial file
+        const std::string tempPath = path.str() + ".tmp" + std::to_string(std::random_device{}());
+        {
+            MapCacheHeader header{};
+            std::memcpy(header.magic, MapCacheMagic, sizeof(MapCacheMagic));
+            header.version = MapCacheVersion;
+            header.width = m_UnwrappedResolution.width;
+            header.height = m_UnwrappedResolution.height;
+
+            std::ofstream ofs(tempPath, std::ios::binary);
+            ofs.exceptions(std::ios::badbit | std::ios::failbit);
+            ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char *>(m_UnwrapMap.data),
+                      m_UnwrapMap.total() * m_UnwrapMap.elemSize());
+        }
+        if (std::rename(tempPath.c_str(), path.str().c_str()) != 0) {
+            std::remove(tempPath.c_str());
+        }
+    } catch (std::exception &e) {
+        LOGW << "Could not save unwrap maps to " << path << ": " << e.what();
+    }
 }
 
 void
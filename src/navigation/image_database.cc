@@ -1,5 +1,6 @@
 // BoB robotics includes
 #include "common/macros.h"
+#include "common/memory_mapped_file.h"
 #include "common/string.h"
 #include "imgproc/opencv_unwrap_360.h"
 #include "navigation/image_database.h"
@@ -12,6 +13,11 @@
 #include <tbb/parallel_for.h>
 
 // Standard C includes
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 
 // Standard C++ includes
@@ -20,16 +26,136 @@
 #include <regex>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 
 using namespace units::literals;
 using namespace units::angle;
 using namespace units::length;
 
+namespace {
+//! A range of characters in a memory-mapped file
+struct CharRange
+{
+    const char *begin, *end;
+
+    std::string str() const { return { begin, end }; }
+};
+
+CharRange
+trimRange(CharRange range)
+{
+    while (range.begin != range.end && std::isspace(static_cast<unsigned char>(*range.begin))) {
+        range.begin++;
+    }
+    while (range.end != range.begin && std::isspace(static_cast<unsigned char>(range.end[-1]))) {
+        range.end--;
+    }
+    return range;
+}
+
+/*
+ * The strto* functions need null-terminated strings, so copy fields into a
+ * buffer first. We're only parsing numbers, so there's no need to worry about
+ * long fields.
+ */
+template<class T, class ParseFunc>
+T
+parseNumber(const CharRange &field, const ParseFunc &parse)
+{
+    char buffer[64];
+    const auto length = std::min<size_t>(field.end - field.begin, sizeof(buffer) - 1);
+    std::copy_n(field.begin, length, buffer);
+    buffer[length] = '\0';
+
+    char *parsedEnd;
+    const T value = parse(buffer, &parsedEnd);
+    if (parsedEnd == buffer) {
+        throw std::invalid_argument("Could not parse \"" + field.str() + "\" as a number");
+    }
+    return value;
+}
+
+double
+parseDouble(const CharRange &field)
+{
+    return parseNumber<double>(field, [](const char *str, char **end) {
+        return std::strtod(str, end);
+    });
+}
+
+size_t
+parseSize(const CharRange &field)
+{
+    return parseNumber<size_t>(field, [](const char *str, char **end) {
+        return static_cast<size_t>(std::strtoull(str, end, 10));
+    });
+}
+
+//! Formats CSV output into a buffer, so it is written in large chunks
+class BufferedCSVWriter
+{
+public:
+    BufferedCSVWriter(std::ostream &stream)
+      : m_Stream(stream)
+    {
+        m_Buffer.reserve(BufferSize);
+    }
+
+    BufferedCSVWriter &operator<<(const char *str)
+    {
+        m_Buffer.append(str);
+        return checkFlush();
+    }
+
+    BufferedCSVWriter &operator<<(const std::string &str)
+    {
+        m_Buffer.append(str);
+        return checkFlush();
+    }
+
+    // Formatted the same way as std::ostream does by default
+    BufferedCSVWriter &operator<<(double value)
+    {
+        char str[32];
+        m_Buffer.append(str, std::snprintf(str, sizeof(str), "%g", value));
+        return checkFlush();
+    }
+
+    BufferedCSVWriter &operator<<(size_t value)
+    {
+        char str[32];
+        m_Buffer.append(str, std::snprintf(str, sizeof(str), "%zu", value));
+        return checkFlush();
+    }
+
+    void flush()
+    {
+        m_Stream.write(m_Buffer.data(), m_Buffer.size());
+        m_Buffer.clear();
+    }
+
+private:
+    static constexpr size_t BufferSize = 1 << 20;
+    std::ostream &m_Stream;
+    std::string m_Buffer;
+
+    BufferedCSVWriter &checkFlush()
+    {
+        if (m_Buffer.size() >= BufferSize) {
+            flush();
+        }
+        return *this;
+    }
+};
+} // anonymous namespace
+
 namespace BoBRobotics {
 namespace Navigation {
 
 constexpr const char *ImageDatabase::MetadataFilename;
 constexpr const char *ImageDatabase::EntriesFilename;
+constexpr size_t ImageDatabase::MinVideoSegmentFrames;
+constexpr size_t ImageDatabase::MaxVideoGrabFrames;
 
 size_t
 Range::size() const
@@ -50,17 +176,35 @@ ImageDatabase::Entry::load(bool greyscale) const
 bool
 ImageDatabase::Entry::hasExtraField(const std::string &name) const
 {
-    return extraFields.find(name) != extraFields.cend();
+    return findExtraField(name) != nullptr;
 }
 
 const std::string &
 ImageDatabase::Entry::getExtraField(const std::string &name) const
+{
+    const auto value = findExtraField(name);
+    BOB_ASSERT(value != nullptr);
+    return *value;
+}
+
+const std::string *
+ImageDatabase::Entry::findExtraField(const std::string &name) const
 {
     const auto pos = extraFields.find(name);
-    BOB_ASSERT(pos != extraFields.cend());
+    if (pos != extraFields.cend()) {
+        return &pos->second;
+    }
 
-    // This is needed because operator[] is non-const for std::unordered_map
-    return pos->second;
+    // There are usually only a handful of extra fields, so a linear search is fine
+    if (extraFieldTable) {
+        const auto &names = extraFieldTable->names;
+        const auto col = std::find(names.cbegin(), names.cend(), name);
+        if (col != names.cend()) {
+            return &extraFieldTable->columns[col - names.cbegin()][extraFieldRow];
+        }
+    }
+
+    return nullptr;
 }
 
 ImageDatabase::ImageFileWriter::ImageFileWriter(const ImageDatabase &,
@@ -69,13 +213,16 @@ ImageDatabase::ImageFileWriter::ImageFileWriter(const ImageDatabase &,
 {}
 
 void
-ImageDatabase::ImageFileWriter::writeFrame(const cv::Mat &frame, Entry &entry)
+ImageDatabase::ImageFileWriter::prepareFrame(Entry &entry)
 {
-    filesystem::path path = getCurrentFilenameRoot() + "." + m_ImageFormat;
-    BOB_ASSERT(!path.exists()); // Don't overwrite data by default!
-    BOB_ASSERT(cv::imwrite(path.str(), frame));
+    entry.path = getCurrentFilenameRoot() + "." + m_ImageFormat;
+    BOB_ASSERT(!entry.path.exists()); // Don't overwrite data by default!
+}
 
-    entry.path = std::move(path);
+void
+ImageDatabase::ImageFileWriter::encodeFrame(const cv::Mat &frame, const Entry &entry)
+{
+    BOB_ASSERT(cv::imwrite(entry.path.str(), frame));
 }
 
 ImageDatabase::VideoFileWriter::VideoFileWriter(const ImageDatabase &database,
@@ -101,11 +248,220 @@ ImageDatabase::VideoFileWriter::getVideoFileName() const
 }
 
 void
-ImageDatabase::VideoFileWriter::writeFrame(const cv::Mat &frame, Entry &)
+ImageDatabase::VideoFileWriter::encodeFrame(const cv::Mat &frame, const Entry &)
 {
     m_Writer.write(frame);
 }
 
+ImageDatabase::PackedFileWriter::PackedFileWriter(const ImageDatabase &database,
+                                                  const Format &format)
+  : m_FileName{ database.getName() + ".bobpack" }
+{
+    const auto path = database.getPath() / m_FileName;
+    BOB_ASSERT(!path.exists()); // Don't overwrite by mistake
+
+    const auto compression = format.compress ? PackedImageFile::Compression::LZ4
+                                             : PackedImageFile::Compression::None;
+    m_Writer = std::make_shared<PackedImageFile::Writer>(path, format.resolution,
+                                                         format.channels, compression);
+}
+
+void
+ImageDatabase::PackedFileWriter::encodeFrame(const cv::Mat &frame, const Entry &)
+{
+    m_Writer->write(frame);
+}
+
+void
+ImageDatabase::PackedFileWriter::finish()
+{
+    m_Writer->finish();
+}
+
+const std::string &
+ImageDatabase::PackedFileWriter::getPackedFileName() const
+{
+    return m_FileName;
+}
+
+ImageDatabase::AsyncEncoder::AsyncEncoder(FrameWriter &writer,
+                                          const AsyncOptions &options)
+  : m_Writer(writer)
+  , m_Policy(options.policy)
+{
+    BOB_ASSERT(options.queueSize > 0);
+
+    // Leave a core free for whatever is doing the recording
+    size_t numEncoders = 1;
+    if (writer.canEncodeInParallel()) {
+        numEncoders = options.numEncoders;
+        if (numEncoders == 0) {
+            numEncoders = std::max(2U, std::thread::hardware_concurrency()) - 1;
+        }
+    }
+    numEncoders = std::min(numEncoders, options.queueSize);
+
+    // Split the queue between the encoder threads
+    const size_t queueSize = (options.queueSize + numEncoders - 1) / numEncoders;
+    for (size_t i = 0; i < numEncoders; i++) {
+        m_Queues.emplace_back(std::make_unique<SPSCQueue<Slot>>(queueSize));
+    }
+    m_QueueNotEmpty = std::vector<std::condition_variable>(numEncoders);
+    for (size_t i = 0; i < numEncoders; i++) {
+        m_Threads.emplace_back(&AsyncEncoder::run, this, i);
+    }
+}
+
+ImageDatabase::AsyncEncoder::~AsyncEncoder()
+{
+    stop();
+    if (m_Failed) {
+        LOGE << "Frames were not all saved successfully";
+    }
+}
+
+bool
+ImageDatabase::AsyncEncoder::push(const cv::Mat &frame, const Entry &entry)
+{
+    BOB_ASSERT(!m_Stopping);
+    rethrowError();
+    if (m_Failed) {
+        throw std::runtime_error("Earlier frames could not be saved");
+    }
+
+    auto backoff = std::chrono::microseconds{ 50 };
+    while (true) {
+        // Deal frames out in turn, skipping encoders which have fallen behind
+        for (size_t i = 0; i < m_Queues.size(); i++) {
+            const size_t index = m_NextQueue;
+            auto &queue = *m_Queues[index];
+            m_NextQueue = (m_NextQueue + 1) % m_Queues.size();
+
+            Slot *slot = queue.beginPush();
+            if (slot) {
+                // Slots' images are reused, so this usually won't allocate
+                frame.copyTo(slot->image);
+                slot->entry = entry;
+                slot->queueTime = std::chrono::steady_clock::now();
+                queue.endPush();
+
+                // Taking the lock means the encoder can't miss this between checking its queue and sleeping
+                {
+                    std::lock_guard<std::mutex> guard{ m_WakeMutex };
+                }
+                m_QueueNotEmpty[index].notify_one();
+                return true;
+            }
+        }
+
+        if (m_Policy == QueueFullPolicy::Drop) {
+            m_FramesDropped++;
+            return false;
+        }
+
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::microseconds{ 1000 });
+        rethrowError();
+    }
+}
+
+void
+ImageDatabase::AsyncEncoder::finish()
+{
+    stop();
+    rethrowError();
+}
+
+ImageDatabase::AsyncStats
+ImageDatabase::AsyncEncoder::getStats() const
+{
+    AsyncStats stats;
+    for (const auto &queue : m_Queues) {
+        stats.queueDepth += queue->size();
+    }
+    stats.framesWritten = m_FramesWritten;
+    stats.framesDropped = m_FramesDropped;
+    if (stats.framesWritten > 0) {
+        stats.meanLatency = std::chrono::microseconds{ m_TotalLatency / static_cast<int64_t>(stats.framesWritten) };
+    }
+    stats.maxLatency = std::chrono::microseconds{ m_MaxLatency };
+    return stats;
+}
+
+void
+ImageDatabase::AsyncEncoder::run(size_t index)
+{
+    using namespace std::chrono;
+
+    auto &queue = *m_Queues[index];
+    while (true) {
+        Slot *slot = queue.front();
+        if (!slot) {
+            // Sleep until a frame is pushed or we're told to stop
+            {
+                std::unique_lock<std::mutex> lock{ m_WakeMutex };
+                m_QueueNotEmpty[index].wait(lock, [&]() {
+                    return queue.front() || m_Stopping.load(std::memory_order_acquire);
+                });
+            }
+
+            // Anything pushed before we were told to stop is visible by now
+            slot = queue.front();
+            if (!slot) {
+                return;
+            }
+        }
+
+        // After an error, keep emptying the queue so the producer doesn't block
+        if (!m_Failed) {
+            try {
+                m_Writer.encodeFrame(slot->image, slot->entry);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard{ m_ErrorMutex };
+                m_Error = std::current_exception();
+                m_Failed = true;
+            }
+        }
+
+        const int64_t latency = duration_cast<microseconds>(steady_clock::now() - slot->queueTime).count();
+        queue.pop();
+
+        m_TotalLatency += latency;
+        int64_t maxLatency = m_MaxLatency;
+        while (latency > maxLatency && !m_MaxLatency.compare_exchange_weak(maxLatency, latency)) {}
+        m_FramesWritten++;
+    }
+}
+
+void
+ImageDatabase::AsyncEncoder::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard{ m_WakeMutex };
+        m_Stopping.store(true, std::memory_order_release);
+    }
+    for (auto &condition : m_QueueNotEmpty) {
+        condition.notify_one();
+    }
+    for (auto &thread : m_Threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+// Errors are only rethrown once, so save() doesn't throw again from ~Recorder
+void
+ImageDatabase::AsyncEncoder::rethrowError()
+{
+    std::lock_guard<std::mutex> guard{ m_ErrorMutex };
+    if (m_Error) {
+        auto error = m_Error;
+        m_Error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
 ImageDatabase::GridRecorder::GridRecorder(ImageDatabase &imageDatabase,
                                           const Range &xrange,
                                           const Range &yrange,
@@ -280,7 +636,10 @@ ImageDatabase::ImageDatabase(const std::tm *creationTime,
     // Try to read entries from CSV file
     if (!loadCSV()) {
         LOGW << "Could not find CSV file";
-        if (m_VideoFilePath.empty()) {
+        if (m_PackedFile) {
+            // Populate m_Entries with empty entries
+            m_Entries.resize(m_PackedFile->size());
+        } else if (m_VideoFilePath.empty()) {
             if (!readDirectoryEntries()) {
                 // Make sure we have a directory to save into
                 filesystem::create_directory(m_Path);
@@ -304,22 +663,49 @@ bool
 ImageDatabase::loadCSV()
 {
     const auto entriesPath = m_Path / EntriesFilename;
-    std::ifstream entriesFile(entriesPath.str());
-    if (entriesFile.fail()) {
+    if (!entriesPath.exists()) {
         return false;
     }
-    entriesFile.exceptions(std::ios::badbit);
 
-    std::string line;
-    if (!std::getline(entriesFile, line)) {
+    // Parse the file in a single pass, straight out of memory
+    const MemoryMappedFile file{ entriesPath };
+    const char *pos = reinterpret_cast<const char *>(file.data());
+    const char *const fileEnd = pos + file.size();
+    if (pos == fileEnd) {
         // ...then it's an empty file
         return false;
     }
 
-    // Read field names, using comma as separator and trimming whitespace
-    std::vector<std::string> fields;
-    strSplit(line, ',', fields);
-    std::for_each(fields.begin(), fields.end(), strTrim);
+    // Get the next line, with whitespace (including line endings) trimmed
+    const auto nextLine = [&pos, fileEnd]() {
+        const char *begin = pos;
+        auto end = static_cast<const char *>(std::memchr(pos, '\n', fileEnd - pos));
+        if (end) {
+            pos = end + 1;
+        } else {
+            pos = end = fileEnd;
+        }
+        return trimRange({ begin, end });
+    };
+
+    // Split a line at commas, trimming whitespace from each field
+    std::vector<CharRange> fields;
+    const auto splitLine = [&fields](const CharRange &line) {
+        fields.clear();
+        const char *begin = line.begin;
+        while (true) {
+            auto end = static_cast<const char *>(std::memchr(begin, ',', line.end - begin));
+            if (!end) {
+                fields.push_back(trimRange({ begin, line.end }));
+                return;
+            }
+            fields.push_back(trimRange({ begin, end }));
+            begin = end + 1;
+        }
+    };
+
+    // Read field names
+    splitLine(nextLine());
     const size_t numFields = fields.size();
 
     constexpr std::array<const char *, 8> defaultFieldNames{
@@ -329,18 +715,23 @@ ImageDatabase::loadCSV()
 
     /*
      * Go through field names, figuring out which are standard ones and which
-     * are extra, user-defined ones
+     * are extra, user-defined ones. The values of the latter are stored
+     * column-wise and shared between entries, rather than each entry having
+     * its own map.
      */
     std::array<int, defaultFieldNames.size()> fieldNameIdx;
     std::fill(fieldNameIdx.begin(), fieldNameIdx.end(), -1);
-    std::unordered_map<size_t, std::string> extraFieldNames;
-    for (size_t i = 0; i < fields.size(); i++) {
-        const auto def = std::find(defaultFieldNames.begin(), defaultFieldNames.end(), fields[i]);
+    std::vector<int> extraFieldIdx(numFields, -1);
+    auto extraFieldTable = std::make_shared<ExtraFieldTable>();
+    for (size_t i = 0; i < numFields; i++) {
+        std::string name{ fields[i].begin, fields[i].end };
+        const auto def = std::find(defaultFieldNames.begin(), defaultFieldNames.end(), name);
         if (def != defaultFieldNames.end()) {
             // If it's a default one, save the column number for later parsing
             fieldNameIdx[std::distance(defaultFieldNames.begin(), def)] = i;
         } else {
-            extraFieldNames.emplace(i, std::move(fields[i]));
+            extraFieldIdx[i] = static_cast<int>(extraFieldTable->names.size());
+            extraFieldTable->names.emplace_back(std::move(name));
         }
     }
 
@@ -352,9 +743,9 @@ ImageDatabase::loadCSV()
 
     /*
      * The Filename column is required for image-type databases, but doesn't
-     * make sense for video-type ones.
+     * make sense for video- or packed-type ones.
      */
-    BOB_ASSERT(validIdx(fieldNameIdx[4]) == m_VideoFilePath.empty());
+    BOB_ASSERT(validIdx(fieldNameIdx[4]) == hasImageFiles());
 
     // Assume it's a grid if we have any of the Grid fields...
     if (!hasMetadata()) {
@@ -366,52 +757,63 @@ ImageDatabase::loadCSV()
         BOB_ASSERT(std::all_of(fieldNameIdx.cbegin() + 5, fieldNameIdx.cend(), validIdx));
     }
 
+    // Reserve space up front, assuming there's one entry per remaining line
+    const auto maxEntries = static_cast<size_t>(std::count(pos, fileEnd, '\n')) + 1;
+    m_Entries.reserve(m_Entries.size() + maxEntries);
+    extraFieldTable->columns.resize(extraFieldTable->names.size());
+    for (auto &column : extraFieldTable->columns) {
+        column.reserve(maxEntries);
+    }
+
+    // Get the value for a given default field
+    const auto getDefaultField = [&fields, &fieldNameIdx](size_t i) {
+        return fields[fieldNameIdx[i]];
+    };
+
     // Read data line by line
-    while (std::getline(entriesFile, line)) {
+    size_t row = 0;
+    while (pos != fileEnd) {
         // Ignore empty lines
-        strTrim(line);
-        if (line.empty()) {
+        const auto line = nextLine();
+        if (line.begin == line.end) {
             continue;
         }
 
         // Use comma as delimiter
-        strSplit(line, ',', fields);
+        splitLine(line);
         BOB_ASSERT(fields.size() == numFields);
-        std::for_each(fields.begin(), fields.end(), strTrim);
 
         // Get values for any user-defined fields
-        std::unordered_map<std::string, std::string> extraFields;
-        for (size_t i = 0; i < fields.size(); i++) {
-            const auto pos = extraFieldNames.find(i);
-            if (pos != extraFieldNames.cend()) {
-                extraFields.emplace(pos->second, std::move(fields[i]));
+        for (size_t i = 0; i < numFields; i++) {
+            if (extraFieldIdx[i] != -1) {
+                extraFieldTable->columns[extraFieldIdx[i]].emplace_back(fields[i].begin, fields[i].end);
             }
         }
 
-        // Get the value for a given default field
-        const auto getDefaultField = [&fields, &fieldNameIdx](size_t i) {
-            return fields[fieldNameIdx[i]];
-        };
-
         // Get grid position for grid databases
         std::array<size_t, 3> gridPosition{0, 0, 0};
         if (!m_IsRoute) {
-            gridPosition[0] = static_cast<size_t>(std::stoul(getDefaultField(5)));
-            gridPosition[1] = static_cast<size_t>(std::stoul(getDefaultField(6)));
-            gridPosition[2] = static_cast<size_t>(std::stoul(getDefaultField(7)));
+            gridPosition[0] = parseSize(getDefaultField(5));
+            gridPosition[1] = parseSize(getDefaultField(6));
+            gridPosition[2] = parseSize(getDefaultField(7));
         }
 
         // Save details to vector
         Entry entry{
-            { millimeter_t(std::stod(getDefaultField(0))),
-              millimeter_t(std::stod(getDefaultField(1))),
-              millimeter_t(std::stod(getDefaultField(2))) },
-            degree_t(std::stod(getDefaultField(3))),
-            m_VideoFilePath.empty() ? m_Path / getDefaultField(4) : filesystem::path{},
+            { millimeter_t(parseDouble(getDefaultField(0))),
+              millimeter_t(parseDouble(getDefaultField(1))),
+              millimeter_t(parseDouble(getDefaultField(2))) },
+            degree_t(parseDouble(getDefaultField(3))),
+            hasImageFiles() ? m_Path / getDefaultField(4).str() : filesystem::path{},
             gridPosition,
-            std::move(extraFields)
+            {}
         };
+        if (!extraFieldTable->names.empty()) {
+            entry.extraFieldTable = extraFieldTable;
+            entry.extraFieldRow = row;
+        }
         m_Entries.emplace_back(std::move(entry));
+        row++;
     }
 
     return true;
@@ -517,6 +919,25 @@ ImageDatabase::getRouteVideoRecorder(const cv::Size &resolution,
     return recorder;
 }
 
+ImageDatabase::RouteRecorder<ImageDatabase::PackedFileWriter>
+ImageDatabase::getRoutePackedRecorder(const cv::Size &resolution,
+                                      int channels,
+                                      bool compress,
+                                      std::vector<std::string> extraFieldNames)
+{
+    m_Resolution = resolution;
+
+    const PackedFileWriter::Format format{ resolution, channels, compress };
+    RouteRecorder<PackedFileWriter> recorder{
+        *this,
+        format,
+        std::move(extraFieldNames)
+    };
+    recorder.getMetadataWriter() << "packedFile" << recorder.getPackedFileName();
+
+    return recorder;
+}
+
 //! Get the path of the directory corresponding to this ImageDatabase
 const filesystem::path &
 ImageDatabase::getPath() const
@@ -670,7 +1091,7 @@ ImageDatabase::generateUnwrapCSV(const filesystem::path &destination,
 
     // Copy headers; if the source is a video file we need to append file names
     ofs << line;
-    if (!m_VideoFilePath.empty()) {
+    if (!hasImageFiles()) {
         ofs << ",Filename";
     }
     ofs << "\n";
@@ -680,7 +1101,7 @@ ImageDatabase::generateUnwrapCSV(const filesystem::path &destination,
         BOB_ASSERT(!line.empty());
 
         ofs << line;
-        if (!m_VideoFilePath.empty()) {
+        if (!hasImageFiles()) {
             ofs << ",image" << i << ".jpg";
         }
         ofs << "\n";
@@ -692,6 +1113,68 @@ ImageDatabase::generateUnwrapCSV(const filesystem::path &destination,
     }
 }
 
+void
+ImageDatabase::generatePackedCSV(const filesystem::path &destination,
+                                 size_t frameSkip) const
+{
+    const auto src = m_Path / EntriesFilename;
+    if (!src.exists()) {
+        return;
+    }
+
+    std::ifstream ifs;
+    ifs.exceptions(std::ios::badbit);
+    ifs.open(src.str());
+
+    std::string line;
+    if (!std::getline(ifs, line)) {
+        // ...then it's an empty file
+        return;
+    }
+
+    std::ofstream ofs;
+    ofs.exceptions(std::ios::badbit | std::ios::failbit);
+    ofs.open((destination / EntriesFilename).str());
+
+    // Find the Filename column (if any), which we need to drop
+    std::vector<std::string> fields;
+    strSplit(line, ',', fields);
+    const auto isFileName = [](std::string field) {
+        strTrim(field);
+        return field == "Filename";
+    };
+    const auto fileNameIdx = static_cast<size_t>(std::distance(fields.begin(),
+                                                               std::find_if(fields.begin(), fields.end(), isFileName)));
+
+    // Copy all the other fields
+    const auto writeFields = [&]() {
+        bool first = true;
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (i != fileNameIdx) {
+                if (!first) {
+                    ofs << ",";
+                }
+                ofs << fields[i];
+                first = false;
+            }
+        }
+        ofs << "\n";
+    };
+    writeFields();
+
+    for (size_t i = 0; i < m_Entries.size() / frameSkip; i++) {
+        BOB_ASSERT(std::getline(ifs, line));
+        BOB_ASSERT(!line.empty());
+        strSplit(line, ',', fields);
+        writeFields();
+
+        // Skip the requested number of lines
+        for (size_t j = 1; j < frameSkip; j++) {
+            BOB_ASSERT(std::getline(ifs, line));
+        }
+    }
+}
+
 /**!
  *  \brief Unwrap all the panoramic images in this database into a new
  *         folder, creating a new database.
@@ -699,7 +1182,7 @@ ImageDatabase::generateUnwrapCSV(const filesystem::path &destination,
 void
 ImageDatabase::unwrap(const filesystem::path &destination,
                       const cv::Size &unwrapRes, size_t frameSkip,
-                      bool greyscale) const
+                      bool greyscale, size_t maxTokens) const
 {
     // Check that the database doesn't already exist
     BOB_ASSERT(!(destination / EntriesFilename).exists());
@@ -761,8 +1244,8 @@ ImageDatabase::unwrap(const filesystem::path &destination,
                     continue;
                 }
 
-                // The new database won't have a video file
-                if (key == "videoFile") {
+                // The new database won't have a video or packed file
+                if (key == "videoFile" || key == "packedFile") {
                     continue;
                 }
             }
@@ -786,23 +1269,122 @@ ImageDatabase::unwrap(const filesystem::path &destination,
     }
 
     // Finally, unwrap all images and save to new folder
-    forEachImage([&](size_t i, const cv::Mat &image) {
-        /*
-         * *If* forEachImage runs in parallel, then each thread will need its own
-         * copy of these scratch variables.
-         */
-        static thread_local cv::Mat unwrapped;
-        static thread_local std::string outPath;
+    streamImages(
+            [&](size_t i, const cv::Mat &image, cv::Mat &unwrapped) {
+                unwrapper.unwrap(image, unwrapped);
+
+                // Encode here too, as this stage runs in parallel
+                std::string outPath;
+                if (m_Entries[i * frameSkip].path.empty()) {
+                    outPath = "image" + std::to_string(i) + ".jpg";
+                } else {
+                    outPath = m_Entries[i * frameSkip].path.filename();
+                }
+                BOB_ASSERT(cv::imwrite((destination / outPath).str(), unwrapped));
+            },
+            [](size_t, const cv::Mat &) {},
+            frameSkip,
+            greyscale,
+            maxTokens);
+}
+
+void
+ImageDatabase::pack(const filesystem::path &destination, size_t frameSkip,
+                    bool greyscale, bool compress) const
+{
+    // Check that the database doesn't already exist
+    BOB_ASSERT(!(destination / EntriesFilename).exists());
+
+    BOB_ASSERT(frameSkip != 0);
+    BOB_ASSERT(!empty());
+    filesystem::create_directory(destination);
+
+    // Generate new CSV file from the old (if it exists)
+    generatePackedCSV(destination, frameSkip);
+
+    const std::string packedFileName = destination.make_absolute().filename() + ".bobpack";
+
+    // The file's resolution is only known once we have the first image
+    std::unique_ptr<PackedImageFile::Writer> writer;
+    cv::Size resolution;
+    const auto write = [&](const cv::Mat &image) {
+        if (!writer) {
+            resolution = image.size();
+            const auto compression = compress ? PackedImageFile::Compression::LZ4
+                                              : PackedImageFile::Compression::None;
+            writer = std::make_unique<PackedImageFile::Writer>(destination / packedFileName,
+                                                               image.size(),
+                                                               image.channels(),
+                                                               compression);
+        }
+        writer->write(image);
+    };
+
+    // Stream images so they are loaded in parallel, but written in order
+    streamImages([](size_t, const cv::Mat &image, cv::Mat &output) {
+                     output = image;
+                 },
+                 [&write](size_t, const cv::Mat &image) {
+                     write(image);
+                 },
+                 frameSkip,
+                 greyscale);
+
+    if (writer) {
+        writer->finish();
+    }
+
+    // Create new metadata (YAML) file, copying the old one if present
+    {
+        std::ofstream ofs((destination / MetadataFilename).str());
+        ofs.exceptions(std::ios::badbit | std::ios::failbit);
 
-        unwrapper.unwrap(image, unwrapped);
-        if (m_Entries[i].path.empty()) {
-            outPath = "image" + std::to_string(i) + ".jpg";
+        if (hasMetadata()) {
+            std::ifstream ifs((m_Path / MetadataFilename).str());
+            BOB_ASSERT(!ifs.fail());
+            ifs.exceptions(std::ios::badbit);
+
+            // See unwrap() for why we're doing it this way
+            const std::regex regex{ "^(\\s*)(\\w+):.*" };
+            std::smatch match;
+            std::string line;
+            while (std::getline(ifs, line)) {
+                if (std::regex_match(line, match, regex)) {
+                    const auto &whitespace = match[1];
+                    const auto &key = match[2];
+
+                    // Set this field if converting to greyscale
+                    if (greyscale && key == "isGreyscale") {
+                        ofs << whitespace << "isGreyscale: 1\n";
+                        continue;
+                    }
+
+                    // The new database won't have a video file and we
+                    // write frameSkip ourselves
+                    if (key == "videoFile" || key == "packedFile" || key == "frameSkip") {
+                        continue;
+                    }
+                }
+
+                ofs << line << "\n";
+            }
         } else {
-            outPath = m_Entries[i * frameSkip].path.filename();
+            // We need at least enough metadata to find the packed file again
+            ofs << "metadata:\n"
+                << "  type: " << (m_IsRoute ? "route" : "grid") << "\n"
+                << "  needsUnwrapping: " << m_NeedsUnwrapping << "\n"
+                << "  camera:\n"
+                << "    resolution: [ " << resolution.width << ", " << resolution.height << " ]\n";
         }
 
-        BOB_ASSERT(cv::imwrite((destination / outPath).str(), unwrapped));
-    }, frameSkip, greyscale);
+        // If this database was already subsampled, take that into account
+        int oldFrameSkip = 0;
+        if (hasMetadata()) {
+            getMetadata()["frameSkip"] >> oldFrameSkip;
+        }
+        ofs << "  frameSkip: " << frameSkip * std::max(1, oldFrameSkip) << "\n"
+            << "  packedFile: " << packedFileName << "\n";
+    }
 }
 
 bool
@@ -867,6 +1449,14 @@ ImageDatabase::loadMetadata()
         metadata["camera"]["resolution"] >> size;
         m_Resolution = { size[0], size[1] };
 
+        // This will only be set if images are stored in a PackedImageFile
+        std::string packedFileName;
+        metadata["packedFile"] >> packedFileName;
+        if (!packedFileName.empty() && (m_Path / packedFileName).exists()) {
+            m_PackedFile = std::make_unique<PackedImageFile>(m_Path / packedFileName);
+            m_Resolution = m_PackedFile->getResolution();
+        }
+
         // These will only be set if database was recorded as a video file
         std::string videoFileName;
         metadata["videoFile"] >> videoFileName;
@@ -909,11 +1499,12 @@ ImageDatabase::addNewEntries(std::vector<ImageDatabase::Entry> &newEntries,
     }
 
     // Write image entries info to CSV file
-    std::ofstream os;
-    os.exceptions(std::ios::badbit | std::ios::failbit);
-    os.open(path);
+    std::ofstream ofs;
+    ofs.exceptions(std::ios::badbit | std::ios::failbit);
+    ofs.open(path);
+    BufferedCSVWriter os{ ofs };
     os << "X [mm], Y [mm], Z [mm], Heading [degrees]";
-    if (m_VideoFilePath.empty()) {
+    if (hasImageFiles()) {
         os << ", Filename";
     }
     if (!m_IsRoute) {
@@ -924,13 +1515,14 @@ ImageDatabase::addNewEntries(std::vector<ImageDatabase::Entry> &newEntries,
     }
     os << "\n";
 
-    for (auto &e : m_Entries) {
+    const std::string empty;
+    for (const auto &e : m_Entries) {
         // These fields are always written...
         os << e.position[0]() << ", " << e.position[1]() << ", "
            << e.position[2]() << ", " << e.heading();
 
-        // ...this is only written if we're not saving as a video
-        if (m_VideoFilePath.empty()) {
+        // ...this is only written if we're saving individual image files
+        if (hasImageFiles()) {
             os << ", " << e.path.filename();
         }
 
@@ -942,11 +1534,113 @@ ImageDatabase::addNewEntries(std::vector<ImageDatabase::Entry> &newEntries,
 
         // Write any extra user-specified field values
         for (const auto &name : extraFieldNames) {
-            os << ", " << e.extraFields[name];
+            const auto value = e.findExtraField(name);
+            os << ", " << (value ? *value : empty);
         }
 
         os << "\n";
     }
+    os.flush();
+}
+
+ImageDatabase::VideoDecodePlan
+ImageDatabase::planVideoDecode(size_t frameSkip) const
+{
+    cv::VideoCapture cap{ m_VideoFilePath.str() };
+    BOB_ASSERT(cap.isOpened());
+
+    /*
+     * Seeking isn't frame-accurate with every OpenCV backend and container,
+     * so check that we land where we asked; if not, fall back on decoding
+     * the whole video in order.
+     */
+    const size_t numFrames = m_Entries.size();
+    const size_t target = numFrames / 2;
+    const bool seekable = target > 0 && cap.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(target))
+            && std::lround(cap.get(cv::CAP_PROP_POS_FRAMES)) == static_cast<long>(target);
+    if (!seekable) {
+        LOGD << "Cannot seek accurately in " << m_VideoFilePath << "; decoding sequentially";
+        return { 1, false };
+    }
+
+    /*
+     * The backend seeks to the preceding keyframe and decodes forward from
+     * there, so for codecs with keyframes it's only worth seeking past a lot
+     * of frames. With intra-only codecs, like MJPEG (our default), every frame
+     * is a keyframe.
+     */
+    const auto fourcc = static_cast<int>(cap.get(cv::CAP_PROP_FOURCC));
+    const bool intraOnly = fourcc == cv::VideoWriter::fourcc('M', 'J', 'P', 'G')
+            || fourcc == cv::VideoWriter::fourcc('m', 'j', 'p', 'g');
+    const size_t maxGrab = intraOnly ? 1 : MaxVideoGrabFrames;
+
+    /*
+     * Each segment's seek costs up to a keyframe interval's worth of decoding,
+     * so make segments long enough to amortise this, but have a few per
+     * thread so the load is balanced.
+     */
+    const size_t numThreads = std::max(1U, std::thread::hardware_concurrency());
+    const size_t numImages = numFrames / frameSkip;
+    const size_t numSegments = std::min({ numFrames / MinVideoSegmentFrames,
+                                          4 * numThreads,
+                                          numImages });
+
+    return { std::max<size_t>(1, numSegments), frameSkip > maxGrab };
+}
+
+void
+ImageDatabase::loadImage(size_t index, cv::Mat &image, bool greyscale) const
+{
+    if (m_PackedFile) {
+        loadPackedImage(index, image, greyscale);
+    } else {
+        image = m_Entries[index].load(greyscale);
+    }
+}
+
+void
+ImageDatabase::seekVideo(cv::VideoCapture &cap, size_t frame)
+{
+    BOB_ASSERT(cap.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(frame)));
+}
+
+void
+ImageDatabase::skipVideoFrames(cv::VideoCapture &cap, size_t nextImage,
+                               size_t frameSkip, bool seekToSkip)
+{
+    // Skip frames, by seeking if that's likely to be cheaper than decoding them
+    if (seekToSkip) {
+        seekVideo(cap, nextImage * frameSkip);
+    } else {
+        for (size_t j = 1; j < frameSkip && cap.grab(); j++)
+            ;
+    }
+}
+
+size_t
+ImageDatabase::getDefaultMaxTokens()
+{
+    return 2 * std::max(1U, std::thread::hardware_concurrency());
+}
+
+bool
+ImageDatabase::hasImageFiles() const
+{
+    return m_VideoFilePath.empty() && !m_PackedFile;
+}
+
+void
+ImageDatabase::loadPackedImage(size_t index, cv::Mat &image, bool greyscale) const
+{
+    m_PackedFile->getImage(index, image);
+
+    // Convert colour, if needed, which also gives us our own copy of the data
+    const int channels = image.channels();
+    if (greyscale && channels != 1) {
+        cv::cvtColor(image, image, (channels == 4) ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    } else if (!greyscale && channels == 1) {
+        cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+    }
 }
 } // Navigation
 } // BoB robotics
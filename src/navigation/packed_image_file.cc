@@ -0,0 +1,303 @@
+// BoB robotics includes
+#include "common/macros.h"
+#include "navigation/packed_image_file.h"
+
+// Third-party includes
+#include "plog/Log.h"
+
+// LZ4
+#ifdef BOB_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+// Standard C includes
+#include <cstring>
+
+// Standard C++ includes
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+using namespace BoBRobotics::Navigation;
+
+constexpr char Magic[8] = "BoBPACK";
+constexpr uint32_t Version = 1;
+constexpr uint64_t Alignment = 64;
+
+static_assert(sizeof(PackedImageFile::Header) == 64,
+              "PackedImageFile::Header must be 64 bytes");
+
+uint64_t
+alignUp(uint64_t value)
+{
+    return (value + Alignment - 1) & ~(Alignment - 1);
+}
+
+void
+throwNoLZ4()
+{
+    throw std::runtime_error("Packed image file is compressed with LZ4, but "
+                             "BoB robotics was built without LZ4 support");
+}
+} // anonymous namespace
+
+namespace BoBRobotics {
+namespace Navigation {
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::PackedImageFile::Writer
+//------------------------------------------------------------------------
+PackedImageFile::Writer::Writer(const filesystem::path &path,
+                                const cv::Size &resolution,
+                                int channels,
+                                Compression compression)
+  : m_Stream(path.str(), std::ios::binary | std::ios::trunc)
+  , m_Header{}
+{
+    BOB_ASSERT(channels == 1 || channels == 3 || channels == 4);
+    if (!m_Stream.good()) {
+        throw std::runtime_error("Could not open " + path.str() + " for writing");
+    }
+#ifndef BOB_HAVE_LZ4
+    if (compression == Compression::LZ4) {
+        LOGW << "Built without LZ4 support; packed images will be stored uncompressed";
+        compression = Compression::None;
+    }
+#endif
+
+    std::copy(std::begin(Magic), std::end(Magic), m_Header.magic);
+    m_Header.version = Version;
+    m_Header.width = static_cast<uint32_t>(resolution.width);
+    m_Header.height = static_cast<uint32_t>(resolution.height);
+    m_Header.channels = static_cast<uint32_t>(channels);
+    m_Header.compression = compression;
+    m_Header.frameStride = alignUp(m_Header.width * m_Header.height * m_Header.channels);
+
+    // Numbers of entries is left as zero until we finish
+    m_Stream.write(reinterpret_cast<const char *>(&m_Header), sizeof(Header));
+}
+
+PackedImageFile::Writer::~Writer()
+{
+    try {
+        finish();
+    } catch (std::exception &e) {
+        LOGE << "Error finishing packed image file: " << e.what();
+    }
+}
+
+void
+PackedImageFile::Writer::write(const cv::Mat &image)
+{
+    BOB_ASSERT(!m_Finished);
+    BOB_ASSERT(image.type() == CV_8UC(static_cast<int>(m_Header.channels)));
+    BOB_ASSERT(image.cols == static_cast<int>(m_Header.width));
+    BOB_ASSERT(image.rows == static_cast<int>(m_Header.height));
+
+    const size_t rowBytes = m_Header.width * m_Header.channels;
+    const size_t imageBytes = rowBytes * m_Header.height;
+    const auto offset = static_cast<uint64_t>(m_Stream.tellp());
+    m_Offsets.push_back(offset);
+
+    // Gather image into one contiguous block
+    const char *data;
+    if (image.isContinuous()) {
+        data = reinterpret_cast<const char *>(image.data);
+    } else {
+        m_Scratch.resize(imageBytes);
+        for (int y = 0; y < image.rows; y++) {
+            std::memcpy(&m_Scratch[y * rowBytes], image.ptr(y), rowBytes);
+        }
+        data = m_Scratch.data();
+    }
+
+    if (m_Header.compression == Compression::None) {
+        m_Stream.write(data, imageBytes);
+
+        // Pad so the next image starts on an aligned boundary
+        static const char padding[Alignment]{};
+        m_Stream.write(padding, m_Header.frameStride - imageBytes);
+    } else {
+#ifdef BOB_HAVE_LZ4
+        std::vector<char> compressed(LZ4_compressBound(static_cast<int>(imageBytes)));
+        const int size = LZ4_compress_default(data, compressed.data(),
+                                              static_cast<int>(imageBytes),
+                                              static_cast<int>(compressed.size()));
+        BOB_ASSERT(size > 0);
+
+        // Each compressed image is prefixed with its size
+        const auto size32 = static_cast<uint32_t>(size);
+        m_Stream.write(reinterpret_cast<const char *>(&size32), sizeof(size32));
+        m_Stream.write(compressed.data(), size);
+#else
+        throwNoLZ4();
+#endif
+    }
+
+    if (!m_Stream.good()) {
+        throw std::runtime_error("Error writing to packed image file");
+    }
+}
+
+void
+PackedImageFile::Writer::finish()
+{
+    if (m_Finished) {
+        return;
+    }
+    m_Finished = true;
+
+    // Compressed images are variable-sized, so write a table of their offsets
+    if (m_Header.compression != Compression::None) {
+        m_Header.offsetTable = static_cast<uint64_t>(m_Stream.tellp());
+        m_Stream.write(reinterpret_cast<const char *>(m_Offsets.data()),
+                       m_Offsets.size() * sizeof(uint64_t));
+    }
+
+    // Now we know how many images there are, rewrite header
+    m_Header.numEntries = m_Offsets.size();
+    m_Stream.seekp(0);
+    m_Stream.write(reinterpret_cast<const char *>(&m_Header), sizeof(Header));
+    m_Stream.close();
+    if (m_Stream.fail()) {
+        throw std::runtime_error("Error writing to packed image file");
+    }
+}
+
+//------------------------------------------------------------------------
+// BoBRobotics::Navigation::PackedImageFile
+//------------------------------------------------------------------------
+PackedImageFile::PackedImageFile(const filesystem::path &path)
+  : m_File(path)
+  , m_Data(m_File.data())
+  , m_FileSize(m_File.size())
+{
+    if (m_FileSize < sizeof(Header)) {
+        throw std::runtime_error(path.str() + " is not a packed image file");
+    }
+    std::memcpy(&m_Header, m_Data, sizeof(Header));
+    if (std::memcmp(m_Header.magic, Magic, sizeof(Magic)) != 0) {
+        throw std::runtime_error(path.str() + " is not a packed image file");
+    }
+    if (m_Header.version != Version) {
+        throw std::runtime_error("Unsupported packed image file version in " + path.str());
+    }
+
+    if (m_Header.compression == Compression::None) {
+        // Uncompressed images are at fixed offsets, so if the file wasn't
+        // finished properly, we can work out how many complete images there are
+        size_t numEntries = m_Header.numEntries;
+        if (numEntries == 0) {
+            numEntries = (m_FileSize - sizeof(Header) + m_Header.frameStride - getImageBytes()) / m_Header.frameStride;
+        }
+        BOB_ASSERT(sizeof(Header) + numEntries * m_Header.frameStride <= m_FileSize + m_Header.frameStride - getImageBytes());
+
+        m_Offsets.resize(numEntries);
+        for (size_t i = 0; i < numEntries; i++) {
+            m_Offsets[i] = sizeof(Header) + i * m_Header.frameStride;
+        }
+    } else if (m_Header.numEntries > 0) {
+        BOB_ASSERT(m_Header.offsetTable + m_Header.numEntries * sizeof(uint64_t) <= m_FileSize);
+        m_Offsets.resize(m_Header.numEntries);
+        std::memcpy(m_Offsets.data(), m_Data + m_Header.offsetTable,
+                    m_Offsets.size() * sizeof(uint64_t));
+    } else {
+        // Recover what we can from an unfinished file by following the size prefixes
+        LOGW << path.str() << " was not finished properly; scanning for images";
+        uint64_t offset = sizeof(Header);
+        uint32_t size;
+        while (offset + sizeof(size) <= m_FileSize) {
+            std::memcpy(&size, m_Data + offset, sizeof(size));
+            if (offset + sizeof(size) + size > m_FileSize) {
+                break;
+            }
+            m_Offsets.push_back(offset);
+            offset += sizeof(size) + size;
+        }
+    }
+}
+
+cv::Size
+PackedImageFile::getResolution() const
+{
+    return { static_cast<int>(m_Header.width), static_cast<int>(m_Header.height) };
+}
+
+int
+PackedImageFile::getChannels() const
+{
+    return static_cast<int>(m_Header.channels);
+}
+
+PackedImageFile::Compression
+PackedImageFile::getCompression() const
+{
+    return m_Header.compression;
+}
+
+cv::Mat
+PackedImageFile::getImage(size_t index) const
+{
+    BOB_ASSERT(index < m_Offsets.size());
+    BOB_ASSERT(m_Header.compression == Compression::None);
+
+    // OpenCV has no read-only Mat, so it's up to the caller not to write to it
+    return cv::Mat(getResolution(), getMatType(),
+                   const_cast<uint8_t *>(m_Data + m_Offsets[index]));
+}
+
+void
+PackedImageFile::getImage(size_t index, cv::Mat &image) const
+{
+    if (m_Header.compression == Compression::None) {
+        image = getImage(index);
+        return;
+    }
+
+    BOB_ASSERT(index < m_Offsets.size());
+#ifdef BOB_HAVE_LZ4
+    const uint8_t *record = m_Data + m_Offsets[index];
+    uint32_t size;
+    std::memcpy(&size, record, sizeof(size));
+
+    // Don't decompress into a view onto the file or somebody else's data
+    if (image.u == nullptr || image.u->refcount > 1) {
+        image.release();
+    }
+    image.create(getResolution(), getMatType());
+    const int decompressed = LZ4_decompress_safe(reinterpret_cast<const char *>(record + sizeof(size)),
+                                                 reinterpret_cast<char *>(image.data),
+                                                 static_cast<int>(size),
+                                                 static_cast<int>(getImageBytes()));
+    if (decompressed != static_cast<int>(getImageBytes())) {
+        throw std::runtime_error("Corrupt image in packed image file");
+    }
+#else
+    throwNoLZ4();
+#endif
+}
+
+bool
+PackedImageFile::supportsCompression()
+{
+#ifdef BOB_HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+int
+PackedImageFile::getMatType() const
+{
+    return CV_8UC(static_cast<int>(m_Header.channels));
+}
+
+size_t
+PackedImageFile::getImageBytes() const
+{
+    return static_cast<size_t>(m_Header.width) * m_Header.height * m_Header.channels;
+}
+
+} // Navigation
+} // BoBRobotics
@@ -58,6 +58,60 @@ Input::needsUnwrapping() const
 
 BOB_NOT_IMPLEMENTED(void Input::setOutputSize(const cv::Size &))
 
+bool
+Input::readFrameROI(const cv::Rect &roi, cv::Mat &outFrame)
+{
+    if (readFrame(m_FullFrame)) {
+        outFrame = m_FullFrame(roi);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool
+Input::readGreyscaleFrameROI(const cv::Rect &roi, cv::Mat &outFrame)
+{
+    if (readGreyscaleFrame(m_FullFrame)) {
+        outFrame = m_FullFrame(roi);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void
+Input::setUnwrapResolution(const cv::Size &unwrapRes)
+{
+    m_Unwrapper = createUnwrapper(unwrapRes);
+    m_UnwrapROI = m_Unwrapper.getAnnulusBounds();
+    m_Unwrapper.setInputROI(m_UnwrapROI);
+}
+
+bool
+Input::readUnwrappedFrame(cv::Mat &outFrame)
+{
+    BOB_ASSERT(!m_UnwrapROI.empty());
+    if (readFrameROI(m_UnwrapROI, m_ROIFrame)) {
+        m_Unwrapper.unwrap(m_ROIFrame, outFrame);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool
+Input::readUnwrappedGreyscaleFrame(cv::Mat &outFrame)
+{
+    BOB_ASSERT(!m_UnwrapROI.empty());
+    if (readGreyscaleFrameROI(m_UnwrapROI, m_ROIFrame)) {
+        m_Unwrapper.unwrap(m_ROIFrame, outFrame);
+        return true;
+    } else {
+        return false;
+    }
+}
+
 void
 Input::readFrameSync(cv::Mat &outFrame)
 {
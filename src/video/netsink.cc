@@ -3,12 +3,21 @@
 #include "plog/Log.h"
 #include "video/netsink.h"
 
+// Standard C includes
+#include <cstdio>
+
 // Standard C++ includes
+#include <algorithm>
 #include <chrono>
 #include <stdexcept>
 
 using namespace std::literals;
 
+namespace {
+// Length of "IMG SFRAME <10-digit size>\n"
+constexpr size_t StreamCommandLength = 22;
+}
+
 namespace BoBRobotics {
 namespace Video {
 
@@ -50,6 +59,15 @@ NetSink::~NetSink()
         m_Thread.join();
     }
 
+    // Wake encoder thread so it notices we're stopping
+    {
+        std::lock_guard<std::mutex> guard(m_PendingMutex);
+    }
+    m_PendingCondition.notify_all();
+    if (m_EncoderThread.joinable()) {
+        m_EncoderThread.join();
+    }
+
     LOG_DEBUG << "Video::NetSink stopped";
 }
 
@@ -62,7 +80,20 @@ void NetSink::sendFrame(const cv::Mat &frame)
     // Wait for start acknowledgement
     m_AckSemaphore.waitOnce();
 
-    sendFrameInternal(frame);
+    if (isStreaming()) {
+        postFrame(frame);
+    } else {
+        sendFrameInternal(frame);
+    }
+}
+
+NetSink::StreamStats
+NetSink::getStreamStats() const
+{
+    StreamStats stats;
+    stats.framesSent = m_FramesSent;
+    stats.framesDropped = m_FramesDropped;
+    return stats;
 }
 
 void NetSink::sendFrameInternal(const cv::Mat &frame)
@@ -80,6 +111,27 @@ void NetSink::onCommandReceived(const Net::Command &command)
         throw Net::BadCommandError();
     }
 
+    // Receiver can ask for streaming mode, with a codec and its options
+    if (command.size() >= 4 && command[2] == "STREAM" && !m_Encoder) {
+        NetStreamOptions options;
+        try {
+            options.codec = parseNetStreamCodec(command[3]);
+            if (command.size() >= 5) {
+                options.quality = std::min(std::max(std::stoi(command[4]), 0), 100);
+            }
+            if (command.size() >= 6) {
+                options.keyframeInterval = std::stoul(command[5]);
+            }
+        } catch (std::logic_error &) {
+            // i.e. std::invalid_argument or std::out_of_range
+            throw Net::BadCommandError();
+        }
+
+        LOG_INFO << "Streaming video with " << command[3] << " codec";
+        m_Encoder = std::make_unique<NetStreamEncoder>(options);
+        m_EncoderThread = std::thread(&NetSink::runEncoder, this);
+    }
+
     // ACK the command and tell client the camera resolution
     m_Connection.getSocketWriter().send("IMG PARAMS " + std::to_string(m_FrameSize.width) + " " +
                                     std::to_string(m_FrameSize.height) + " " +
@@ -110,7 +162,11 @@ void NetSink::runAsync()
         cv::Mat frame;
         while (m_DoRun) {
             if (m_Input->readFrame(frame)) {
-                sendFrameInternal(frame);
+                if (isStreaming()) {
+                    postFrame(frame);
+                } else {
+                    sendFrameInternal(frame);
+                }
             } else {
                 std::this_thread::sleep_for(25ms);
             }
@@ -120,5 +176,57 @@ void NetSink::runAsync()
     }
 }
 
+void NetSink::postFrame(const cv::Mat &frame)
+{
+    const int64_t timestamp = getNetStreamTimestamp();
+
+    std::lock_guard<std::mutex> guard(m_PendingMutex);
+    if (m_HasPendingFrame) {
+        // Encoder hasn't kept up, so drop the older frame
+        m_FramesDropped++;
+    }
+    frame.copyTo(m_PendingFrame);
+    m_PendingTimestamp = timestamp;
+    m_PendingSequence = m_NextSequence++;
+    m_HasPendingFrame = true;
+    m_PendingCondition.notify_one();
+}
+
+void NetSink::runEncoder()
+{
+    try {
+        while (true) {
+            uint32_t sequence;
+            int64_t timestamp;
+            {
+                std::unique_lock<std::mutex> lock(m_PendingMutex);
+                m_PendingCondition.wait(lock, [this]() { return m_HasPendingFrame || !m_DoRun; });
+                if (!m_DoRun) {
+                    return;
+                }
+
+                // Take frame, leaving our old buffer to be reused for the next one
+                cv::swap(m_PendingFrame, m_EncodingFrame);
+                sequence = m_PendingSequence;
+                timestamp = m_PendingTimestamp;
+                m_HasPendingFrame = false;
+            }
+
+            // Leave space for a fixed-width command so everything can be sent at once
+            m_StreamBuffer.resize(StreamCommandLength);
+            m_Encoder->encode(m_EncodingFrame, sequence, timestamp, m_StreamBuffer);
+
+            char command[StreamCommandLength + 1];
+            snprintf(command, sizeof(command), "IMG SFRAME %010zu\n",
+                     m_StreamBuffer.size() - StreamCommandLength);
+            std::copy_n(command, StreamCommandLength, m_StreamBuffer.begin());
+            m_Connection.getSocketWriter().send(m_StreamBuffer.data(), m_StreamBuffer.size());
+            m_FramesSent++;
+        }
+    } catch (...) {
+        BackgroundExceptionCatcher::set(std::current_exception());
+    }
+}
+
 } // Video
 } // BoBRobotics
@@ -1,4 +1,5 @@
 // BoB robotics includes
+#include "plog/Log.h"
 #include "video/netsource.h"
 
 namespace BoBRobotics {
@@ -16,6 +17,20 @@ NetSource::NetSource(Net::Connection &connection)
     connection.getSocketWriter().send("IMG START\n");
 }
 
+NetSource::NetSource(Net::Connection &connection, const NetStreamOptions &options)
+  : m_Connection(connection)
+{
+    // Handle incoming IMG commands
+    connection.setCommandHandler("IMG", [this](Net::Connection &connection, const Net::Command &command) {
+        onCommandReceived(connection, command);
+    });
+
+    // When connected, ask NetSink to start streaming with these options
+    connection.getSocketWriter().send("IMG START STREAM " + getNetStreamCodecName(options.codec) + " " +
+                                      std::to_string(options.quality) + " " +
+                                      std::to_string(options.keyframeInterval) + "\n");
+}
+
 NetSource::~NetSource()
 {
     // Ignore IMG commands
@@ -58,6 +73,13 @@ NetSource::readFrame(cv::Mat &frame)
     }
 }
 
+NetSource::StreamStats
+NetSource::getStreamStats() const
+{
+    std::lock_guard<std::mutex> guard(m_FrameMutex);
+    return m_Stats;
+}
+
 void
 NetSource::onCommandReceived(Net::Connection &connection, const Net::Command &command)
 {
@@ -74,10 +96,41 @@ NetSource::onCommandReceived(Net::Connection &connection, const Net::Command &co
         std::lock_guard<std::mutex> guard(m_FrameMutex);
         cv::imdecode(m_Buffer, cv::IMREAD_UNCHANGED, &m_Frame);
         m_NewFrame = true;
+    } else if (command[1] == "SFRAME") {
+        onStreamFrameReceived(connection, static_cast<size_t>(stoul(command[2])));
     } else {
         throw Net::BadCommandError();
     }
 }
 
+void
+NetSource::onStreamFrameReceived(Net::Connection &connection, size_t nbytes)
+{
+    m_Buffer.resize(nbytes);
+    connection.read(m_Buffer.data(), nbytes);
+
+    // Decode without holding the lock, so readFrame() isn't held up
+    NetStreamFrameHeader header;
+    if (!m_Decoder.decode(m_Buffer.data(), nbytes, header, m_DecodedFrame)) {
+        LOGW << "Skipping delta frame " << header.sequence << " with no previous frame";
+        return;
+    }
+    const std::chrono::microseconds latency{ getNetStreamTimestamp() - header.timestamp };
+
+    std::lock_guard<std::mutex> guard(m_FrameMutex);
+    cv::swap(m_Frame, m_DecodedFrame);
+    m_NewFrame = true;
+
+    // Sequence numbers are assigned to every frame the sender captures
+    if (m_Stats.framesReceived > 0 && header.sequence > m_LastSequence + 1) {
+        m_Stats.framesDropped += header.sequence - m_LastSequence - 1;
+    }
+    m_LastSequence = header.sequence;
+    m_Stats.framesReceived++;
+    m_Stats.latency = latency;
+    m_TotalLatency += latency;
+    m_Stats.meanLatency = m_TotalLatency / static_cast<int64_t>(m_Stats.framesReceived);
+}
+
 } // Video
 } // BoBRobotics
@@ -0,0 +1,271 @@
+// BoB robotics includes
+#include "common/macros.h"
+#include "video/netstream.h"
+
+// Standard C includes
+#include <cstring>
+
+// Standard C++ includes
+#include <chrono>
+#include <stdexcept>
+
+namespace {
+using namespace BoBRobotics::Video;
+
+static_assert(sizeof(NetStreamFrameHeader) == 24,
+              "NetStreamFrameHeader must be 24 bytes");
+
+// Maximum length of a run in a delta-encoded frame
+constexpr size_t MaxRun = UINT16_MAX;
+
+// Unchanged bytes needed to end a run of changed ones (each run costs 4 bytes)
+constexpr size_t MinUnchangedRun = 4;
+
+void
+throwCorrupt()
+{
+    throw std::runtime_error("Corrupt frame received from video stream");
+}
+
+// Append pixel data, row by row in case frame isn't continuous
+void
+appendPixels(const cv::Mat &frame, std::vector<uchar> &buffer)
+{
+    const size_t rowBytes = frame.cols * frame.elemSize();
+    for (int y = 0; y < frame.rows; y++) {
+        const uchar *row = frame.ptr(y);
+        buffer.insert(buffer.end(), row, row + rowBytes);
+    }
+}
+
+bool
+isUnchangedRun(const std::vector<uchar> &delta, size_t i)
+{
+    if (i + MinUnchangedRun > delta.size()) {
+        return false;
+    }
+    for (size_t j = i; j < i + MinUnchangedRun; j++) {
+        if (delta[j] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Delta frames are encoded as a series of records, each with the number of
+ * unchanged bytes to skip and the number of changed bytes which follow (both
+ * 16-bit), followed by those bytes XORed with the previous frame's
+ */
+void
+appendRunLengthEncoded(const std::vector<uchar> &delta, std::vector<uchar> &buffer)
+{
+    size_t i = 0;
+    while (i < delta.size()) {
+        const size_t unchangedStart = i;
+        while (i < delta.size() && delta[i] == 0 && i - unchangedStart < MaxRun) {
+            i++;
+        }
+        const size_t changedStart = i;
+        while (i < delta.size() && i - changedStart < MaxRun && !isUnchangedRun(delta, i)) {
+            i++;
+        }
+
+        const uint16_t counts[2] = { static_cast<uint16_t>(changedStart - unchangedStart),
+                                     static_cast<uint16_t>(i - changedStart) };
+        const auto countBytes = reinterpret_cast<const uchar *>(counts);
+        buffer.insert(buffer.end(), countBytes, countBytes + sizeof(counts));
+        buffer.insert(buffer.end(), delta.data() + changedStart, delta.data() + i);
+    }
+}
+
+void
+applyRunLengthEncoded(const uchar *data, size_t size, cv::Mat &frame)
+{
+    uchar *out = frame.data;
+    const size_t frameBytes = frame.total() * frame.elemSize();
+    const uchar *const end = data + size;
+    size_t pos = 0;
+    while (data < end) {
+        uint16_t counts[2];
+        if (static_cast<size_t>(end - data) < sizeof(counts)) {
+            throwCorrupt();
+        }
+        std::memcpy(counts, data, sizeof(counts));
+        data += sizeof(counts);
+
+        pos += counts[0];
+        if (counts[1] > static_cast<size_t>(end - data) || pos + counts[1] > frameBytes) {
+            throwCorrupt();
+        }
+        for (size_t i = 0; i < counts[1]; i++) {
+            out[pos++] ^= *data++;
+        }
+    }
+}
+} // anonymous namespace
+
+namespace BoBRobotics {
+namespace Video {
+
+std::string
+getNetStreamCodecName(NetStreamCodec codec)
+{
+    switch (codec) {
+    case NetStreamCodec::RawGreyscale:
+        return "RAW";
+    case NetStreamCodec::JPEG:
+        return "JPEG";
+    case NetStreamCodec::Delta:
+        return "DELTA";
+    }
+    throw std::invalid_argument("Unknown video stream codec");
+}
+
+NetStreamCodec
+parseNetStreamCodec(const std::string &name)
+{
+    for (auto codec : { NetStreamCodec::RawGreyscale, NetStreamCodec::JPEG, NetStreamCodec::Delta }) {
+        if (name == getNetStreamCodecName(codec)) {
+            return codec;
+        }
+    }
+    throw std::invalid_argument("Unknown video stream codec: " + name);
+}
+
+int64_t
+getNetStreamTimestamp()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+//----------------------------------------------------------------------------
+// BoBRobotics::Video::NetStreamEncoder
+//----------------------------------------------------------------------------
+NetStreamEncoder::NetStreamEncoder(const NetStreamOptions &options)
+  : m_Options(options)
+{}
+
+void
+NetStreamEncoder::encode(const cv::Mat &frame, uint32_t sequence, int64_t timestamp,
+                         std::vector<uchar> &buffer)
+{
+    BOB_ASSERT(frame.type() == CV_8UC1 || frame.type() == CV_8UC3);
+    BOB_ASSERT(frame.cols <= UINT16_MAX && frame.rows <= UINT16_MAX);
+
+    NetStreamFrameHeader header{};
+    header.sequence = sequence;
+    header.codec = m_Options.codec;
+    header.channels = static_cast<uint8_t>(frame.channels());
+    header.keyframe = 1;
+    header.width = static_cast<uint16_t>(frame.cols);
+    header.height = static_cast<uint16_t>(frame.rows);
+    header.timestamp = timestamp;
+
+    // Leave space for header, which we fill in once we know the payload size
+    const size_t headerOffset = buffer.size();
+    buffer.resize(headerOffset + sizeof(header));
+
+    switch (m_Options.codec) {
+    case NetStreamCodec::RawGreyscale:
+        header.channels = 1;
+        if (frame.channels() == 1) {
+            appendPixels(frame, buffer);
+        } else {
+            cv::cvtColor(frame, m_Frame, cv::COLOR_BGR2GRAY);
+            appendPixels(m_Frame, buffer);
+        }
+        break;
+    case NetStreamCodec::JPEG:
+        cv::imencode(".jpg", frame, m_Scratch, { cv::IMWRITE_JPEG_QUALITY, m_Options.quality });
+        buffer.insert(buffer.end(), m_Scratch.begin(), m_Scratch.end());
+        break;
+    case NetStreamCodec::Delta:
+        if (m_Previous.size() != frame.size() || m_Previous.type() != frame.type() ||
+                m_FramesSinceKeyframe >= m_Options.keyframeInterval) {
+            appendPixels(frame, buffer);
+            m_FramesSinceKeyframe = 0;
+        } else {
+            header.keyframe = 0;
+
+            // XOR with previous frame, so unchanged pixels become runs of zeros
+            const size_t rowBytes = frame.cols * frame.elemSize();
+            m_Scratch.resize(rowBytes * frame.rows);
+            for (int y = 0; y < frame.rows; y++) {
+                const uchar *row = frame.ptr(y);
+                const uchar *previousRow = m_Previous.ptr(y);
+                uchar *delta = &m_Scratch[y * rowBytes];
+                for (size_t i = 0; i < rowBytes; i++) {
+                    delta[i] = row[i] ^ previousRow[i];
+                }
+            }
+            appendRunLengthEncoded(m_Scratch, buffer);
+        }
+        m_FramesSinceKeyframe++;
+        frame.copyTo(m_Previous);
+        break;
+    }
+
+    header.payloadSize = static_cast<uint32_t>(buffer.size() - headerOffset - sizeof(header));
+    std::memcpy(&buffer[headerOffset], &header, sizeof(header));
+}
+
+//----------------------------------------------------------------------------
+// BoBRobotics::Video::NetStreamDecoder
+//----------------------------------------------------------------------------
+bool
+NetStreamDecoder::decode(const uchar *data, size_t size, NetStreamFrameHeader &header,
+                         cv::Mat &frame)
+{
+    if (size < sizeof(header)) {
+        throwCorrupt();
+    }
+    std::memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    if (header.payloadSize != size - sizeof(header) ||
+            (header.channels != 1 && header.channels != 3)) {
+        throwCorrupt();
+    }
+
+    const cv::Size frameSize{ header.width, header.height };
+    const int type = CV_8UC(header.channels);
+    const size_t frameBytes = frameSize.area() * header.channels;
+    auto *payload = const_cast<uchar *>(data);
+    switch (header.codec) {
+    case NetStreamCodec::RawGreyscale:
+        if (header.payloadSize != frameBytes) {
+            throwCorrupt();
+        }
+        cv::Mat(frameSize, type, payload).copyTo(frame);
+        return true;
+    case NetStreamCodec::JPEG:
+        cv::imdecode(cv::Mat(1, header.payloadSize, CV_8UC1, payload),
+                     cv::IMREAD_UNCHANGED, &frame);
+        if (frame.empty()) {
+            throwCorrupt();
+        }
+        return true;
+    case NetStreamCodec::Delta:
+        if (header.keyframe) {
+            if (header.payloadSize != frameBytes) {
+                throwCorrupt();
+            }
+            cv::Mat(frameSize, type, payload).copyTo(m_Previous);
+        } else {
+            // We can't decode this without the frame it's relative to
+            if (m_Previous.size() != frameSize || m_Previous.type() != type) {
+                return false;
+            }
+            applyRunLengthEncoded(data, header.payloadSize, m_Previous);
+        }
+        m_Previous.copyTo(frame);
+        return true;
+    }
+
+    throwCorrupt();
+    return false;
+}
+
+} // Video
+} // BoBRobotics
@@ -3,11 +3,401 @@
 #include "plog/Log.h"
 #include "video/see3cam_cu40.h"
 
+// TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+// SIMD intrinsics
+// **NOTE** on x86, SSSE3 is needed for the byte shuffles which interleave BGR
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#define BOB_SUPERPIXEL_SIMD
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BOB_SUPERPIXEL_SIMD
+#endif
+
 // Standard C++
 #include <chrono>
 #include <numeric>
 #include <thread>
 
+namespace {
+// Rows of super-pixels converted by each TBB task
+constexpr int RowsPerTask = 16;
+
+//------------------------------------------------------------------------
+// Vector helpers
+//------------------------------------------------------------------------
+/*
+ * These operate on vectors of 16-bit sensor values. Results are either
+ * truncated to 8 bits (as the scalar code's casts to uint8_t do) or clamped
+ * at 255, so the vectorised conversions match the scalar ones bit-for-bit.
+ */
+#if defined(__AVX2__)
+using Vec = __m256i;
+constexpr int VecWidth = 16;
+
+template<int N>
+inline Vec vecShiftRight(Vec v) { return _mm256_srli_epi16(v, N); }
+inline Vec vecMulHi(Vec v, uint16_t c) { return _mm256_mulhi_epu16(v, _mm256_set1_epi16(static_cast<short>(c))); }
+inline Vec vecLow8(Vec v) { return _mm256_and_si256(v, _mm256_set1_epi16(0xFF)); }
+inline Vec vecMin255(Vec v) { return _mm256_min_epu16(v, _mm256_set1_epi16(0xFF)); }
+inline Vec vecAdd(Vec a, Vec b) { return _mm256_add_epi16(a, b); }
+#elif defined(__SSSE3__)
+using Vec = __m128i;
+constexpr int VecWidth = 8;
+
+template<int N>
+inline Vec vecShiftRight(Vec v) { return _mm_srli_epi16(v, N); }
+inline Vec vecMulHi(Vec v, uint16_t c) { return _mm_mulhi_epu16(v, _mm_set1_epi16(static_cast<short>(c))); }
+inline Vec vecLow8(Vec v) { return _mm_and_si128(v, _mm_set1_epi16(0xFF)); }
+
+// There's no unsigned 16-bit min before SSE4.1, so use a saturating subtract
+inline Vec vecMin255(Vec v) { return _mm_sub_epi16(v, _mm_subs_epu16(v, _mm_set1_epi16(0xFF))); }
+inline Vec vecAdd(Vec a, Vec b) { return _mm_add_epi16(a, b); }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+using Vec = uint16x8_t;
+constexpr int VecWidth = 8;
+
+template<int N>
+inline Vec vecShiftRight(Vec v) { return vshrq_n_u16(v, N); }
+inline Vec vecMulHi(Vec v, uint16_t c)
+{
+    const uint32x4_t lo = vmull_n_u16(vget_low_u16(v), c);
+    const uint32x4_t hi = vmull_n_u16(vget_high_u16(v), c);
+    return vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16));
+}
+inline Vec vecLow8(Vec v) { return vandq_u16(v, vdupq_n_u16(0xFF)); }
+inline Vec vecMin255(Vec v) { return vminq_u16(v, vdupq_n_u16(0xFF)); }
+inline Vec vecAdd(Vec a, Vec b) { return vaddq_u16(a, b); }
+#endif
+
+//------------------------------------------------------------------------
+// PixelScale
+//------------------------------------------------------------------------
+// Converts 10-bit intensity values to 8-bit by dividing by 4
+struct PixelScale
+{
+    static uint8_t getR(uint16_t r, uint16_t, uint16_t) { return getScaled(r); }
+    static uint8_t getG(uint16_t, uint16_t g, uint16_t) { return getScaled(g); }
+    static uint8_t getB(uint16_t, uint16_t, uint16_t b) { return getScaled(b); }
+    static uint8_t getScaled(uint16_t v) { return (uint8_t)(v >> 2); }
+
+#ifdef BOB_SUPERPIXEL_SIMD
+    static Vec getR(Vec r, Vec, Vec) { return vecLow8(vecShiftRight<2>(r)); }
+    static Vec getG(Vec, Vec g, Vec) { return vecLow8(vecShiftRight<2>(g)); }
+    static Vec getB(Vec, Vec, Vec b) { return vecLow8(vecShiftRight<2>(b)); }
+#endif
+};
+
+//------------------------------------------------------------------------
+// PixelClamp
+//------------------------------------------------------------------------
+// Converts 10-bit intensity values to 8-bit by clamping at 255
+// **NOTE** this is dubious but a)Is what the qtcam example does and b)Can
+// LOOK nicer than PixelScale
+struct PixelClamp
+{
+    static uint8_t getR(uint16_t r, uint16_t, uint16_t) { return getClamped(r); }
+    static uint8_t getG(uint16_t, uint16_t g, uint16_t) { return getClamped(g); }
+    static uint8_t getB(uint16_t, uint16_t, uint16_t b) { return getClamped(b); }
+    static uint8_t getClamped(uint16_t v) { return (uint8_t) std::min<uint16_t>(255, v); }
+
+#ifdef BOB_SUPERPIXEL_SIMD
+    static Vec getR(Vec r, Vec, Vec) { return vecMin255(r); }
+    static Vec getG(Vec, Vec g, Vec) { return vecMin255(g); }
+    static Vec getB(Vec, Vec, Vec b) { return vecMin255(b); }
+#endif
+};
+
+//------------------------------------------------------------------------
+// WhiteBalanceCoolWhite
+//------------------------------------------------------------------------
+struct WhiteBalanceCoolWhite
+{
+    // 0.96 (15729)
+    static uint8_t getR(uint16_t r, uint16_t, uint16_t) { return (uint8_t)(((uint32_t) r * 15729) >> 16); }
+    static uint8_t getG(uint16_t, uint16_t g, uint16_t) { return (uint8_t)(g >> 2); }
+
+    // 1.74 (28508)
+    static uint8_t getB(uint16_t, uint16_t, uint16_t b)
+    {
+        return (uint8_t) std::min<uint32_t>(((uint32_t) b * 28508) >> 16, 255);
+    }
+
+#ifdef BOB_SUPERPIXEL_SIMD
+    static Vec getR(Vec r, Vec, Vec) { return vecLow8(vecMulHi(r, 15729)); }
+    static Vec getG(Vec, Vec g, Vec) { return vecLow8(vecShiftRight<2>(g)); }
+    static Vec getB(Vec, Vec, Vec b) { return vecMin255(vecMulHi(b, 28508)); }
+#endif
+};
+
+//------------------------------------------------------------------------
+// WhiteBalanceU30
+//------------------------------------------------------------------------
+struct WhiteBalanceU30
+{
+    // 0.92 (15073)
+    static uint8_t getR(uint16_t r, uint16_t, uint16_t) { return (uint8_t)(((uint32_t) r * 15073) >> 16); }
+    static uint8_t getG(uint16_t, uint16_t g, uint16_t) { return (uint8_t)(g >> 2); }
+
+    // 1.53 (25068)
+    static uint8_t getB(uint16_t, uint16_t, uint16_t b)
+    {
+        return (uint8_t) std::min<uint32_t>(((uint32_t) b * 25068) >> 16, 255);
+    }
+
+#ifdef BOB_SUPERPIXEL_SIMD
+    static Vec getR(Vec r, Vec, Vec) { return vecLow8(vecMulHi(r, 15073)); }
+    static Vec getG(Vec, Vec g, Vec) { return vecLow8(vecShiftRight<2>(g)); }
+    static Vec getB(Vec, Vec, Vec b) { return vecMin255(vecMulHi(b, 25068)); }
+#endif
+};
+
+#ifdef BOB_SUPERPIXEL_SIMD
+// Average the channels and rescale from 10-bit to 8-bit i.e. divide by 12
+// **NOTE** 10-bit channels can't overflow the sum and, for any 16-bit x,
+// (x * 0xAAAB) >> 17 == x / 3
+inline Vec vecGreyscale(Vec b, Vec g, Vec r)
+{
+    const Vec quarter = vecShiftRight<2>(vecAdd(vecAdd(b, g), r));
+    return vecLow8(vecShiftRight<1>(vecMulHi(quarter, 0xAAAB)));
+}
+#endif
+
+//------------------------------------------------------------------------
+// Vectorised row conversion
+//------------------------------------------------------------------------
+/*
+ * Each of these converts a row of super-pixels from a pair of Bayer rows
+ * (BGBG... followed by IR R IR R...) and returns how many super-pixels were
+ * converted; any remainder is left for the scalar code.
+ */
+#if defined(__AVX2__) || defined(__SSSE3__)
+// Split 16 interleaved 16-bit values into the even and odd ones
+inline void deinterleave(const uint16_t *in, __m128i &even, __m128i &odd)
+{
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 8));
+
+    // Sign-extend each value to 32 bits so packing doesn't saturate it
+    even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                           _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+    odd = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+}
+
+// Store 16 pixels' worth of B, G and R bytes as BGRBGR...
+inline void storeBGR(uint8_t *out, __m128i b, __m128i g, __m128i r)
+{
+    // **NOTE** shuffle indices of -1 produce zeros
+    const auto shuffle = [&](__m128i mb, __m128i mg, __m128i mr) {
+        return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, mb), _mm_shuffle_epi8(g, mg)),
+                            _mm_shuffle_epi8(r, mr));
+    };
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     shuffle(_mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5),
+                             _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1),
+                             _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16),
+                     shuffle(_mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1),
+                             _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10),
+                             _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 32),
+                     shuffle(_mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1),
+                             _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1),
+                             _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)));
+}
+#endif
+
+#if defined(__AVX2__)
+// Load 16 super-pixels' worth of B, G and R values
+inline void loadBGR(const uint16_t *row0, const uint16_t *row1, Vec &b, Vec &g, Vec &r)
+{
+    __m128i bLo, bHi, gLo, gHi, irLo, irHi, rLo, rHi;
+    deinterleave(row0, bLo, gLo);
+    deinterleave(row0 + 16, bHi, gHi);
+    deinterleave(row1, irLo, rLo);
+    deinterleave(row1 + 16, irHi, rHi);
+    b = _mm256_inserti128_si256(_mm256_castsi128_si256(bLo), bHi, 1);
+    g = _mm256_inserti128_si256(_mm256_castsi128_si256(gLo), gHi, 1);
+    r = _mm256_inserti128_si256(_mm256_castsi128_si256(rLo), rHi, 1);
+}
+
+// Pack 16 values, which must all fit in a byte, into bytes
+inline __m128i packBytes(Vec v)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+template<typename T>
+int
+convertRowVector(const uint16_t *row0, const uint16_t *row1, uint8_t *out, int width)
+{
+    int x = 0;
+    for (; x + VecWidth <= width; x += VecWidth) {
+        Vec b, g, r;
+        loadBGR(row0 + 2 * x, row1 + 2 * x, b, g, r);
+        storeBGR(out + 3 * x, packBytes(T::getB(r, g, b)), packBytes(T::getG(r, g, b)),
+                 packBytes(T::getR(r, g, b)));
+    }
+    return x;
+}
+
+int
+convertRowGreyscaleVector(const uint16_t *row0, const uint16_t *row1, uint8_t *out, int width)
+{
+    int x = 0;
+    for (; x + VecWidth <= width; x += VecWidth) {
+        Vec b, g, r;
+        loadBGR(row0 + 2 * x, row1 + 2 * x, b, g, r);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), packBytes(vecGreyscale(b, g, r)));
+    }
+    return x;
+}
+#elif defined(__SSSE3__)
+// Load 8 super-pixels' worth of B, G and R values
+inline void loadBGR(const uint16_t *row0, const uint16_t *row1, Vec &b, Vec &g, Vec &r)
+{
+    Vec ir;
+    deinterleave(row0, b, g);
+    deinterleave(row1, ir, r);
+}
+
+// **NOTE** storeBGR() writes 16 pixels so these do two vectors per iteration
+template<typename T>
+int
+convertRowVector(const uint16_t *row0, const uint16_t *row1, uint8_t *out, int width)
+{
+    int x = 0;
+    for (; x + 2 * VecWidth <= width; x += 2 * VecWidth) {
+        Vec b0, g0, r0, b1, g1, r1;
+        loadBGR(row0 + 2 * x, row1 + 2 * x, b0, g0, r0);
+        loadBGR(row0 + 2 * (x + VecWidth), row1 + 2 * (x + VecWidth), b1, g1, r1);
+        storeBGR(out + 3 * x,
+                 _mm_packus_epi16(T::getB(r0, g0, b0), T::getB(r1, g1, b1)),
+                 _mm_packus_epi16(T::getG(r0, g0, b0), T::getG(r1, g1, b1)),
+                 _mm_packus_epi16(T::getR(r0, g0, b0), T::getR(r1, g1, b1)));
+    }
+    return x;
+}
+
+int
+convertRowGreyscaleVector(const uint16_t *row0, const uint16_t *row1, uint8_t *out, int width)
+{
+    int x = 0;
+    for (; x + 2 * VecWidth <= width; x += 2 * VecWidth) {
+        Vec b0, g0, r0, b1, g1, r1;
+        loadBGR(row0 + 2 * x, row1 + 2 * x, b0, g0, r0);
+        loadBGR(row0 + 2 * (x + VecWidth), row1 + 2 * (x + VecWidth), b1, g1, r1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                         _mm_packus_epi16(vecGreyscale(b0, g0, r0), vecGreyscale(b1, g1, r1)));
+    }
+    return x;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+template<typename T>
+int
+convertRowVector(const uint16_t *row0, const uint16_t *row1, uint8_t *out, int width)
+{
+    int x = 0;
+    for (; x + VecWidth <= width; x += VecWidth) {
+        const uint16x8x2_t bg = vld2q_u16(row0 + 2 * x);
+        const uint16x8x2_t irR = vld2q_u16(row1 + 2 * x);
+        const Vec b = bg.val[0], g = bg.val[1], r = irR.val[1];
+
+        uint8x8x3_t bgr;
+        bgr.val[0] = vmovn_u16(T::getB(r, g, b));
+        bgr.val[1] = vmovn_u16(T::getG(r, g, b));
+        bgr.val[2] = vmovn_u16(T::getR(r, g, b));
+        vst3_u8(out + 3 * x, bgr);
+    }
+    return x;
+}
+
+int
+convertRowGreyscaleVector(const uint16_t *row0, const uint16_t *row1, uint8_t *out, int width)
+{
+    int x = 0;
+    for (; x + VecWidth <= width; x += VecWidth) {
+        const uint16x8x2_t bg = vld2q_u16(row0 + 2 * x);
+        const uint16x8x2_t irR = vld2q_u16(row1 + 2 * x);
+        vst1_u8(out + x, vmovn_u16(vecGreyscale(bg.val[0], bg.val[1], irR.val[1])));
+    }
+    return x;
+}
+#else
+template<typename T>
+int
+convertRowVector(const uint16_t *, const uint16_t *, uint8_t *, int)
+{
+    return 0;
+}
+
+int
+convertRowGreyscaleVector(const uint16_t *, const uint16_t *, uint8_t *, int)
+{
+    return 0;
+}
+#endif
+
+//------------------------------------------------------------------------
+// Frame conversion
+//------------------------------------------------------------------------
+// Get pointers to the pair of Bayer rows making up a row of super-pixels
+inline void getBayerRows(const cv::Mat &bayer, const cv::Rect &roi, int y,
+                         const uint16_t *&row0, const uint16_t *&row1)
+{
+    row0 = bayer.ptr<uint16_t>(2 * (roi.y + y)) + 2 * roi.x;
+    row1 = bayer.ptr<uint16_t>(2 * (roi.y + y) + 1) + 2 * roi.x;
+}
+
+template<typename T>
+void
+convertSuperPixelRows(const cv::Mat &bayer, cv::Mat &output, const cv::Rect &roi, bool vectorise)
+{
+    // Convert bands of rows in parallel
+    tbb::parallel_for(tbb::blocked_range<int>(0, roi.height, RowsPerTask),
+        [&](const auto &rows) {
+            for (int y = rows.begin(); y != rows.end(); y++) {
+                const uint16_t *row0, *row1;
+                getBayerRows(bayer, roi, y, row0, row1);
+                uint8_t *out = output.ptr(y);
+
+                // Convert as much as we can with SIMD, then mop up the remainder
+                int x = vectorise ? convertRowVector<T>(row0, row1, out, roi.width) : 0;
+                for (; x < roi.width; x++) {
+                    // Read Bayer pixels
+                    const uint16_t b = row0[2 * x];
+                    const uint16_t g = row0[2 * x + 1];
+                    const uint16_t r = row1[2 * x + 1];
+
+                    // Write back to BGR
+                    out[3 * x] = T::getB(r, g, b);
+                    out[3 * x + 1] = T::getG(r, g, b);
+                    out[3 * x + 2] = T::getR(r, g, b);
+                }
+            }
+        });
+}
+
+// Check the Bayer frame and ROI and allocate output
+void
+prepareConversion(const cv::Mat &bayer, cv::Mat &output, cv::Rect &roi, int type)
+{
+    BOB_ASSERT(bayer.type() == CV_16UC1);
+    BOB_ASSERT(bayer.cols % 2 == 0 && bayer.rows % 2 == 0);
+
+    // Empty ROI means whole frame
+    const cv::Rect frame{ 0, 0, bayer.cols / 2, bayer.rows / 2 };
+    if (roi.area() == 0) {
+        roi = frame;
+    }
+    BOB_ASSERT((roi & frame) == roi);
+    output.create(roi.size(), type);
+}
+} // anonymous namespace
+
 namespace BoBRobotics {
 namespace Video {
 
@@ -43,6 +433,22 @@ See3CAM_CU40::readGreyscaleFrame(cv::Mat &outFrame)
     return true;
 }
 
+bool
+See3CAM_CU40::readFrameROI(const cv::Rect &roi, cv::Mat &outFrame)
+{
+    outFrame.create(roi.size(), CV_8UC3);
+    captureSuperPixel(outFrame, SuperPixelMode::WBU30, roi);
+    return true;
+}
+
+bool
+See3CAM_CU40::readGreyscaleFrameROI(const cv::Rect &roi, cv::Mat &outFrame)
+{
+    outFrame.create(roi.size(), CV_8UC1);
+    captureSuperPixelGreyscale(outFrame, roi);
+    return true;
+}
+
 cv::Size
 See3CAM_CU40::getOutputSize() const
 {
@@ -77,70 +483,38 @@ See3CAM_CU40::open(const std::string &device,
 void
 See3CAM_CU40::captureSuperPixel(cv::Mat &output)
 {
-    captureSuperPixel<PixelScale>(output);
+    // Check that output size is suitable for super-pixel output i.e. a
+    // quarter input size
+    BOB_ASSERT(output.size() == getSuperPixelSize());
+    captureSuperPixel(output, SuperPixelMode::Scale, { { 0, 0 }, getSuperPixelSize() });
 }
 
 void
 See3CAM_CU40::captureSuperPixelClamp(cv::Mat &output)
 {
-    captureSuperPixel<PixelClamp>(output);
+    BOB_ASSERT(output.size() == getSuperPixelSize());
+    captureSuperPixel(output, SuperPixelMode::Clamp, { { 0, 0 }, getSuperPixelSize() });
 }
 
 void
 See3CAM_CU40::captureSuperPixelWBCoolWhite(cv::Mat &output)
 {
-    captureSuperPixel<WhiteBalanceCoolWhite>(output);
+    BOB_ASSERT(output.size() == getSuperPixelSize());
+    captureSuperPixel(output, SuperPixelMode::WBCoolWhite, { { 0, 0 }, getSuperPixelSize() });
 }
 
 void
 See3CAM_CU40::captureSuperPixelWBU30(cv::Mat &output)
 {
-    captureSuperPixel<WhiteBalanceU30>(output);
+    BOB_ASSERT(output.size() == getSuperPixelSize());
+    captureSuperPixel(output, SuperPixelMode::WBU30, { { 0, 0 }, getSuperPixelSize() });
 }
 
 void
 See3CAM_CU40::captureSuperPixelGreyscale(cv::Mat &output)
 {
-    // Check that output size is suitable for super-pixel output i.e. a
-    // quarter input size
-    const unsigned int inputWidth = getWidth();
-    const unsigned int inputHeight = getHeight();
-    BOB_ASSERT(output.cols == (int) inputWidth / 2);
-    BOB_ASSERT(output.rows == (int) inputHeight / 2);
-    BOB_ASSERT(output.type() == CV_8UC1);
-
-    // Read data and size (in bytes) from camera
-    // **NOTE** these pointers are only valid within one frame
-    void *data = nullptr;
-    uint32_t sizeBytes = Video4LinuxCamera::capture(data);
-
-    // Check frame size is correct
-    BOB_ASSERT(sizeBytes == (inputWidth * inputHeight * sizeof(uint16_t)));
-    const uint16_t *bayerData = reinterpret_cast<uint16_t *>(data);
-
-    // Loop through bayer pixels
-    for (unsigned int y = 0; y < inputHeight; y += 2) {
-        // Get pointers to start of both rows of Bayer data and output
-        // RGB data
-        const uint16_t *inBG16Start = &bayerData[y * inputWidth];
-        const uint16_t *inR16Start =
-                &bayerData[((y + 1) * inputWidth) + 1];
-        uint8_t *outStart = output.ptr(y / 2);
-        for (unsigned int x = 0; x < inputWidth; x += 2) {
-            // Read Bayer pixels
-            const uint16_t b = *(inBG16Start++);
-            const uint16_t g = *(inBG16Start++);
-            const uint16_t r = *inR16Start;
-            inR16Start += 2;
-
-            // Add channels together and divide by 3 to take average and
-            // 4 to rescale from 10-bit per-channel to 8-bit
-            const uint32_t gray = (b + g + r) / (3 * 4);
-
-            // Write back to BGR
-            *(outStart++) = (uint8_t) gray;
-        }
-    }
+    BOB_ASSERT(output.size() == getSuperPixelSize());
+    captureSuperPixelGreyscale(output, { { 0, 0 }, getSuperPixelSize() });
 }
 
 // Calculates entropy, either from whole frame or within subset specified by
@@ -158,14 +532,13 @@ See3CAM_CU40::calculateImageEntropy(const cv::Mat &mask)
                           mask.rows == (int) (inputHeight / 2)));
     BOB_ASSERT(noMask || mask.type() == CV_8UC1);
 
-    // Read data and size (in bytes) from camera
-    // **NOTE** these pointers are only valid within one frame
-    void *data = nullptr;
-    uint32_t sizeBytes = Video4LinuxCamera::capture(data);
+    // Borrow frame straight from the camera's buffer
+    // **NOTE** it is given back to the driver when frame goes out of scope
+    const auto frame = Video4LinuxCamera::captureFrame();
 
     // Check frame size is correct
-    BOB_ASSERT(sizeBytes == (inputWidth * inputHeight * sizeof(uint16_t)));
-    const uint16_t *bayerData = reinterpret_cast<uint16_t *>(data);
+    BOB_ASSERT(frame.size() == (inputWidth * inputHeight * sizeof(uint16_t)));
+    const uint16_t *bayerData = reinterpret_cast<const uint16_t *>(frame.data());
 
     // Zero a 10-bit RGB histogram for each colour channel
     unsigned int hist[3][1024];
@@ -254,10 +627,9 @@ See3CAM_CU40::autoExposure(const cv::Mat &mask, int brightnessExposureConstant)
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
         // Throw away frame so new frame is captured AFTER setting change
-        // **NOTE** this is required because of double-buffering in
-        // Video4LinuxCamera
-        void *data = nullptr;
-        capture(data);
+        // **NOTE** this is required because Video4LinuxCamera keeps a ring
+        // of buffers queued
+        captureFrame();
 
         // Calculate image entropy
         const float entropy = calculateImageEntropy(mask);
@@ -381,89 +753,88 @@ See3CAM_CU40::createBubblescopeMask(const cv::Size &camRes)
     return mask;
 }
 
-uint8_t
-See3CAM_CU40::PixelScale::getR(uint16_t r, uint16_t, uint16_t)
-{
-    return getScaled(r);
-}
-uint8_t
-See3CAM_CU40::PixelScale::getG(uint16_t, uint16_t g, uint16_t)
-{
-    return getScaled(g);
-}
-uint8_t
-See3CAM_CU40::PixelScale::getB(uint16_t, uint16_t, uint16_t b)
-{
-    return getScaled(b);
-}
-
-uint8_t
-See3CAM_CU40::PixelScale::getScaled(uint16_t v)
-{
-    return (uint8_t)(v >> 2);
+//------------------------------------------------------------------------
+// Static API
+//------------------------------------------------------------------------
+void
+See3CAM_CU40::convertSuperPixel(const cv::Mat &bayer, cv::Mat &output,
+                                SuperPixelMode mode, cv::Rect roi, bool vectorise)
+{
+    prepareConversion(bayer, output, roi, CV_8UC3);
+    switch (mode) {
+    case SuperPixelMode::Scale:
+        convertSuperPixelRows<PixelScale>(bayer, output, roi, vectorise);
+        break;
+    case SuperPixelMode::Clamp:
+        convertSuperPixelRows<PixelClamp>(bayer, output, roi, vectorise);
+        break;
+    case SuperPixelMode::WBCoolWhite:
+        convertSuperPixelRows<WhiteBalanceCoolWhite>(bayer, output, roi, vectorise);
+        break;
+    case SuperPixelMode::WBU30:
+        convertSuperPixelRows<WhiteBalanceU30>(bayer, output, roi, vectorise);
+        break;
+    }
 }
 
-uint8_t
-See3CAM_CU40::PixelClamp::getR(uint16_t r, uint16_t, uint16_t)
-{
-    return getClamped(r);
-}
-uint8_t
-See3CAM_CU40::PixelClamp::getG(uint16_t, uint16_t g, uint16_t)
-{
-    return getClamped(g);
-}
-uint8_t
-See3CAM_CU40::PixelClamp::getB(uint16_t, uint16_t, uint16_t b)
-{
-    return getClamped(b);
-}
-uint8_t
-See3CAM_CU40::PixelClamp::getClamped(uint16_t v)
-{
-    return (uint8_t) std::min<uint16_t>(255, v);
+void
+See3CAM_CU40::convertSuperPixelGreyscale(const cv::Mat &bayer, cv::Mat &output,
+                                         cv::Rect roi, bool vectorise)
+{
+    prepareConversion(bayer, output, roi, CV_8UC1);
+    tbb::parallel_for(tbb::blocked_range<int>(0, roi.height, RowsPerTask),
+        [&](const auto &rows) {
+            for (int y = rows.begin(); y != rows.end(); y++) {
+                const uint16_t *row0, *row1;
+                getBayerRows(bayer, roi, y, row0, row1);
+                uint8_t *out = output.ptr(y);
+
+                int x = vectorise ? convertRowGreyscaleVector(row0, row1, out, roi.width) : 0;
+                for (; x < roi.width; x++) {
+                    // Read Bayer pixels
+                    const uint16_t b = row0[2 * x];
+                    const uint16_t g = row0[2 * x + 1];
+                    const uint16_t r = row1[2 * x + 1];
+
+                    // Add channels together and divide by 3 to take average and
+                    // 4 to rescale from 10-bit per-channel to 8-bit
+                    out[x] = (uint8_t) ((b + g + r) / (3 * 4));
+                }
+            }
+        });
 }
 
-uint8_t
-See3CAM_CU40::WhiteBalanceCoolWhite::getR(uint16_t r, uint16_t, uint16_t)
+//------------------------------------------------------------------------
+// Private API
+//------------------------------------------------------------------------
+void
+See3CAM_CU40::captureSuperPixel(cv::Mat &output, SuperPixelMode mode, const cv::Rect &roi)
 {
-    // 0.96 (15729)
-    return (uint8_t)(((uint32_t) r * 15729) >> 16);
-}
+    BOB_ASSERT(output.size() == roi.size());
+    BOB_ASSERT(output.type() == CV_8UC3);
 
-uint8_t
-See3CAM_CU40::WhiteBalanceCoolWhite::getG(uint16_t, uint16_t g, uint16_t)
-{
-    return (uint8_t)(g >> 2);
-}
+    // Borrow frame straight from the camera's buffer
+    // **NOTE** it is given back to the driver when frame goes out of scope
+    const auto frame = Video4LinuxCamera::captureFrame();
 
-uint8_t
-See3CAM_CU40::WhiteBalanceCoolWhite::getB(uint16_t, uint16_t, uint16_t b)
-{
-    // 1.74 (28508)
-    return (uint8_t) std::min<uint32_t>(((uint32_t) b * 28508) >> 16,
-                                        255);
+    // Check frame size is correct
+    BOB_ASSERT(frame.size() == (getWidth() * getHeight() * sizeof(uint16_t)));
+    convertSuperPixel(frame.getMat(), output, mode, roi);
 }
 
-uint8_t
-See3CAM_CU40::WhiteBalanceU30::getR(uint16_t r, uint16_t, uint16_t)
+void
+See3CAM_CU40::captureSuperPixelGreyscale(cv::Mat &output, const cv::Rect &roi)
 {
-    // 0.92 (15073)
-    return (uint8_t)(((uint32_t) r * 15073) >> 16);
-}
+    BOB_ASSERT(output.size() == roi.size());
+    BOB_ASSERT(output.type() == CV_8UC1);
 
-uint8_t
-See3CAM_CU40::WhiteBalanceU30::getG(uint16_t, uint16_t g, uint16_t)
-{
-    return (uint8_t)(g >> 2);
-}
+    // Borrow frame straight from the camera's buffer
+    // **NOTE** it is given back to the driver when frame goes out of scope
+    const auto frame = Video4LinuxCamera::captureFrame();
 
-uint8_t
-See3CAM_CU40::WhiteBalanceU30::getB(uint16_t, uint16_t, uint16_t b)
-{
-    // 1.53 (25068)
-    return (uint8_t) std::min<uint32_t>(((uint32_t) b * 25068) >> 16,
-                                        255);
+    // Check frame size is correct
+    BOB_ASSERT(frame.size() == (getWidth() * getHeight() * sizeof(uint16_t)));
+    convertSuperPixelGreyscale(frame.getMat(), output, roi);
 }
 
 } // Video
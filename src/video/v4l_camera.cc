@@ -4,72 +4,175 @@
 #include "plog/Log.h"
 
 // Standard C includes
+#include <cerrno>
 #include <cstring>
 
+// Standard C++ includes
+#include <utility>
+
 // POSIX includes
 #include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+namespace {
+// Retry ioctls which are interrupted by signals
+int
+xioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret == -1 && errno == EINTR);
+    return ret;
+}
+
+// OpenCV type for viewing a buffer, or -1 if it's e.g. compressed
+int
+getMatType(uint32_t pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_GREY:
+        return CV_8UC1;
+    case V4L2_PIX_FMT_Y16:
+        return CV_16UC1;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        return CV_8UC2;
+    case V4L2_PIX_FMT_BGR24:
+    case V4L2_PIX_FMT_RGB24:
+        return CV_8UC3;
+    default:
+        return -1;
+    }
+}
+} // anonymous namespace
+
 namespace BoBRobotics {
 namespace Video {
 
+constexpr unsigned int Video4LinuxCamera::DefaultNumBuffers;
+
 Video4LinuxCamera::Error::Error(const std::string &msg)
   : std::runtime_error(msg + " (" + strerror(errno) + ")")
 {}
 
+//------------------------------------------------------------------------
+// BoBRobotics::Video::Video4LinuxCamera::Frame
+//------------------------------------------------------------------------
+Video4LinuxCamera::Frame::Frame(Video4LinuxCamera &camera, unsigned int index,
+                                uint32_t bytesUsed, cv::Mat mat)
+  : m_Camera(&camera)
+  , m_Index(index)
+  , m_BytesUsed(bytesUsed)
+  , m_Mat(std::move(mat))
+{}
+
+Video4LinuxCamera::Frame::Frame(Frame &&other) noexcept
+  : m_Camera(other.m_Camera)
+  , m_Index(other.m_Index)
+  , m_BytesUsed(other.m_BytesUsed)
+  , m_Mat(std::move(other.m_Mat))
+{
+    other.m_Camera = nullptr;
+}
+
+Video4LinuxCamera::Frame &
+Video4LinuxCamera::Frame::operator=(Frame &&other) noexcept
+{
+    if (this != &other) {
+        release();
+        m_Camera = other.m_Camera;
+        m_Index = other.m_Index;
+        m_BytesUsed = other.m_BytesUsed;
+        m_Mat = std::move(other.m_Mat);
+        other.m_Camera = nullptr;
+    }
+    return *this;
+}
+
+Video4LinuxCamera::Frame::~Frame()
+{
+    release();
+}
+
+void
+Video4LinuxCamera::Frame::release()
+{
+    if (m_Camera) {
+        m_Mat.release();
+        try {
+            m_Camera->enqueue(m_Index);
+        } catch (Error &e) {
+            LOG_WARNING << e.what();
+        }
+        m_Camera = nullptr;
+    }
+}
+
+//------------------------------------------------------------------------
+// BoBRobotics::Video::Video4LinuxCamera
+//------------------------------------------------------------------------
 Video4LinuxCamera::Video4LinuxCamera()
   : m_Camera(-1)
-  , m_Frame(0)
-  , m_Buffer{ nullptr, nullptr }
+  , m_Epoll(-1)
+  , m_Format{}
 {}
 
 Video4LinuxCamera::Video4LinuxCamera(const std::string &device,
                                      unsigned int width,
                                      unsigned int height,
-                                     uint32_t pixelFormat)
+                                     uint32_t pixelFormat,
+                                     unsigned int numBuffers)
   : Video4LinuxCamera()
 {
-    open(device, width, height, pixelFormat);
+    open(device, width, height, pixelFormat, numBuffers);
 }
 
 Video4LinuxCamera::~Video4LinuxCamera()
 {
-    if (m_Camera >= 0) {
-        // Stop video streaming
-        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        if (ioctl(m_Camera, VIDIOC_STREAMOFF, &type) < 0) {
-            LOG_WARNING << "Could not stop streaming (" << strerror(errno)
-                        << ")";
-        }
-
-        // munmap buffers
-        if ((m_Buffer[0] && munmap(m_Buffer[0], m_BufferInfo[0].length) == -1) ||
-            (m_Buffer[1] && munmap(m_Buffer[1], m_BufferInfo[1].length) == -1)) {
-            LOG_WARNING << "Could not free buffers ("
-                        << strerror(errno) << ")";
-        }
-
-        // Close camera
-        close(m_Camera);
-    }
+    close();
 }
 
 void
 Video4LinuxCamera::open(const std::string &device,
                         unsigned int width,
                         unsigned int height,
-                        uint32_t pixelFormat)
+                        uint32_t pixelFormat,
+                        unsigned int numBuffers)
 {
-    // Open camera
-    if ((m_Camera = ::open(device.c_str(), O_RDWR)) < 0) {
+    // We need at least one buffer to lend out and one for the driver
+    if (numBuffers < 2) {
+        throw std::invalid_argument("At least two buffers are required");
+    }
+    close();
+
+    // Don't leak the device or buffers if something goes wrong
+    try {
+        openDevice(device, width, height, pixelFormat, numBuffers);
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+void
+Video4LinuxCamera::openDevice(const std::string &device,
+                              unsigned int width,
+                              unsigned int height,
+                              uint32_t pixelFormat,
+                              unsigned int numBuffers)
+{
+    // Open camera; we use epoll to wait for frames, so DQBUF shouldn't block
+    if ((m_Camera = ::open(device.c_str(), O_RDWR | O_NONBLOCK)) < 0) {
         throw Error("Could not open camera");
     }
 
     // Query capabilities
     v4l2_capability cap;
-    if (ioctl(m_Camera, VIDIOC_QUERYCAP, &cap) < 0) {
+    if (xioctl(m_Camera, VIDIOC_QUERYCAP, &cap) < 0) {
         throw Error("Could not query capabilities");
     }
 
@@ -91,69 +194,82 @@ Video4LinuxCamera::open(const std::string &device,
     format.fmt.pix.width = width;
     format.fmt.pix.height = height;
 
-    // Set format
-    if (ioctl(m_Camera, VIDIOC_S_FMT, &format) < 0) {
+    // Set format (the driver fills in what it actually chose)
+    if (xioctl(m_Camera, VIDIOC_S_FMT, &format) < 0) {
         throw Error("Cannot set format");
     }
+    m_Format = format.fmt.pix;
 
-    // Fill buffer request structure to request two buffers
+    // Fill buffer request structure to request buffers
     v4l2_requestbuffers bufferRequest;
     memset(&bufferRequest, 0, sizeof(v4l2_requestbuffers));
     bufferRequest.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     bufferRequest.memory = V4L2_MEMORY_MMAP;
-    bufferRequest.count = 2;
+    bufferRequest.count = numBuffers;
 
-    if (ioctl(m_Camera, VIDIOC_REQBUFS, &bufferRequest) < 0) {
+    // **NOTE** the driver may give us a different number of buffers
+    if (xioctl(m_Camera, VIDIOC_REQBUFS, &bufferRequest) < 0) {
         throw Error("Cannot request buffers");
     }
+    if (bufferRequest.count < 2) {
+        throw Error("Not enough buffers available");
+    }
+    if (bufferRequest.count != numBuffers) {
+        LOG_DEBUG << "Driver allocated " << bufferRequest.count << " buffers";
+    }
 
     // Loop through buffers
-    for (unsigned int i = 0; i < 2; i++) {
+    m_Buffers.reserve(bufferRequest.count);
+    for (unsigned int i = 0; i < bufferRequest.count; i++) {
         // Fill buffer structure
-        memset(&m_BufferInfo[i], 0, sizeof(v4l2_buffer));
-        m_BufferInfo[i].type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        m_BufferInfo[i].memory = V4L2_MEMORY_MMAP;
-        m_BufferInfo[i].index = i;
+        v4l2_buffer bufferInfo;
+        memset(&bufferInfo, 0, sizeof(v4l2_buffer));
+        bufferInfo.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        bufferInfo.memory = V4L2_MEMORY_MMAP;
+        bufferInfo.index = i;
 
         // Query buffers
-        if (ioctl(m_Camera, VIDIOC_QUERYBUF, &m_BufferInfo[i]) < 0) {
+        if (xioctl(m_Camera, VIDIOC_QUERYBUF, &bufferInfo) < 0) {
             throw Error("Cannot query buffer");
         }
 
-        LOG_DEBUG << "Queried " << m_BufferInfo[i].length << " byte buffer";
+        LOG_DEBUG << "Queried " << bufferInfo.length << " byte buffer";
 
         // Map memory
-        m_Buffer[i] = mmap(
+        void *data = mmap(
                 nullptr,
-                m_BufferInfo[i]
-                        .length,           // Length of buffer returned from V4L
+                bufferInfo.length,         // Length of buffer returned from V4L
                 PROT_READ | PROT_WRITE,    // Buffer is for RW access
                 MAP_SHARED,                // Buffer is shared with other processes i.e.
                                            // kernel driver
                 m_Camera,                  // Camera device to map within
-                m_BufferInfo[i].m.offset); // Offset into device 'file'
+                bufferInfo.m.offset);      // Offset into device 'file'
                                            // where buffer should be mapped
-        if (m_Buffer[i] == MAP_FAILED) {   // NOLINT
+        if (data == MAP_FAILED) {          // NOLINT
             throw Error("Cannot mmap buffer");
         }
+        m_Buffers.push_back({ data, bufferInfo.length });
 
-        // Zero buffer
-        memset(m_Buffer[i], 0, m_BufferInfo[i].length);
+        // Enqueue all buffers onto the device's incoming queue up front
+        enqueue(i);
     }
 
     // Start video streaming
     int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (ioctl(m_Camera, VIDIOC_STREAMON, &type) < 0) {
+    if (xioctl(m_Camera, VIDIOC_STREAMON, &type) < 0) {
         throw Error("Cannot start streaming");
     }
 
-    // Enqueue our buffer onto the device's incoming queue
-    if (ioctl(m_Camera, VIDIOC_QBUF, &m_BufferInfo[0]) < 0) {
-        throw Error("Cannot enqueue buffer");
+    // Create epoll instance to wait for frames with
+    if ((m_Epoll = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        throw Error("Could not create epoll instance");
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = m_Camera;
+    if (epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Camera, &event) < 0) {
+        throw Error("Could not add camera to epoll instance");
     }
-
-    // Ensure that frame is zeroed
-    m_Frame = 0;
 }
 
 void
@@ -164,7 +280,7 @@ Video4LinuxCamera::enumerateControls(const std::function<void(const v4l2_queryct
     memset(&queryControl, 0, sizeof(v4l2_queryctrl));
     queryControl.id = V4L2_CTRL_FLAG_NEXT_CTRL;
 
-    while (ioctl(m_Camera, VIDIOC_QUERYCTRL, &queryControl) == 0) {
+    while (xioctl(m_Camera, VIDIOC_QUERYCTRL, &queryControl) == 0) {
         // If this control isn't disabled
         if (!(queryControl.flags & V4L2_CTRL_FLAG_DISABLED)) {
             processControl(queryControl);
@@ -184,32 +300,65 @@ Video4LinuxCamera::queryControl(uint32_t id, v4l2_queryctrl &queryControl)
     memset(&queryControl, 0, sizeof(v4l2_queryctrl));
     queryControl.id = id;
 
-    if (ioctl(m_Camera, VIDIOC_QUERYCTRL, &queryControl) < 0) {
+    if (xioctl(m_Camera, VIDIOC_QUERYCTRL, &queryControl) < 0) {
         throw Error("Cannot query controls");
     }
 }
 
-uint32_t
-Video4LinuxCamera::capture(void *&buffer)
+Video4LinuxCamera::Frame
+Video4LinuxCamera::captureFrame()
+{
+    Frame frame;
+    tryCaptureFrame(frame, -1);
+    return frame;
+}
+
+bool
+Video4LinuxCamera::tryCaptureFrame(Frame &frame, int timeoutMs)
 {
-    // Dequeue this frame's buffer from device's outgoing queue
-    if (ioctl(m_Camera, VIDIOC_DQBUF, &m_BufferInfo[m_Frame]) < 0) {
-        throw Error("Cannot dequeue buffer");
+    v4l2_buffer bufferInfo;
+    while (!dequeueLatest(bufferInfo)) {
+        // Wait until a buffer is ready
+        epoll_event event;
+        const int ret = epoll_wait(m_Epoll, &event, 1, timeoutMs);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw Error("Error waiting for frame");
+        }
+        if (ret == 0) {
+            return false;
+        }
+        if (event.events & EPOLLERR) {
+            throw Error("Error waiting for frame");
+        }
     }
 
-    // Pass out buffer data and length
-    buffer = m_Buffer[m_Frame];
-    uint32_t sizebytes = m_BufferInfo[m_Frame].length;
+    // Build a header over the buffer, if we know the format
+    const auto &buffer = m_Buffers[bufferInfo.index];
+    const int type = getMatType(m_Format.pixelformat);
+    cv::Mat mat;
+    if (type == -1) {
+        mat = cv::Mat(1, static_cast<int>(bufferInfo.bytesused), CV_8UC1, buffer.data);
+    } else {
+        mat = cv::Mat(static_cast<int>(m_Format.height), static_cast<int>(m_Format.width),
+                      type, buffer.data, m_Format.bytesperline);
+    }
 
-    // Increment frame number
-    m_Frame = (m_Frame + 1) % 2;
+    frame = Frame{ *this, bufferInfo.index, bufferInfo.bytesused, std::move(mat) };
+    return true;
+}
 
-    // Enqueue next buffer onto the device's incoming queue
-    if (ioctl(m_Camera, VIDIOC_QBUF, &m_BufferInfo[m_Frame]) < 0) {
-        throw Error("Cannot enqueue buffer");
-    }
+uint32_t
+Video4LinuxCamera::capture(void *&buffer)
+{
+    // Gets the new frame before giving back the last one
+    m_CapturedFrame = captureFrame();
 
-    return sizebytes;
+    // Pass out buffer data and length
+    buffer = m_CapturedFrame.getMat().data;
+    return static_cast<uint32_t>(m_Buffers[m_CapturedFrame.m_Index].length);
 }
 
 int32_t
@@ -221,7 +370,7 @@ Video4LinuxCamera::getControlValue(uint32_t id) const
     control.id = id;
 
     // Get control value
-    if (ioctl(m_Camera, VIDIOC_G_CTRL, &control) < 0) {
+    if (xioctl(m_Camera, VIDIOC_G_CTRL, &control) < 0) {
         throw Error("Cannot get control value");
     } else {
         return control.value;
@@ -238,11 +387,91 @@ Video4LinuxCamera::setControlValue(uint32_t id, int32_t value)
     control.value = value;
 
     // Get control value
-    if (ioctl(m_Camera, VIDIOC_S_CTRL, &control) < 0) {
+    if (xioctl(m_Camera, VIDIOC_S_CTRL, &control) < 0) {
         throw Error("Cannot set control value");
     }
 }
 
+//------------------------------------------------------------------------
+// Private API
+//------------------------------------------------------------------------
+bool
+Video4LinuxCamera::dequeueLatest(v4l2_buffer &bufferInfo)
+{
+    bool gotBuffer = false;
+    while (true) {
+        // Dequeue a buffer from device's outgoing queue, if there is one
+        v4l2_buffer next;
+        memset(&next, 0, sizeof(v4l2_buffer));
+        next.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        next.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(m_Camera, VIDIOC_DQBUF, &next) < 0) {
+            if (errno == EAGAIN) {
+                return gotBuffer;
+            }
+            throw Error("Cannot dequeue buffer");
+        }
+
+        // Skip older frames, giving their buffers straight back
+        if (gotBuffer) {
+            enqueue(bufferInfo.index);
+        }
+        bufferInfo = next;
+        gotBuffer = true;
+    }
+}
+
+void
+Video4LinuxCamera::enqueue(unsigned int index)
+{
+    // The camera may have been closed while a frame was lent out
+    if (m_Camera < 0) {
+        return;
+    }
+
+    v4l2_buffer bufferInfo;
+    memset(&bufferInfo, 0, sizeof(v4l2_buffer));
+    bufferInfo.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    bufferInfo.memory = V4L2_MEMORY_MMAP;
+    bufferInfo.index = index;
+    if (xioctl(m_Camera, VIDIOC_QBUF, &bufferInfo) < 0) {
+        throw Error("Cannot enqueue buffer");
+    }
+}
+
+void
+Video4LinuxCamera::close()
+{
+    m_CapturedFrame.release();
+
+    if (m_Epoll >= 0) {
+        ::close(m_Epoll);
+        m_Epoll = -1;
+    }
+
+    if (m_Camera >= 0) {
+        // Stop video streaming
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(m_Camera, VIDIOC_STREAMOFF, &type) < 0) {
+            LOG_WARNING << "Could not stop streaming (" << strerror(errno)
+                        << ")";
+        }
+
+        // munmap buffers
+        for (const auto &buffer : m_Buffers) {
+            if (munmap(buffer.data, buffer.length) == -1) {
+                LOG_WARNING << "Could not free buffers ("
+                            << strerror(errno) << ")";
+            }
+        }
+        m_Buffers.clear();
+
+        // Close camera
+        ::close(m_Camera);
+        m_Camera = -1;
+    }
+}
+
 } // Video
 } // BoBRobotics
 #endif // linux
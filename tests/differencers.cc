@@ -3,6 +3,7 @@
 // BoB robotics includes
 #include "imgproc/mask.h"
 #include "navigation/differencers.h"
+#include "navigation/generate_images.h"
 
 // Standard C++ includes
 #include <algorithm>
@@ -120,6 +121,48 @@ TEST_F(Differencers, RMSDiffMask)
     EXPECT_FLOAT_EQ(rmsDiff(im1, im2, mask), 124.8070510828615f);
 }
 
+template<class Differencer, class FusedDifferencer>
+void compareFused(const ImgProc::Mask &mask1, const ImgProc::Mask &mask2)
+{
+    typename Differencer::template Internal<> differencer;
+    typename FusedDifferencer::template Internal<> fusedDifferencer;
+
+    // The fused differencers should give *exactly* the same answers
+    for (size_t i = 1; i < TestImages.size(); i++) {
+        EXPECT_EQ(differencer(TestImages[0], TestImages[i], mask1, mask2),
+                  fusedDifferencer(TestImages[0], TestImages[i], mask1, mask2));
+    }
+
+    // Check that images with padding between rows are also handled properly
+    const cv::Rect roi{ 3, 1, TestImageSize.width - 5, TestImageSize.height - 2 };
+    const ImgProc::Mask roiMask1{ mask1.empty() ? cv::Mat{} : mask1.get()(roi).clone() };
+    const ImgProc::Mask roiMask2{ mask2.empty() ? cv::Mat{} : mask2.get()(roi).clone() };
+    EXPECT_EQ(differencer(TestImages[0](roi), TestImages[1](roi), roiMask1, roiMask2),
+              fusedDifferencer(TestImages[0](roi), TestImages[1](roi), roiMask1, roiMask2));
+}
+
+TEST_F(Differencers, FusedAbsDiff)
+{
+    FusedAbsDiff::Internal<> absDiff;
+    EXPECT_FLOAT_EQ(absDiff(m_Zeros, m_Ones), 1.f);
+    EXPECT_FLOAT_EQ(absDiff(m_Zeros, m_Half1, m_Mask2), 1.f / 3.f);
+
+    compareFused<AbsDiff, FusedAbsDiff>({}, {});
+    compareFused<AbsDiff, FusedAbsDiff>(TestMask, {});
+    compareFused<AbsDiff, FusedAbsDiff>(TestMask, TestMask);
+}
+
+TEST_F(Differencers, FusedRMSDiff)
+{
+    FusedRMSDiff::Internal<> rmsDiff;
+    EXPECT_FLOAT_EQ(rmsDiff(m_Zeros, m_Ones), 1.f);
+    EXPECT_FLOAT_EQ(rmsDiff(m_Zeros, m_Half1, m_Mask2), sqrtf(1.f / 3.f));
+
+    compareFused<RMSDiff, FusedRMSDiff>({}, {});
+    compareFused<RMSDiff, FusedRMSDiff>({}, TestMask);
+    compareFused<RMSDiff, FusedRMSDiff>(TestMask, TestMask);
+}
+
 TEST_F(Differencers, CorrCoefficient)
 {
     CorrCoefficient::Internal<> ccoeff;
@@ -2,8 +2,11 @@
 
 // BoB robotics includes
 #include "navigation/image_database.h"
+#include "video/randominput.h"
 
+using namespace BoBRobotics;
 using namespace BoBRobotics::Navigation;
+using namespace units::length;
 
 TEST(ImageDatabase, fileNameCompare) {
     const auto check = [](const auto &x, const auto &y) {
@@ -19,3 +22,168 @@ TEST(ImageDatabase, fileNameCompare) {
     // Check that we fall back on alphabetical comparison if strings don't match
     check("frame2.png", "image1.png");
 }
+
+TEST(ImageDatabase, PackedImageFile) {
+    const filesystem::path path = "test_packed.bobpack";
+    Video::RandomInput<> cam{ { 90, 10 }, "random", /*seed=*/42 };
+    std::vector<cv::Mat> images(10);
+    for (auto &image : images) {
+        cam.readFrameSync(image);
+        image = image.clone();
+    }
+
+    const auto check = [&](PackedImageFile::Compression compression) {
+        {
+            PackedImageFile::Writer writer{ path, images[0].size(), 3, compression };
+            for (const auto &image : images) {
+                writer.write(image);
+            }
+        }
+
+        PackedImageFile file{ path };
+        ASSERT_EQ(file.size(), images.size());
+        EXPECT_EQ(file.getResolution(), images[0].size());
+        EXPECT_EQ(file.getChannels(), 3);
+
+        cv::Mat image;
+        for (size_t i = 0; i < images.size(); i++) {
+            file.getImage(i, image);
+            EXPECT_EQ(cv::norm(image, images[i], cv::NORM_INF), 0);
+        }
+    };
+
+    check(PackedImageFile::Compression::None);
+    if (PackedImageFile::supportsCompression()) {
+        check(PackedImageFile::Compression::LZ4);
+    }
+    path.remove_file();
+}
+
+namespace {
+std::vector<cv::Mat>
+recordPackedDatabase(const filesystem::path &path, size_t numImages)
+{
+    Video::RandomInput<> cam{ { 90, 10 }, "random", /*seed=*/42 };
+    std::vector<cv::Mat> images(numImages);
+
+    ImageDatabase database{ path, /*overwrite=*/true };
+    auto recorder = database.getRoutePackedRecorder(cam.getOutputSize());
+    recorder.getMetadataWriter() << "camera" << cam;
+    for (auto &image : images) {
+        cam.readGreyscaleFrameSync(image);
+        image = image.clone();
+        recorder.record(Vector3<millimeter_t>::nan(), 0_deg, image);
+    }
+
+    return images;
+}
+} // anonymous namespace
+
+TEST(ImageDatabase, PackedRecorder) {
+    const filesystem::path path = "test_packed_db";
+    const auto images = recordPackedDatabase(path, 10);
+
+    const ImageDatabase database{ path };
+    ASSERT_EQ(database.size(), images.size());
+    EXPECT_EQ(database.getResolution(), images[0].size());
+
+    const auto loaded = database.loadImages();
+    for (size_t i = 0; i < images.size(); i++) {
+        EXPECT_EQ(cv::norm(loaded[i], images[i], cv::NORM_INF), 0);
+    }
+    filesystem::remove_all(path);
+}
+
+TEST(ImageDatabase, StreamImages) {
+    const filesystem::path path = "test_stream_db";
+    const auto images = recordPackedDatabase(path, 50);
+    const ImageDatabase database{ path };
+
+    // Images should reach the consumer in order, even with few tokens
+    size_t next = 0;
+    database.streamImages(
+            [](size_t, const cv::Mat &image, cv::Mat &output) {
+                cv::bitwise_not(image, output);
+            },
+            [&](size_t i, const cv::Mat &output) {
+                ASSERT_EQ(i, next);
+                cv::Mat expected;
+                cv::bitwise_not(images[i * 2], expected);
+                EXPECT_EQ(cv::norm(output, expected, cv::NORM_INF), 0);
+                next++;
+            },
+            /*frameSkip=*/2, /*greyscale=*/true, /*maxTokens=*/3);
+    EXPECT_EQ(next, images.size() / 2);
+    filesystem::remove_all(path);
+}
+
+TEST(ImageDatabase, AsyncRecorder) {
+    const filesystem::path path = "test_async_db";
+    Video::RandomInput<> cam{ { 90, 10 }, "random", /*seed=*/42 };
+    std::vector<cv::Mat> images(20);
+    {
+        ImageDatabase database{ path, /*overwrite=*/true };
+        auto recorder = database.getRouteRecorder("png", { "index" });
+        recorder.setAsync({ /*queueSize=*/4, /*numEncoders=*/3, ImageDatabase::QueueFullPolicy::Block });
+        cv::Mat frame;
+        for (size_t i = 0; i < images.size(); i++) {
+            // The recorder should copy the frame, so we can reuse the buffer
+            cam.readFrameSync(frame);
+            images[i] = frame.clone();
+            EXPECT_TRUE(recorder.record(Vector3<millimeter_t>::nan(), 0_deg, frame, i));
+        }
+        recorder.save();
+
+        const auto stats = recorder.getAsyncStats();
+        EXPECT_EQ(stats.framesWritten, images.size());
+        EXPECT_EQ(stats.framesDropped, 0U);
+        EXPECT_EQ(stats.queueDepth, 0U);
+    }
+
+    // Entries should be in the order they were recorded in
+    const ImageDatabase database{ path };
+    ASSERT_EQ(database.size(), images.size());
+    const auto loaded = database.loadImages({}, 1, /*greyscale=*/false);
+    for (size_t i = 0; i < images.size(); i++) {
+        EXPECT_EQ(database[i].getExtraField("index"), std::to_string(i));
+        EXPECT_EQ(cv::norm(loaded[i], images[i], cv::NORM_INF), 0);
+    }
+    filesystem::remove_all(path);
+}
+
+TEST(ImageDatabase, LoadCSV) {
+    const filesystem::path path = "test_csv_db";
+    if (path.exists()) {
+        filesystem::remove_all(path);
+    }
+    filesystem::create_directory(path);
+    {
+        // Include Windows line endings, blank lines and stray whitespace
+        std::ofstream os((path / "database_entries.csv").str());
+        os << "X [mm], Y [mm], Z [mm], Heading [degrees], Filename, Grid X, Grid Y, Grid Z, Sensor value\r\n"
+           << "1.5, -2, 3e2, 90, image_a.png, 0, 1, 2, foo\r\n"
+           << "\n"
+           << "  4,5,6,  -45.25 ,image_b.png,3,4,5,  bar baz \n";
+    }
+
+    const ImageDatabase database{ path };
+    ASSERT_EQ(database.size(), 2U);
+    EXPECT_TRUE(database.isGrid());
+
+    const auto &e1 = database[0];
+    EXPECT_EQ(e1.position[0], 1.5_mm);
+    EXPECT_EQ(e1.position[1], -2_mm);
+    EXPECT_EQ(e1.position[2], 300_mm);
+    EXPECT_EQ(e1.heading, 90_deg);
+    EXPECT_EQ(e1.path.filename(), "image_a.png");
+    EXPECT_EQ(e1.gridPosition, (std::array<size_t, 3>{ 0, 1, 2 }));
+    EXPECT_EQ(e1.getExtraField("Sensor value"), "foo");
+
+    const auto &e2 = database[1];
+    EXPECT_EQ(e2.heading, -45.25_deg);
+    EXPECT_EQ(e2.gridPosition, (std::array<size_t, 3>{ 3, 4, 5 }));
+    EXPECT_EQ(e2.getExtraField("Sensor value"), "bar baz");
+    EXPECT_FALSE(e2.hasExtraField("Missing"));
+
+    filesystem::remove_all(path);
+}
@@ -4,6 +4,7 @@
 #include "common/path.h"
 #include "common/serialise_matrix.h"
 #include "navigation/generate_images.h"
+#include "navigation/infomax_quantised.h"
 #include "navigation/infomax_test.h"
 
 using namespace BoBRobotics;
@@ -25,6 +26,171 @@ TEST(InfoMax, SampleImage)
     compareFloatMatrices(differences, trueDifferences);
 }
 
+// Check that rotating without copying the image gives the same results
+TEST(InfoMax, RollFreeRotater)
+{
+    InfoMaxRotater<> infomax{ TestImageSize, InitialWeights };
+    InfoMaxRotater<float, RollFreeRotater> infomaxRollFree{ TestImageSize, InitialWeights };
+    for (const auto &image : TestImages) {
+        infomax.train(image);
+        infomaxRollFree.train(image);
+    }
+
+    const auto &differences = infomax.getImageDifferences(TestImages[0]);
+    const auto &differencesRollFree = infomaxRollFree.getImageDifferences(TestImages[0]);
+    ASSERT_EQ(differences.size(), differencesRollFree.size());
+    for (size_t i = 0; i < differences.size(); i++) {
+        EXPECT_FLOAT_EQ(differences[i], differencesRollFree[i]);
+    }
+
+    using namespace units::angle;
+    const auto heading = std::get<0>(infomax.getHeading(TestImages[1]));
+    const auto headingRollFree = std::get<0>(infomaxRollFree.getHeading(TestImages[1]));
+    BOB_EXPECT_UNIT_T_EQ(heading, headingRollFree);
+}
+
+template<class... Ts>
+void testRIDFMethod(InfoMaxRotater<>::RIDFMethod method, Ts &&... rotaterArgs)
+{
+    InfoMaxRotater<> infomax{ TestImageSize, InitialWeights };
+    for (const auto &image : TestImages) {
+        infomax.train(image);
+    }
+
+    const auto differences = infomax.getImageDifferences(TestImages[0], ImgProc::Mask{}, rotaterArgs...);
+    infomax.setRIDFMethod(method);
+    const auto &differencesGEMM = infomax.getImageDifferences(TestImages[0], ImgProc::Mask{}, rotaterArgs...);
+    ASSERT_EQ(differences.size(), differencesGEMM.size());
+
+    // Matrix-matrix products may sum in a different order, so allow some slack
+    for (size_t i = 0; i < differences.size(); i++) {
+        EXPECT_NEAR(differences[i], differencesGEMM[i], 1e-5f * differences[i]);
+    }
+}
+
+TEST(InfoMax, StackedGEMM)
+{
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::StackedGEMM);
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::StackedGEMM, /*scanStep=*/size_t{ 3 }, /*beginRoll=*/size_t{ 6 });
+}
+
+TEST(InfoMax, CirculantGEMM)
+{
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::CirculantGEMM);
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::CirculantGEMM, /*scanStep=*/size_t{ 3 }, /*beginRoll=*/size_t{ 6 });
+
+    // Unevenly spaced rotations should fall back to StackedGEMM
+    const std::vector<size_t> rotations{ 0, 1, 5, 40, 89 };
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::CirculantGEMM, rotations.cbegin(), rotations.cend());
+
+    // ...as should scan steps which wrap around the image (the width is 90)
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::CirculantGEMM, /*scanStep=*/size_t{ 7 }, /*beginRoll=*/size_t{ 80 }, /*endRoll=*/size_t{ 150 });
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::CirculantGEMM, /*scanStep=*/size_t{ 87 }, /*beginRoll=*/size_t{ 6 }, /*endRoll=*/size_t{ 267 });
+    testRIDFMethod(InfoMaxRotater<>::RIDFMethod::CirculantGEMM, /*scanStep=*/size_t{ 90 }, /*beginRoll=*/size_t{ 5 }, /*endRoll=*/size_t{ 185 });
+}
+
+// Check that processing a batch of views gives the same results as one at a time
+TEST(InfoMax, Batch)
+{
+    InfoMaxRotater<> infomax{ TestImageSize, InitialWeights };
+    for (const auto &image : TestImages) {
+        infomax.train(image);
+    }
+
+    const std::vector<cv::Mat> views(TestImages.begin(), TestImages.begin() + 20);
+    const auto result = infomax.getHeadings(views);
+    const auto &headings = std::get<0>(result);
+    const auto &batchDifferences = std::get<1>(result);
+    ASSERT_EQ(headings.size(), views.size());
+
+    for (size_t q = 0; q < views.size(); q++) {
+        // Matrix-matrix products may sum in a different order, so allow some slack
+        const auto &differences = infomax.getImageDifferences(views[q]);
+        for (size_t i = 0; i < differences.size(); i++) {
+            EXPECT_NEAR(batchDifferences(q, i), differences[i], 1e-5f * differences[i]);
+        }
+
+        const auto single = infomax.getHeading(views[q]);
+        BOB_EXPECT_UNIT_T_EQ(headings[q].first, std::get<0>(single));
+    }
+}
+
+// Check that training in batches of one is the same as training image by image
+TEST(InfoMax, TrainBatch)
+{
+    const std::vector<cv::Mat> images(TestImages.begin(), TestImages.end());
+    InfoMax<> infomax{ TestImageSize, InitialWeights };
+    InfoMax<> infomaxBatch{ TestImageSize, InitialWeights };
+    for (const auto &image : images) {
+        infomax.train(image);
+    }
+    infomaxBatch.trainBatch(images, 1);
+
+    const auto &weights = infomax.getWeights();
+    const auto &batchWeights = infomaxBatch.getWeights();
+    const float maxWeight = weights.array().abs().maxCoeff();
+    EXPECT_LT((weights - batchWeights).array().abs().maxCoeff(), 1e-4f * maxWeight);
+
+    /*
+     * Larger batches (including a partial final batch) should sum the updates
+     * train() would make to the weights as they were at the start of the batch
+     */
+    constexpr size_t BatchSize = 32;
+    Eigen::MatrixXf expectedWeights = InitialWeights;
+    for (size_t first = 0; first < images.size(); first += BatchSize) {
+        const Eigen::MatrixXf batchStartWeights = expectedWeights;
+        for (size_t i = first; i < std::min(images.size(), first + BatchSize); i++) {
+            InfoMax<> single{ TestImageSize, batchStartWeights };
+            single.train(images[i]);
+            expectedWeights += single.getWeights() - batchStartWeights;
+        }
+    }
+
+    InfoMax<> infomaxLargeBatch{ TestImageSize, InitialWeights };
+    infomaxLargeBatch.trainBatch(images, BatchSize);
+    const auto &largeBatchWeights = infomaxLargeBatch.getWeights();
+    const float maxExpectedWeight = expectedWeights.array().abs().maxCoeff();
+    EXPECT_LT((expectedWeights - largeBatchWeights).array().abs().maxCoeff(), 1e-4f * maxExpectedWeight);
+}
+
+template<class Rotater>
+void testQuantised(WeightPrecision precision, float tolerance)
+{
+    InfoMaxRotater<> infomax{ TestImageSize, InitialWeights };
+    for (const auto &image : TestImages) {
+        infomax.train(image);
+    }
+
+    const QuantisedInfoMaxRotater<Rotater> quantised{ infomax, precision };
+    for (size_t i = 0; i < TestImages.size(); i += 10) {
+        const auto &differences = infomax.getImageDifferences(TestImages[i]);
+        const auto &quantisedDifferences = quantised.getImageDifferences(TestImages[i]);
+        ASSERT_EQ(differences.size(), quantisedDifferences.size());
+        for (size_t j = 0; j < differences.size(); j++) {
+            EXPECT_NEAR(quantisedDifferences[j], differences[j], tolerance * differences[j]);
+        }
+    }
+
+    // The best heading for the float weights should also be (near enough) the best for quantised weights
+    const auto &differences = std::get<2>(infomax.getHeading(TestImages[0]));
+    const size_t bestIndex = std::distance(differences.cbegin(), std::min_element(differences.cbegin(), differences.cend()));
+    const auto quantisedResult = quantised.getHeading(TestImages[0]);
+    EXPECT_LE(std::get<2>(quantisedResult)[bestIndex], (1.0f + 2.0f * tolerance) * std::get<1>(quantisedResult));
+}
+
+// Check that reduced-precision weights give approximately the same results as floats
+TEST(InfoMax, QuantisedInt8)
+{
+    testQuantised<InSilicoRotater>(WeightPrecision::Int8, 0.01f);
+    testQuantised<RollFreeRotater>(WeightPrecision::Int8, 0.01f);
+}
+
+TEST(InfoMax, QuantisedFloat16)
+{
+    testQuantised<InSilicoRotater>(WeightPrecision::Float16, 0.001f);
+    testQuantised<RollFreeRotater>(WeightPrecision::Float16, 0.001f);
+}
+
 // Check that the columns have means of approx 0 and SDs of approx 1
 TEST(InfoMax, RandomWeightsDistribution)
 {
@@ -0,0 +1,116 @@
+#include "common.h"
+
+// BoB robotics includes
+#include "video/netstream.h"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+// Standard C++ includes
+#include <vector>
+
+using namespace BoBRobotics::Video;
+
+namespace {
+cv::Mat
+getTestFrame()
+{
+    cv::Mat frame(120, 160, CV_8UC3);
+    cv::randu(frame, 0, 256);
+    return frame;
+}
+
+cv::Mat
+roundTrip(NetStreamEncoder &encoder, NetStreamDecoder &decoder, const cv::Mat &frame,
+          uint32_t sequence, NetStreamFrameHeader &header)
+{
+    std::vector<uchar> buffer;
+    encoder.encode(frame, sequence, getNetStreamTimestamp(), buffer);
+
+    cv::Mat decoded;
+    EXPECT_TRUE(decoder.decode(buffer.data(), buffer.size(), header, decoded));
+    EXPECT_EQ(header.sequence, sequence);
+    EXPECT_EQ(header.payloadSize + sizeof(header), buffer.size());
+    return decoded;
+}
+} // anonymous namespace
+
+TEST(NetStream, RawGreyscale)
+{
+    NetStreamOptions options;
+    options.codec = NetStreamCodec::RawGreyscale;
+    NetStreamEncoder encoder{ options };
+    NetStreamDecoder decoder;
+
+    const cv::Mat frame = getTestFrame();
+    cv::Mat expected;
+    cv::cvtColor(frame, expected, cv::COLOR_BGR2GRAY);
+
+    NetStreamFrameHeader header;
+    const cv::Mat decoded = roundTrip(encoder, decoder, frame, 0, header);
+    EXPECT_EQ(header.channels, 1);
+    EXPECT_EQ(decoded.type(), CV_8UC1);
+    EXPECT_EQ(cv::norm(decoded, expected, cv::NORM_INF), 0);
+}
+
+TEST(NetStream, JPEG)
+{
+    NetStreamOptions options;
+    options.codec = NetStreamCodec::JPEG;
+    options.quality = 95;
+    NetStreamEncoder encoder{ options };
+    NetStreamDecoder decoder;
+
+    cv::Mat frame(120, 160, CV_8UC3);
+    cv::rectangle(frame, { 0, 0, 80, 120 }, cv::Scalar{ 255, 0, 0 }, cv::FILLED);
+    cv::rectangle(frame, { 80, 0, 80, 120 }, cv::Scalar{ 0, 128, 255 }, cv::FILLED);
+
+    NetStreamFrameHeader header;
+    const cv::Mat decoded = roundTrip(encoder, decoder, frame, 0, header);
+    EXPECT_EQ(decoded.size(), frame.size());
+    EXPECT_EQ(decoded.type(), CV_8UC3);
+    EXPECT_LT(cv::norm(decoded, frame, cv::NORM_L1) / frame.total(), 5.0);
+}
+
+TEST(NetStream, Delta)
+{
+    NetStreamOptions options;
+    options.codec = NetStreamCodec::Delta;
+    options.keyframeInterval = 5;
+    NetStreamEncoder encoder{ options };
+    NetStreamDecoder decoder;
+
+    cv::Mat frame = getTestFrame();
+    for (uint32_t i = 0; i < 12; i++) {
+        // Change a small part of the frame each time
+        cv::randu(frame(cv::Rect(i * 10, i * 5, 20, 10)), 0, 256);
+
+        std::vector<uchar> buffer;
+        encoder.encode(frame, i, 0, buffer);
+
+        NetStreamFrameHeader header;
+        cv::Mat decoded;
+        ASSERT_TRUE(decoder.decode(buffer.data(), buffer.size(), header, decoded));
+        EXPECT_EQ(static_cast<bool>(header.keyframe), i % options.keyframeInterval == 0);
+        EXPECT_EQ(cv::norm(decoded, frame, cv::NORM_INF), 0);
+        if (!header.keyframe) {
+            EXPECT_LT(buffer.size(), frame.total() * frame.elemSize() / 10);
+        }
+    }
+
+    // A decoder which has missed the keyframe can't decode delta frames
+    std::vector<uchar> buffer;
+    encoder.encode(frame, 12, 0, buffer);
+    NetStreamDecoder lateDecoder;
+    NetStreamFrameHeader header;
+    cv::Mat decoded;
+    EXPECT_FALSE(lateDecoder.decode(buffer.data(), buffer.size(), header, decoded));
+}
+
+TEST(NetStream, CodecNames)
+{
+    for (auto codec : { NetStreamCodec::RawGreyscale, NetStreamCodec::JPEG, NetStreamCodec::Delta }) {
+        EXPECT_EQ(parseNetStreamCodec(getNetStreamCodecName(codec)), codec);
+    }
+    EXPECT_THROW(parseNetStreamCodec("H264"), std::invalid_argument);
+}
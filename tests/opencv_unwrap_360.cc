@@ -0,0 +1,104 @@
+#include "common.h"
+
+// BoB robotics includes
+#include "imgproc/opencv_unwrap_360.h"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+using namespace BoBRobotics::ImgProc;
+
+namespace {
+const cv::Size cameraResolution(640, 480);
+const cv::Size unwrapResolution(360, 80);
+
+cv::Mat
+getTestImage()
+{
+    cv::Mat image(cameraResolution, CV_8UC3);
+    cv::randu(image, 0, 256);
+    return image;
+}
+} // anonymous namespace
+
+TEST(OpenCVUnwrap360, MatchesFloatMaps)
+{
+    const auto oldCachePath = OpenCVUnwrap360::getMapCachePath();
+    OpenCVUnwrap360::setMapCachePath({});
+    const OpenCVUnwrap360 unwrapper(cameraResolution, unwrapResolution,
+                                    0.5, 0.5, 0.1, 0.45, 30_deg, true);
+    OpenCVUnwrap360::setMapCachePath(oldCachePath);
+
+    // Build float maps the way we used to
+    cv::Mat mapX(unwrapResolution, CV_32FC1), mapY(unwrapResolution, CV_32FC1);
+    for (int i = 0; i < unwrapResolution.height; i++) {
+        for (int j = 0; j < unwrapResolution.width; j++) {
+            const float iFrac = 1.0f - ((float) i / (float) unwrapResolution.height);
+            const float r = iFrac * (unwrapper.m_OuterPixel - unwrapper.m_InnerPixel) + unwrapper.m_InnerPixel;
+            const units::angle::degree_t th = (((double) j / (double) unwrapResolution.width) * 360.0_deg) + unwrapper.m_OffsetAngle;
+            mapX.at<float>(i, j) = unwrapper.m_CentrePixel.x - r * units::math::sin(th);
+            mapY.at<float>(i, j) = unwrapper.m_CentrePixel.y + r * units::math::cos(th);
+        }
+    }
+
+    const cv::Mat image = getTestImage();
+    cv::Mat expected, unwrapped;
+    cv::remap(image, expected, mapX, mapY, cv::INTER_NEAREST);
+    unwrapper.unwrap(image, unwrapped);
+    EXPECT_EQ(cv::norm(unwrapped, expected, cv::NORM_INF), 0);
+}
+
+TEST(OpenCVUnwrap360, MapCache)
+{
+    const filesystem::path cachePath = "test_unwrap_cache";
+    const auto oldCachePath = OpenCVUnwrap360::getMapCachePath();
+    OpenCVUnwrap360::setMapCachePath(cachePath);
+
+    const cv::Mat image = getTestImage();
+    cv::Mat unwrapped1, unwrapped2;
+    OpenCVUnwrap360{ cameraResolution, unwrapResolution }.unwrap(image, unwrapped1);
+    EXPECT_TRUE(cachePath.exists());
+
+    // This time maps should come from the cache
+    OpenCVUnwrap360{ cameraResolution, unwrapResolution }.unwrap(image, unwrapped2);
+    EXPECT_EQ(cv::norm(unwrapped1, unwrapped2, cv::NORM_INF), 0);
+
+    OpenCVUnwrap360::setMapCachePath(oldCachePath);
+    filesystem::remove_all(cachePath);
+}
+
+TEST(OpenCVUnwrap360, UnwrapGreyscale)
+{
+    // With a uniform image, sampling shouldn't make any difference
+    const cv::Mat image(cameraResolution, CV_8UC3, cv::Scalar(50, 100, 200));
+    cv::Mat grey;
+    cv::cvtColor(image, grey, cv::COLOR_BGR2GRAY);
+
+    OpenCVUnwrap360 unwrapper(cameraResolution, unwrapResolution, 0.5, 0.5, 0.1, 0.4);
+    const cv::Size outputSize(unwrapResolution.width / 4, unwrapResolution.height / 4);
+    cv::Mat unwrapped;
+    unwrapper.unwrapGreyscale(image, unwrapped, outputSize);
+    ASSERT_EQ(unwrapped.size(), outputSize);
+    ASSERT_EQ(unwrapped.type(), CV_8UC1);
+
+    double minVal, maxVal;
+    cv::minMaxLoc(unwrapped, &minVal, &maxVal);
+    EXPECT_NEAR(minVal, grey.at<uint8_t>(0, 0), 1);
+    EXPECT_NEAR(maxVal, grey.at<uint8_t>(0, 0), 1);
+}
+
+TEST(OpenCVUnwrap360, InputROI)
+{
+    const OpenCVUnwrap360 unwrapper(cameraResolution, unwrapResolution, 0.45, 0.5, 0.1, 0.3);
+    OpenCVUnwrap360 croppedUnwrapper(cameraResolution, unwrapResolution, 0.45, 0.5, 0.1, 0.3);
+    const cv::Rect roi = croppedUnwrapper.getAnnulusBounds();
+    ASSERT_LT(roi.area(), cameraResolution.area());
+    croppedUnwrapper.setInputROI(roi);
+
+    // Unwrapping a cropped image should give exactly the same result
+    const cv::Mat image = getTestImage();
+    cv::Mat expected, unwrapped;
+    unwrapper.unwrap(image, expected);
+    croppedUnwrapper.unwrap(image(roi), unwrapped);
+    EXPECT_EQ(cv::norm(unwrapped, expected, cv::NORM_INF), 0);
+}
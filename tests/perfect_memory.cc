@@ -3,7 +3,9 @@
 
 // BoB robotics includes
 #include "navigation/perfect_memory.h"
+#include "navigation/perfect_memory_store_arena.h"
 #include "navigation/perfect_memory_store_hog.h"
+#include "navigation/perfect_memory_store_spectral.h"
 
 using namespace BoBRobotics::Navigation;
 using Window = std::pair<size_t, size_t>;
@@ -25,6 +27,41 @@ using Window = std::pair<size_t, size_t>;
 PM_TEST(SampleImage, PerfectMemoryRotater<>, "pm.bin")
 PM_TEST(SampleImageRMS, PerfectMemoryRotater<PerfectMemoryStore::RawImage<RMSDiff>>, "pm_rms.bin")
 
+// The arena store should give exactly the same results as RawImage
+PM_TEST(SampleImageArena, PerfectMemoryRotater<PerfectMemoryStore::RawImageArena<>>, "pm.bin")
+PM_TEST(SampleImageArenaRMS, PerfectMemoryRotater<PerfectMemoryStore::RawImageArena<RMSDiff>>, "pm_rms.bin")
+
+// The fused SIMD differencers should also give the same results
+PM_TEST(SampleImageFused, PerfectMemoryRotater<PerfectMemoryStore::RawImage<FusedAbsDiff>>, "pm.bin")
+PM_TEST(SampleImageFusedRMS, PerfectMemoryRotater<PerfectMemoryStore::RawImage<FusedRMSDiff>>, "pm_rms.bin")
+PM_TEST(SampleImageArenaFused, PerfectMemoryRotater<PerfectMemoryStore::RawImageArena<FusedAbsDiff>>, "pm.bin")
+PM_TEST(SampleImageArenaFusedRMS, PerfectMemoryRotater<PerfectMemoryStore::RawImageArena<FusedRMSDiff>>, "pm_rms.bin")
+
+// Rotating without copying the image should also give the same results
+using RollFreePM = PerfectMemoryRotater<PerfectMemoryStore::RawImage<>, BestMatchingSnapshot, RollFreeRotater>;
+using RollFreePMRMS = PerfectMemoryRotater<PerfectMemoryStore::RawImage<RMSDiff>, BestMatchingSnapshot, RollFreeRotater>;
+using RollFreePMFusedRMS = PerfectMemoryRotater<PerfectMemoryStore::RawImageArena<FusedRMSDiff>, BestMatchingSnapshot, RollFreeRotater>;
+PM_TEST(SampleImageRollFree, RollFreePM, "pm.bin")
+PM_TEST(SampleImageRollFreeRMS, RollFreePMRMS, "pm_rms.bin")
+PM_TEST(SampleImageRollFreeFusedRMS, RollFreePMFusedRMS, "pm_rms.bin")
+
+// Calculating RIDFs with FFTs should give the same results as RMSDiff
+PM_TEST(SampleImageSpectral, PerfectMemoryRotater<PerfectMemoryStore::SpectralRaw>, "pm_rms.bin")
+
+TEST(PerfectMemory, SpectralScanStep)
+{
+    PerfectMemoryRotater<PerfectMemoryStore::RawImage<RMSDiff>> pm{ TestImageSize };
+    PerfectMemoryRotater<PerfectMemoryStore::SpectralRaw> pmSpectral{ TestImageSize };
+    for (const auto &image : TestImages) {
+        pm.train(image);
+        pmSpectral.train(image);
+    }
+
+    const auto &differences = pm.getImageDifferences(TestImages[0], /*scanStep=*/size_t{ 3 }, /*beginRoll=*/size_t{ 6 });
+    const auto &differencesSpectral = pmSpectral.getImageDifferences(TestImages[0], size_t{ 3 }, size_t{ 6 });
+    compareFloatMatrices(differences, differencesSpectral);
+}
+
 void testCCoeff(const std::string &filename, const ImgProc::Mask &mask, std::pair<size_t, size_t> window)
 {
     using namespace BoBRobotics;
@@ -127,3 +164,147 @@ TEST(PerfectMemory, SampleImageHogCorrCoefficientWindow)
 {
     testHog<PerfectMemoryStore::HOG<CorrCoefficient>>("window_pm_hog_ccoeff.bin", { 0, 10 }, 1e-5);
 }
+
+template<class Algo>
+void testBatch(const ImgProc::Mask &mask)
+{
+    Algo pm{ TestImageSize };
+    for (const auto &image : TestImages) {
+        pm.train(image, mask);
+    }
+
+    const std::vector<cv::Mat> views(TestImages.begin(), TestImages.begin() + 5);
+    const auto result = pm.getHeadings(views, mask, Window{ 10, 60 });
+    const auto &headings = std::get<0>(result);
+    const auto &batchDifferences = *std::get<1>(result);
+    ASSERT_EQ(headings.size(), views.size());
+
+    // Should give the same answers as processing the views one at a time
+    for (size_t q = 0; q < views.size(); q++) {
+        const auto single = pm.getHeading(views[q], mask, Window{ 10, 60 });
+        BOB_EXPECT_UNIT_T_EQ(std::get<0>(headings[q]), std::get<0>(single));
+        EXPECT_EQ(std::get<1>(headings[q]), std::get<1>(single));
+
+        const auto &differences = *std::get<3>(single);
+        for (int s = 0; s < differences.rows(); s++) {
+            for (int i = 0; i < differences.cols(); i++) {
+                EXPECT_FLOAT_EQ(batchDifferences(q, s, i), differences(s, i));
+            }
+        }
+    }
+}
+
+TEST(PerfectMemory, Batch)
+{
+    testBatch<PerfectMemoryRotater<>>({});
+}
+
+TEST(PerfectMemory, BatchMask)
+{
+    testBatch<PerfectMemoryRotater<>>(TestMask);
+}
+
+TEST(PerfectMemory, BatchSpectral)
+{
+    testBatch<PerfectMemoryRotater<PerfectMemoryStore::SpectralRaw>>(TestMask);
+}
+
+template<class Store>
+void trainThroughBase(PerfectMemory<Store> &pm, const std::vector<cv::Mat> &images,
+                      const ImgProc::Mask &mask)
+{
+    pm.clearMemory();
+    for (const auto &image : images) {
+        pm.train(image, mask);
+    }
+}
+
+template<class Algo, class... Ts>
+void testCoarseToFine(const ImgProc::Mask &mask, Ts &&... rotaterArgs)
+{
+    // Use larger images so that rolls by multiples of four pixels line up at every level of the pyramid
+    const cv::Size imageSize{ TestImageSize.width * 4, TestImageSize.height * 4 };
+    const ImgProc::Mask largeMask{ mask.get(), imageSize };
+    std::vector<cv::Mat> images(20);
+    for (size_t i = 0; i < images.size(); i++) {
+        cv::resize(TestImages[i], images[i], imageSize, 0.0, 0.0, cv::INTER_NEAREST);
+    }
+
+    Algo pm{ imageSize };
+    Algo pmCoarseToFine{ imageSize };
+    pmCoarseToFine.setCoarseToFine(/*numLevels=*/2, /*numCandidates=*/4);
+    for (const auto &image : images) {
+        pm.train(image, largeMask);
+    }
+
+    // The pyramid should be kept in step even when training through the base class
+    trainThroughBase(pmCoarseToFine, images, largeMask);
+    trainThroughBase(pmCoarseToFine, images, largeMask);
+    ASSERT_EQ(pmCoarseToFine.getNumSnapshots(), images.size());
+
+    // Rotated training views should be found with the same heading, snapshot and difference
+    cv::Mat view;
+    for (size_t i = 0; i < images.size(); i += 3) {
+        ImgProc::roll(images[i], view, 12 * i);
+        const auto exhaustive = pm.getHeading(view, largeMask, Window{ 0, 20 }, rotaterArgs...);
+        const auto coarseToFine = pmCoarseToFine.getHeadingCoarseToFine(view, largeMask, Window{ 0, 20 }, rotaterArgs...);
+        BOB_EXPECT_UNIT_T_EQ(std::get<0>(coarseToFine), std::get<0>(exhaustive));
+        EXPECT_EQ(std::get<1>(coarseToFine), std::get<1>(exhaustive));
+        EXPECT_EQ(std::get<2>(coarseToFine), std::get<2>(exhaustive));
+    }
+}
+
+TEST(PerfectMemory, CoarseToFine)
+{
+    testCoarseToFine<PerfectMemoryRotater<>>({});
+    testCoarseToFine<PerfectMemoryRotater<>>(TestMask);
+    testCoarseToFine<PerfectMemoryRotater<PerfectMemoryStore::RawImage<RMSDiff>>>({});
+    testCoarseToFine<PerfectMemoryRotater<>>({}, /*scanStep=*/size_t{ 3 });
+}
+
+template<class Algo>
+void testBounded(const ImgProc::Mask &mask, const Window &window)
+{
+    Algo pm{ TestImageSize };
+    for (const auto &image : TestImages) {
+        pm.train(image, mask);
+    }
+
+    // Should give exactly the same heading, snapshot and difference as an exhaustive search
+    cv::Mat view;
+    for (size_t i = 0; i < TestImages.size(); i += 7) {
+        ImgProc::roll(TestImages[i], view, i);
+        const auto exhaustive = pm.getHeading(view, mask, window);
+        const auto bounded = pm.getHeadingBounded(view, mask, window);
+        BOB_EXPECT_UNIT_T_EQ(std::get<0>(bounded), std::get<0>(exhaustive));
+        EXPECT_EQ(std::get<1>(bounded), std::get<1>(exhaustive));
+        EXPECT_EQ(std::get<2>(bounded), std::get<2>(exhaustive));
+    }
+
+    // ...including for views which aren't training images
+    const auto exhaustive = pm.getHeading(TestMask.get(), mask, window);
+    const auto bounded = pm.getHeadingBounded(TestMask.get(), mask, window);
+    BOB_EXPECT_UNIT_T_EQ(std::get<0>(bounded), std::get<0>(exhaustive));
+    EXPECT_EQ(std::get<1>(bounded), std::get<1>(exhaustive));
+    EXPECT_EQ(std::get<2>(bounded), std::get<2>(exhaustive));
+}
+
+TEST(PerfectMemory, Bounded)
+{
+    testBounded<PerfectMemoryRotater<>>({}, { 0, 100 });
+    testBounded<PerfectMemoryRotater<>>({}, { 10, 60 });
+    testBounded<PerfectMemoryRotater<PerfectMemoryStore::RawImageArena<FusedAbsDiff>>>({}, { 0, 100 });
+}
+
+TEST(PerfectMemory, BoundedMask)
+{
+    testBounded<PerfectMemoryRotater<>>(TestMask, { 0, 100 });
+    testBounded<PerfectMemoryRotater<>>(TestMask, { 10, 60 });
+}
+
+TEST(PerfectMemory, BoundedRMS)
+{
+    testBounded<PerfectMemoryRotater<PerfectMemoryStore::RawImage<RMSDiff>>>({}, { 0, 100 });
+    testBounded<PerfectMemoryRotater<PerfectMemoryStore::RawImage<RMSDiff>>>(TestMask, { 10, 60 });
+    testBounded<PerfectMemoryRotater<PerfectMemoryStore::RawImageArena<FusedRMSDiff>>>({}, { 0, 100 });
+}
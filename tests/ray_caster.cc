@@ -0,0 +1,74 @@
+// Google Test
+#include <gtest/gtest.h>
+
+// BoB robotics includes
+#include "antworld/ray_caster.h"
+
+// Third-party includes
+#include "third_party/path.h"
+
+// Standard C++ includes
+#include <fstream>
+#include <vector>
+
+using namespace BoBRobotics;
+using namespace units::literals;
+
+namespace {
+// A downward-facing triangle one metre above the ground, mostly in front of the origin
+constexpr double Ceiling[3][3] = { { -1.0, -1.0, 1.0 }, { -1.0, 3.0, 1.0 }, { 3.0, -1.0, 1.0 } };
+
+void writeCeilingWorld(const filesystem::path &path, size_t numCopies)
+{
+    /*
+     * .bin worlds hold each component of each vertex of every triangle,
+     * followed by their colours (and two more values we don't use)
+     */
+    std::vector<double> data(12 * numCopies, 1.0);
+    for (size_t c = 0; c < 3; c++) {
+        for (size_t v = 0; v < 3; v++) {
+            std::fill_n(&data[((c * 3) + v) * numCopies], numCopies, Ceiling[v][c]);
+        }
+    }
+
+    std::ofstream output(path.str(), std::ios::binary);
+    output.write(reinterpret_cast<const char *>(data.data()), data.size() * sizeof(double));
+}
+
+void testCeiling(size_t numCopies)
+{
+    const filesystem::path path = "test_ceiling.bin";
+    writeCeilingWorld(path, numCopies);
+
+    const float worldColour[3] = { 0.0f, 1.0f, 0.0f };
+    const float groundColour[3] = { 1.0f, 0.0f, 0.0f };
+    AntWorld::RayCaster rayCaster;
+    rayCaster.load(path, worldColour, groundColour);
+    rayCaster.setSkyColour({ { 0.0f, 0.0f, 1.0f } });
+    path.remove_file();
+    EXPECT_EQ(rayCaster.getNumTriangles(), numCopies + 2);
+
+    // Render a 10 degree per pixel view looking along the y-axis
+    cv::Mat view;
+    rayCaster.renderPanoramicView(0_m, 0_m, 0.5_m, 0_deg, 0_deg, 0_deg, { 36, 10 }, view);
+    ASSERT_EQ(view.size(), cv::Size(36, 10));
+    ASSERT_EQ(view.type(), CV_8UC3);
+
+    // Triangle above, ground below and in front and sky at the horizon and behind
+    EXPECT_EQ(view.at<cv::Vec3b>(0, 17), cv::Vec3b(0, 255, 0));
+    EXPECT_EQ(view.at<cv::Vec3b>(9, 17), cv::Vec3b(0, 0, 255));
+    EXPECT_EQ(view.at<cv::Vec3b>(7, 17), cv::Vec3b(255, 0, 0));
+    EXPECT_EQ(view.at<cv::Vec3b>(9, 0), cv::Vec3b(255, 0, 0));
+}
+} // anonymous namespace
+
+TEST(RayCaster, SingleTriangle)
+{
+    testCeiling(1);
+}
+
+TEST(RayCaster, CoincidentTriangles)
+{
+    // More coincident triangles than fit in a leaf, so they must be split without help from the SAH
+    testCeiling(1000);
+}
@@ -0,0 +1,84 @@
+#ifdef __linux__
+#include "common.h"
+
+// BoB robotics includes
+#include "video/see3cam_cu40.h"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+using namespace BoBRobotics::Video;
+
+namespace {
+/*
+ * A synthetic 10-bit Bayer frame whose width in super-pixels isn't a multiple
+ * of any vector width, so the scalar remainder gets exercised too
+ */
+cv::Mat
+getTestFrame()
+{
+    cv::Mat bayer(2 * 45, 2 * 133, CV_16UC1);
+    cv::randu(bayer, 0, 1024);
+
+    // Make sure the extremes are in there
+    bayer.row(0).setTo(1023);
+    bayer.row(3).setTo(0);
+    bayer.col(7).setTo(1023);
+    return bayer;
+}
+
+void
+testSuperPixel(See3CAM_CU40::SuperPixelMode mode)
+{
+    const cv::Mat bayer = getTestFrame();
+    for (const auto &roi : { cv::Rect{}, cv::Rect{ 5, 3, 101, 17 } }) {
+        cv::Mat vectorised, scalar;
+        See3CAM_CU40::convertSuperPixel(bayer, vectorised, mode, roi, true);
+        See3CAM_CU40::convertSuperPixel(bayer, scalar, mode, roi, false);
+        ASSERT_EQ(vectorised.type(), CV_8UC3);
+        ASSERT_EQ(vectorised.size(), roi.area() ? roi.size() : bayer.size() / 2);
+        EXPECT_EQ(cv::norm(vectorised, scalar, cv::NORM_INF), 0);
+    }
+}
+} // anonymous namespace
+
+TEST(See3CAM_CU40, SuperPixelScale)
+{
+    testSuperPixel(See3CAM_CU40::SuperPixelMode::Scale);
+}
+
+TEST(See3CAM_CU40, SuperPixelClamp)
+{
+    testSuperPixel(See3CAM_CU40::SuperPixelMode::Clamp);
+}
+
+TEST(See3CAM_CU40, SuperPixelWBCoolWhite)
+{
+    testSuperPixel(See3CAM_CU40::SuperPixelMode::WBCoolWhite);
+}
+
+TEST(See3CAM_CU40, SuperPixelWBU30)
+{
+    testSuperPixel(See3CAM_CU40::SuperPixelMode::WBU30);
+}
+
+TEST(See3CAM_CU40, SuperPixelGreyscale)
+{
+    const cv::Mat bayer = getTestFrame();
+    cv::Mat vectorised, scalar;
+    See3CAM_CU40::convertSuperPixelGreyscale(bayer, vectorised, {}, true);
+    See3CAM_CU40::convertSuperPixelGreyscale(bayer, scalar, {}, false);
+    ASSERT_EQ(vectorised.type(), CV_8UC1);
+    EXPECT_EQ(cv::norm(vectorised, scalar, cv::NORM_INF), 0);
+
+    // Check against straightforward average of channels
+    for (int y = 0; y < scalar.rows; y++) {
+        for (int x = 0; x < scalar.cols; x++) {
+            const int sum = bayer.at<uint16_t>(2 * y, 2 * x) +
+                            bayer.at<uint16_t>(2 * y, 2 * x + 1) +
+                            bayer.at<uint16_t>(2 * y + 1, 2 * x + 1);
+            ASSERT_EQ(vectorised.at<uint8_t>(y, x), sum / 12);
+        }
+    }
+}
+#endif // __linux__
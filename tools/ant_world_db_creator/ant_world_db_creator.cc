@@ -23,6 +23,7 @@
 #include <algorithm>
 #include <string>
 #include <fstream>
+#include <memory>
 #include <tuple>
 #include <vector>
 
@@ -47,25 +48,33 @@ const cv::Size RenderSize{ 720, 150 };
 class AntWorldDatabaseCreator {
 protected:
     ImageDatabase m_Database;
-    sf::Window &m_Window;
+    sf::Window *m_Window;
     AntWorld::Renderer m_Renderer;
-    AntWorld::AntAgent m_Agent;
+    std::unique_ptr<AntWorld::AntAgent> m_Agent;
     const meter_t m_AgentHeight;
     const bool m_OldAntWorld;
 
     AntWorldDatabaseCreator(const std::string &databaseName,
                             bool oldAntWorld,
                             meter_t agentHeight,
-                            sf::Window &window)
+                            sf::Window *window,
+                            AntWorld::HeadlessContext *context)
       : m_Database(databaseName)
       , m_Window(window)
       , m_Renderer(512, 0.1)
-      , m_Agent(window, m_Renderer, RenderSize)
       , m_AgentHeight(agentHeight)
       , m_OldAntWorld(oldAntWorld)
     {
         BOB_ASSERT(m_Database.empty());
 
+        // Render into window if we have one, otherwise offscreen
+        if (window) {
+            m_Agent = std::make_unique<AntWorld::AntAgent>(*window, m_Renderer, RenderSize);
+        } else {
+            BOB_ASSERT(context);
+            m_Agent = std::make_unique<AntWorld::AntAgent>(*context, m_Renderer, RenderSize);
+        }
+
         // Create renderer
         const auto antWorldPath = Path::getResourcesPath() / "antworld";
         if (oldAntWorld) {
@@ -80,36 +89,42 @@ protected:
     template<typename PoseVectorType, typename RecordOp>
     void run(const PoseVectorType &poses, RecordOp record)
     {
-        // Host OpenCV array to hold pixels read from screen
-        cv::Mat frame(RenderSize, CV_8UC3);
-
-        for (auto it = poses.cbegin(); m_Window.isOpen() && it < poses.cend(); ++it) {
+        // Views are rendered offscreen in batches, which keeps the GPU busy
+        // while frames are copied back, but we still check for window events
+        // between batches
+        constexpr size_t BatchSize = 256;
+        std::vector<Pose3<meter_t, degree_t>> batch;
+        for (size_t start = 0; m_Agent->isOpen() && start < poses.size(); start += BatchSize) {
             // Process window events
             sf::Event event;
-            while (m_Window.pollEvent(event)) {
+            while (m_Window && m_Window->pollEvent(event)) {
                 // Close window: exit
                 if (event.type == sf::Event::Closed) {
-                    m_Window.close();
+                    m_Window->close();
                 }
             }
 
-            // Update agent's position
-            m_Agent.setPosition(it->x(), it->y(), m_AgentHeight);
-            m_Agent.setAttitude(it->yaw(), 0_deg, 0_deg);
-            LOGD << "Current pose: " << m_Agent.getPose();
-
-            // Get current view
-            m_Agent.readFrameSync(frame);
+            // Agent's poses for this batch
+            batch.clear();
+            const size_t end = std::min(start + BatchSize, poses.size());
+            for (size_t i = start; i < end; i++) {
+                batch.emplace_back(Vector3<meter_t>{ poses[i].x(), poses[i].y(), m_AgentHeight },
+                                   std::array<degree_t, 3>{ poses[i].yaw(), 0_deg, 0_deg });
+            }
 
-            // Write to image database
-            record(frame);
+            // Render views and write them to image database
+            m_Renderer.renderPanoramicViews(batch, RenderSize,
+                                            [&](size_t i, const cv::Mat &frame) {
+                                                LOGD << "Current pose: " << batch[i];
+                                                record(batch[i], frame);
+                                            });
         }
     }
 
     void addMetadata(cv::FileStorage &metadata)
     {
         // Record "camera" info
-        metadata << "camera" << m_Agent
+        metadata << "camera" << *m_Agent
                  << "needsUnwrapping" << false
                  << "isGreyscale" << false;
     }
@@ -117,9 +132,10 @@ protected:
 
 class GridDatabaseCreator : AntWorldDatabaseCreator {
 public:
-    GridDatabaseCreator(bool oldAntWorld, sf::Window &window)
+    GridDatabaseCreator(bool oldAntWorld, sf::Window *window,
+                        AntWorld::HeadlessContext *context)
       : AntWorldDatabaseCreator("world5000_grid", oldAntWorld,
-                                oldAntWorld ? 0.01_m : 1.5_m, window)
+                                oldAntWorld ? 0.01_m : 1.5_m, window, context)
     {}
 
     void runForGrid()
@@ -146,7 +162,9 @@ public:
         addMetadata(gridRecorder.getMetadataWriter());
 
         // Record image database
-        run(gridRecorder.getPositions(), [&gridRecorder](const cv::Mat &image) { gridRecorder.record(image); });
+        run(gridRecorder.getPositions(), [&gridRecorder](const Pose3<meter_t, degree_t> &, const cv::Mat &image) {
+            gridRecorder.record(image);
+        });
     }
 };
 
@@ -154,10 +172,11 @@ class RouteDatabaseCreator : AntWorldDatabaseCreator {
 public:
     RouteDatabaseCreator(const std::string &databaseName,
                          bool oldAntWorld,
-                         sf::Window &window,
+                         sf::Window *window,
+                         AntWorld::HeadlessContext *context,
                          AntWorld::RouteContinuous &route)
       : AntWorldDatabaseCreator(databaseName, oldAntWorld,
-                                oldAntWorld ? 0.01_m : 1.8_m, window)
+                                oldAntWorld ? 0.01_m : 1.8_m, window, context)
       , m_Route(route)
     {}
 
@@ -175,9 +194,9 @@ public:
         auto routeRecorder = m_Database.getRouteRecorder();
         addMetadata(routeRecorder.getMetadataWriter());
 
-        run(poses, [&routeRecorder, this](const cv::Mat &image) {
-            const auto pos = m_Agent.getPose().position();
-            routeRecorder.record({pos[0], pos[1], pos[2]}, m_Agent.getPose().attitude()[0], image);
+        run(poses, [&routeRecorder](const Pose3<meter_t, degree_t> &pose, const cv::Mat &image) {
+            const auto &pos = pose.position();
+            routeRecorder.record({ pos[0], pos[1], pos[2] }, pose.yaw(), image);
         });
     }
 
@@ -187,16 +206,30 @@ private:
 
 int bobMain(int argc, char **argv)
 {
-    auto window = AntWorld::AntAgent::initialiseWindow(RenderSize);
-
-    // Allow for using the old, lower-res ant world
+    // Allow for using the old, lower-res ant world and for rendering without a display
     bool oldAntWorld = false;
-    if (argc > 1 && strcmp(argv[1], "--old-ant-world") == 0) {
-        oldAntWorld = true;
+    bool headless = false;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--old-ant-world") == 0) {
+            oldAntWorld = true;
+        } else if (strcmp(argv[1], "--headless") == 0) {
+            headless = true;
+        } else {
+            LOGE << "Unknown option: " << argv[1];
+            return EXIT_FAILURE;
+        }
         argc--;
         argv++;
     }
 
+    std::unique_ptr<sf::Window> window;
+    std::unique_ptr<AntWorld::HeadlessContext> context;
+    if (headless) {
+        context = AntWorld::AntAgent::initialiseHeadlessContext(RenderSize);
+    } else {
+        window = AntWorld::AntAgent::initialiseWindow(RenderSize);
+    }
+
     if (argc > 1) {
         // Remaining arguments are paths to route files
         do {
@@ -213,13 +246,13 @@ int bobMain(int argc, char **argv)
                 databaseName = databaseName.substr(0, pos);
             }
 
-            RouteDatabaseCreator creator(databaseName, oldAntWorld, *window, route);
+            RouteDatabaseCreator creator(databaseName, oldAntWorld, window.get(), context.get(), route);
             creator.runForRoute();
 
             argv++;
         } while (--argc > 1);
     } else {
-        GridDatabaseCreator creator(oldAntWorld, *window);
+        GridDatabaseCreator creator(oldAntWorld, window.get(), context.get());
         creator.runForGrid();
     }
 
@@ -0,0 +1,145 @@
+// BoB robotics includes
+#include "common/stopwatch.h"
+#include "common/string.h"
+#include "navigation/image_database.h"
+
+// Third-party includes
+#include "third_party/CLI11.hpp"
+
+// Standard C++ includes
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace BoBRobotics;
+using namespace units::length;
+using namespace units::literals;
+
+namespace {
+double
+toMilliseconds(Stopwatch::Duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Write a grid database's CSV file the way ImageDatabase used to
+void
+writeSyntheticCSV(const filesystem::path &path, size_t numRows)
+{
+    std::ofstream os((path / "database_entries.csv").str());
+    os.exceptions(std::ios::badbit | std::ios::failbit);
+    os << "X [mm], Y [mm], Z [mm], Heading [degrees], Filename, Grid X, Grid Y, Grid Z, Sensor value, Label\n";
+    for (size_t i = 0; i < numRows; i++) {
+        const size_t x = i % 1000, y = i / 1000;
+        os << x * 10.5 << ", " << y * 10.5 << ", " << 150 << ", " << (i % 360) * 1.25 << ", "
+           << "image_" << i << ".png, " << x << ", " << y << ", " << 0 << ", "
+           << i * 0.001 << ", label" << i % 7 << "\n";
+    }
+}
+
+// How ImageDatabase used to parse CSV files, for comparison
+size_t
+parseCSVLegacy(const filesystem::path &path)
+{
+    std::ifstream is((path / "database_entries.csv").str());
+    std::string line;
+    std::getline(is, line);
+    std::vector<std::string> fields;
+    strSplit(line, ',', fields);
+    std::for_each(fields.begin(), fields.end(), strTrim);
+    const auto names = fields;
+
+    size_t count = 0;
+    double checksum = 0;
+    while (std::getline(is, line)) {
+        strTrim(line);
+        if (line.empty()) {
+            continue;
+        }
+        strSplit(line, ',', fields);
+        std::for_each(fields.begin(), fields.end(), strTrim);
+
+        std::unordered_map<std::string, std::string> extraFields;
+        extraFields.emplace(names[8], std::move(fields[8]));
+        extraFields.emplace(names[9], std::move(fields[9]));
+        for (size_t i = 0; i < 4; i++) {
+            checksum += std::stod(fields[i]);
+        }
+        for (size_t i = 5; i < 8; i++) {
+            checksum += std::stoul(fields[i]);
+        }
+        count++;
+    }
+
+    // Stop the compiler optimising everything away
+    return count + (checksum < 0);
+}
+} // anonymous namespace
+
+int bobMain(int argc, char **argv)
+{
+    size_t numRows = 1000000;
+    std::string dbPath = "csv_benchmark_db";
+
+    CLI::App app{ "Benchmark for reading and writing image database CSV files." };
+    app.add_option("-n,--rows", numRows, "Number of rows in synthetic CSV file");
+    app.add_option("-p,--path", dbPath, "Where to create temporary databases");
+    CLI11_PARSE(app, argc, argv);
+
+    const filesystem::path gridPath = dbPath + "_grid";
+    const filesystem::path routePath = dbPath + "_route";
+    for (const auto &path : { gridPath, routePath }) {
+        if (path.exists()) {
+            filesystem::remove_all(path);
+        }
+    }
+    filesystem::create_directory(gridPath);
+
+    Stopwatch stopwatch;
+    stopwatch.start();
+    writeSyntheticCSV(gridPath, numRows);
+    std::cout << "Writing " << numRows << " rows with std::ofstream: "
+              << toMilliseconds(stopwatch.lap()) << " ms\n";
+
+    const size_t legacyCount = parseCSVLegacy(gridPath);
+    std::cout << "Parsing with std::getline/strSplit/std::stod: "
+              << toMilliseconds(stopwatch.lap()) << " ms (" << legacyCount << " rows)\n";
+
+    {
+        const Navigation::ImageDatabase database{ gridPath };
+        std::cout << "Loading with ImageDatabase: " << toMilliseconds(stopwatch.lap())
+                  << " ms (" << database.size() << " rows)\n";
+        BOB_ASSERT(database.size() == numRows);
+        BOB_ASSERT(database[numRows - 1].getExtraField("Label") == "label" + std::to_string((numRows - 1) % 7));
+    }
+
+    // Time writing CSV via a recorder, using tiny images so that it dominates
+    {
+        Navigation::ImageDatabase database{ routePath };
+        auto recorder = database.getRoutePackedRecorder({ 1, 1 }, 1, false, { "Sensor value" });
+        recorder.getMetadataWriter() << "camera"
+                                     << "{"
+                                     << "resolution" << cv::Size{ 1, 1 }
+                                     << "}";
+        const cv::Mat image{ 1, 1, CV_8UC1, cv::Scalar{ 0 } };
+        Vector3<millimeter_t> position{ 0_mm, 0_mm, 150_mm };
+        for (size_t i = 0; i < numRows; i++) {
+            position.x() = millimeter_t{ i * 10.5 };
+            recorder.record(position, 0_deg, image, i * 0.001);
+        }
+
+        stopwatch.start();
+        recorder.save();
+        std::cout << "Saving with ImageDatabase recorder: " << toMilliseconds(stopwatch.lap())
+                  << " ms\n";
+    }
+
+    filesystem::remove_all(gridPath);
+    filesystem::remove_all(routePath);
+
+    return EXIT_SUCCESS;
+}
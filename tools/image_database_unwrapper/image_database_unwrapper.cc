@@ -13,6 +13,7 @@ int bobMain(int argc, char **argv)
 {
     std::vector<size_t> size{ 720, 150 };
     size_t frameSkip = 1;
+    size_t maxInFlight = 0;
     bool greyscale = false;
 
     CLI::App app{ "Tool for unwrapping image databases." };
@@ -21,6 +22,8 @@ int bobMain(int argc, char **argv)
     auto opt = app.add_option("-r,--resolution", size, "Resolution of unwrapped images");
     opt->expected(2);
     app.add_flag("-g,--greyscale", greyscale, "Convert images to greyscale");
+    app.add_option("-j,--max-in-flight", maxInFlight,
+                   "Maximum number of images to hold in memory at once (default: two per core)");
     CLI11_PARSE(app, argc, argv);
     if (app.remaining_size() != 1) {
         std::cout << app.help();
@@ -33,7 +36,7 @@ int bobMain(int argc, char **argv)
     const filesystem::path outPath = inPath.parent_path() /
                                         ("unwrapped_" + inPath.filename());
     std::cout << "Creating new database in " << outPath << "\n";
-    database.unwrap(outPath, { (int) size[0], (int) size[1] }, frameSkip, greyscale);
+    database.unwrap(outPath, { (int) size[0], (int) size[1] }, frameSkip, greyscale, maxInFlight);
 
     return EXIT_SUCCESS;
 }
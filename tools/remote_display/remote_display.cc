@@ -1,16 +1,45 @@
 // BoB robotics includes
 #include "net/client.h"
+#include "plog/Log.h"
 #include "video/display.h"
 #include "video/netsource.h"
 
+// Third-party includes
+#include "third_party/CLI11.hpp"
+
+// Standard C++ includes
+#include <memory>
+#include <string>
+
 using namespace BoBRobotics;
 
-int bobMain(int, char **)
+int bobMain(int argc, char **argv)
 {
+    std::string codec;
+    Video::NetStreamOptions options;
+
+    CLI::App app{ "Display video from a robot's Video::NetSink." };
+    app.add_option("-c,--codec", codec, "Stream with this codec (RAW, JPEG or DELTA) rather than sending frames one at a time");
+    app.add_option("-q,--quality", options.quality, "JPEG quality when streaming");
+    app.add_option("-k,--keyframe-interval", options.keyframeInterval, "Frames between keyframes for DELTA codec");
+    CLI11_PARSE(app, argc, argv);
+
     Net::Client client;
-    Video::NetSource video{ client };
+    std::unique_ptr<Video::NetSource> video;
+    if (codec.empty()) {
+        video = std::make_unique<Video::NetSource>(client);
+    } else {
+        options.codec = Video::parseNetStreamCodec(codec);
+        video = std::make_unique<Video::NetSource>(client, options);
+    }
     client.runInBackground();
-    Video::Display display{ video };
+    Video::Display display{ *video };
     display.run();
+
+    if (!codec.empty()) {
+        const auto stats = video->getStreamStats();
+        LOGI << "Received " << stats.framesReceived << " frames (" << stats.framesDropped
+             << " dropped by sender); mean latency: " << stats.meanLatency.count() / 1000.0 << " ms";
+    }
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,146 @@
+// BoB robotics includes
+#include "common/macros.h"
+#include "common/stopwatch.h"
+#include "video/see3cam_cu40.h"
+
+// Third-party includes
+#include "third_party/CLI11.hpp"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+// Standard C++ includes
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace BoBRobotics;
+using namespace BoBRobotics::Video;
+
+namespace {
+double
+toMilliseconds(Stopwatch::Duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Raw frames are just the camera's 16-bit values, with no header
+cv::Mat
+loadRawFrame(const std::string &path, const cv::Size &resolution)
+{
+    cv::Mat bayer(resolution, CV_16UC1);
+    std::ifstream is(path, std::ios::binary);
+    is.exceptions(std::ios::badbit | std::ios::failbit);
+    is.read(reinterpret_cast<char *>(bayer.data), bayer.total() * bayer.elemSize());
+    return bayer;
+}
+
+void
+saveRawFrame(const std::string &path, const cv::Mat &bayer)
+{
+    std::ofstream os(path, std::ios::binary);
+    os.exceptions(std::ios::badbit | std::ios::failbit);
+    os.write(reinterpret_cast<const char *>(bayer.data), bayer.total() * bayer.elemSize());
+}
+
+// Find the camera resolution matching a frame size, returning false if there isn't one
+bool
+getResolution(const cv::Size &size, See3CAM_CU40::Resolution &resolution)
+{
+    using Resolution = See3CAM_CU40::Resolution;
+    for (const auto res : { Resolution::_672x380, Resolution::_1280x720,
+                            Resolution::_1920x1080, Resolution::_2688x1520 }) {
+        const auto value = static_cast<uint64_t>(res);
+        if (static_cast<int>(value & 0xFFFFFFFF) == size.width &&
+            static_cast<int>(value >> 32) == size.height) {
+            resolution = res;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename F>
+double
+timeConversion(size_t numRepeats, F convert)
+{
+    Stopwatch stopwatch;
+    stopwatch.start();
+    for (size_t i = 0; i < numRepeats; i++) {
+        convert();
+    }
+    return toMilliseconds(stopwatch.elapsed()) / numRepeats;
+}
+} // anonymous namespace
+
+int bobMain(int argc, char **argv)
+{
+    size_t numRepeats = 100;
+    std::string rawPath, dumpPath, device = "/dev/video0";
+    int width = 1280, height = 720;
+
+    CLI::App app{ "Benchmark for converting See3CAM_CU40 Bayer frames to super-pixels." };
+    app.add_option("-n,--repeats", numRepeats, "Number of times to convert each frame");
+    app.add_option("-r,--raw", rawPath, "Raw 16-bit frame to load (otherwise a random one is used)");
+    app.add_option("-W,--width", width, "Width of raw frame (and of dumped frame)");
+    app.add_option("-H,--height", height, "Height of raw frame (and of dumped frame)");
+    app.add_option("-d,--dump", dumpPath, "Capture a raw frame from the camera and save it here");
+    app.add_option("--device", device, "Camera device to dump frame from");
+    CLI11_PARSE(app, argc, argv);
+
+    if (!dumpPath.empty()) {
+        See3CAM_CU40::Resolution resolution;
+        if (!getResolution({ width, height }, resolution)) {
+            std::cerr << "Error: See3CAM_CU40 cannot capture " << width << "x"
+                      << height << " frames\n";
+            return EXIT_FAILURE;
+        }
+
+        See3CAM_CU40 camera(device, resolution);
+        const auto frame = camera.captureFrame();
+        saveRawFrame(dumpPath, frame.getMat());
+        std::cout << "Saved " << frame.getMat().size() << " frame to " << dumpPath << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    cv::Mat bayer;
+    if (rawPath.empty()) {
+        bayer.create(height, width, CV_16UC1);
+        cv::randu(bayer, 0, 1024);
+    } else {
+        bayer = loadRawFrame(rawPath, { width, height });
+    }
+
+    const std::pair<const char *, See3CAM_CU40::SuperPixelMode> modes[] = {
+        { "Scale", See3CAM_CU40::SuperPixelMode::Scale },
+        { "Clamp", See3CAM_CU40::SuperPixelMode::Clamp },
+        { "WBCoolWhite", See3CAM_CU40::SuperPixelMode::WBCoolWhite },
+        { "WBU30", See3CAM_CU40::SuperPixelMode::WBU30 }
+    };
+
+    cv::Mat scalar, vectorised;
+    for (const auto &mode : modes) {
+        const double scalarTime = timeConversion(numRepeats, [&]() {
+            See3CAM_CU40::convertSuperPixel(bayer, scalar, mode.second, {}, false);
+        });
+        const double vectorisedTime = timeConversion(numRepeats, [&]() {
+            See3CAM_CU40::convertSuperPixel(bayer, vectorised, mode.second, {}, true);
+        });
+        BOB_ASSERT(cv::norm(scalar, vectorised, cv::NORM_INF) == 0);
+        std::cout << mode.first << ": scalar " << scalarTime << " ms, vectorised "
+                  << vectorisedTime << " ms\n";
+    }
+
+    const double scalarTime = timeConversion(numRepeats, [&]() {
+        See3CAM_CU40::convertSuperPixelGreyscale(bayer, scalar, {}, false);
+    });
+    const double vectorisedTime = timeConversion(numRepeats, [&]() {
+        See3CAM_CU40::convertSuperPixelGreyscale(bayer, vectorised, {}, true);
+    });
+    BOB_ASSERT(cv::norm(scalar, vectorised, cv::NORM_INF) == 0);
+    std::cout << "Greyscale: scalar " << scalarTime << " ms, vectorised "
+              << vectorisedTime << " ms\n";
+
+    return EXIT_SUCCESS;
+}